@@ -0,0 +1,96 @@
+// Adaptive density benchmark
+//
+// Description: Samples the default 3x3 chunk sample with sample_density and
+// with sample_density_adaptive, checks that marching cubes and surface nets
+// extract the same meshes from both and reports the noise calls saved.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+#include "adaptive_density.hpp"
+#include "density.hpp"
+#include "extractor.hpp"
+
+namespace {
+    constexpr auto AXIS_LENGTH = 100;
+    constexpr auto CHUNKS_PER_AXIS = 3;
+    constexpr auto REPETITIONS = 3;
+
+    template<typename Function>
+    double best_of(Function&& function) {
+        auto best = 1e30;
+        for (auto repetition = 0; repetition < REPETITIONS; repetition++) {
+            auto start = std::chrono::high_resolution_clock::now();
+            function();
+            auto end = std::chrono::high_resolution_clock::now();
+            best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+        }
+        return best;
+    }
+
+    bool same_mesh(const ExtractedMesh& a, const ExtractedMesh& b) {
+        return a.indices == b.indices && a.vertices.size() == b.vertices.size() &&
+            std::memcmp(a.vertices.data(), b.vertices.data(), a.vertices.size() * sizeof(MeshVertex)) == 0;
+    }
+}
+
+int main() {
+    auto settings = GenerationSettings();
+    settings.scale = 0.151f;
+
+    auto marching_cubes = Extractor::create(ExtractorType::MARCHING_CUBES_CPU);
+    // Without the chunk overlap, full and adaptive grids are the same chunk
+    auto surface_nets = std::make_unique<SurfaceNetsExtractor>();
+
+    auto full_grid = DensityGrid();
+    auto adaptive_grid = DensityGrid();
+    auto full_mesh = ExtractedMesh();
+    auto adaptive_mesh = ExtractedMesh();
+    auto totals = AdaptiveSamplingStats();
+    auto full_total_ms = 0.0;
+    auto adaptive_total_ms = 0.0;
+    auto all_match = true;
+
+    std::printf("%-8s | %9s %9s | %8s %10s | %5s %5s\n", "chunk", "full ms", "adaptive", "exact", "noise", "mc", "sn");
+    for (auto y = 0; y < CHUNKS_PER_AXIS; y++) {
+        for (auto x = 0; x < CHUNKS_PER_AXIS; x++) {
+            auto offset = glm::ivec3(x, y, 0) * (AXIS_LENGTH - 1);
+            auto stats = AdaptiveSamplingStats();
+
+            auto full_ms = best_of([&] { sample_density(settings, offset, AXIS_LENGTH, full_grid); });
+            auto adaptive_ms = best_of([&] { sample_density_adaptive(settings, offset, AXIS_LENGTH, adaptive_grid, &stats); });
+
+            auto matches = [&](Extractor& extractor) {
+                extractor.extract(full_grid, settings.iso_level, full_mesh);
+                extractor.extract(adaptive_grid, settings.iso_level, adaptive_mesh);
+                return same_mesh(full_mesh, adaptive_mesh);
+            };
+            auto mc_match = matches(*marching_cubes);
+            auto sn_match = matches(*surface_nets);
+            all_match = all_match && mc_match && sn_match;
+
+            std::printf("%3d,%3d  | %9.1f %9.1f | %7.1f%% %9.1f%% | %5s %5s\n",
+                offset.x, offset.y, full_ms, adaptive_ms,
+                100.0 * stats.exact_samples / std::max<std::size_t>(stats.samples - stats.constant_samples, 1),
+                100.0 * stats.noise_calls / std::max<std::size_t>(stats.full_noise_calls, 1),
+                mc_match ? "same" : "DIFF", sn_match ? "same" : "DIFF");
+
+            totals.samples += stats.samples;
+            totals.exact_samples += stats.exact_samples;
+            totals.noise_calls += stats.noise_calls;
+            totals.full_noise_calls += stats.full_noise_calls;
+            full_total_ms += full_ms;
+            adaptive_total_ms += adaptive_ms;
+        }
+    }
+
+    std::printf("noise calls: %zu full, %zu adaptive (%.1f%% saved)\n",
+        totals.full_noise_calls, totals.noise_calls, 100.0 - 100.0 * totals.noise_calls / totals.full_noise_calls);
+    std::printf("sampling:    %.1f ms full, %.1f ms adaptive\n", full_total_ms, adaptive_total_ms);
+    std::printf("meshes:      %s\n", all_match ? "identical" : "MISMATCH");
+
+    return all_match ? 0 : 1;
+}
@@ -0,0 +1,105 @@
+// Animated region benchmark
+//
+// Description: Builds a 64^3 region of the animated terrain for 120 frames
+// of 1/60 s on a pool with every hardware thread and on one worker. Reports
+// sampling and meshing time per frame and whether the frame fits in 60 Hz.
+// Exits with 1 if the slab by slab mesh differs from meshing the grid whole.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "animated_region.hpp"
+#include "density.hpp"
+#include "extractor.hpp"
+#include "thread_pool.hpp"
+
+namespace {
+    constexpr auto AXIS_LENGTH = 64;
+    constexpr auto FRAMES = 120;
+    constexpr auto FRAME_SECONDS = 1.0f / 60.0f;
+    constexpr auto FRAME_MS = 1000.0 * FRAME_SECONDS;
+    // World units along w per second
+    constexpr auto SPEED = 10.0f;
+
+    const auto ORIGIN = glm::ivec3(100, 20, 100);
+
+    // Same triangles in the same order, the joined mesh repeats the
+    // vertices on slab boundaries so indices differ
+    bool same_triangles(const ExtractedMesh& a, const ExtractedMesh& b) {
+        if (a.indices.size() != b.indices.size()) {
+            return false;
+        }
+        for (auto i = std::size_t(0); i < a.indices.size(); i++) {
+            if (a.vertices[a.indices[i]].position != b.vertices[b.indices[i]].position) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool run(std::size_t num_threads, const GenerationSettings& settings) {
+        auto pool = ThreadPool(num_threads);
+        auto region = AnimatedRegion(&pool, AXIS_LENGTH);
+
+        auto sample_ms = std::vector<double>();
+        auto mesh_ms = std::vector<double>();
+        auto total_ms = std::vector<double>();
+        auto triangles = std::size_t(0);
+        for (auto frame = 0; frame < FRAMES; frame++) {
+            region.submit(settings, ORIGIN, frame * FRAME_SECONDS * SPEED);
+            region.wait();
+            const auto& stats = region.stats();
+            sample_ms.push_back(stats.sample_ms);
+            mesh_ms.push_back(stats.mesh_ms);
+            total_ms.push_back(stats.sample_ms + stats.mesh_ms);
+            triangles += region.front().num_triangles();
+        }
+
+        auto mean = [](const std::vector<double>& values) {
+            auto sum = 0.0;
+            for (auto value : values) {
+                sum += value;
+            }
+            return sum / double(values.size());
+        };
+        auto sorted = total_ms;
+        std::sort(sorted.begin(), sorted.end());
+        auto p99 = sorted[std::min(sorted.size() - 1, std::size_t(0.99 * sorted.size()))];
+
+        std::printf("%2zu threads: sample %6.2f ms, mesh %6.2f ms, frame %6.2f ms mean %6.2f ms p99, %6zu triangles, %s 60 Hz\n",
+            num_threads, mean(sample_ms), mean(mesh_ms), mean(total_ms), p99, triangles / FRAMES,
+            p99 <= FRAME_MS ? "fits" : "misses");
+
+        // The last frame against the whole grid meshed on this thread
+        auto grid = DensityGrid();
+        grid.resize(AXIS_LENGTH);
+        grid.offset = ORIGIN;
+        density_graph::evaluate(animated_terrain_graph(settings, (FRAMES - 1) * FRAME_SECONDS * SPEED), ORIGIN, AXIS_LENGTH, grid.values.data());
+        auto whole = ExtractedMesh();
+        MarchingCubesExtractor().extract(grid, settings.iso_level, whole);
+        if (!same_triangles(whole, region.front())) {
+            std::printf("slab meshes differ from the whole grid: %zu against %zu triangles\n",
+                region.front().num_triangles(), whole.num_triangles());
+            return false;
+        }
+        return true;
+    }
+}
+
+int main() {
+    // Features about the size of the region, at the terrain's 0.151 the
+    // region mostly falls inside one ridge and has no surface
+    auto settings = GenerationSettings();
+    settings.scale = 1.0f;
+
+    auto hardware_threads = std::size_t(std::max(1u, std::thread::hardware_concurrency()));
+    auto ok = run(1, settings);
+    if (hardware_threads > 1) {
+        ok = run(hardware_threads, settings) && ok;
+    }
+
+    return ok ? 0 : 1;
+}
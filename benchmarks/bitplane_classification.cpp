@@ -0,0 +1,152 @@
+// Bitplane classification benchmark
+//
+// Description: Classifies every cell of the default 3x3 chunk sample one
+// corner at a time, as marching cubes did, and 64 cells at a time on sign
+// bitplanes. Both count the active cells and sum their cube indices, and the
+// run exits with 1 if they disagree. Also times the whole extraction, which
+// now classifies on bitplanes.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <vector>
+
+#include "bitplanes.hpp"
+#include "density.hpp"
+#include "extractor.hpp"
+#include "marching_cubes_tables.hpp"
+
+namespace {
+    constexpr auto AXIS_LENGTH = 100;
+    constexpr auto CHUNKS_PER_AXIS = 3;
+    constexpr auto REPETITIONS = 10;
+
+    struct Classified {
+        std::size_t active = 0;
+        std::size_t index_sum = 0;
+    };
+
+    template<typename Function>
+    double best_of(Function&& function) {
+        auto best = 1e30;
+        for (auto repetition = 0; repetition < REPETITIONS; repetition++) {
+            auto start = std::chrono::high_resolution_clock::now();
+            function();
+            auto end = std::chrono::high_resolution_clock::now();
+            best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+        }
+        return best;
+    }
+
+    // The loop marching cubes ran before bitplanes
+    Classified classify_scalar(const DensityGrid& grid, float iso_level) {
+        auto result = Classified();
+        const auto length = grid.axis_length;
+        for (auto x = 0; x < length - 1; x++) {
+            for (auto y = 0; y < length - 1; y++) {
+                for (auto z = 0; z < length - 1; z++) {
+                    float corners[8];
+                    auto lowest = std::numeric_limits<float>::max();
+                    auto highest = std::numeric_limits<float>::lowest();
+                    for (auto corner = 0; corner < 8; corner++) {
+                        const auto* c = CORNER_OFFSETS[corner];
+                        corners[corner] = grid.at(x + c[0], y + c[1], z + c[2]);
+                        lowest = std::min(lowest, corners[corner]);
+                        highest = std::max(highest, corners[corner]);
+                    }
+                    if (lowest >= iso_level || highest < iso_level) {
+                        continue;
+                    }
+
+                    auto cube_index = 0;
+                    for (auto corner = 0; corner < 8; corner++) {
+                        if (corners[corner] < iso_level) {
+                            cube_index |= 1 << corner;
+                        }
+                    }
+                    result.active++;
+                    result.index_sum += std::size_t(cube_index);
+                }
+            }
+        }
+        return result;
+    }
+
+    Classified classify_bitplanes(const DensityGrid& grid, float iso_level, SignPlane planes[2]) {
+        auto result = Classified();
+        const auto length = grid.axis_length;
+        planes[0].resize(length);
+        planes[1].resize(length);
+        planes[0].threshold(grid, 0, iso_level);
+        for (auto x = 0; x < length - 1; x++) {
+            planes[(x + 1) & 1].threshold(grid, x + 1, iso_level);
+            for (auto y = 0; y < length - 1; y++) {
+                for_each_active_cell(planes[x & 1], planes[(x + 1) & 1], y, [&](int, int cube_index) {
+                    result.active++;
+                    result.index_sum += std::size_t(cube_index);
+                });
+            }
+        }
+        return result;
+    }
+}
+
+int main() {
+    auto settings = GenerationSettings();
+    settings.scale = 0.151f;
+
+    auto grids = std::vector<DensityGrid>();
+    for (auto y = 0; y < CHUNKS_PER_AXIS; y++) {
+        for (auto x = 0; x < CHUNKS_PER_AXIS; x++) {
+            grids.emplace_back();
+            sample_density(settings, glm::ivec3(x, y, 0) * (AXIS_LENGTH - 1), AXIS_LENGTH, grids.back());
+        }
+    }
+
+    auto scalar = Classified();
+    auto bitplanes = Classified();
+    SignPlane planes[2];
+    auto scalar_ms = best_of([&] {
+        scalar = Classified();
+        for (const auto& grid : grids) {
+            auto chunk = classify_scalar(grid, settings.iso_level);
+            scalar.active += chunk.active;
+            scalar.index_sum += chunk.index_sum;
+        }
+    });
+    auto bitplane_ms = best_of([&] {
+        bitplanes = Classified();
+        for (const auto& grid : grids) {
+            auto chunk = classify_bitplanes(grid, settings.iso_level, planes);
+            bitplanes.active += chunk.active;
+            bitplanes.index_sum += chunk.index_sum;
+        }
+    });
+
+    auto extractor = MarchingCubesExtractor();
+    auto mesh = ExtractedMesh();
+    auto triangles = std::size_t(0);
+    auto extract_ms = best_of([&] {
+        triangles = 0;
+        for (const auto& grid : grids) {
+            extractor.extract(grid, settings.iso_level, mesh);
+            triangles += mesh.num_triangles();
+        }
+    });
+
+    const auto cells = double(grids.size()) * (AXIS_LENGTH - 1) * (AXIS_LENGTH - 1) * (AXIS_LENGTH - 1);
+    std::printf("%zu chunks, %.0f cells, %zu active\n", grids.size(), cells, scalar.active);
+    std::printf("%-12s %9s %14s\n", "classify", "ms", "Mcells/s");
+    std::printf("%-12s %9.2f %14.1f\n", "scalar", scalar_ms, cells / scalar_ms / 1000.0);
+    std::printf("%-12s %9.2f %14.1f   %.1fx\n", "bitplanes", bitplane_ms, cells / bitplane_ms / 1000.0, scalar_ms / bitplane_ms);
+    std::printf("%-12s %9.2f %14.1f   %zu triangles\n", "extract", extract_ms, cells / extract_ms / 1000.0, triangles);
+
+    if (scalar.active != bitplanes.active || scalar.index_sum != bitplanes.index_sum) {
+        std::printf("bitplanes found %zu active cells with index sum %zu, scalar %zu with %zu\n",
+            bitplanes.active, bitplanes.index_sum, scalar.active, scalar.index_sum);
+        return 1;
+    }
+    return 0;
+}
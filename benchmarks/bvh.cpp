@@ -0,0 +1,255 @@
+// BVH benchmark
+//
+// Description: Meshes the default 3x3 chunk sample with CPU marching cubes and
+// builds a BVH per chunk, one at a time and then all at once on the thread
+// pool through WorldBvh. Reports build time per chunk and rays per second
+// for single rays and 4 and 8 wide packets, with coherent camera rays and
+// scattered ones, plus the cost of a refit after a small edit. Exits with 1
+// if packets or the tree disagree with single rays or a brute force test.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "bvh.hpp"
+#include "density.hpp"
+#include "extractor.hpp"
+#include "thread_pool.hpp"
+
+namespace {
+    constexpr auto AXIS_LENGTH = 100;
+    constexpr auto CHUNKS_PER_AXIS = 3;
+    constexpr auto REPETITIONS = 3;
+    constexpr auto IMAGE_SIZE = 512;
+    constexpr auto BRUTE_FORCE_RAYS = 256;
+
+    double milliseconds_since(std::chrono::high_resolution_clock::time_point start) {
+        auto end = std::chrono::high_resolution_clock::now();
+        return std::chrono::duration<double, std::milli>(end - start).count();
+    }
+
+    // Nearest hit over every triangle of every chunk
+    float brute_force(const std::vector<std::vector<glm::vec3>>& chunks, const Ray& ray) {
+        auto nearest = std::numeric_limits<float>::max();
+        for (const auto& positions : chunks) {
+            for (auto corner = std::size_t(0); corner < positions.size(); corner += 3) {
+                auto edge_1 = positions[corner + 1] - positions[corner];
+                auto edge_2 = positions[corner + 2] - positions[corner];
+                auto p = glm::cross(ray.direction, edge_2);
+                auto determinant = glm::dot(edge_1, p);
+                if (std::fabs(determinant) < 1e-8f) {
+                    continue;
+                }
+                auto s = ray.origin - positions[corner];
+                auto u = glm::dot(s, p) / determinant;
+                auto q = glm::cross(s, edge_1);
+                auto v = glm::dot(ray.direction, q) / determinant;
+                auto t = glm::dot(edge_2, q) / determinant;
+                if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t >= 0.0f) {
+                    nearest = std::min(nearest, t);
+                }
+            }
+        }
+        return nearest;
+    }
+
+    bool same_t(float a, float b) {
+        return std::fabs(a - b) <= 1e-3f * std::max(1.0f, std::fabs(a));
+    }
+
+    template<int Width>
+    double trace_packets(const WorldBvh& world, const std::vector<Ray>& rays, std::vector<RayHit>& hits) {
+        auto start = std::chrono::high_resolution_clock::now();
+        for (auto first = std::size_t(0); first < rays.size(); first += Width) {
+            auto packet = RayPacket<Width>(rays.data() + first);
+            world.intersect(packet);
+            for (auto ray = 0; ray < Width; ray++) {
+                hits[first + ray] = packet.hit(ray);
+            }
+        }
+        return milliseconds_since(start);
+    }
+}
+
+int main() {
+    auto settings = GenerationSettings();
+    settings.scale = 0.151f;
+
+    auto extractor = Extractor::create(ExtractorType::MARCHING_CUBES_CPU);
+    auto grid = DensityGrid();
+    auto mesh = ExtractedMesh();
+
+    auto chunks = std::vector<std::vector<glm::vec3>>();
+    for (auto y = 0; y < CHUNKS_PER_AXIS; y++) {
+        for (auto x = 0; x < CHUNKS_PER_AXIS; x++) {
+            auto offset = glm::ivec3(x, y, 0) * (AXIS_LENGTH - 1);
+            sample_density(settings, offset, AXIS_LENGTH, grid);
+            extractor->extract(grid, settings.iso_level, mesh);
+
+            auto positions = std::vector<glm::vec3>();
+            for (auto index : mesh.indices) {
+                positions.push_back(glm::vec3(mesh.vertices[index].position));
+            }
+            chunks.push_back(std::move(positions));
+        }
+    }
+
+    // One thread, one chunk at a time
+    auto total_triangles = std::size_t(0);
+    auto total_ms = 0.0;
+    for (auto chunk = std::size_t(0); chunk < chunks.size(); chunk++) {
+        auto bvh = TriangleBvh();
+        auto best = 1e30;
+        for (auto repetition = 0; repetition < REPETITIONS; repetition++) {
+            auto start = std::chrono::high_resolution_clock::now();
+            bvh.build(chunks[chunk]);
+            best = std::min(best, milliseconds_since(start));
+        }
+        std::printf("chunk %zu: %6zu triangles, %6zu nodes, build %6.2f ms (%.0f ns per triangle)\n",
+            chunk, bvh.num_triangles(), bvh.num_nodes(), best, bvh.num_triangles() == 0 ? 0.0 : best * 1e6 / double(bvh.num_triangles()));
+        total_triangles += bvh.num_triangles();
+        total_ms += best;
+    }
+    std::printf("total: %zu triangles, build %.2f ms on one thread\n", total_triangles, total_ms);
+
+    // Every chunk at once on the pool, the way the renderer submits them
+    auto pool = ThreadPool();
+    auto world = WorldBvh(&pool);
+    world.resize(chunks.size());
+    auto best = 1e30;
+    for (auto repetition = 0; repetition < REPETITIONS; repetition++) {
+        auto start = std::chrono::high_resolution_clock::now();
+        for (auto chunk = 0u; chunk < chunks.size(); chunk++) {
+            world.submit(chunk, std::vector<glm::vec3>(chunks[chunk]));
+        }
+        world.wait();
+        best = std::min(best, milliseconds_since(start));
+    }
+    auto stats = world.stats();
+    std::printf("world: %zu triangles, %zu nodes, build %.2f ms on %zu threads\n\n",
+        stats.triangles, stats.nodes, best, std::size_t(std::max(1u, std::thread::hardware_concurrency())));
+
+    // Coherent rays from a camera over the middle of the sample looking down
+    // at an angle, and scattered rays from random points in random directions
+    auto center = glm::vec3(CHUNKS_PER_AXIS * (AXIS_LENGTH - 1) * 0.5f, 60.0f, (AXIS_LENGTH - 1) * 0.5f);
+    auto eye = center + glm::vec3(0.0f, 140.0f, -160.0f);
+    auto forward = glm::normalize(center - eye);
+    auto right = glm::normalize(glm::cross(forward, glm::vec3(0.0f, 1.0f, 0.0f)));
+    auto up = glm::cross(right, forward);
+
+    // Packets take 2x2 and 4x2 pixel tiles, so rays are ordered by tile
+    auto camera_rays = std::vector<Ray>();
+    for (auto tile_y = 0; tile_y < IMAGE_SIZE; tile_y += 2) {
+        for (auto tile_x = 0; tile_x < IMAGE_SIZE; tile_x += 4) {
+            for (auto y = tile_y; y < tile_y + 2; y++) {
+                for (auto x = tile_x; x < tile_x + 4; x++) {
+                    auto u = (x + 0.5f) / IMAGE_SIZE * 2.0f - 1.0f;
+                    auto v = (y + 0.5f) / IMAGE_SIZE * 2.0f - 1.0f;
+                    camera_rays.push_back(Ray { eye, glm::normalize(forward + (u * right + v * up) * 0.6f) });
+                }
+            }
+        }
+    }
+
+    auto random = std::mt19937(7);
+    auto unit = std::uniform_real_distribution<float>(-1.0f, 1.0f);
+    auto scattered_rays = std::vector<Ray>();
+    auto extent = glm::vec3(CHUNKS_PER_AXIS * (AXIS_LENGTH - 1), AXIS_LENGTH, AXIS_LENGTH);
+    while (scattered_rays.size() < camera_rays.size()) {
+        auto direction = glm::vec3(unit(random), unit(random), unit(random));
+        if (glm::length(direction) < 0.1f) {
+            continue;
+        }
+        auto origin = (glm::vec3(unit(random), unit(random), unit(random)) * 0.5f + 0.5f) * extent;
+        scattered_rays.push_back(Ray { origin, glm::normalize(direction) });
+    }
+
+    auto failures = 0;
+    std::printf("%-10s %8s %14s %14s %14s\n", "rays", "hit", "single Mray/s", "packet4 Mray/s", "packet8 Mray/s");
+    for (auto set = 0; set < 2; set++) {
+        const auto& rays = set == 0 ? camera_rays : scattered_rays;
+        auto single = std::vector<RayHit>(rays.size());
+        auto packet4 = std::vector<RayHit>(rays.size());
+        auto packet8 = std::vector<RayHit>(rays.size());
+
+        auto single_ms = 1e30, packet4_ms = 1e30, packet8_ms = 1e30;
+        for (auto repetition = 0; repetition < REPETITIONS; repetition++) {
+            auto start = std::chrono::high_resolution_clock::now();
+            for (auto ray = std::size_t(0); ray < rays.size(); ray++) {
+                single[ray] = world.intersect(rays[ray]);
+            }
+            single_ms = std::min(single_ms, milliseconds_since(start));
+            packet4_ms = std::min(packet4_ms, trace_packets<4>(world, rays, packet4));
+            packet8_ms = std::min(packet8_ms, trace_packets<8>(world, rays, packet8));
+        }
+
+        auto hits = std::size_t(0);
+        for (auto ray = std::size_t(0); ray < rays.size(); ray++) {
+            hits += single[ray].hit();
+            for (const auto* packet : { &packet4[ray], &packet8[ray] }) {
+                if (packet->hit() != single[ray].hit() || (single[ray].hit() && !same_t(packet->t, single[ray].t))) {
+                    failures++;
+                }
+            }
+        }
+        for (auto ray = std::size_t(0); ray < rays.size(); ray += rays.size() / BRUTE_FORCE_RAYS) {
+            auto expected = brute_force(chunks, rays[ray]);
+            auto found = single[ray].hit() ? single[ray].t : std::numeric_limits<float>::max();
+            if (!same_t(expected, found)) {
+                failures++;
+            }
+        }
+
+        auto rate = [&](double ms) { return double(rays.size()) / (ms * 1e3); };
+        std::printf("%-10s %7.1f%% %14.2f %14.2f %14.2f\n", set == 0 ? "camera" : "scattered",
+            100.0 * double(hits) / double(rays.size()), rate(single_ms), rate(packet4_ms), rate(packet8_ms));
+    }
+
+    // A brush sized dent in the middle chunk, refit against a rebuild
+    auto edited = chunks[4];
+    auto brush = center;
+    for (auto& position : edited) {
+        auto offset = position - brush;
+        auto distance = glm::length(offset);
+        if (distance < 8.0f) {
+            position -= glm::vec3(0.0f, 1.0f - distance / 8.0f, 0.0f);
+        }
+    }
+    auto bvh = TriangleBvh();
+    bvh.build(chunks[4]);
+    auto refit_ms = 1e30, rebuild_ms = 1e30;
+    for (auto repetition = 0; repetition < REPETITIONS; repetition++) {
+        auto refitted = bvh;
+        auto start = std::chrono::high_resolution_clock::now();
+        refitted.refit(edited);
+        refit_ms = std::min(refit_ms, milliseconds_since(start));
+
+        auto rebuilt = TriangleBvh();
+        start = std::chrono::high_resolution_clock::now();
+        rebuilt.build(edited);
+        rebuild_ms = std::min(rebuild_ms, milliseconds_since(start));
+
+        if (repetition == 0) {
+            for (auto ray = std::size_t(0); ray < camera_rays.size(); ray += 97) {
+                auto a = RayHit(), b = RayHit();
+                refitted.intersect(camera_rays[ray], a);
+                rebuilt.intersect(camera_rays[ray], b);
+                if (a.hit() != b.hit() || (a.hit() && !same_t(a.t, b.t))) {
+                    failures++;
+                }
+            }
+        }
+    }
+    std::printf("\nedit of chunk 4: refit %.2f ms, rebuild %.2f ms\n", refit_ms, rebuild_ms);
+
+    if (failures != 0) {
+        std::printf("%d rays disagree\n", failures);
+        return 1;
+    }
+    return 0;
+}
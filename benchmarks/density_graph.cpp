@@ -0,0 +1,113 @@
+// Density graph benchmark
+//
+// Description: Samples one 100^3 chunk with the default terrain four ways: the
+// scalar procedural_density, the graph interpreted through a virtual call per
+// node, octaves and their operations included, the fused graph one sample at
+// a time and the fused graph four samples at a time. A richer graph with
+// warping and blending is timed the same way. Fusing alone saves only the
+// calls around the simplex noise, which dominates, the lanes give the rest.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "density.hpp"
+#include "density_graph.hpp"
+
+namespace {
+    constexpr auto AXIS_LENGTH = 100;
+    constexpr auto NUM_SAMPLES = AXIS_LENGTH * AXIS_LENGTH * AXIS_LENGTH;
+    constexpr auto REPETITIONS = 5;
+    const auto ORIGIN = glm::ivec3(99, 0, 0);
+
+    template<typename Function>
+    double best_of(Function&& function) {
+        auto best = 1e30;
+        for (auto repetition = 0; repetition < REPETITIONS; repetition++) {
+            auto start = std::chrono::high_resolution_clock::now();
+            function();
+            auto end = std::chrono::high_resolution_clock::now();
+            best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+        }
+        return best;
+    }
+
+    // Visits the chunk in the stage 1 grid order
+    template<typename Function>
+    void for_each_sample(std::vector<float>& values, Function&& function) {
+        auto index = std::size_t(0);
+        for (auto x = 0; x < AXIS_LENGTH; x++) {
+            for (auto y = 0; y < AXIS_LENGTH; y++) {
+                for (auto z = 0; z < AXIS_LENGTH; z++) {
+                    values[index++] = function(float(ORIGIN.x + x), float(ORIGIN.y + y), float(ORIGIN.z + z));
+                }
+            }
+        }
+    }
+
+    float max_difference(const std::vector<float>& a, const std::vector<float>& b) {
+        auto difference = 0.0f;
+        for (auto i = std::size_t(0); i < a.size(); i++) {
+            difference = std::max(difference, std::fabs(a[i] - b[i]));
+        }
+        return difference;
+    }
+
+    void report(const char* name, double ms, float difference) {
+        std::printf("  %-28s %8.2f ms  %6.1f ns/sample  max difference %g\n", name, ms, ms * 1e6 / NUM_SAMPLES, difference);
+    }
+
+    // Interpreted, fused scalar and fused SIMD runs of one graph against reference
+    template<typename Graph>
+    void time_graph(const Graph& graph, const std::vector<float>& reference) {
+        auto values = std::vector<float>(NUM_SAMPLES);
+
+        auto interpreted = graph.interpret();
+        auto interpreted_ms = best_of([&] {
+            for_each_sample(values, [&](float x, float y, float z) { return interpreted->eval(x, y, z); });
+        });
+        report("interpreted graph", interpreted_ms, max_difference(values, reference));
+
+        auto fused_ms = best_of([&] {
+            for_each_sample(values, [&](float x, float y, float z) { return graph.eval(x, y, z); });
+        });
+        report("fused graph, scalar", fused_ms, max_difference(values, reference));
+
+        auto simd_ms = best_of([&] {
+            density_graph::evaluate(graph, ORIGIN, AXIS_LENGTH, values.data());
+        });
+        report("fused graph, 4 lanes", simd_ms, max_difference(values, reference));
+        std::printf("  fused scalar %.2fx faster than interpreted, 4 lanes %.2fx faster than fused scalar\n",
+            interpreted_ms / fused_ms, fused_ms / simd_ms);
+    }
+}
+
+int main() {
+    using namespace density_graph;
+
+    auto settings = GenerationSettings();
+    settings.scale = 0.151f;
+
+    std::printf("default terrain, %d samples\n", NUM_SAMPLES);
+    auto reference = std::vector<float>(NUM_SAMPLES);
+    auto scalar_ms = best_of([&] {
+        for_each_sample(reference, [&](float x, float y, float z) { return procedural_density(settings, glm::vec3(x, y, z)); });
+    });
+    report("procedural_density", scalar_ms, 0.0f);
+    time_graph(terrain_graph(settings), reference);
+
+    // Domain warped ridges blended into rolling hills, capped to a band
+    auto warp_x = simplex_noise(0.004f);
+    auto warp_z = simplex_noise(0.0043f);
+    auto hills = fbm(FractalParameters { 0.002f, 3, 0.5f, 2.0f }) * 20.0f + y() - 60.0f;
+    auto ridges = warp(ridged(FractalParameters { 0.0015f, 4, 0.5f, 2.0f }), warp_x, constant(0.0f), warp_z, 30.0f);
+    auto rich = clamp(smooth_union(hills, ridges, 0.5f), -10.0f, 140.0f);
+
+    std::printf("warped and blended terrain\n");
+    for_each_sample(reference, [&](float x, float y, float z) { return rich.eval(x, y, z); });
+    time_graph(rich, reference);
+
+    return 0;
+}
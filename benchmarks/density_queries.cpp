@@ -0,0 +1,149 @@
+// Density queries benchmark
+//
+// Description: Fills a DensityCache with the default 3x3 chunk sample and
+// times density and height queries, one at a time and batched, for points
+// around a player and points spread over the whole sample. Exits with 1 if
+// a query disagrees with the sampled grid or with a column scan.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "density.hpp"
+#include "density_cache.hpp"
+
+namespace {
+    constexpr auto AXIS_LENGTH = 100;
+    constexpr auto CHUNKS_PER_AXIS = 3;
+    constexpr auto NUM_QUERIES = 1 << 20;
+    constexpr auto REPETITIONS = 5;
+
+    double milliseconds_since(std::chrono::high_resolution_clock::time_point start) {
+        auto end = std::chrono::high_resolution_clock::now();
+        return std::chrono::duration<double, std::milli>(end - start).count();
+    }
+}
+
+int main() {
+    auto settings = GenerationSettings();
+    settings.scale = 0.151f;
+
+    auto cache = DensityCache(CHUNKS_PER_AXIS, AXIS_LENGTH);
+    cache.set_iso_level(settings.iso_level);
+
+    // The sample is one chunk deep, chunks further along z read as air
+    auto grids = std::vector<DensityGrid>();
+    auto fill_ms = 0.0;
+    for (auto y = 0; y < CHUNKS_PER_AXIS; y++) {
+        for (auto x = 0; x < CHUNKS_PER_AXIS; x++) {
+            auto grid = DensityGrid();
+            sample_density(settings, glm::ivec3(x, y, 0) * (AXIS_LENGTH - 1), AXIS_LENGTH, grid);
+            auto start = std::chrono::high_resolution_clock::now();
+            cache.store(grid);
+            fill_ms += milliseconds_since(start);
+            grids.push_back(std::move(grid));
+        }
+    }
+    auto bytes = std::size_t(0);
+    for (auto chunk = 0u; chunk < CHUNKS_PER_AXIS * CHUNKS_PER_AXIS * CHUNKS_PER_AXIS; chunk++) {
+        bytes += cache.bytes(chunk);
+    }
+    std::printf("filled %zu chunks in %.2f ms, %.1f MB\n", cache.num_cached(), fill_ms, bytes / (1024.0 * 1024.0));
+
+    // Samples come back exactly, midpoints are the average of their corners
+    auto failures = 0;
+    for (const auto& grid : grids) {
+        for (auto x = 0; x < AXIS_LENGTH - 1; x += 7) {
+            for (auto y = 0; y < AXIS_LENGTH - 1; y += 5) {
+                for (auto z = 0; z < AXIS_LENGTH - 1; z += 3) {
+                    auto position = glm::vec3(grid.offset + glm::ivec3(x, y, z));
+                    if (std::fabs(cache.density(position) - grid.at(x, y, z)) > 1e-5f) {
+                        failures++;
+                    }
+                    auto average = 0.0f;
+                    for (auto corner = 0; corner < 8; corner++) {
+                        average += grid.at(x + (corner >> 2), y + (corner >> 1 & 1), z + (corner & 1));
+                    }
+                    if (std::fabs(cache.density(position + glm::vec3(0.5f)) - average / 8.0f) > 1e-4f) {
+                        failures++;
+                    }
+                }
+            }
+        }
+    }
+
+    // Heights against a scan down the column at sample positions
+    auto world_top = CHUNKS_PER_AXIS * (AXIS_LENGTH - 1);
+    for (auto x = 0; x < world_top; x += 11) {
+        for (auto z = 0; z < AXIS_LENGTH - 1; z += 7) {
+            auto expected = NO_SURFACE;
+            for (auto y = world_top; y > 0; y--) {
+                auto below = cache.density(glm::vec3(x, y - 1, z));
+                auto above = cache.density(glm::vec3(x, y, z));
+                if (below < settings.iso_level && above >= settings.iso_level) {
+                    expected = float(y - 1) + (settings.iso_level - below) / (above - below);
+                    break;
+                }
+            }
+            if (std::fabs(cache.height(float(x), float(z)) - expected) > 1e-3f) {
+                failures++;
+            }
+        }
+    }
+
+    auto random = std::mt19937(11);
+    auto unit = std::uniform_real_distribution<float>(0.0f, 1.0f);
+    auto world = glm::vec3(float(world_top), float(world_top), float(AXIS_LENGTH - 1));
+    auto player = glm::vec3(150.0f, 60.0f, 50.0f);
+
+    std::printf("%-8s %16s %16s %16s\n", "points", "single Mq/s", "batched Mq/s", "height Mq/s");
+    for (auto set = 0; set < 2; set++) {
+        auto points = std::vector<glm::vec3>(NUM_QUERIES);
+        for (auto& point : points) {
+            auto r = glm::vec3(unit(random), unit(random), unit(random));
+            point = set == 0 ? player + (r - 0.5f) * 16.0f : r * world;
+        }
+
+        auto single = std::vector<float>(NUM_QUERIES);
+        auto batched = std::vector<float>(NUM_QUERIES);
+        auto heights = std::vector<float>(NUM_QUERIES);
+        auto single_ms = 1e30, batched_ms = 1e30, height_ms = 1e30;
+        for (auto repetition = 0; repetition < REPETITIONS; repetition++) {
+            auto start = std::chrono::high_resolution_clock::now();
+            for (auto i = 0; i < NUM_QUERIES; i++) {
+                single[i] = cache.density(points[i]);
+            }
+            single_ms = std::min(single_ms, milliseconds_since(start));
+
+            start = std::chrono::high_resolution_clock::now();
+            cache.density(points.data(), points.size(), batched.data());
+            batched_ms = std::min(batched_ms, milliseconds_since(start));
+
+            start = std::chrono::high_resolution_clock::now();
+            for (auto i = 0; i < NUM_QUERIES; i++) {
+                heights[i] = cache.height(points[i].x, points[i].z);
+            }
+            height_ms = std::min(height_ms, milliseconds_since(start));
+        }
+
+        for (auto i = 0; i < NUM_QUERIES; i++) {
+            if (std::fabs(single[i] - batched[i]) > 1e-4f * std::max(1.0f, std::fabs(single[i]))) {
+                failures++;
+            }
+        }
+
+        auto rate = [](double ms) { return NUM_QUERIES / (ms * 1e3); };
+        std::printf("%-8s %16.1f %16.1f %16.1f\n", set == 0 ? "player" : "world", rate(single_ms), rate(batched_ms), rate(height_ms));
+    }
+
+    if (failures != 0) {
+        std::printf("%d queries disagree\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,95 @@
+// Frustum culling benchmark
+//
+// Description: Culls a 100x100 grid of chunk bounds (10k chunks) from a camera
+// sweeping around the middle of the world, comparing the scalar and SSE paths
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "glm/gtc/matrix_transform.hpp"
+
+#include "frustum.hpp"
+
+namespace {
+    constexpr auto CHUNKS_PER_AXIS = 100;
+    constexpr auto CHUNK_SIZE = 99.0f;
+    constexpr auto ITERATIONS = 2000;
+
+    template <typename Func>
+    double time_ms(Func&& func) {
+        auto start = std::chrono::high_resolution_clock::now();
+        func();
+        auto end = std::chrono::high_resolution_clock::now();
+        return std::chrono::duration<double, std::milli>(end - start).count();
+    }
+}
+
+int main() {
+    auto rng = std::mt19937(1234);
+    auto height = std::uniform_real_distribution<float>(5.0f, 140.0f);
+
+    auto culler = FrustumCuller();
+    culler.resize(CHUNKS_PER_AXIS * CHUNKS_PER_AXIS);
+    for (auto x = 0; x < CHUNKS_PER_AXIS; x++) {
+        for (auto z = 0; z < CHUNKS_PER_AXIS; z++) {
+            auto origin = glm::vec3(x * CHUNK_SIZE, 0.0f, z * CHUNK_SIZE);
+            culler.set_bounds(
+                x * CHUNKS_PER_AXIS + z,
+                BoundingBox(origin, origin + glm::vec3(CHUNK_SIZE, height(rng), CHUNK_SIZE))
+            );
+        }
+    }
+
+    auto const world_center = glm::vec3(CHUNKS_PER_AXIS * CHUNK_SIZE * 0.5f, 60.0f, CHUNKS_PER_AXIS * CHUNK_SIZE * 0.5f);
+    auto const projection = glm::perspective(glm::radians(45.0f), 1440.0f / 900.0f, 0.1f, 3000.0f);
+
+    auto frustum_for = [&](int iteration) {
+        auto angle = iteration * 0.01f;
+        auto view = glm::lookAt(world_center, world_center + glm::vec3(cos(angle), -0.2f, sin(angle)), glm::vec3(0.0f, 1.0f, 0.0f));
+        return Frustum::from_matrix(projection * view);
+    };
+
+    auto visible = std::vector<uint32_t>();
+    visible.reserve(culler.size());
+
+    std::size_t scalar_visible = 0;
+    auto scalar_ms = time_ms([&] {
+        for (auto i = 0; i < ITERATIONS; i++) {
+            visible.clear();
+            culler.cull_scalar(frustum_for(i), visible);
+            scalar_visible += visible.size();
+        }
+    });
+
+    std::size_t simd_visible = 0;
+    auto simd_ms = time_ms([&] {
+        for (auto i = 0; i < ITERATIONS; i++) {
+            visible.clear();
+            culler.cull_simd(frustum_for(i), visible);
+            simd_visible += visible.size();
+        }
+    });
+
+    std::size_t sorted_visible = 0;
+    auto sorted_ms = time_ms([&] {
+        for (auto i = 0; i < ITERATIONS; i++) {
+            culler.cull(frustum_for(i), world_center, visible);
+            sorted_visible += visible.size();
+        }
+    });
+
+    std::cout << "chunks:                " << culler.size() << "\n"
+              << "average visible:       " << simd_visible / ITERATIONS << "\n"
+              << "scalar cull:           " << scalar_ms / ITERATIONS << " ms/frame\n"
+              << "simd cull:             " << simd_ms / ITERATIONS << " ms/frame\n"
+              << "simd cull + sort:      " << sorted_ms / ITERATIONS << " ms/frame\n";
+
+    if (scalar_visible != simd_visible || simd_visible != sorted_visible) {
+        std::cout << "mismatch between scalar and simd results" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,115 @@
+// Marching cubes tables benchmark
+//
+// Description: Times the table work of stage 2 on the cube configurations of
+// the default 3x3 chunk sample: counting triangles per cell and walking the
+// edges of every triangle, with the int triangulation scanned until -1 against
+// the packed constexpr tables.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "density.hpp"
+#include "marching_cubes_tables.hpp"
+
+namespace {
+    constexpr auto AXIS_LENGTH = 100;
+    constexpr auto CHUNKS_PER_AXIS = 3;
+    constexpr auto REPETITIONS = 20;
+
+    template<typename Function>
+    double best_of(Function&& function) {
+        auto best = 1e30;
+        for (auto repetition = 0; repetition < REPETITIONS; repetition++) {
+            auto start = std::chrono::high_resolution_clock::now();
+            function();
+            auto end = std::chrono::high_resolution_clock::now();
+            best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+        }
+        return best;
+    }
+}
+
+int main() {
+    auto settings = GenerationSettings();
+    settings.scale = 0.151f;
+
+    // Cube configuration of every cell in the sample
+    auto grid = DensityGrid();
+    auto cube_indices = std::vector<uint8_t>();
+    for (auto y = 0; y < CHUNKS_PER_AXIS; y++) {
+        for (auto x = 0; x < CHUNKS_PER_AXIS; x++) {
+            sample_density(settings, glm::ivec3(x, y, 0) * (AXIS_LENGTH - 1), AXIS_LENGTH, grid);
+            for (auto cx = 0; cx < AXIS_LENGTH - 1; cx++) {
+                for (auto cy = 0; cy < AXIS_LENGTH - 1; cy++) {
+                    for (auto cz = 0; cz < AXIS_LENGTH - 1; cz++) {
+                        auto cube_index = 0;
+                        for (auto corner = 0; corner < 8; corner++) {
+                            const auto* c = CORNER_OFFSETS[corner];
+                            if (grid.at(cx + c[0], cy + c[1], cz + c[2]) < settings.iso_level) {
+                                cube_index |= 1 << corner;
+                            }
+                        }
+                        cube_indices.push_back(uint8_t(cube_index));
+                    }
+                }
+            }
+        }
+    }
+
+    // Volatile sinks keep the loops from being folded away
+    volatile uint64_t sink = 0;
+
+    auto scan_count = best_of([&] {
+        uint64_t triangles = 0;
+        for (auto cube_index : cube_indices) {
+            for (auto i = 0; triangulation[cube_index][i] != -1; i += 3) {
+                triangles++;
+            }
+        }
+        sink = triangles;
+    });
+    auto scanned_triangles = uint64_t(sink);
+
+    auto packed_count = best_of([&] {
+        uint64_t triangles = 0;
+        for (auto cube_index : cube_indices) {
+            triangles += TRIANGLE_COUNTS[cube_index];
+        }
+        sink = triangles;
+    });
+
+    auto scan_edges = best_of([&] {
+        uint64_t checksum = 0;
+        for (auto cube_index : cube_indices) {
+            for (auto i = 0; triangulation[cube_index][i] != -1; i++) {
+                checksum += EDGE_CORNER_A[triangulation[cube_index][i]] * 13 + i;
+            }
+        }
+        sink = checksum;
+    });
+    auto scanned_checksum = uint64_t(sink);
+
+    auto packed_edges = best_of([&] {
+        uint64_t checksum = 0;
+        for (auto cube_index : cube_indices) {
+            auto packed = PACKED_TRIANGULATION[cube_index];
+            auto num_vertices = int(packed >> 60) * 3;
+            for (auto i = 0; i < num_vertices; i++, packed >>= 4) {
+                checksum += EDGE_CORNER_A[packed & 0xF] * 13 + i;
+            }
+        }
+        sink = checksum;
+    });
+
+    std::printf("cells:                %zu, %llu triangles\n", cube_indices.size(), (unsigned long long)scanned_triangles);
+    std::printf("table sizes:          %zu bytes int triangulation, %zu bytes packed + %zu bytes counts\n",
+        sizeof(triangulation), sizeof(PACKED_TRIANGULATION), sizeof(TRIANGLE_COUNTS));
+    std::printf("count triangles:      %.2f ms scanning until -1, %.2f ms from counts\n", scan_count, packed_count);
+    std::printf("walk triangle edges:  %.2f ms scanning until -1, %.2f ms packed nibbles%s\n",
+        scan_edges, packed_edges, uint64_t(sink) == scanned_checksum ? "" : " (MISMATCH)");
+
+    return 0;
+}
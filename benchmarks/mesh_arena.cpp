@@ -0,0 +1,110 @@
+// Mesh arena benchmark
+//
+// Description: Simulates the chunk mesh arena for a 1000 chunk world on the CPU.
+// Chunks are created, then a slice of them is regenerated with new sizes every
+// frame while compaction runs under a per-frame budget. Reports arena memory
+// against the per-chunk worst case allocation TerrainChunk used to make.
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "arena_allocator.hpp"
+
+namespace {
+    constexpr auto NUM_CHUNKS = 1000;
+    constexpr auto NUM_FRAMES = 1000;
+    constexpr auto REGENERATED_PER_FRAME = 20;
+    constexpr auto MAX_COMPACTION_TRIANGLES = 10 * 1024;
+    constexpr auto INITIAL_ARENA_TRIANGLES = 256 * 1024;
+
+    // Matches sizeof(Triangle), three vertices of position, normal and color vec4s
+    constexpr auto TRIANGLE_BYTES = 144.0;
+
+    // Old per-chunk VBO: num_points * 2 * sizeof(Triangle) for a 100^3 chunk
+    constexpr auto WORST_CASE_TRIANGLES = 1000000.0 * 2;
+
+    // Triangle counts of 100^3 chunks at the default settings, from a CPU
+    // evaluation of the stage 1 and stage 2 kernels: the ground layer, the
+    // layer above it and the empty sky
+    const std::vector<uint32_t> MEASURED_TRIANGLES = {
+        30548, 41225, 36086,
+        21300, 21639, 6928,
+        0, 0, 0
+    };
+
+    double to_mb(double triangles) {
+        return triangles * TRIANGLE_BYTES / (1024.0 * 1024.0);
+    }
+}
+
+int main() {
+    auto rng = std::mt19937(1234);
+    auto pick = std::uniform_int_distribution<std::size_t>(0, MEASURED_TRIANGLES.size() - 1);
+    auto jitter = std::uniform_real_distribution<double>(0.8, 1.2);
+    auto chunk = std::uniform_int_distribution<std::size_t>(0, NUM_CHUNKS - 1);
+
+    auto arena = ArenaAllocator(INITIAL_ARENA_TRIANGLES);
+    auto handles = std::vector<ArenaAllocator::Handle>(NUM_CHUNKS, ArenaAllocator::INVALID_HANDLE);
+    auto peak_capacity = 0u;
+    auto operations = 0u;
+    auto allocation_ns = 0.0;
+
+    auto regenerate = [&](std::size_t index) {
+        auto triangles = uint32_t(MEASURED_TRIANGLES[pick(rng)] * jitter(rng));
+
+        auto start = std::chrono::high_resolution_clock::now();
+        if (handles[index] != ArenaAllocator::INVALID_HANDLE) {
+            arena.free(handles[index]);
+            handles[index] = ArenaAllocator::INVALID_HANDLE;
+        }
+        if (triangles > 0) {
+            handles[index] = arena.allocate(triangles);
+            while (handles[index] == ArenaAllocator::INVALID_HANDLE) {
+                arena.grow(arena.capacity() + std::max(arena.capacity() / 2, triangles));
+                handles[index] = arena.allocate(triangles);
+            }
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+
+        allocation_ns += std::chrono::duration<double, std::nano>(end - start).count();
+        operations++;
+        peak_capacity = std::max(peak_capacity, arena.capacity());
+    };
+
+    for (auto index = 0u; index < NUM_CHUNKS; index++) {
+        regenerate(index);
+    }
+
+    auto moved = 0.0;
+    auto compaction_ms = 0.0;
+    for (auto frame = 0; frame < NUM_FRAMES; frame++) {
+        for (auto i = 0; i < REGENERATED_PER_FRAME; i++) {
+            regenerate(chunk(rng));
+        }
+
+        auto start = std::chrono::high_resolution_clock::now();
+        for (const auto& move : arena.compact(MAX_COMPACTION_TRIANGLES)) {
+            moved += move.size;
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        compaction_ms += std::chrono::duration<double, std::milli>(end - start).count();
+    }
+
+    auto stats = arena.stats();
+    auto free_triangles = double(stats.capacity - stats.used);
+
+    std::cout << "chunks:                      " << NUM_CHUNKS << "\n"
+              << "per-chunk worst case VBOs:   " << to_mb(WORST_CASE_TRIANGLES * NUM_CHUNKS) << " MB\n"
+              << "live triangles:              " << to_mb(stats.used) << " MB\n"
+              << "arena capacity (peak):       " << to_mb(peak_capacity) << " MB\n"
+              << "free space in arena:         " << to_mb(free_triangles) << " MB, largest hole "
+              << to_mb(stats.largest_free) << " MB\n"
+              << "allocate/free:               " << allocation_ns / operations << " ns per regeneration\n"
+              << "compaction:                  " << to_mb(moved / NUM_FRAMES) << " MB moved, "
+              << compaction_ms / NUM_FRAMES << " ms per frame\n";
+
+    return 0;
+}
@@ -0,0 +1,167 @@
+// Meshlets benchmark
+//
+// Description: Meshes the default 3x3 chunk sample with CPU marching cubes,
+// expands it to the stage 2 triangle layout and splits it into meshlets.
+// Reports build time and, for a few cameras, the triangles culled by the
+// frustum and normal cone tests next to the per-triangle back face ideal.
+// Exits with 1 if a cone culls a triangle that faces the camera.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+
+#include "density.hpp"
+#include "extractor.hpp"
+#include "frustum.hpp"
+#include "meshlets.hpp"
+
+namespace {
+    constexpr auto AXIS_LENGTH = 100;
+    constexpr auto CHUNKS_PER_AXIS = 3;
+    constexpr auto REPETITIONS = 3;
+
+    struct Camera {
+        const char* name;
+        glm::vec3 eye;
+        glm::vec3 target;
+    };
+
+    glm::vec3 outward_normal(const MeshVertex* corners) {
+        auto a = glm::vec3(corners[0].position);
+        auto normal = glm::cross(a - glm::vec3(corners[1].position), a - glm::vec3(corners[2].position));
+        if (glm::dot(normal, glm::vec3(corners[0].normal + corners[1].normal + corners[2].normal)) < 0.0f) {
+            normal = -normal;
+        }
+        return normal;
+    }
+
+    bool triangle_back_facing(const MeshVertex* corners, glm::vec3 eye) {
+        auto normal = outward_normal(corners);
+        for (auto corner = 0; corner < 3; corner++) {
+            if (glm::dot(glm::vec3(corners[corner].position) - eye, normal) <= 0.0f) {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+int main() {
+    auto settings = GenerationSettings();
+    settings.scale = 0.151f;
+
+    auto extractor = Extractor::create(ExtractorType::MARCHING_CUBES_CPU);
+    auto grid = DensityGrid();
+    auto mesh = ExtractedMesh();
+    auto builder = MeshletBuilder();
+
+    struct Chunk {
+        std::vector<MeshVertex> triangles;
+        std::vector<Meshlet> meshlets;
+    };
+    auto chunks = std::vector<Chunk>();
+
+    auto soup = std::vector<MeshVertex>();
+    auto total_triangles = std::size_t(0);
+    auto total_meshlets = std::size_t(0);
+    auto total_ms = 0.0;
+    for (auto y = 0; y < CHUNKS_PER_AXIS; y++) {
+        for (auto x = 0; x < CHUNKS_PER_AXIS; x++) {
+            auto offset = glm::ivec3(x, y, 0) * (AXIS_LENGTH - 1);
+            sample_density(settings, offset, AXIS_LENGTH, grid);
+            extractor->extract(grid, settings.iso_level, mesh);
+
+            soup.clear();
+            for (auto index : mesh.indices) {
+                soup.push_back(mesh.vertices[index]);
+            }
+            auto num_triangles = uint32_t(soup.size() / 3);
+
+            auto chunk = Chunk();
+            auto best = 1e30;
+            for (auto repetition = 0; repetition < REPETITIONS; repetition++) {
+                auto start = std::chrono::high_resolution_clock::now();
+                builder.build(soup.data(), num_triangles, chunk.triangles, chunk.meshlets);
+                auto end = std::chrono::high_resolution_clock::now();
+                best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+            }
+
+            auto covered = std::size_t(0);
+            for (const auto& meshlet : chunk.meshlets) {
+                covered += meshlet.count;
+            }
+            if (covered != num_triangles || chunk.triangles.size() != soup.size()) {
+                std::printf("meshlets cover %zu of %u triangles\n", covered, num_triangles);
+                return 1;
+            }
+
+            std::printf("%3d,%3d: %6u triangles, %4zu meshlets, %5.1f triangles each, %6.2f ms\n",
+                offset.x, offset.y, num_triangles, chunk.meshlets.size(),
+                chunk.meshlets.empty() ? 0.0 : double(num_triangles) / chunk.meshlets.size(), best);
+            total_triangles += num_triangles;
+            total_meshlets += chunk.meshlets.size();
+            total_ms += best;
+            chunks.push_back(std::move(chunk));
+        }
+    }
+    std::printf("total: %zu triangles in %zu meshlets, build %.2f ms (%.1f ns per triangle)\n\n",
+        total_triangles, total_meshlets, total_ms, total_ms * 1e6 / double(total_triangles));
+
+    auto center = glm::vec3(CHUNKS_PER_AXIS * (AXIS_LENGTH - 1) * 0.5f, 60.0f, (AXIS_LENGTH - 1) * 0.5f);
+    const Camera cameras[] = {
+        { "overhead", center + glm::vec3(0.0f, 250.0f, -1.0f), center },
+        { "side", glm::vec3(center.x, 70.0f, -150.0f), center },
+        { "inside", glm::vec3(center.x - 60.0f, 120.0f, center.z), center + glm::vec3(40.0f, -40.0f, 0.0f) },
+        { "low", glm::vec3(-50.0f, 40.0f, center.z), center },
+    };
+
+    auto violations = 0;
+    std::printf("%-10s %10s %10s %10s %14s\n", "camera", "frustum", "cone", "culled", "back ideal");
+    for (const auto& camera : cameras) {
+        auto projection = glm::perspective(glm::radians(45.0f), 1440.0f / 900.0f, 0.1f, 1000.0f);
+        auto view = glm::lookAt(camera.eye, camera.target, glm::vec3(0.0f, 1.0f, 0.0f));
+        auto frustum = Frustum::from_matrix(projection * view);
+
+        auto frustum_culled = std::size_t(0);
+        auto cone_culled = std::size_t(0);
+        auto back_facing = std::size_t(0);
+        for (const auto& chunk : chunks) {
+            for (const auto& meshlet : chunk.meshlets) {
+                const auto* first = chunk.triangles.data() + std::size_t(meshlet.first) * 3;
+                for (auto triangle = 0u; triangle < meshlet.count; triangle++) {
+                    back_facing += triangle_back_facing(first + triangle * 3, camera.eye);
+                }
+
+                if (!frustum.intersects(meshlet.center, meshlet.radius)) {
+                    frustum_culled += meshlet.count;
+                    continue;
+                }
+                if (!meshlet_back_facing(meshlet, camera.eye)) {
+                    continue;
+                }
+
+                cone_culled += meshlet.count;
+                for (auto triangle = 0u; triangle < meshlet.count; triangle++) {
+                    const auto* corners = first + triangle * 3;
+                    if (outward_normal(corners) != glm::vec3(0.0f) && !triangle_back_facing(corners, camera.eye)) {
+                        violations++;
+                    }
+                }
+            }
+        }
+
+        auto percent = [&](std::size_t count) { return 100.0 * double(count) / double(total_triangles); };
+        std::printf("%-10s %9.1f%% %9.1f%% %9.1f%% %13.1f%%\n", camera.name,
+            percent(frustum_culled), percent(cone_culled), percent(frustum_culled + cone_culled), percent(back_facing));
+    }
+
+    if (violations != 0) {
+        std::printf("%d front facing triangles culled\n", violations);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,91 @@
+// Multi iso benchmark
+//
+// Description: Meshes the default 3x3 chunk sample at 1, 2, 4 and 8 iso
+// levels with CPU marching cubes, once as a pass per level and once as a
+// single pass that thresholds each row of samples against every level in one
+// read and skips the levels outside each word's sample range. Reports both
+// times and exits with 1 if the meshes of the two differ.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "density.hpp"
+#include "extractor.hpp"
+
+namespace {
+    constexpr auto AXIS_LENGTH = 100;
+    constexpr auto CHUNKS_PER_AXIS = 3;
+    constexpr auto REPETITIONS = 3;
+
+    // Around the default iso level of 1, layers like a water line or a
+    // rock and soil boundary sit close to the main surface
+    const float LEVELS[] = { 1.0f, 0.8f, 1.2f, 0.6f, 1.4f, 0.9f, 1.1f, 0.7f };
+
+    bool same_mesh(const ExtractedMesh& a, const ExtractedMesh& b) {
+        if (a.indices != b.indices || a.vertices.size() != b.vertices.size()) {
+            return false;
+        }
+        for (auto i = std::size_t(0); i < a.vertices.size(); i++) {
+            if (a.vertices[i].position != b.vertices[i].position || a.vertices[i].normal != b.vertices[i].normal) {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+int main() {
+    auto settings = GenerationSettings();
+    settings.scale = 0.151f;
+
+    auto extractor = Extractor::create(ExtractorType::MARCHING_CUBES_CPU);
+    auto grids = std::vector<DensityGrid>(CHUNKS_PER_AXIS * CHUNKS_PER_AXIS);
+    for (auto y = 0; y < CHUNKS_PER_AXIS; y++) {
+        for (auto x = 0; x < CHUNKS_PER_AXIS; x++) {
+            auto offset = glm::ivec3(x, y, 0) * (AXIS_LENGTH - 1);
+            sample_density(settings, offset, AXIS_LENGTH, grids[y * CHUNKS_PER_AXIS + x]);
+        }
+    }
+
+    auto separate = std::vector<ExtractedMesh>();
+    auto combined = std::vector<ExtractedMesh>();
+    auto mismatches = 0;
+
+    std::printf("%-7s %12s %14s %14s %9s\n", "levels", "triangles", "separate ms", "one pass ms", "speedup");
+    for (auto num_levels : { 1, 2, 4, 8 }) {
+        auto levels = std::vector<float>(LEVELS, LEVELS + num_levels);
+        auto separate_ms = 0.0;
+        auto combined_ms = 0.0;
+        auto triangles = std::size_t(0);
+
+        for (const auto& grid : grids) {
+            auto best_separate = 1e30;
+            auto best_combined = 1e30;
+            for (auto repetition = 0; repetition < REPETITIONS; repetition++) {
+                auto start = std::chrono::high_resolution_clock::now();
+                extractor->Extractor::extract_levels(grid, levels, separate);
+                auto middle = std::chrono::high_resolution_clock::now();
+                extractor->extract_levels(grid, levels, combined);
+                auto end = std::chrono::high_resolution_clock::now();
+                best_separate = std::min(best_separate, std::chrono::duration<double, std::milli>(middle - start).count());
+                best_combined = std::min(best_combined, std::chrono::duration<double, std::milli>(end - middle).count());
+            }
+            separate_ms += best_separate;
+            combined_ms += best_combined;
+
+            for (auto level = 0; level < num_levels; level++) {
+                triangles += combined[level].num_triangles();
+                if (!same_mesh(separate[level], combined[level])) {
+                    std::printf("level %.2f differs at offset %d,%d\n", levels[level], grid.offset.x, grid.offset.y);
+                    mismatches++;
+                }
+            }
+        }
+
+        std::printf("%-7d %12zu %14.2f %14.2f %8.2fx\n", num_levels, triangles, separate_ms, combined_ms, separate_ms / combined_ms);
+    }
+
+    return mismatches == 0 ? 0 : 1;
+}
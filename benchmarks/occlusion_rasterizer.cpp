@@ -0,0 +1,108 @@
+// Occlusion rasterizer benchmark
+//
+// Description: Rasterises a rolling field of solid column occluders into the
+// software depth buffer from a camera close to the ground, single threaded
+// and across the thread pool, then tests 10k chunk sized boxes against it
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "glm/gtc/matrix_transform.hpp"
+
+#include "occlusion.hpp"
+#include "thread_pool.hpp"
+
+namespace {
+    constexpr auto COLUMNS_PER_AXIS = 64;
+    constexpr auto COLUMN_SIZE = 25.0f;
+    constexpr auto NUM_TEST_BOXES = 10000;
+    constexpr auto ITERATIONS = 200;
+
+    template <typename Func>
+    double time_ms(Func&& func) {
+        auto start = std::chrono::high_resolution_clock::now();
+        func();
+        auto end = std::chrono::high_resolution_clock::now();
+        return std::chrono::duration<double, std::milli>(end - start).count();
+    }
+}
+
+int main() {
+    auto terrain_height = [](int x, int z) {
+        return 20.0f + 15.0f * std::sin(x * 0.3f) * std::cos(z * 0.2f);
+    };
+
+    auto occluders = std::vector<BoundingBox>();
+    for (auto x = 0; x < COLUMNS_PER_AXIS; x++) {
+        for (auto z = 0; z < COLUMNS_PER_AXIS; z++) {
+            auto height = terrain_height(x, z);
+            auto origin = glm::vec3(x * COLUMN_SIZE, 0.0f, z * COLUMN_SIZE);
+            occluders.emplace_back(origin, origin + glm::vec3(COLUMN_SIZE, height, COLUMN_SIZE));
+        }
+    }
+
+    auto rng = std::mt19937(1234);
+    auto extent = std::uniform_real_distribution<float>(0.0f, COLUMNS_PER_AXIS * COLUMN_SIZE - 10.0f);
+    auto test_boxes = std::vector<BoundingBox>();
+    for (auto i = 0; i < NUM_TEST_BOXES; i++) {
+        // Boxes sit on top of the terrain like the surface bounds of a chunk would
+        auto x = extent(rng);
+        auto z = extent(rng);
+        auto origin = glm::vec3(x, terrain_height(int(x / COLUMN_SIZE), int(z / COLUMN_SIZE)), z);
+        test_boxes.emplace_back(origin, origin + glm::vec3(10.0f, 5.0f, 10.0f));
+    }
+
+    auto const eye = glm::vec3(10.0f, 38.0f, 10.0f);
+    auto const view = glm::lookAt(eye, glm::vec3(800.0f, 30.0f, 800.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    auto const projection = glm::perspective(glm::radians(45.0f), 1440.0f / 900.0f, 0.1f, 3000.0f);
+    auto const view_projection = projection * view;
+
+    auto pool = ThreadPool();
+    auto single = OcclusionBuffer();
+    auto threaded = OcclusionBuffer(OcclusionBuffer::DEFAULT_WIDTH, OcclusionBuffer::DEFAULT_HEIGHT, &pool);
+
+    auto run = [&](OcclusionBuffer& buffer) {
+        buffer.begin_frame(view_projection);
+        for (const auto& occluder : occluders) {
+            buffer.add_occluder(occluder);
+        }
+        buffer.rasterize();
+    };
+
+    auto single_ms = time_ms([&] {
+        for (auto i = 0; i < ITERATIONS; i++) {
+            run(single);
+        }
+    });
+
+    auto threaded_ms = time_ms([&] {
+        for (auto i = 0; i < ITERATIONS; i++) {
+            run(threaded);
+        }
+    });
+
+    auto occluded = 0;
+    auto test_ms = time_ms([&] {
+        for (const auto& box : test_boxes) {
+            occluded += threaded.is_visible(box) ? 0 : 1;
+        }
+    });
+
+    std::cout << "resolution:            " << single.width() << "x" << single.height() << "\n"
+              << "occluder boxes:        " << occluders.size() << "\n"
+              << "occluder triangles:    " << single.num_triangles() << "\n"
+              << "rasterize 1 thread:    " << single_ms / ITERATIONS << " ms\n"
+              << "rasterize " << pool.size() << " threads:    " << threaded_ms / ITERATIONS << " ms\n"
+              << "test " << NUM_TEST_BOXES << " boxes:       " << test_ms << " ms\n"
+              << "occluded boxes:        " << occluded << " / " << NUM_TEST_BOXES << "\n";
+
+    if (single.depth() != threaded.depth()) {
+        std::cout << "threaded depth buffer differs from single threaded" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
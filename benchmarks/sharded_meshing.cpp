@@ -0,0 +1,119 @@
+// Sharded meshing benchmark
+//
+// Description: Meshes a 4x2x4 world of default chunks in this process and
+// with the shard coordinator on 1 up to as many worker processes as there are
+// hardware threads, or the count given on the command line. Reports the speed
+// up over one process and the mesh bytes moved per second, then runs again
+// with every first worker killing itself after two chunks. Exits with 1 if a
+// sharded mesh differs from the in-process one.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <chrono>
+
+#include "density.hpp"
+#include "extractor.hpp"
+#include "sharded_meshing.hpp"
+
+namespace {
+    constexpr auto AXIS_LENGTH = 100;
+    constexpr auto CHUNKS_X = 4;
+    constexpr auto CHUNKS_Y = 2;
+    constexpr auto CHUNKS_Z = 4;
+    constexpr auto BYTES_PER_MB = 1024.0 * 1024.0;
+
+    bool same_meshes(const std::vector<ExtractedMesh>& a, const std::vector<ExtractedMesh>& b) {
+        if (a.size() != b.size()) {
+            return false;
+        }
+        for (auto i = std::size_t(0); i < a.size(); i++) {
+            if (a[i].indices != b[i].indices || a[i].vertices.size() != b[i].vertices.size() ||
+                std::memcmp(a[i].vertices.data(), b[i].vertices.data(), a[i].vertices.size() * sizeof(MeshVertex)) != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+int main(int argc, char** argv) {
+    auto max_workers = argc > 1 ? std::atoi(argv[1]) : int(std::thread::hardware_concurrency());
+    max_workers = std::max(max_workers, 1);
+
+    auto settings = GenerationSettings();
+    settings.scale = 0.151f;
+    settings.extractor = ExtractorType::MARCHING_CUBES_CPU;
+
+    auto offsets = std::vector<glm::ivec3>();
+    for (auto x = 0; x < CHUNKS_X; x++) {
+        for (auto y = 0; y < CHUNKS_Y; y++) {
+            for (auto z = 0; z < CHUNKS_Z; z++) {
+                offsets.push_back(glm::ivec3(x, y, z) * (AXIS_LENGTH - 1));
+            }
+        }
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    auto expected = std::vector<ExtractedMesh>(offsets.size());
+    auto extractor = MarchingCubesExtractor();
+    auto grid = DensityGrid();
+    for (auto i = std::size_t(0); i < offsets.size(); i++) {
+        sample_density(settings, offsets[i], AXIS_LENGTH, grid);
+        extractor.extract(grid, settings.iso_level, expected[i]);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    auto in_process_ms = std::chrono::duration<double, std::milli>(end - start).count();
+
+    std::printf("%zu chunks of %d^3\n", offsets.size(), AXIS_LENGTH);
+    std::printf("%-10s %10s %9s %10s %9s %9s\n", "processes", "ms", "speed up", "mesh MB/s", "retried", "restarts");
+    std::printf("%-10s %10.0f %9s %10s %9s %9s\n", "in process", in_process_ms, "-", "-", "-", "-");
+
+    auto mismatches = 0;
+    auto one_process_ms = 0.0;
+    auto run = [&](int workers, int crash_after) {
+        auto options = ShardCoordinator::Options();
+        options.num_workers = std::size_t(workers);
+        options.crash_after = crash_after;
+        auto coordinator = ShardCoordinator(options);
+        auto meshes = std::vector<ExtractedMesh>();
+        auto complete = coordinator.mesh(settings, offsets, AXIS_LENGTH, meshes);
+        const auto& stats = coordinator.stats();
+        if (workers == 1 && crash_after == 0) {
+            one_process_ms = stats.ms;
+        }
+
+        std::printf("%-10d %10.0f %9.2f %10.1f %9zu %9d%s\n", workers, stats.ms, one_process_ms / stats.ms,
+            stats.bytes_received / BYTES_PER_MB / (stats.ms / 1000.0), stats.retried, stats.restarts,
+            crash_after > 0 ? " (crashing workers)" : "");
+        if (!complete || !same_meshes(meshes, expected)) {
+            std::printf("%-10d sharded meshes differ from in process, %zu shards failed\n", workers, stats.failed);
+            mismatches++;
+        }
+    };
+
+    for (auto workers = 1; workers <= max_workers; workers *= 2) {
+        run(workers, 0);
+        if (workers < max_workers && workers * 2 > max_workers) {
+            run(max_workers, 0);
+        }
+    }
+    run(max_workers, 2);
+
+    return mismatches == 0 ? 0 : 1;
+}
+
+#else
+
+int main() {
+    std::printf("sharded meshing needs fork and shared memory, not available here\n");
+    return 0;
+}
+
+#endif
@@ -0,0 +1,128 @@
+// Slab stream benchmark
+//
+// Description: Meshes a 512^3 and a 2048^3 region of the default terrain with
+// the slab streaming extractor, and for regions up to 512^3 also by sampling
+// the whole grid and meshing it after. Reports throughput, the working
+// memory of each and the process peak RSS after each run. Exits with 1 if a
+// streamed mesh differs from the whole grid one. Other sizes can be given on
+// the command line.
+//
+// Peak RSS only grows, so every streamed run is done before the whole grid
+// runs and sizes go in increasing order.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
+
+#include "density.hpp"
+#include "extractor.hpp"
+#include "slab_stream.hpp"
+#include "thread_pool.hpp"
+
+namespace {
+    // 4 GB and up of density is left out
+    constexpr auto MAX_WHOLE_AXIS_LENGTH = 512;
+    constexpr auto BYTES_PER_MB = 1024.0 * 1024.0;
+
+    double peak_rss_mb() {
+#if defined(_WIN32)
+        return 0.0;
+#else
+        auto usage = rusage();
+        getrusage(RUSAGE_SELF, &usage);
+        // Kilobytes on Linux
+        return double(usage.ru_maxrss) / 1024.0;
+#endif
+    }
+
+    double mesh_mb(const ExtractedMesh& mesh) {
+        return (mesh.vertices.size() * sizeof(MeshVertex) + mesh.indices.size() * sizeof(uint32_t)) / BYTES_PER_MB;
+    }
+
+    bool same_mesh(const ExtractedMesh& a, const ExtractedMesh& b) {
+        if (a.indices != b.indices || a.vertices.size() != b.vertices.size()) {
+            return false;
+        }
+        for (auto i = std::size_t(0); i < a.vertices.size(); i++) {
+            if (a.vertices[i].position != b.vertices[i].position || a.vertices[i].normal != b.vertices[i].normal) {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+int main(int argc, char** argv) {
+    auto sizes = std::vector<int>();
+    for (auto i = 1; i < argc; i++) {
+        sizes.push_back(std::atoi(argv[i]));
+    }
+    if (sizes.empty()) {
+        sizes = { 512, 2048 };
+    }
+    std::sort(sizes.begin(), sizes.end());
+
+    auto settings = GenerationSettings();
+    settings.scale = 0.151f;
+    const auto origin = glm::ivec3(0);
+
+    auto pool = ThreadPool();
+    auto streamer = SlabStreamExtractor(&pool);
+    auto streamed = std::vector<ExtractedMesh>(sizes.size());
+
+    std::printf("%-7s %-8s %11s %10s %12s %12s %12s %12s\n",
+        "size", "method", "triangles", "total ms", "Msamples/s", "working MB", "mesh MB", "peak RSS MB");
+    for (auto i = std::size_t(0); i < sizes.size(); i++) {
+        auto length = sizes[i];
+        streamer.extract(terrain_graph(settings), origin, length, settings.iso_level, streamed[i]);
+        const auto& stats = streamer.stats();
+        auto samples = double(length) * length * length;
+        std::printf("%-7d %-8s %11zu %10.0f %12.2f %12.1f %12.1f %12.1f\n", length, "stream", streamed[i].num_triangles(),
+            stats.total_ms, samples / stats.total_ms / 1000.0, stats.working_bytes / BYTES_PER_MB, mesh_mb(streamed[i]), peak_rss_mb());
+        std::printf("%-7s %-8s sample %.0f ms, extract %.0f ms, extraction waited %.0f ms\n", "", "",
+            stats.sample_ms, stats.extract_ms, stats.wait_ms);
+
+        // Too large to compare against a whole grid run, no need to keep it
+        if (length > MAX_WHOLE_AXIS_LENGTH) {
+            streamed[i] = ExtractedMesh();
+        }
+    }
+
+    auto mismatches = 0;
+    auto extractor = MarchingCubesExtractor();
+    for (auto i = std::size_t(0); i < sizes.size(); i++) {
+        auto length = sizes[i];
+        if (length > MAX_WHOLE_AXIS_LENGTH) {
+            std::printf("%-7d %-8s skipped, %.0f MB of density\n", length, "whole",
+                double(length) * length * length * sizeof(float) / BYTES_PER_MB);
+            continue;
+        }
+
+        auto start = std::chrono::high_resolution_clock::now();
+        auto grid = DensityGrid();
+        sample_density(settings, origin, length, grid);
+        auto mesh = ExtractedMesh();
+        extractor.extract(grid, settings.iso_level, mesh);
+        auto end = std::chrono::high_resolution_clock::now();
+
+        auto total_ms = std::chrono::duration<double, std::milli>(end - start).count();
+        auto samples = double(length) * length * length;
+        auto working_mb = (grid.values.size() * sizeof(float) + std::size_t(2) * length * length * 3 * sizeof(uint32_t)) / BYTES_PER_MB;
+        std::printf("%-7d %-8s %11zu %10.0f %12.2f %12.1f %12.1f %12.1f\n", length, "whole", mesh.num_triangles(),
+            total_ms, samples / total_ms / 1000.0, working_mb, mesh_mb(mesh), peak_rss_mb());
+
+        if (!same_mesh(mesh, streamed[i])) {
+            std::printf("%-7d streamed mesh differs from the whole grid: %zu against %zu triangles\n",
+                length, streamed[i].num_triangles(), mesh.num_triangles());
+            mismatches++;
+        }
+    }
+
+    return mismatches == 0 ? 0 : 1;
+}
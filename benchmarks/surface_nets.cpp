@@ -0,0 +1,83 @@
+// Surface nets benchmark
+//
+// Description: Extracts the default 3x3 chunk sample with the CPU marching
+// cubes and surface nets extractors, surface nets with the overlap ring it
+// needs to close the chunk seams. Reports triangles, vertices with and
+// without sharing and extraction time per chunk, side by side.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+
+#include "density.hpp"
+#include "extractor.hpp"
+
+namespace {
+    constexpr auto AXIS_LENGTH = 100;
+    constexpr auto CHUNKS_PER_AXIS = 3;
+    constexpr auto REPETITIONS = 5;
+
+    struct Totals {
+        std::size_t triangles = 0;
+        std::size_t vertices = 0;
+        double milliseconds = 0.0;
+    };
+}
+
+int main() {
+    auto settings = GenerationSettings();
+    settings.scale = 0.151f;
+
+    auto marching_cubes = Extractor::create(ExtractorType::MARCHING_CUBES_CPU);
+    auto surface_nets = Extractor::create(ExtractorType::SURFACE_NETS_CPU);
+
+    auto grid = DensityGrid();
+    auto overlap_grid = DensityGrid();
+    auto mesh = ExtractedMesh();
+    Totals marching_cubes_totals, surface_nets_totals;
+
+    auto run = [&](Extractor& extractor, const DensityGrid& samples, Totals& totals) {
+        auto best = 1e30;
+        for (auto repetition = 0; repetition < REPETITIONS; repetition++) {
+            auto start = std::chrono::high_resolution_clock::now();
+            extractor.extract(samples, settings.iso_level, mesh);
+            auto end = std::chrono::high_resolution_clock::now();
+            best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+        }
+
+        totals.triangles += mesh.num_triangles();
+        totals.vertices += mesh.vertices.size();
+        totals.milliseconds += best;
+        return best;
+    };
+
+    std::printf("%-10s | %-32s | %-32s\n", "chunk", "marching cubes", "surface nets");
+    for (auto y = 0; y < CHUNKS_PER_AXIS; y++) {
+        for (auto x = 0; x < CHUNKS_PER_AXIS; x++) {
+            // Neighbouring chunks share their border samples
+            auto offset = glm::ivec3(x, y, 0) * (AXIS_LENGTH - 1);
+            sample_density(settings, offset, AXIS_LENGTH, grid);
+            auto overlap = surface_nets->overlap();
+            sample_density(settings, offset - glm::ivec3(overlap), AXIS_LENGTH + overlap, overlap_grid);
+
+            auto mc_ms = run(*marching_cubes, grid, marching_cubes_totals);
+            auto mc_triangles = mesh.num_triangles();
+            auto mc_vertices = mesh.vertices.size();
+            auto sn_ms = run(*surface_nets, overlap_grid, surface_nets_totals);
+
+            std::printf("%3d,%3d    | %6zu tris %6zu verts %5.1f ms | %6zu tris %6zu verts %5.1f ms\n",
+                offset.x, offset.y, mc_triangles, mc_vertices, mc_ms,
+                mesh.num_triangles(), mesh.vertices.size(), sn_ms);
+        }
+    }
+
+    auto report = [](const char* name, const Totals& totals) {
+        std::printf("%-15s %8zu triangles, %8zu shared vertices, %8zu unshared (stage 2 layout), %.1f ms\n",
+            name, totals.triangles, totals.vertices, totals.triangles * 3, totals.milliseconds);
+    };
+    report("marching cubes:", marching_cubes_totals);
+    report("surface nets:", surface_nets_totals);
+
+    return 0;
+}
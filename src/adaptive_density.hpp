@@ -0,0 +1,284 @@
+#pragma once
+
+// Adaptive_density.hpp
+//
+// Description: Coarse to fine sampling of the default terrain. The first few
+// octaves are evaluated on a lattice every ADAPTIVE_STRIDE samples, and with
+// a bound on how fast noise can change and how much the remaining octaves can
+// add, every lattice block is either proven to lie on one side of iso_level or
+// left straddling it. Straddling blocks, grown by one sample for the gradient
+// stencil, get the full octave count. Everything else is filled by trilinear
+// upsampling clamped to the proven side, which only the sign is read from, so
+// the extracted mesh is identical to one from sample_density.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "density.hpp"
+#include "density_graph.hpp"
+#include "generation_settings.hpp"
+#include "lanes.hpp"
+
+// Samples between lattice points along each axis
+constexpr auto ADAPTIVE_STRIDE = 4;
+
+// Octaves evaluated on the lattice, the rest are covered by the bound
+constexpr auto ADAPTIVE_COARSE_OCTAVES = 2;
+
+// Upper bound on the gradient length of density_graph::simplex. Sampling a
+// few million points finds about 6.1, this leaves headroom.
+constexpr auto SIMPLEX_GRADIENT_BOUND = 8.0f;
+
+struct AdaptiveSamplingStats {
+    std::size_t samples = 0;
+    std::size_t constant_samples = 0;
+    std::size_t exact_samples = 0;
+    std::size_t upsampled_samples = 0;
+    // Simplex evaluations made, and what sample_density makes for the same
+    // grid. Neither evaluates noise on constant rows.
+    std::size_t noise_calls = 0;
+    std::size_t full_noise_calls = 0;
+};
+
+// Ridged noise after the first octaves of procedural_density, with the weight
+// the next octave would be scaled by
+struct PartialRidged {
+    float noise;
+    float weight;
+};
+
+inline PartialRidged partial_ridged(const GenerationSettings& settings, glm::vec3 pos, int octaves) {
+    auto noise = 0.0f;
+    auto frequency = settings.scale / 100.0f;
+    auto amplitude = 1.0f;
+    auto weight = 1.0f;
+    for (auto octave = 0; octave < octaves; octave++) {
+        auto v = 1.0f - std::fabs(density_graph::simplex(pos.x * frequency, pos.y * frequency, pos.z * frequency));
+        v = v * v;
+        v *= weight;
+        weight = std::max(std::min(v, 1.0f), 0.0f);
+        noise += v * amplitude;
+        amplitude *= settings.persistence;
+        frequency *= settings.lacunarity;
+    }
+    return { noise, weight };
+}
+
+// How the coarse octaves bound the full density. Every later octave adds
+// between 0 and the running weight times its amplitude, and the partial sum
+// and weight change by at most their Lipschitz constant per unit of distance.
+struct RidgedBound {
+    float remaining_amplitude = 0.0f;
+    float noise_lipschitz = 0.0f;
+    float weight_lipschitz = 0.0f;
+
+    RidgedBound(const GenerationSettings& settings, int coarse_octaves) {
+        auto frequency = settings.scale / 100.0f;
+        auto amplitude = 1.0f;
+        for (auto octave = 0; octave < settings.octaves; octave++) {
+            if (octave < coarse_octaves) {
+                // v = (1 - |n|)^2 * weight, with both factors at most 1
+                auto v_lipschitz = 2.0f * SIMPLEX_GRADIENT_BOUND * frequency + weight_lipschitz;
+                noise_lipschitz += amplitude * v_lipschitz;
+                weight_lipschitz = v_lipschitz;
+            } else {
+                remaining_amplitude += amplitude;
+            }
+            amplitude *= settings.persistence;
+            frequency *= settings.lacunarity;
+        }
+    }
+
+    float lower(PartialRidged partial) const {
+        return partial.noise;
+    }
+
+    float upper(PartialRidged partial) const {
+        return partial.noise + partial.weight * remaining_amplitude;
+    }
+
+    float upper_lipschitz() const {
+        return noise_lipschitz + remaining_amplitude * weight_lipschitz;
+    }
+};
+
+// Fills grid like sample_density, exact wherever an extractor reads more than
+// the sign of a sample
+inline void sample_density_adaptive(
+    const GenerationSettings& settings,
+    glm::ivec3 offset,
+    int axis_length,
+    DensityGrid& grid,
+    AdaptiveSamplingStats* stats = nullptr
+)
+{
+    const auto coarse_octaves = std::min(ADAPTIVE_COARSE_OCTAVES, settings.octaves);
+    const auto iso_level = settings.iso_level;
+
+    grid.resize(axis_length);
+    grid.offset = offset;
+
+    auto local_stats = AdaptiveSamplingStats();
+    local_stats.samples = grid.values.size();
+
+    // Lattice points along one axis: every ADAPTIVE_STRIDE samples and the last one
+    const auto last = axis_length - 1;
+    const auto num_blocks = std::max((last + ADAPTIVE_STRIDE - 1) / ADAPTIVE_STRIDE, 1);
+    const auto lattice_length = num_blocks + 1;
+    auto lattice_coordinate = [&](int i) { return std::min(i * ADAPTIVE_STRIDE, last); };
+    auto lattice_index = [&](int x, int y, int z) { return (std::size_t(x) * lattice_length + y) * lattice_length + z; };
+
+    // Only blocks with rows between the floor and ceiling read the lattice
+    auto block_has_noise = [&](int block) {
+        auto value = 0.0f;
+        return block >= 0 && block < num_blocks &&
+            !constant_rows(float(offset.y + lattice_coordinate(block)), float(offset.y + lattice_coordinate(block + 1)), value);
+    };
+
+    auto lattice = std::vector<PartialRidged>(std::size_t(lattice_length) * lattice_length * lattice_length, PartialRidged { 0.0f, 0.0f });
+    for (auto y = 0; y < lattice_length; y++) {
+        if (!block_has_noise(y - 1) && !block_has_noise(y)) {
+            continue;
+        }
+        for (auto x = 0; x < lattice_length; x++) {
+            for (auto z = 0; z < lattice_length; z++) {
+                auto pos = glm::vec3(offset + glm::ivec3(lattice_coordinate(x), lattice_coordinate(y), lattice_coordinate(z)));
+                lattice[lattice_index(x, y, z)] = partial_ridged(settings, pos, coarse_octaves);
+            }
+        }
+        local_stats.noise_calls += std::size_t(lattice_length) * lattice_length * coarse_octaves;
+    }
+
+    // A block straddles iso_level unless its whole range of values is proven
+    // to be on one side. Straddling blocks and one sample around them are exact.
+    const auto bound = RidgedBound(settings, coarse_octaves);
+    const auto reach = std::sqrt(3.0f) * 0.5f * float(ADAPTIVE_STRIDE);
+    auto exact = std::vector<uint8_t>(grid.values.size(), 0);
+
+    for (auto bx = 0; bx < num_blocks; bx++) {
+        for (auto by = 0; by < num_blocks; by++) {
+            for (auto bz = 0; bz < num_blocks; bz++) {
+                auto low = glm::ivec3(lattice_coordinate(bx), lattice_coordinate(by), lattice_coordinate(bz));
+                auto high = glm::ivec3(lattice_coordinate(bx + 1), lattice_coordinate(by + 1), lattice_coordinate(bz + 1));
+                auto world_low_y = float(offset.y + low.y);
+                auto world_high_y = float(offset.y + high.y);
+
+                auto minimum = std::numeric_limits<float>::max();
+                auto maximum = std::numeric_limits<float>::lowest();
+                if (world_low_y < TERRAIN_FLOOR_Y) {
+                    minimum = std::min(minimum, TERRAIN_FLOOR_DENSITY);
+                    maximum = std::max(maximum, TERRAIN_FLOOR_DENSITY);
+                }
+                if (world_high_y > TERRAIN_CEILING_Y) {
+                    minimum = std::min(minimum, TERRAIN_CEILING_DENSITY);
+                    maximum = std::max(maximum, TERRAIN_CEILING_DENSITY);
+                }
+                if (world_high_y >= TERRAIN_FLOOR_Y && world_low_y <= TERRAIN_CEILING_Y) {
+                    auto noise_min = std::numeric_limits<float>::max();
+                    auto noise_max = std::numeric_limits<float>::lowest();
+                    for (auto corner = 0; corner < 8; corner++) {
+                        auto partial = lattice[lattice_index(bx + (corner & 1), by + ((corner >> 1) & 1), bz + (corner >> 2))];
+                        noise_min = std::min(noise_min, bound.lower(partial));
+                        noise_max = std::max(noise_max, bound.upper(partial));
+                    }
+                    minimum = std::min(minimum, noise_min - bound.noise_lipschitz * reach);
+                    maximum = std::max(maximum, noise_max + bound.upper_lipschitz() * reach);
+                }
+
+                if (maximum < iso_level || minimum >= iso_level) {
+                    continue;
+                }
+
+                auto grown_low = glm::max(low - 1, glm::ivec3(0));
+                auto grown_high = glm::min(high + 1, glm::ivec3(last));
+                for (auto x = grown_low.x; x <= grown_high.x; x++) {
+                    for (auto y = grown_low.y; y <= grown_high.y; y++) {
+                        auto* row = exact.data() + (std::size_t(x) * axis_length + y) * axis_length;
+                        std::fill(row + grown_low.z, row + grown_high.z + 1, uint8_t(1));
+                    }
+                }
+            }
+        }
+    }
+
+    // Rows on the floor or ceiling are constant, the rest are evaluated four
+    // samples at a time where any of them is exact and upsampled elsewhere
+    const auto graph = terrain_graph(settings);
+    const float lane_offsets[LANE_COUNT] = { 0.0f, 1.0f, 2.0f, 3.0f };
+    const auto offsets = Lanes::load(lane_offsets);
+    const auto solid_fill = std::nextafter(iso_level, std::numeric_limits<float>::lowest());
+
+    auto upsample = [&](int x, int y, int z) {
+        auto block = glm::min(glm::ivec3(x, y, z) / ADAPTIVE_STRIDE, glm::ivec3(num_blocks - 1));
+        auto low = glm::ivec3(lattice_coordinate(block.x), lattice_coordinate(block.y), lattice_coordinate(block.z));
+        auto high = glm::ivec3(lattice_coordinate(block.x + 1), lattice_coordinate(block.y + 1), lattice_coordinate(block.z + 1));
+        auto t = glm::vec3(glm::ivec3(x, y, z) - low) / glm::vec3(glm::max(high - low, glm::ivec3(1)));
+
+        auto estimate = [&](int cx, int cy, int cz) {
+            auto partial = lattice[lattice_index(block.x + cx, block.y + cy, block.z + cz)];
+            return 0.5f * (bound.lower(partial) + bound.upper(partial));
+        };
+        auto x00 = glm::mix(estimate(0, 0, 0), estimate(1, 0, 0), t.x);
+        auto x10 = glm::mix(estimate(0, 1, 0), estimate(1, 1, 0), t.x);
+        auto x01 = glm::mix(estimate(0, 0, 1), estimate(1, 0, 1), t.x);
+        auto x11 = glm::mix(estimate(0, 1, 1), estimate(1, 1, 1), t.x);
+        auto value = glm::mix(glm::mix(x00, x10, t.y), glm::mix(x01, x11, t.y), t.z);
+
+        // The block was proven to be on one side, the corner that decides it
+        // is as good as any
+        auto solid = lattice[lattice_index(block.x, block.y, block.z)].noise < iso_level;
+        return solid ? std::min(value, solid_fill) : std::max(value, iso_level);
+    };
+
+    for (auto x = 0; x < axis_length; x++) {
+        for (auto y = 0; y < axis_length; y++) {
+            auto index = (std::size_t(x) * axis_length + y) * axis_length;
+            auto* row = grid.values.data() + index;
+            const auto* row_exact = exact.data() + index;
+            auto sample_x = float(offset.x + x);
+            auto sample_y = float(offset.y + y);
+
+            auto constant = 0.0f;
+            if (constant_rows(sample_y, sample_y, constant)) {
+                std::fill(row, row + axis_length, constant);
+                local_stats.constant_samples += axis_length;
+                continue;
+            }
+            local_stats.full_noise_calls += std::size_t(axis_length) * settings.octaves;
+
+            auto z = 0;
+            for (; z + LANE_COUNT <= axis_length; z += LANE_COUNT) {
+                if (std::any_of(row_exact + z, row_exact + z + LANE_COUNT, [](uint8_t e) { return e != 0; })) {
+                    auto sample_z = Lanes(float(offset.z + z)) + offsets;
+                    graph.eval(Lanes(sample_x), Lanes(sample_y), sample_z).store(row + z);
+                    local_stats.exact_samples += LANE_COUNT;
+                    local_stats.noise_calls += LANE_COUNT * std::size_t(settings.octaves);
+                } else {
+                    for (auto lane = 0; lane < LANE_COUNT; lane++) {
+                        row[z + lane] = upsample(x, y, z + lane);
+                    }
+                    local_stats.upsampled_samples += LANE_COUNT;
+                }
+            }
+            for (; z < axis_length; z++) {
+                if (row_exact[z]) {
+                    row[z] = graph.eval(sample_x, sample_y, float(offset.z + z));
+                    local_stats.exact_samples++;
+                    local_stats.noise_calls += settings.octaves;
+                } else {
+                    row[z] = upsample(x, y, z);
+                    local_stats.upsampled_samples++;
+                }
+            }
+        }
+    }
+
+    if (stats != nullptr) {
+        *stats = local_stats;
+    }
+}
@@ -0,0 +1,178 @@
+#pragma once
+
+// Animated_region.hpp
+//
+// Description: Regenerates and remeshes a cube of animated terrain on the
+// worker threads, a new time step every frame. The density is the terrain
+// with its ridged noise taken from 4D noise, time moving along the fourth
+// axis. Meshes are double buffered, the render thread draws the front mesh
+// while the workers fill the back one and poll swaps them without waiting.
+// The animation is CPU only, the GPU stage 1 has no 4D noise.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <utility>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "density.hpp"
+#include "extractor.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
+
+class AnimatedRegion {
+public:
+    struct Stats {
+        double sample_ms = 0.0;
+        double mesh_ms = 0.0;
+        // From submit until the mesh was ready, queueing included
+        double latency_ms = 0.0;
+        uint32_t frames = 0;
+    };
+
+    AnimatedRegion(ThreadPool* pool, int axis_length) : _pool(pool), _axis_length(axis_length)
+    {
+        // A few slabs per worker evens out slabs with more surface than others
+        _num_slabs = std::max<std::size_t>(1, std::min<std::size_t>(_pool->size() * 4, std::size_t(axis_length - 1)));
+        _extractors.resize(_num_slabs);
+        _slab_meshes.resize(_num_slabs);
+    }
+
+    AnimatedRegion(const AnimatedRegion&) = delete;
+    AnimatedRegion& operator=(const AnimatedRegion&) = delete;
+
+    // The job writes into members
+    ~AnimatedRegion() {
+        if (_job.valid()) {
+            _job.wait();
+        }
+    }
+
+    int axis_length() const {
+        return _axis_length;
+    }
+
+    // Starts building the region at origin at time unless the last one is
+    // still building. Returns whether it started.
+    bool submit(const GenerationSettings& settings, glm::ivec3 origin, float time) {
+        if (_job.valid()) {
+            return false;
+        }
+
+        auto submitted = std::chrono::high_resolution_clock::now();
+        _job = _pool->submit([this, settings, origin, time, submitted] {
+            build(settings, origin, time);
+            auto end = std::chrono::high_resolution_clock::now();
+            _back_stats.latency_ms = std::chrono::duration<double, std::milli>(end - submitted).count();
+        });
+        return true;
+    }
+
+    // Swaps in the mesh of a finished build, true when front changed. Never
+    // waits for one still building.
+    bool poll() {
+        if (!_job.valid() || _job.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            return false;
+        }
+        swap();
+        return true;
+    }
+
+    // Blocks until the build in flight is done and swaps it in
+    bool wait() {
+        if (!_job.valid()) {
+            return false;
+        }
+        _job.wait();
+        swap();
+        return true;
+    }
+
+    const ExtractedMesh& front() const {
+        return _front;
+    }
+
+    // Of the build now in front
+    const Stats& stats() const {
+        return _stats;
+    }
+
+private:
+    void swap() {
+        _job.get();
+        std::swap(_front, _back);
+        _back_stats.frames = _stats.frames + 1;
+        _stats = _back_stats;
+    }
+
+    int slab_begin(std::size_t slab, int count) const {
+        return int(std::size_t(count) * slab / _num_slabs);
+    }
+
+    void build(const GenerationSettings& settings, glm::ivec3 origin, float time) {
+        TRACE_ZONE("AnimatedRegion::build");
+        auto start = std::chrono::high_resolution_clock::now();
+
+        _grid.resize(_axis_length);
+        _grid.offset = origin;
+        auto graph = animated_terrain_graph(settings, time);
+        _pool->parallel_for(_num_slabs, [&](std::size_t slab) {
+            density_graph::evaluate(graph, origin, _axis_length,
+                slab_begin(slab, _axis_length), slab_begin(slab + 1, _axis_length), _grid.values.data());
+        });
+        auto sampled = std::chrono::high_resolution_clock::now();
+
+        // Slabs of cells read one sample past their end, so sampling is done
+        // before any of them start
+        auto cells = _axis_length - 1;
+        _pool->parallel_for(_num_slabs, [&](std::size_t slab) {
+            _extractors[slab].extract_cells(_grid, settings.iso_level,
+                slab_begin(slab, cells), slab_begin(slab + 1, cells), _slab_meshes[slab]);
+        });
+
+        // Joined into one mesh for a single draw
+        _vertex_offsets.resize(_num_slabs + 1);
+        _index_offsets.resize(_num_slabs + 1);
+        _vertex_offsets[0] = 0;
+        _index_offsets[0] = 0;
+        for (auto slab = std::size_t(0); slab < _num_slabs; slab++) {
+            _vertex_offsets[slab + 1] = _vertex_offsets[slab] + _slab_meshes[slab].vertices.size();
+            _index_offsets[slab + 1] = _index_offsets[slab] + _slab_meshes[slab].indices.size();
+        }
+        _back.vertices.resize(_vertex_offsets[_num_slabs]);
+        _back.indices.resize(_index_offsets[_num_slabs]);
+        _pool->parallel_for(_num_slabs, [&](std::size_t slab) {
+            const auto& mesh = _slab_meshes[slab];
+            std::copy(mesh.vertices.begin(), mesh.vertices.end(), _back.vertices.begin() + _vertex_offsets[slab]);
+            auto first = uint32_t(_vertex_offsets[slab]);
+            auto* indices = _back.indices.data() + _index_offsets[slab];
+            for (auto i = std::size_t(0); i < mesh.indices.size(); i++) {
+                indices[i] = mesh.indices[i] + first;
+            }
+        });
+
+        auto end = std::chrono::high_resolution_clock::now();
+        _back_stats.sample_ms = std::chrono::duration<double, std::milli>(sampled - start).count();
+        _back_stats.mesh_ms = std::chrono::duration<double, std::milli>(end - sampled).count();
+    }
+
+    ThreadPool* _pool;
+    int _axis_length;
+    std::size_t _num_slabs = 1;
+
+    // Only the job touches these while it runs
+    DensityGrid _grid;
+    std::vector<MarchingCubesExtractor> _extractors;
+    std::vector<ExtractedMesh> _slab_meshes;
+    std::vector<std::size_t> _vertex_offsets;
+    std::vector<std::size_t> _index_offsets;
+    ExtractedMesh _back;
+    Stats _back_stats;
+
+    ExtractedMesh _front;
+    Stats _stats;
+    std::future<void> _job;
+};
@@ -0,0 +1,428 @@
+#pragma once
+
+// ArenaAllocator.hpp
+//
+// Description: Two-level segregated fit (TLSF) allocator over an abstract range
+// of units, plus stable handles and incremental compaction on top of it. No GL
+// in here, the GPU side lives in mesh_arena.hpp.
+
+#include <cstdint>
+#include <vector>
+
+class TlsfAllocator {
+public:
+    static constexpr uint32_t INVALID = ~0u;
+
+    explicit TlsfAllocator(uint32_t capacity) : _capacity(0) {
+        for (auto& row : _heads) {
+            for (auto& head : row) {
+                head = INVALID;
+            }
+        }
+        grow(capacity);
+    }
+
+    uint32_t capacity() const {
+        return _capacity;
+    }
+
+    uint32_t used() const {
+        return _used;
+    }
+
+    uint32_t offset(uint32_t block) const {
+        return _blocks[block].offset;
+    }
+
+    uint32_t size(uint32_t block) const {
+        return _blocks[block].size;
+    }
+
+    uint32_t user(uint32_t block) const {
+        return _blocks[block].user;
+    }
+
+    // Good fit in O(1), returns a block id or INVALID when no free block is large enough
+    uint32_t allocate(uint32_t size, uint32_t user = 0) {
+        if (size == 0) {
+            return INVALID;
+        }
+
+        auto block = find_free(size);
+        if (block == INVALID) {
+            return INVALID;
+        }
+
+        remove_free(block);
+        return take(block, size, user);
+    }
+
+    // Lowest addressed free block that fits entirely below limit, used by compaction
+    uint32_t allocate_lowest(uint32_t size, uint32_t limit, uint32_t user = 0) {
+        for (auto block = _first; block != INVALID; block = _blocks[block].next_physical) {
+            const auto& candidate = _blocks[block];
+            if (candidate.offset + size > limit) {
+                return INVALID;
+            }
+
+            if (candidate.free && candidate.size >= size) {
+                remove_free(block);
+                return take(block, size, user);
+            }
+        }
+
+        return INVALID;
+    }
+
+    void free(uint32_t block) {
+        _used -= _blocks[block].size;
+        _blocks[block].free = true;
+
+        auto previous = _blocks[block].prev_physical;
+        if (previous != INVALID && _blocks[previous].free) {
+            remove_free(previous);
+            block = merge(previous, block);
+        }
+
+        auto next = _blocks[block].next_physical;
+        if (next != INVALID && _blocks[next].free) {
+            remove_free(next);
+            block = merge(block, next);
+        }
+
+        insert_free(block);
+    }
+
+    // Extends the range, existing offsets stay valid
+    void grow(uint32_t capacity) {
+        if (capacity <= _capacity) {
+            return;
+        }
+
+        auto extra = capacity - _capacity;
+        if (_last != INVALID && _blocks[_last].free) {
+            remove_free(_last);
+            _blocks[_last].size += extra;
+            insert_free(_last);
+        } else {
+            auto block = new_block(_capacity, extra);
+            _blocks[block].prev_physical = _last;
+            if (_last != INVALID) {
+                _blocks[_last].next_physical = block;
+            } else {
+                _first = block;
+            }
+            _last = block;
+            insert_free(block);
+        }
+
+        _capacity = capacity;
+    }
+
+    uint32_t largest_free() const {
+        auto largest = 0u;
+        for (auto block = _first; block != INVALID; block = _blocks[block].next_physical) {
+            if (_blocks[block].free && _blocks[block].size > largest) {
+                largest = _blocks[block].size;
+            }
+        }
+        return largest;
+    }
+
+    // Highest addressed allocated block whose offset is below limit
+    uint32_t last_used(uint32_t limit = INVALID) const {
+        for (auto block = _last; block != INVALID; block = _blocks[block].prev_physical) {
+            if (!_blocks[block].free && _blocks[block].offset < limit) {
+                return block;
+            }
+        }
+        return INVALID;
+    }
+
+private:
+    static constexpr uint32_t SL_LOG2 = 4;
+    static constexpr uint32_t SL_COUNT = 1 << SL_LOG2;
+    static constexpr uint32_t FL_COUNT = 32;
+
+    struct Block {
+        uint32_t offset;
+        uint32_t size;
+        uint32_t user;
+        uint32_t prev_physical;
+        uint32_t next_physical;
+        uint32_t prev_free;
+        uint32_t next_free;
+        bool free;
+    };
+
+    static uint32_t find_last_set(uint32_t value) {
+        auto bit = 0u;
+        while (value >>= 1) {
+            bit++;
+        }
+        return bit;
+    }
+
+    static uint32_t find_first_set(uint32_t value) {
+        auto bit = 0u;
+        while (!(value & 1)) {
+            value >>= 1;
+            bit++;
+        }
+        return bit;
+    }
+
+    // Sizes below SL_COUNT get one list each, above that every power of two
+    // range is split into SL_COUNT linear steps
+    static void mapping(uint32_t size, uint32_t& fl, uint32_t& sl) {
+        if (size < SL_COUNT) {
+            fl = 0;
+            sl = size;
+        } else {
+            auto last_set = find_last_set(size);
+            sl = (size >> (last_set - SL_LOG2)) ^ SL_COUNT;
+            fl = last_set - SL_LOG2 + 1;
+        }
+    }
+
+    uint32_t find_free(uint32_t size) const {
+        // Round up to the next list so any block found is large enough
+        if (size >= SL_COUNT) {
+            auto round = (1u << (find_last_set(size) - SL_LOG2)) - 1;
+            if (size > ~0u - round) {
+                return INVALID;
+            }
+            size += round;
+        }
+
+        uint32_t fl, sl;
+        mapping(size, fl, sl);
+
+        auto sl_map = _sl_bitmap[fl] & (~0u << sl);
+        if (!sl_map) {
+            auto fl_map = fl + 1 < FL_COUNT ? _fl_bitmap & (~0u << (fl + 1)) : 0u;
+            if (!fl_map) {
+                return INVALID;
+            }
+            fl = find_first_set(fl_map);
+            sl_map = _sl_bitmap[fl];
+        }
+
+        return _heads[fl][find_first_set(sl_map)];
+    }
+
+    uint32_t take(uint32_t block, uint32_t size, uint32_t user) {
+        // Give the tail back to the free lists
+        if (_blocks[block].size > size) {
+            auto remainder = new_block(_blocks[block].offset + size, _blocks[block].size - size);
+            _blocks[remainder].prev_physical = block;
+            _blocks[remainder].next_physical = _blocks[block].next_physical;
+            if (_blocks[block].next_physical != INVALID) {
+                _blocks[_blocks[block].next_physical].prev_physical = remainder;
+            } else {
+                _last = remainder;
+            }
+            _blocks[block].next_physical = remainder;
+            _blocks[block].size = size;
+            insert_free(remainder);
+        }
+
+        _blocks[block].free = false;
+        _blocks[block].user = user;
+        _used += size;
+        return block;
+    }
+
+    // Folds second into first, both must already be off the free lists
+    uint32_t merge(uint32_t first, uint32_t second) {
+        _blocks[first].size += _blocks[second].size;
+        _blocks[first].next_physical = _blocks[second].next_physical;
+        if (_blocks[second].next_physical != INVALID) {
+            _blocks[_blocks[second].next_physical].prev_physical = first;
+        } else {
+            _last = first;
+        }
+        _unused_blocks.push_back(second);
+        return first;
+    }
+
+    void insert_free(uint32_t block) {
+        uint32_t fl, sl;
+        mapping(_blocks[block].size, fl, sl);
+
+        auto& head = _heads[fl][sl];
+        _blocks[block].free = true;
+        _blocks[block].prev_free = INVALID;
+        _blocks[block].next_free = head;
+        if (head != INVALID) {
+            _blocks[head].prev_free = block;
+        }
+        head = block;
+
+        _fl_bitmap |= 1u << fl;
+        _sl_bitmap[fl] |= 1u << sl;
+    }
+
+    void remove_free(uint32_t block) {
+        uint32_t fl, sl;
+        mapping(_blocks[block].size, fl, sl);
+
+        auto previous = _blocks[block].prev_free;
+        auto next = _blocks[block].next_free;
+        if (previous != INVALID) {
+            _blocks[previous].next_free = next;
+        } else {
+            _heads[fl][sl] = next;
+        }
+        if (next != INVALID) {
+            _blocks[next].prev_free = previous;
+        }
+
+        if (_heads[fl][sl] == INVALID) {
+            _sl_bitmap[fl] &= ~(1u << sl);
+            if (!_sl_bitmap[fl]) {
+                _fl_bitmap &= ~(1u << fl);
+            }
+        }
+    }
+
+    uint32_t new_block(uint32_t offset, uint32_t size) {
+        auto block = Block { offset, size, 0, INVALID, INVALID, INVALID, INVALID, true };
+        if (!_unused_blocks.empty()) {
+            auto index = _unused_blocks.back();
+            _unused_blocks.pop_back();
+            _blocks[index] = block;
+            return index;
+        }
+
+        _blocks.push_back(block);
+        return uint32_t(_blocks.size() - 1);
+    }
+
+    uint32_t _capacity;
+    uint32_t _used = 0;
+    uint32_t _first = INVALID;
+    uint32_t _last = INVALID;
+    uint32_t _fl_bitmap = 0;
+    uint32_t _sl_bitmap[FL_COUNT] = {};
+    uint32_t _heads[FL_COUNT][SL_COUNT];
+    std::vector<Block> _blocks;
+    std::vector<uint32_t> _unused_blocks;
+};
+
+// Hands out stable handles so compaction can move allocations underneath their owners
+class ArenaAllocator {
+public:
+    using Handle = uint32_t;
+    static constexpr Handle INVALID_HANDLE = ~0u;
+
+    // A copy the owner of the backing storage must perform, in order
+    struct Move {
+        uint32_t source;
+        uint32_t destination;
+        uint32_t size;
+    };
+
+    struct Stats {
+        uint32_t capacity;
+        uint32_t used;
+        uint32_t largest_free;
+        uint32_t allocations;
+    };
+
+    explicit ArenaAllocator(uint32_t capacity) : _allocator(capacity) {}
+
+    Handle allocate(uint32_t size) {
+        auto handle = INVALID_HANDLE;
+        if (!_unused_handles.empty()) {
+            handle = _unused_handles.back();
+        } else {
+            handle = Handle(_handle_blocks.size());
+        }
+
+        auto block = _allocator.allocate(size, handle);
+        if (block == TlsfAllocator::INVALID) {
+            return INVALID_HANDLE;
+        }
+
+        if (!_unused_handles.empty()) {
+            _unused_handles.pop_back();
+            _handle_blocks[handle] = block;
+        } else {
+            _handle_blocks.push_back(block);
+        }
+        _allocations++;
+        return handle;
+    }
+
+    void free(Handle handle) {
+        _allocator.free(_handle_blocks[handle]);
+        _handle_blocks[handle] = TlsfAllocator::INVALID;
+        _unused_handles.push_back(handle);
+        _allocations--;
+    }
+
+    uint32_t offset(Handle handle) const {
+        return _allocator.offset(_handle_blocks[handle]);
+    }
+
+    uint32_t size(Handle handle) const {
+        return _allocator.size(_handle_blocks[handle]);
+    }
+
+    void grow(uint32_t capacity) {
+        _allocator.grow(capacity);
+    }
+
+    uint32_t capacity() const {
+        return _allocator.capacity();
+    }
+
+    Stats stats() const {
+        return Stats { _allocator.capacity(), _allocator.used(), _allocator.largest_free(), _allocations };
+    }
+
+    // Moves allocations from the end of the range into the lowest holes that
+    // fit, up to max_units per call so it can run a little every frame
+    std::vector<Move> compact(uint32_t max_units) {
+        std::vector<Move> moves;
+
+        // Bounds the linear searches when the tail is made of immovable allocations
+        constexpr auto MAX_FAILED_ATTEMPTS = 64;
+
+        auto limit = TlsfAllocator::INVALID;
+        auto moved = 0u;
+        auto failed_attempts = 0;
+        while (moved < max_units && failed_attempts < MAX_FAILED_ATTEMPTS) {
+            auto block = _allocator.last_used(limit);
+            if (block == TlsfAllocator::INVALID) {
+                break;
+            }
+
+            auto handle = _allocator.user(block);
+            auto size = _allocator.size(block);
+            auto source = _allocator.offset(block);
+
+            auto destination = _allocator.allocate_lowest(size, source, handle);
+            if (destination == TlsfAllocator::INVALID) {
+                // Nothing fits below this one, try the next allocation down
+                limit = source;
+                failed_attempts++;
+                continue;
+            }
+
+            moves.push_back(Move { source, _allocator.offset(destination), size });
+            _handle_blocks[handle] = destination;
+            _allocator.free(block);
+            moved += size;
+        }
+
+        return moves;
+    }
+
+private:
+    TlsfAllocator _allocator;
+    std::vector<uint32_t> _handle_blocks;
+    std::vector<Handle> _unused_handles;
+    uint32_t _allocations = 0;
+};
@@ -0,0 +1,209 @@
+#pragma once
+
+// Bitplanes.hpp
+//
+// Description: Marching cubes classification 64 cells at a time. Each row of
+// samples along z is thresholded against the iso level into sign bits, and
+// the corner bits of 64 neighbouring cells are then the four rows around them
+// shifted by nothing or one. Cells with every corner on one side drop out with
+// a few ANDs and ORs, and the active ones are visited with a bit scan. Several
+// iso levels are thresholded from one read of each row, and the sample range
+// of each word lets a level skip its 64 cells without building their corners.
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "lanes.hpp"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Index of the lowest set bit, bits must not be 0
+inline int lowest_bit(uint64_t bits) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, bits);
+    return int(index);
+#else
+    return __builtin_ctzll(bits);
+#endif
+}
+
+// Sign bits of one x plane of samples. Bit i of word w of row y is set when
+// sample (y, 64w + i) is below the iso level, solid like a set cube index bit.
+struct SignPlane {
+    int axis_length = 0;
+    int words_per_row = 0;
+    std::vector<uint64_t> bits;
+
+    void resize(int length) {
+        axis_length = length;
+        words_per_row = (length + 63) / 64;
+        bits.assign(std::size_t(words_per_row) * length, 0);
+    }
+
+    const uint64_t* row(int y) const {
+        return bits.data() + std::size_t(y) * words_per_row;
+    }
+
+    // Samples is anything with row(x, y) giving axis_length contiguous
+    // samples along z, like DensityGrid
+    template<typename Samples>
+    void threshold(const Samples& samples, int x, float iso_level) {
+        for (auto y = 0; y < axis_length; y++) {
+            const auto* values = samples.row(x, y);
+            auto* words = bits.data() + std::size_t(y) * words_per_row;
+            for (auto w = 0; w < words_per_row; w++) {
+                words[w] = threshold_word(values + w * 64, std::min(64, axis_length - w * 64), iso_level);
+            }
+        }
+    }
+
+private:
+    static uint64_t threshold_word(const float* values, int count, float iso_level) {
+        auto word = uint64_t(0);
+        auto i = 0;
+#if MC_LANES_SSE
+        const auto iso = _mm_set1_ps(iso_level);
+        for (; i + 4 <= count; i += 4) {
+            auto less = _mm_movemask_ps(_mm_cmplt_ps(_mm_loadu_ps(values + i), iso));
+            word |= uint64_t(less) << i;
+        }
+#endif
+        for (; i < count; i++) {
+            word |= uint64_t(values[i] < iso_level) << i;
+        }
+        return word;
+    }
+};
+
+// Lowest and highest sample under each word of one x plane of samples, the
+// word's 64 and the first of the next word, which its last cell reaches
+struct RangePlane {
+    int axis_length = 0;
+    int words_per_row = 0;
+    std::vector<float> lowest;
+    std::vector<float> highest;
+
+    void resize(int length) {
+        axis_length = length;
+        words_per_row = (length + 63) / 64;
+        lowest.assign(std::size_t(words_per_row) * length, 0.0f);
+        highest.assign(std::size_t(words_per_row) * length, 0.0f);
+    }
+
+    std::size_t index(int y, int w) const {
+        return std::size_t(y) * words_per_row + w;
+    }
+};
+
+// Thresholds plane x of samples against num_levels iso levels into
+// planes[0..num_levels) and records its ranges, reading each sample once
+template<typename Samples>
+inline void threshold_levels(
+    const Samples& samples,
+    int x,
+    const float* iso_levels,
+    std::size_t num_levels,
+    SignPlane* planes,
+    RangePlane& ranges
+)
+{
+    const auto length = ranges.axis_length;
+    for (auto y = 0; y < length; y++) {
+        const auto* values = samples.row(x, y);
+        for (auto w = 0; w < ranges.words_per_row; w++) {
+            const auto* word_values = values + w * 64;
+            const auto count = std::min(64, length - w * 64);
+            const auto word = std::size_t(y) * planes[0].words_per_row + w;
+            for (auto level = std::size_t(0); level < num_levels; level++) {
+                planes[level].bits[word] = 0;
+            }
+
+            auto lowest = std::numeric_limits<float>::max();
+            auto highest = std::numeric_limits<float>::lowest();
+            auto i = 0;
+#if MC_LANES_SSE
+            auto low = _mm_set1_ps(lowest);
+            auto high = _mm_set1_ps(highest);
+            for (; i + 4 <= count; i += 4) {
+                auto v = _mm_loadu_ps(word_values + i);
+                low = _mm_min_ps(low, v);
+                high = _mm_max_ps(high, v);
+                for (auto level = std::size_t(0); level < num_levels; level++) {
+                    auto less = _mm_movemask_ps(_mm_cmplt_ps(v, _mm_set1_ps(iso_levels[level])));
+                    planes[level].bits[word] |= uint64_t(less) << i;
+                }
+            }
+            float lanes[4];
+            _mm_storeu_ps(lanes, low);
+            lowest = std::min(std::min(lanes[0], lanes[1]), std::min(lanes[2], lanes[3]));
+            _mm_storeu_ps(lanes, high);
+            highest = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+#endif
+            for (; i < count; i++) {
+                lowest = std::min(lowest, word_values[i]);
+                highest = std::max(highest, word_values[i]);
+                for (auto level = std::size_t(0); level < num_levels; level++) {
+                    planes[level].bits[word] |= uint64_t(word_values[i] < iso_levels[level]) << i;
+                }
+            }
+            if (count == 64 && w * 64 + 64 < length) {
+                lowest = std::min(lowest, word_values[64]);
+                highest = std::max(highest, word_values[64]);
+            }
+            ranges.lowest[ranges.index(y, w)] = lowest;
+            ranges.highest[ranges.index(y, w)] = highest;
+        }
+    }
+}
+
+// Calls visit(z, cube_index) in z order for every cell of word w between
+// rows y and y + 1 of planes low and high, the planes at x and x + 1, that
+// has corners on both sides of the iso level
+template<typename Visit>
+inline void for_each_active_cell_in_word(const SignPlane& low, const SignPlane& high, int y, int w, Visit&& visit) {
+    const auto words = low.words_per_row;
+    const auto num_cells = low.axis_length - 1;
+    const auto* low_y = low.row(y);
+    const auto* high_y = high.row(y);
+    const auto* low_y1 = low.row(y + 1);
+    const auto* high_y1 = high.row(y + 1);
+
+    // The next sample along z for all 64 cells, bit 0 of the next word
+    // moving in at the top
+    auto next = [words, w](const uint64_t* row) {
+        return (row[w] >> 1) | (w + 1 < words ? row[w + 1] << 63 : 0);
+    };
+
+    // In CORNER_OFFSETS order
+    const uint64_t corners[8] = {
+        low_y[w], high_y[w], next(high_y), next(low_y),
+        low_y1[w], high_y1[w], next(high_y1), next(low_y1)
+    };
+    auto all = corners[0] & corners[1] & corners[2] & corners[3] & corners[4] & corners[5] & corners[6] & corners[7];
+    auto any = corners[0] | corners[1] | corners[2] | corners[3] | corners[4] | corners[5] | corners[6] | corners[7];
+    auto cells = num_cells - w * 64;
+    auto active = (any & ~all) & (cells >= 64 ? ~uint64_t(0) : (uint64_t(1) << cells) - 1);
+
+    while (active != 0) {
+        auto bit = lowest_bit(active);
+        auto cube_index = 0;
+        for (auto corner = 0; corner < 8; corner++) {
+            cube_index |= int((corners[corner] >> bit) & 1) << corner;
+        }
+        visit(w * 64 + bit, cube_index);
+        active &= active - 1;
+    }
+}
+
+// Every word of rows y and y + 1
+template<typename Visit>
+inline void for_each_active_cell(const SignPlane& low, const SignPlane& high, int y, Visit&& visit) {
+    for (auto w = 0; w < low.words_per_row && w * 64 < low.axis_length - 1; w++) {
+        for_each_active_cell_in_word(low, high, y, w, visit);
+    }
+}
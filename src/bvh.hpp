@@ -0,0 +1,762 @@
+#pragma once
+
+// Bvh.hpp
+//
+// Description: Bounding volume hierarchies for ray queries against the
+// terrain. A binned SAH builder writes nodes depth first into a flat array,
+// TriangleBvh holds one chunk's triangles and WorldBvh puts a small tree over
+// the chunks, builds chunk trees on worker threads and installs them when
+// they are done. Rays are traced one at a time or in packets of 4 or 8.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <future>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "frustum.hpp"
+#include "lanes.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
+
+constexpr auto BVH_BINS = 12;
+constexpr auto BVH_MAX_LEAF_PRIMITIVES = 4u;
+constexpr auto BVH_INVALID = ~0u;
+
+// Nodes this deep are split at the centroid median instead of by SAH. Halving
+// reaches a leaf within 31 more levels for any primitive count, so no leaf is
+// deeper than BVH_STACK_SIZE - 1 and the fixed traversal stacks cannot
+// overflow.
+constexpr auto BVH_MEDIAN_DEPTH = 32u;
+constexpr auto BVH_STACK_SIZE = 64;
+
+// 32 bytes, two to a cache line. The left child of an inner node directly
+// follows it, offset holds the right child. Leaves hold count primitives
+// from offset in the primitive order.
+struct BvhNode {
+    glm::vec3 min;
+    uint32_t offset;
+    glm::vec3 max;
+    uint16_t count;
+    uint16_t axis;
+
+    bool is_leaf() const {
+        return count != 0;
+    }
+};
+
+static_assert(sizeof(BvhNode) == 32, "BvhNode should stay 32 bytes");
+
+struct Ray {
+    glm::vec3 origin;
+    glm::vec3 direction;
+    float t_max = std::numeric_limits<float>::max();
+};
+
+struct RayHit {
+    float t = std::numeric_limits<float>::max();
+    uint32_t chunk = BVH_INVALID;
+    uint32_t triangle = BVH_INVALID;
+
+    bool hit() const {
+        return triangle != BVH_INVALID;
+    }
+};
+
+// Width rays side by side in groups of LANE_COUNT
+template<int Width>
+struct RayPacket {
+    static_assert(Width % LANE_COUNT == 0, "Packets are whole lane groups");
+    static constexpr int GROUPS = Width / LANE_COUNT;
+
+    Lanes origin[3][GROUPS];
+    Lanes inverse_direction[3][GROUPS];
+    Lanes direction[3][GROUPS];
+    Lanes t[GROUPS];
+    uint32_t chunk[Width];
+    uint32_t triangle[Width];
+
+    explicit RayPacket(const Ray* rays) {
+        for (auto axis = 0; axis < 3; axis++) {
+            for (auto group = 0; group < GROUPS; group++) {
+                float origins[LANE_COUNT], directions[LANE_COUNT], inverses[LANE_COUNT];
+                for (auto lane = 0; lane < LANE_COUNT; lane++) {
+                    const auto& ray = rays[group * LANE_COUNT + lane];
+                    origins[lane] = ray.origin[axis];
+                    directions[lane] = ray.direction[axis];
+                    inverses[lane] = 1.0f / ray.direction[axis];
+                }
+                origin[axis][group] = Lanes::load(origins);
+                direction[axis][group] = Lanes::load(directions);
+                inverse_direction[axis][group] = Lanes::load(inverses);
+            }
+        }
+        for (auto group = 0; group < GROUPS; group++) {
+            float t_max[LANE_COUNT];
+            for (auto lane = 0; lane < LANE_COUNT; lane++) {
+                t_max[lane] = rays[group * LANE_COUNT + lane].t_max;
+            }
+            t[group] = Lanes::load(t_max);
+        }
+        std::fill(chunk, chunk + Width, BVH_INVALID);
+        std::fill(triangle, triangle + Width, BVH_INVALID);
+    }
+
+    RayHit hit(int ray) const {
+        float t_values[LANE_COUNT];
+        t[ray / LANE_COUNT].store(t_values);
+        return RayHit { t_values[ray % LANE_COUNT], chunk[ray], triangle[ray] };
+    }
+};
+
+namespace bvh_detail {
+    inline float half_area(const BoundingBox& box) {
+        auto extent = box.max - box.min;
+        return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+    }
+
+    // Entry and exit distance of one ray through a node, a miss when entry > exit
+    inline bool intersects(const BvhNode& node, glm::vec3 origin, glm::vec3 inverse_direction, float t_max, float& entry) {
+        auto t0 = (node.min - origin) * inverse_direction;
+        auto t1 = (node.max - origin) * inverse_direction;
+        auto near = glm::min(t0, t1);
+        auto far = glm::max(t0, t1);
+        entry = std::max(std::max(near.x, near.y), std::max(near.z, 0.0f));
+        auto exit = std::min(std::min(far.x, far.y), std::min(far.z, t_max));
+        return entry <= exit;
+    }
+
+    // Whether any ray of the packet passes through the node
+    template<int Width>
+    bool intersects(const BvhNode& node, const RayPacket<Width>& packet) {
+        for (auto group = 0; group < RayPacket<Width>::GROUPS; group++) {
+            auto entry = Lanes(0.0f);
+            auto exit = packet.t[group];
+            for (auto axis = 0; axis < 3; axis++) {
+                auto t0 = (Lanes(node.min[axis]) - packet.origin[axis][group]) * packet.inverse_direction[axis][group];
+                auto t1 = (Lanes(node.max[axis]) - packet.origin[axis][group]) * packet.inverse_direction[axis][group];
+                entry = lane_max(entry, lane_min(t0, t1));
+                exit = lane_min(exit, lane_max(t0, t1));
+            }
+            if (!lane_all_less(exit, entry)) {
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+// Binned SAH over primitive boxes. Fills nodes depth first and order with
+// the primitive index of each leaf slot.
+inline void build_bvh(
+    const std::vector<BoundingBox>& boxes,
+    const std::vector<glm::vec3>& centroids,
+    std::vector<BvhNode>& nodes,
+    std::vector<uint32_t>& order
+)
+{
+    nodes.clear();
+    order.resize(boxes.size());
+    for (auto i = 0u; i < order.size(); i++) {
+        order[i] = i;
+    }
+    if (boxes.empty()) {
+        return;
+    }
+    nodes.reserve(2 * boxes.size() / BVH_MAX_LEAF_PRIMITIVES + 1);
+
+    struct Bin {
+        BoundingBox box;
+        uint32_t count = 0;
+    };
+
+    // A right child tells its parent where it ended up
+    struct Task {
+        uint32_t parent;
+        uint32_t first;
+        uint32_t count;
+        uint32_t depth;
+    };
+
+    // Explicit stack. Nodes are appended as they are taken off it, so a left
+    // child lands right after its parent and right subtrees follow the
+    // whole left one.
+    auto tasks = std::vector<Task>();
+    tasks.push_back(Task { BVH_INVALID, 0, uint32_t(boxes.size()), 0 });
+
+    while (!tasks.empty()) {
+        auto task = tasks.back();
+        tasks.pop_back();
+
+        auto node = uint32_t(nodes.size());
+        nodes.emplace_back();
+        if (task.parent != BVH_INVALID) {
+            nodes[task.parent].offset = node;
+        }
+
+        auto bounds = BoundingBox();
+        auto centroid_bounds = BoundingBox();
+        for (auto i = task.first; i < task.first + task.count; i++) {
+            bounds.expand(boxes[order[i]]);
+            centroid_bounds.expand(centroids[order[i]]);
+        }
+
+        auto make_leaf = [&] {
+            nodes[node] = BvhNode { bounds.min, task.first, bounds.max, uint16_t(task.count), 0 };
+        };
+
+        if (task.count <= BVH_MAX_LEAF_PRIMITIVES) {
+            make_leaf();
+            continue;
+        }
+
+        // Cheapest split plane over all axes, cost in primitives times area
+        auto best_cost = std::numeric_limits<float>::max();
+        auto best_axis = -1;
+        auto best_split = 0;
+        const auto median = task.depth >= BVH_MEDIAN_DEPTH;
+        for (auto axis = 0; axis < 3 && !median; axis++) {
+            auto low = centroid_bounds.min[axis];
+            auto extent = centroid_bounds.max[axis] - low;
+            if (extent <= 0.0f) {
+                continue;
+            }
+
+            Bin bins[BVH_BINS];
+            auto scale = BVH_BINS / extent;
+            for (auto i = task.first; i < task.first + task.count; i++) {
+                auto bin = std::min(BVH_BINS - 1, int((centroids[order[i]][axis] - low) * scale));
+                bins[bin].count++;
+                bins[bin].box.expand(boxes[order[i]]);
+            }
+
+            // Right to left sweep first, then left to right
+            float right_cost[BVH_BINS];
+            auto right = BoundingBox();
+            auto right_count = 0u;
+            for (auto bin = BVH_BINS - 1; bin > 0; bin--) {
+                right.expand(bins[bin].box);
+                right_count += bins[bin].count;
+                right_cost[bin] = right_count == 0 ? 0.0f : bvh_detail::half_area(right) * right_count;
+            }
+
+            auto left = BoundingBox();
+            auto left_count = 0u;
+            for (auto split = 1; split < BVH_BINS; split++) {
+                left.expand(bins[split - 1].box);
+                left_count += bins[split - 1].count;
+                if (left_count == 0 || left_count == task.count) {
+                    continue;
+                }
+                auto cost = bvh_detail::half_area(left) * left_count + right_cost[split];
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_split = split;
+                }
+            }
+        }
+
+        // A leaf beats splitting when intersecting everything is cheaper than
+        // one more traversal step, unless the leaf would get too large
+        auto leaf_cost = bvh_detail::half_area(bounds) * task.count;
+        auto traversal_cost = bvh_detail::half_area(bounds);
+        auto small = task.count <= 2 * BVH_MAX_LEAF_PRIMITIVES;
+        if (small && (best_axis < 0 || best_cost + traversal_cost >= leaf_cost)) {
+            make_leaf();
+            continue;
+        }
+
+        // Centroids all in one point cannot be split by position, halve them
+        // instead so leaf counts stay small
+        auto left_count = task.count / 2;
+        if (median) {
+            auto extent = centroid_bounds.max - centroid_bounds.min;
+            best_axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : extent.y >= extent.z ? 1 : 2;
+            std::nth_element(order.begin() + task.first, order.begin() + task.first + left_count, order.begin() + task.first + task.count,
+                [&](uint32_t a, uint32_t b) { return centroids[a][best_axis] < centroids[b][best_axis]; });
+        } else if (best_axis >= 0) {
+            auto low = centroid_bounds.min[best_axis];
+            auto scale = BVH_BINS / (centroid_bounds.max[best_axis] - low);
+            auto middle = std::partition(order.begin() + task.first, order.begin() + task.first + task.count, [&](uint32_t primitive) {
+                return std::min(BVH_BINS - 1, int((centroids[primitive][best_axis] - low) * scale)) < best_split;
+            });
+            left_count = uint32_t(middle - (order.begin() + task.first));
+        }
+
+        nodes[node] = BvhNode { bounds.min, BVH_INVALID, bounds.max, 0, uint16_t(std::max(best_axis, 0)) };
+        tasks.push_back(Task { node, task.first + left_count, task.count - left_count, task.depth + 1 });
+        tasks.push_back(Task { BVH_INVALID, task.first, left_count, task.depth + 1 });
+    }
+}
+
+// Recomputes node boxes from the primitive boxes, children always come
+// after their parent so one backwards pass is enough
+inline void refit_bvh(const std::vector<BoundingBox>& boxes, const std::vector<uint32_t>& order, std::vector<BvhNode>& nodes) {
+    for (auto index = nodes.size(); index-- > 0;) {
+        auto& node = nodes[index];
+        auto bounds = BoundingBox();
+        if (node.is_leaf()) {
+            for (auto i = node.offset; i < node.offset + node.count; i++) {
+                bounds.expand(boxes[order[i]]);
+            }
+        } else {
+            bounds.expand(BoundingBox(nodes[index + 1].min, nodes[index + 1].max));
+            bounds.expand(BoundingBox(nodes[node.offset].min, nodes[node.offset].max));
+        }
+        node.min = bounds.min;
+        node.max = bounds.max;
+    }
+}
+
+// One chunk's triangles, stored in leaf order as a corner and two edges
+class TriangleBvh {
+public:
+    // positions holds three corners per triangle, a triangle's index in it
+    // is what hits report
+    void build(const std::vector<glm::vec3>& positions) {
+        auto num_triangles = positions.size() / 3;
+        _boxes.resize(num_triangles);
+        _centroids.resize(num_triangles);
+        for (auto triangle = std::size_t(0); triangle < num_triangles; triangle++) {
+            auto box = BoundingBox();
+            box.expand(positions[triangle * 3]);
+            box.expand(positions[triangle * 3 + 1]);
+            box.expand(positions[triangle * 3 + 2]);
+            _boxes[triangle] = box;
+            _centroids[triangle] = box.center();
+        }
+
+        build_bvh(_boxes, _centroids, _nodes, _order);
+        store_triangles(positions);
+    }
+
+    // Same triangles with moved corners, keeps the tree and only updates
+    // the boxes. Fine for small changes, the tree degrades with large ones.
+    void refit(const std::vector<glm::vec3>& positions) {
+        for (auto triangle = std::size_t(0); triangle < _boxes.size(); triangle++) {
+            auto box = BoundingBox();
+            box.expand(positions[triangle * 3]);
+            box.expand(positions[triangle * 3 + 1]);
+            box.expand(positions[triangle * 3 + 2]);
+            _boxes[triangle] = box;
+        }
+
+        refit_bvh(_boxes, _order, _nodes);
+        store_triangles(positions);
+    }
+
+    bool empty() const {
+        return _nodes.empty();
+    }
+
+    std::size_t num_triangles() const {
+        return _triangles.size();
+    }
+
+    std::size_t num_nodes() const {
+        return _nodes.size();
+    }
+
+    BoundingBox bounds() const {
+        return _nodes.empty() ? BoundingBox() : BoundingBox(_nodes[0].min, _nodes[0].max);
+    }
+
+    // Nearest hit closer than hit.t, which is updated with it and chunk
+    bool intersect(const Ray& ray, RayHit& hit, uint32_t chunk = BVH_INVALID) const {
+        if (_nodes.empty()) {
+            return false;
+        }
+
+        auto inverse_direction = 1.0f / ray.direction;
+        auto found = false;
+        uint32_t stack[BVH_STACK_SIZE];
+        auto depth = 0;
+        stack[depth++] = 0;
+        while (depth > 0) {
+            const auto& node = _nodes[stack[--depth]];
+            auto entry = 0.0f;
+            if (!bvh_detail::intersects(node, ray.origin, inverse_direction, std::min(hit.t, ray.t_max), entry)) {
+                continue;
+            }
+
+            if (node.is_leaf()) {
+                for (auto slot = node.offset; slot < node.offset + node.count; slot++) {
+                    auto t = intersect_triangle(_triangles[slot], ray.origin, ray.direction);
+                    if (t < hit.t && t <= ray.t_max) {
+                        hit.t = t;
+                        hit.chunk = chunk;
+                        hit.triangle = _order[slot];
+                        found = true;
+                    }
+                }
+                continue;
+            }
+
+            // Near child on top, decided by the ray direction on the split axis
+            auto left = uint32_t(&node - _nodes.data()) + 1;
+            auto right = node.offset;
+            if (ray.direction[node.axis] < 0.0f) {
+                std::swap(left, right);
+            }
+            stack[depth++] = right;
+            stack[depth++] = left;
+        }
+        return found;
+    }
+
+    // Nearest hits of every ray in the packet, t, chunk and triangle are
+    // updated for the rays that hit. Returns whether any did.
+    template<int Width>
+    bool intersect(RayPacket<Width>& packet, uint32_t chunk = BVH_INVALID) const {
+        if (_nodes.empty()) {
+            return false;
+        }
+
+        auto found = false;
+        uint32_t stack[BVH_STACK_SIZE];
+        auto depth = 0;
+        stack[depth++] = 0;
+        while (depth > 0) {
+            const auto& node = _nodes[stack[--depth]];
+            if (!bvh_detail::intersects(node, packet)) {
+                continue;
+            }
+
+            if (node.is_leaf()) {
+                for (auto slot = node.offset; slot < node.offset + node.count; slot++) {
+                    found |= intersect_triangle(_triangles[slot], chunk, _order[slot], packet);
+                }
+                continue;
+            }
+
+            auto left = uint32_t(&node - _nodes.data()) + 1;
+            auto right = node.offset;
+            float first_direction[LANE_COUNT];
+            packet.direction[node.axis][0].store(first_direction);
+            if (first_direction[0] < 0.0f) {
+                std::swap(left, right);
+            }
+            stack[depth++] = right;
+            stack[depth++] = left;
+        }
+        return found;
+    }
+
+private:
+    struct StoredTriangle {
+        glm::vec3 corner;
+        glm::vec3 edge_1;
+        glm::vec3 edge_2;
+    };
+
+    void store_triangles(const std::vector<glm::vec3>& positions) {
+        _triangles.resize(_order.size());
+        for (auto slot = std::size_t(0); slot < _order.size(); slot++) {
+            const auto* corners = &positions[std::size_t(_order[slot]) * 3];
+            _triangles[slot] = StoredTriangle { corners[0], corners[1] - corners[0], corners[2] - corners[0] };
+        }
+    }
+
+    // Möller-Trumbore, both sides count. Infinity on a miss.
+    static float intersect_triangle(const StoredTriangle& triangle, glm::vec3 origin, glm::vec3 direction) {
+        constexpr auto EPSILON = 1e-8f;
+        auto p = glm::cross(direction, triangle.edge_2);
+        auto determinant = glm::dot(triangle.edge_1, p);
+        if (std::fabs(determinant) < EPSILON) {
+            return std::numeric_limits<float>::infinity();
+        }
+
+        auto inverse = 1.0f / determinant;
+        auto s = origin - triangle.corner;
+        auto u = glm::dot(s, p) * inverse;
+        if (u < 0.0f || u > 1.0f) {
+            return std::numeric_limits<float>::infinity();
+        }
+
+        auto q = glm::cross(s, triangle.edge_1);
+        auto v = glm::dot(direction, q) * inverse;
+        if (v < 0.0f || u + v > 1.0f) {
+            return std::numeric_limits<float>::infinity();
+        }
+
+        auto t = glm::dot(triangle.edge_2, q) * inverse;
+        return t >= 0.0f ? t : std::numeric_limits<float>::infinity();
+    }
+
+    // The same test for every ray of the packet at once
+    template<int Width>
+    static bool intersect_triangle(const StoredTriangle& triangle, uint32_t chunk, uint32_t index, RayPacket<Width>& packet) {
+        constexpr auto EPSILON = 1e-8f;
+        auto found = false;
+        for (auto group = 0; group < RayPacket<Width>::GROUPS; group++) {
+            const auto* d = packet.direction;
+            const auto* o = packet.origin;
+
+            // p = direction x edge_2
+            auto px = d[1][group] * triangle.edge_2.z - d[2][group] * triangle.edge_2.y;
+            auto py = d[2][group] * triangle.edge_2.x - d[0][group] * triangle.edge_2.z;
+            auto pz = d[0][group] * triangle.edge_2.y - d[1][group] * triangle.edge_2.x;
+            auto determinant = px * triangle.edge_1.x + py * triangle.edge_1.y + pz * triangle.edge_1.z;
+            auto inverse = Lanes(1.0f) / determinant;
+
+            auto sx = o[0][group] - triangle.corner.x;
+            auto sy = o[1][group] - triangle.corner.y;
+            auto sz = o[2][group] - triangle.corner.z;
+            auto u = (sx * px + sy * py + sz * pz) * inverse;
+
+            // q = s x edge_1
+            auto qx = sy * triangle.edge_1.z - sz * triangle.edge_1.y;
+            auto qy = sz * triangle.edge_1.x - sx * triangle.edge_1.z;
+            auto qz = sx * triangle.edge_1.y - sy * triangle.edge_1.x;
+            auto v = (d[0][group] * qx + d[1][group] * qy + d[2][group] * qz) * inverse;
+            auto t = (qx * triangle.edge_2.x + qy * triangle.edge_2.y + qz * triangle.edge_2.z) * inverse;
+
+            // Every condition as a margin that must not be negative, a flat
+            // determinant forces a miss whatever NaNs the divide made
+            auto margin = lane_min(lane_min(u, v), lane_min(Lanes(1.0f) - u - v, lane_min(t, packet.t[group] - t)));
+            margin = lane_select_less(lane_abs(determinant), Lanes(EPSILON), Lanes(-1.0f), margin);
+            if (lane_all_less(margin, Lanes(0.0f))) {
+                continue;
+            }
+
+            packet.t[group] = lane_select_less(margin, Lanes(0.0f), packet.t[group], t);
+            float margins[LANE_COUNT];
+            margin.store(margins);
+            for (auto lane = 0; lane < LANE_COUNT; lane++) {
+                if (margins[lane] >= 0.0f) {
+                    packet.chunk[group * LANE_COUNT + lane] = chunk;
+                    packet.triangle[group * LANE_COUNT + lane] = index;
+                    found = true;
+                }
+            }
+        }
+        return found;
+    }
+
+    std::vector<BoundingBox> _boxes;
+    std::vector<glm::vec3> _centroids;
+    std::vector<BvhNode> _nodes;
+    std::vector<uint32_t> _order;
+    std::vector<StoredTriangle> _triangles;
+};
+
+// Chunk trees under one small tree over the chunk bounds. Chunk trees are
+// built on the pool and swapped in by poll, queries always see complete
+// trees. Render thread only apart from the builds themselves.
+class WorldBvh {
+public:
+    struct Stats {
+        std::size_t triangles = 0;
+        std::size_t nodes = 0;
+        uint32_t pending = 0;
+        // Worker time of the last installed chunk build
+        double last_build_ms = 0.0;
+    };
+
+    explicit WorldBvh(ThreadPool* pool) : _pool(pool) {}
+
+    void resize(std::size_t num_chunks) {
+        _chunks.resize(num_chunks);
+    }
+
+    // Builds a new tree for chunk from three corners per triangle
+    void submit(uint32_t chunk, std::vector<glm::vec3>&& positions) {
+        auto job = std::make_shared<Job>();
+        job->chunk = chunk;
+        job->positions = std::move(positions);
+        job->bvh = std::make_shared<TriangleBvh>();
+        job->done = _pool->submit([job] {
+            TRACE_ZONE("WorldBvh::build");
+            auto start = std::chrono::high_resolution_clock::now();
+            job->bvh->build(job->positions);
+            auto end = std::chrono::high_resolution_clock::now();
+            job->ms = std::chrono::duration<double, std::milli>(end - start).count();
+            job->positions = std::vector<glm::vec3>();
+        });
+        _jobs.push_back(job);
+    }
+
+    // Installs finished builds in submission order, so a newer tree for a
+    // chunk never gets replaced by an older one. Returns how many.
+    uint32_t poll() {
+        auto installed = 0u;
+        while (installed < _jobs.size() &&
+               _jobs[installed]->done.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            install(*_jobs[installed]);
+            installed++;
+        }
+        finish(installed);
+        return installed;
+    }
+
+    // Blocks until every submitted build is installed
+    void wait() {
+        for (auto& job : _jobs) {
+            job->done.wait();
+            install(*job);
+        }
+        finish(uint32_t(_jobs.size()));
+    }
+
+    RayHit intersect(const Ray& ray) const {
+        auto hit = RayHit();
+        if (_nodes.empty()) {
+            return hit;
+        }
+
+        auto inverse_direction = 1.0f / ray.direction;
+        uint32_t stack[BVH_STACK_SIZE];
+        auto depth = 0;
+        stack[depth++] = 0;
+        while (depth > 0) {
+            const auto& node = _nodes[stack[--depth]];
+            auto entry = 0.0f;
+            if (!bvh_detail::intersects(node, ray.origin, inverse_direction, std::min(hit.t, ray.t_max), entry)) {
+                continue;
+            }
+
+            if (node.is_leaf()) {
+                for (auto slot = node.offset; slot < node.offset + node.count; slot++) {
+                    auto leaf = _order[slot];
+                    _leaves[leaf]->intersect(ray, hit, _members[leaf]);
+                }
+                continue;
+            }
+
+            auto left = uint32_t(&node - _nodes.data()) + 1;
+            auto right = node.offset;
+            if (ray.direction[node.axis] < 0.0f) {
+                std::swap(left, right);
+            }
+            stack[depth++] = right;
+            stack[depth++] = left;
+        }
+        return hit;
+    }
+
+    template<int Width>
+    void intersect(RayPacket<Width>& packet) const {
+        if (_nodes.empty()) {
+            return;
+        }
+
+        uint32_t stack[BVH_STACK_SIZE];
+        auto depth = 0;
+        stack[depth++] = 0;
+        while (depth > 0) {
+            const auto& node = _nodes[stack[--depth]];
+            if (!bvh_detail::intersects(node, packet)) {
+                continue;
+            }
+
+            if (node.is_leaf()) {
+                for (auto slot = node.offset; slot < node.offset + node.count; slot++) {
+                    auto leaf = _order[slot];
+                    _leaves[leaf]->intersect(packet, _members[leaf]);
+                }
+                continue;
+            }
+
+            auto left = uint32_t(&node - _nodes.data()) + 1;
+            auto right = node.offset;
+            float first_direction[LANE_COUNT];
+            packet.direction[node.axis][0].store(first_direction);
+            if (first_direction[0] < 0.0f) {
+                std::swap(left, right);
+            }
+            stack[depth++] = right;
+            stack[depth++] = left;
+        }
+    }
+
+    // Line of sight, whether any terrain lies between a and b
+    bool occluded(glm::vec3 a, glm::vec3 b) const {
+        auto length = glm::length(b - a);
+        if (length == 0.0f) {
+            return false;
+        }
+        return intersect(Ray { a, (b - a) / length, length }).hit();
+    }
+
+    Stats stats() const {
+        auto stats = Stats();
+        for (const auto& chunk : _chunks) {
+            if (chunk) {
+                stats.triangles += chunk->num_triangles();
+                stats.nodes += chunk->num_nodes();
+            }
+        }
+        stats.nodes += _nodes.size();
+        stats.pending = uint32_t(_jobs.size());
+        stats.last_build_ms = _last_build_ms;
+        return stats;
+    }
+
+private:
+    struct Job {
+        uint32_t chunk;
+        std::vector<glm::vec3> positions;
+        std::shared_ptr<TriangleBvh> bvh;
+        std::future<void> done;
+        double ms = 0.0;
+    };
+
+    void install(Job& job) {
+        job.done.get();
+        _chunks[job.chunk] = job.bvh->empty() ? nullptr : job.bvh;
+        _last_build_ms = job.ms;
+    }
+
+    // The top level over chunk bounds. Refit when the same chunks have
+    // triangles as before, rebuilt when that changed.
+    void finish(uint32_t installed) {
+        if (installed == 0) {
+            return;
+        }
+        _jobs.erase(_jobs.begin(), _jobs.begin() + installed);
+
+        _next_members.clear();
+        for (auto chunk = 0u; chunk < _chunks.size(); chunk++) {
+            if (_chunks[chunk]) {
+                _next_members.push_back(chunk);
+            }
+        }
+
+        _leaves.resize(_next_members.size());
+        _boxes.resize(_next_members.size());
+        _centroids.resize(_next_members.size());
+        for (auto leaf = std::size_t(0); leaf < _next_members.size(); leaf++) {
+            _leaves[leaf] = _chunks[_next_members[leaf]];
+            _boxes[leaf] = _leaves[leaf]->bounds();
+            _centroids[leaf] = _boxes[leaf].center();
+        }
+
+        if (_next_members == _members && !_nodes.empty()) {
+            refit_bvh(_boxes, _order, _nodes);
+        } else {
+            build_bvh(_boxes, _centroids, _nodes, _order);
+            _members.swap(_next_members);
+        }
+    }
+
+    ThreadPool* _pool;
+    std::vector<std::shared_ptr<TriangleBvh>> _chunks;
+    std::vector<std::shared_ptr<Job>> _jobs;
+    double _last_build_ms = 0.0;
+
+    // Top level, its primitives are the chunks with triangles. _members
+    // holds their chunk index, _leaves their tree.
+    std::vector<uint32_t> _members;
+    std::vector<uint32_t> _next_members;
+    std::vector<std::shared_ptr<TriangleBvh>> _leaves;
+    std::vector<BoundingBox> _boxes;
+    std::vector<glm::vec3> _centroids;
+    std::vector<BvhNode> _nodes;
+    std::vector<uint32_t> _order;
+};
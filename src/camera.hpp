@@ -136,6 +136,25 @@ public:
         return _position;
     }
 
+    void set_position(glm::vec3 position) {
+        _position = position;
+    }
+
+    float get_yaw() {
+        return _yaw;
+    }
+
+    float get_pitch() {
+        return _pitch;
+    }
+
+    // Euler angles in degrees, as process_mouse_movement leaves them
+    void set_orientation(float yaw, float pitch) {
+        _yaw = yaw;
+        _pitch = pitch;
+        update_camera_vectors();
+    }
+
     void process_keyboard(CameraMovement direction, float delta_time) {
         float velocity = _movement_speed * delta_time;
         if (direction == CameraMovement::FORWARD)
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "../../density_cache.hpp"
+#include "../../trace.hpp"
+#include "../../wrappers.hpp"
+
+// DensityReadback keeps the DensityCache in step with the chunks. Stage 1
+// samples are copied out of the shared points buffer into a staging buffer
+// right after each dispatch, and poll moves them into the cache once their
+// fence has passed, so the render thread does not wait on the GPU for them.
+// Uniform chunks, evictions and the CPU extractors' grids apply straight away.
+class DensityReadback {
+public:
+    // Copies in flight, one more waits for the oldest
+    static constexpr std::size_t MAX_PENDING = 2;
+
+    explicit DensityReadback(std::shared_ptr<DensityCache> cache, std::size_t num_chunks)
+    : _cache(cache),
+      _versions(num_chunks, 0)
+    {
+        _memory.reserve(num_chunks);
+        for (auto chunk = 0u; chunk < num_chunks; chunk++) {
+            _memory.emplace_back(MemoryTag { MemoryCategory::DENSITY_CACHE, chunk });
+        }
+    }
+
+    static std::shared_ptr<DensityReadback> create(std::shared_ptr<DensityCache> cache, std::size_t num_chunks) {
+        return std::make_shared<DensityReadback>(cache, num_chunks);
+    }
+
+    const DensityCache& cache() const {
+        return *_cache;
+    }
+
+    // Queues a copy of the samples in [sample_min, sample_max) stage 1 just
+    // wrote to points. Whole x slabs of the sampled rows are copied, only the
+    // sampled z range is read from them.
+    void request(
+        glm::ivec3 offset,
+        int axis_length,
+        glm::ivec3 sample_min,
+        glm::ivec3 sample_max,
+        bool full,
+        const ShaderStorageBuffer<glm::vec4>& points
+    )
+    {
+        TRACE_ZONE("DensityReadback::request");
+
+        if (_pending.size() >= MAX_PENDING) {
+            _pending.front().buffer->wait();
+            poll();
+        }
+
+        auto pending = Pending { offset, axis_length, sample_min, sample_max, full, _versions[_cache->chunk_index(offset)], nullptr };
+        if (_free.empty()) {
+            pending.buffer = std::make_unique<ReadbackBuffer>();
+        } else {
+            pending.buffer = std::move(_free.back());
+            _free.pop_back();
+        }
+
+        auto rows = sample_max.y - sample_min.y;
+        auto slab_bytes = GLsizeiptr(rows) * axis_length * sizeof(glm::vec4);
+        pending.buffer->reserve(slab_bytes * (sample_max.x - sample_min.x));
+
+        // Stage 1 wrote the points from a shader
+        GL_CHECK(glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT));
+        for (auto x = sample_min.x; x < sample_max.x; x++) {
+            auto first = (GLintptr(x) * axis_length + sample_min.y) * axis_length;
+            pending.buffer->copy_from_ssbo(points, first * sizeof(glm::vec4), (x - sample_min.x) * slab_bytes, slab_bytes);
+        }
+        pending.buffer->fence();
+        _pending.push_back(std::move(pending));
+    }
+
+    // A grid already on the CPU, replaces the chunk
+    void store(const DensityGrid& grid) {
+        auto chunk = _cache->chunk_index(grid.offset);
+        _versions[chunk]++;
+        _cache->store(grid);
+        _memory[chunk].set(_cache->bytes(chunk));
+    }
+
+    void store_uniform(glm::ivec3 offset, float value) {
+        auto chunk = _cache->chunk_index(offset);
+        _versions[chunk]++;
+        _cache->store_uniform(offset, value);
+        _memory[chunk].set(_cache->bytes(chunk));
+    }
+
+    // The chunk reads as air until it is sampled again
+    void drop(glm::ivec3 offset) {
+        auto chunk = _cache->chunk_index(offset);
+        _versions[chunk]++;
+        _cache->drop(offset);
+        _memory[chunk].set(0);
+    }
+
+    void set_iso_level(float iso_level) {
+        _cache->set_iso_level(iso_level);
+    }
+
+    // Moves the copies that have landed into the cache in the order they
+    // were requested, returns how many. Copies overtaken by a store,
+    // store_uniform or drop of their chunk are thrown away.
+    uint32_t poll() {
+        TRACE_ZONE("DensityReadback::poll");
+
+        auto applied = 0u;
+        while (!_pending.empty() && _pending.front().buffer->ready()) {
+            auto& pending = _pending.front();
+            auto chunk = _cache->chunk_index(pending.offset);
+            if (pending.version == _versions[chunk]) {
+                apply(pending);
+                _memory[chunk].set(_cache->bytes(chunk));
+                applied++;
+            }
+            _free.push_back(std::move(pending.buffer));
+            _pending.pop_front();
+        }
+        return applied;
+    }
+
+    std::size_t pending() const {
+        return _pending.size();
+    }
+
+private:
+    struct Pending {
+        glm::ivec3 offset;
+        int axis_length;
+        glm::ivec3 sample_min;
+        glm::ivec3 sample_max;
+        bool full;
+        uint32_t version;
+        std::unique_ptr<ReadbackBuffer> buffer;
+    };
+
+    void apply(const Pending& pending) {
+        auto extent = pending.sample_max - pending.sample_min;
+        auto bytes = GLsizeiptr(extent.x) * extent.y * pending.axis_length * sizeof(glm::vec4);
+        const auto* points = static_cast<const glm::vec4*>(pending.buffer->map(bytes));
+        auto axis_length = pending.axis_length;
+        auto sample_min = pending.sample_min;
+        _cache->update(pending.offset, pending.sample_min, pending.sample_max, pending.full, [&](int x, int y, int z) {
+            return points[(std::size_t(x - sample_min.x) * extent.y + (y - sample_min.y)) * axis_length + z].w;
+        });
+        pending.buffer->unmap();
+    }
+
+    std::shared_ptr<DensityCache> _cache;
+    std::deque<Pending> _pending;
+    std::vector<std::unique_ptr<ReadbackBuffer>> _free;
+    // Bumped by changes that apply straight away, older copies are stale
+    std::vector<uint32_t> _versions;
+    std::vector<MemoryRecord> _memory;
+};
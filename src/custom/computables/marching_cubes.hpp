@@ -1,32 +1,77 @@
 #pragma once
 
+#include <algorithm>
+#include <climits>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
 #include "../../shader.hpp"
 #include "../../computable.hpp"
+#include "../../density_graph.hpp"
+#include "../../extractor.hpp"
+#include "../../frustum.hpp"
+#include "../../generation_settings.hpp"
+#include "../../marching_cubes_tables.hpp"
+#include "../../sculpt.hpp"
+#include "../../trace.hpp"
+#include "density_readback.hpp"
 
-struct GenerationSettings
-{
-    float iso_level;
-    float scale;
-    float persistence;
-    int octaves;
-    float lacunarity;
-
-    GenerationSettings() 
-    : iso_level(1.0f), scale(1.0f), persistence(0.5f), octaves(4),
-      lacunarity(2.0f)
-    {
+// Mirrors the Bounds block in stage 2, values are order preserving integer
+// encodings of floats so the shader can reduce them atomically
+struct GpuBounds {
+    glm::ivec4 min;
+    glm::ivec4 max;
+
+    static float float_from_ordered_int(int value) {
+        auto bits = value >= 0 ? value : value ^ 0x7FFFFFFF;
+        float result;
+        memcpy(&result, &bits, sizeof(result));
+        return result;
     }
 
-    bool operator==(const GenerationSettings& other) {
-        const auto epsilon = 0.001f;
-        return fabs(iso_level - other.iso_level) < epsilon &&
-               fabs(scale - other.scale) < epsilon &&
-               octaves == other.octaves &&
-               fabs(persistence - other.persistence) < epsilon &&
-               fabs(lacunarity - other.lacunarity) < epsilon;
+    BoundingBox to_bounding_box() const {
+        if (min.x > max.x) {
+            return BoundingBox();
+        }
+
+        return BoundingBox(
+            glm::vec3(float_from_ordered_int(min.x), float_from_ordered_int(min.y), float_from_ordered_int(min.z)),
+            glm::vec3(float_from_ordered_int(max.x), float_from_ordered_int(max.y), float_from_ordered_int(max.z))
+        );
     }
 };
 
+// Mirrors the OccluderColumns block in stage 1. The chunk footprint is split
+// into columns and each records the lowest sample row that is not solid.
+constexpr auto OCCLUDER_COLUMNS = 4;
+
+struct GpuOccluderColumns {
+    GLint lowest_air[OCCLUDER_COLUMNS * OCCLUDER_COLUMNS];
+};
+
+// Starting size of the triangle buffer in triangles. Busy 100^3 chunks emit
+// around 40k, the buffer grows from the measured count when one emits more.
+constexpr GLuint INITIAL_TRIANGLE_CAPACITY = 64 * 1024;
+
+// Starting size of the near-surface point list used by the point view
+constexpr GLuint INITIAL_SURFACE_POINT_CAPACITY = 128 * 1024;
+
+// Brushes overlapping a single dispatch, grows when more overlap
+constexpr GLuint INITIAL_BRUSH_CAPACITY = 64;
+
+// Mirrors the BrickTriangles block in stage 2. Chunk meshes are split into
+// bricks of BRICK_CELLS^3 cells so an edit only remeshes the bricks it touches.
+constexpr auto BRICK_CELLS = 25;
+constexpr auto BRICKS_PER_AXIS = 4;
+constexpr auto NUM_BRICKS = BRICKS_PER_AXIS * BRICKS_PER_AXIS * BRICKS_PER_AXIS;
+
+struct GpuBrickTriangles {
+    GLuint counts[NUM_BRICKS];
+    GLuint cursors[NUM_BRICKS];
+};
+
 // Shader Storage Buffers will pad a vec3 to a vec4 :(
 struct Triangle {
     glm::vec4 vertex_a;
@@ -40,318 +85,45 @@ struct Triangle {
     glm::vec4 color_c;
 };
 
-static int edges[256]={
-    0x0  , 0x109, 0x203, 0x30a, 0x406, 0x50f, 0x605, 0x70c,
-    0x80c, 0x905, 0xa0f, 0xb06, 0xc0a, 0xd03, 0xe09, 0xf00,
-    0x190, 0x99 , 0x393, 0x29a, 0x596, 0x49f, 0x795, 0x69c,
-    0x99c, 0x895, 0xb9f, 0xa96, 0xd9a, 0xc93, 0xf99, 0xe90,
-    0x230, 0x339, 0x33 , 0x13a, 0x636, 0x73f, 0x435, 0x53c,
-    0xa3c, 0xb35, 0x83f, 0x936, 0xe3a, 0xf33, 0xc39, 0xd30,
-    0x3a0, 0x2a9, 0x1a3, 0xaa , 0x7a6, 0x6af, 0x5a5, 0x4ac,
-    0xbac, 0xaa5, 0x9af, 0x8a6, 0xfaa, 0xea3, 0xda9, 0xca0,
-    0x460, 0x569, 0x663, 0x76a, 0x66 , 0x16f, 0x265, 0x36c,
-    0xc6c, 0xd65, 0xe6f, 0xf66, 0x86a, 0x963, 0xa69, 0xb60,
-    0x5f0, 0x4f9, 0x7f3, 0x6fa, 0x1f6, 0xff , 0x3f5, 0x2fc,
-    0xdfc, 0xcf5, 0xfff, 0xef6, 0x9fa, 0x8f3, 0xbf9, 0xaf0,
-    0x650, 0x759, 0x453, 0x55a, 0x256, 0x35f, 0x55 , 0x15c,
-    0xe5c, 0xf55, 0xc5f, 0xd56, 0xa5a, 0xb53, 0x859, 0x950,
-    0x7c0, 0x6c9, 0x5c3, 0x4ca, 0x3c6, 0x2cf, 0x1c5, 0xcc ,
-    0xfcc, 0xec5, 0xdcf, 0xcc6, 0xbca, 0xac3, 0x9c9, 0x8c0,
-    0x8c0, 0x9c9, 0xac3, 0xbca, 0xcc6, 0xdcf, 0xec5, 0xfcc,
-    0xcc , 0x1c5, 0x2cf, 0x3c6, 0x4ca, 0x5c3, 0x6c9, 0x7c0,
-    0x950, 0x859, 0xb53, 0xa5a, 0xd56, 0xc5f, 0xf55, 0xe5c,
-    0x15c, 0x55 , 0x35f, 0x256, 0x55a, 0x453, 0x759, 0x650,
-    0xaf0, 0xbf9, 0x8f3, 0x9fa, 0xef6, 0xfff, 0xcf5, 0xdfc,
-    0x2fc, 0x3f5, 0xff , 0x1f6, 0x6fa, 0x7f3, 0x4f9, 0x5f0,
-    0xb60, 0xa69, 0x963, 0x86a, 0xf66, 0xe6f, 0xd65, 0xc6c,
-    0x36c, 0x265, 0x16f, 0x66 , 0x76a, 0x663, 0x569, 0x460,
-    0xca0, 0xda9, 0xea3, 0xfaa, 0x8a6, 0x9af, 0xaa5, 0xbac,
-    0x4ac, 0x5a5, 0x6af, 0x7a6, 0xaa , 0x1a3, 0x2a9, 0x3a0,
-    0xd30, 0xc39, 0xf33, 0xe3a, 0x936, 0x83f, 0xb35, 0xa3c,
-    0x53c, 0x435, 0x73f, 0x636, 0x13a, 0x33 , 0x339, 0x230,
-    0xe90, 0xf99, 0xc93, 0xd9a, 0xa96, 0xb9f, 0x895, 0x99c,
-    0x69c, 0x795, 0x49f, 0x596, 0x29a, 0x393, 0x99 , 0x190,
-    0xf00, 0xe09, 0xd03, 0xc0a, 0xb06, 0xa0f, 0x905, 0x80c,
-    0x70c, 0x605, 0x50f, 0x406, 0x30a, 0x203, 0x109, 0x0   
-};
-
-static int triangulation[256][16] =
-{
-    {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {0, 8, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {0, 1, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {1, 8, 3, 9, 8, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {1, 2, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {0, 8, 3, 1, 2, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {9, 2, 10, 0, 2, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {2, 8, 3, 2, 10, 8, 10, 9, 8, -1, -1, -1, -1, -1, -1, -1},
-    {3, 11, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {0, 11, 2, 8, 11, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {1, 9, 0, 2, 3, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {1, 11, 2, 1, 9, 11, 9, 8, 11, -1, -1, -1, -1, -1, -1, -1},
-    {3, 10, 1, 11, 10, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {0, 10, 1, 0, 8, 10, 8, 11, 10, -1, -1, -1, -1, -1, -1, -1},
-    {3, 9, 0, 3, 11, 9, 11, 10, 9, -1, -1, -1, -1, -1, -1, -1},
-    {9, 8, 10, 10, 8, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {4, 7, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {4, 3, 0, 7, 3, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {0, 1, 9, 8, 4, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {4, 1, 9, 4, 7, 1, 7, 3, 1, -1, -1, -1, -1, -1, -1, -1},
-    {1, 2, 10, 8, 4, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {3, 4, 7, 3, 0, 4, 1, 2, 10, -1, -1, -1, -1, -1, -1, -1},
-    {9, 2, 10, 9, 0, 2, 8, 4, 7, -1, -1, -1, -1, -1, -1, -1},
-    {2, 10, 9, 2, 9, 7, 2, 7, 3, 7, 9, 4, -1, -1, -1, -1},
-    {8, 4, 7, 3, 11, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {11, 4, 7, 11, 2, 4, 2, 0, 4, -1, -1, -1, -1, -1, -1, -1},
-    {9, 0, 1, 8, 4, 7, 2, 3, 11, -1, -1, -1, -1, -1, -1, -1},
-    {4, 7, 11, 9, 4, 11, 9, 11, 2, 9, 2, 1, -1, -1, -1, -1},
-    {3, 10, 1, 3, 11, 10, 7, 8, 4, -1, -1, -1, -1, -1, -1, -1},
-    {1, 11, 10, 1, 4, 11, 1, 0, 4, 7, 11, 4, -1, -1, -1, -1},
-    {4, 7, 8, 9, 0, 11, 9, 11, 10, 11, 0, 3, -1, -1, -1, -1},
-    {4, 7, 11, 4, 11, 9, 9, 11, 10, -1, -1, -1, -1, -1, -1, -1},
-    {9, 5, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {9, 5, 4, 0, 8, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {0, 5, 4, 1, 5, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {8, 5, 4, 8, 3, 5, 3, 1, 5, -1, -1, -1, -1, -1, -1, -1},
-    {1, 2, 10, 9, 5, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {3, 0, 8, 1, 2, 10, 4, 9, 5, -1, -1, -1, -1, -1, -1, -1},
-    {5, 2, 10, 5, 4, 2, 4, 0, 2, -1, -1, -1, -1, -1, -1, -1},
-    {2, 10, 5, 3, 2, 5, 3, 5, 4, 3, 4, 8, -1, -1, -1, -1},
-    {9, 5, 4, 2, 3, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {0, 11, 2, 0, 8, 11, 4, 9, 5, -1, -1, -1, -1, -1, -1, -1},
-    {0, 5, 4, 0, 1, 5, 2, 3, 11, -1, -1, -1, -1, -1, -1, -1},
-    {2, 1, 5, 2, 5, 8, 2, 8, 11, 4, 8, 5, -1, -1, -1, -1},
-    {10, 3, 11, 10, 1, 3, 9, 5, 4, -1, -1, -1, -1, -1, -1, -1},
-    {4, 9, 5, 0, 8, 1, 8, 10, 1, 8, 11, 10, -1, -1, -1, -1},
-    {5, 4, 0, 5, 0, 11, 5, 11, 10, 11, 0, 3, -1, -1, -1, -1},
-    {5, 4, 8, 5, 8, 10, 10, 8, 11, -1, -1, -1, -1, -1, -1, -1},
-    {9, 7, 8, 5, 7, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {9, 3, 0, 9, 5, 3, 5, 7, 3, -1, -1, -1, -1, -1, -1, -1},
-    {0, 7, 8, 0, 1, 7, 1, 5, 7, -1, -1, -1, -1, -1, -1, -1},
-    {1, 5, 3, 3, 5, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {9, 7, 8, 9, 5, 7, 10, 1, 2, -1, -1, -1, -1, -1, -1, -1},
-    {10, 1, 2, 9, 5, 0, 5, 3, 0, 5, 7, 3, -1, -1, -1, -1},
-    {8, 0, 2, 8, 2, 5, 8, 5, 7, 10, 5, 2, -1, -1, -1, -1},
-    {2, 10, 5, 2, 5, 3, 3, 5, 7, -1, -1, -1, -1, -1, -1, -1},
-    {7, 9, 5, 7, 8, 9, 3, 11, 2, -1, -1, -1, -1, -1, -1, -1},
-    {9, 5, 7, 9, 7, 2, 9, 2, 0, 2, 7, 11, -1, -1, -1, -1},
-    {2, 3, 11, 0, 1, 8, 1, 7, 8, 1, 5, 7, -1, -1, -1, -1},
-    {11, 2, 1, 11, 1, 7, 7, 1, 5, -1, -1, -1, -1, -1, -1, -1},
-    {9, 5, 8, 8, 5, 7, 10, 1, 3, 10, 3, 11, -1, -1, -1, -1},
-    {5, 7, 0, 5, 0, 9, 7, 11, 0, 1, 0, 10, 11, 10, 0, -1},
-    {11, 10, 0, 11, 0, 3, 10, 5, 0, 8, 0, 7, 5, 7, 0, -1},
-    {11, 10, 5, 7, 11, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {10, 6, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {0, 8, 3, 5, 10, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {9, 0, 1, 5, 10, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {1, 8, 3, 1, 9, 8, 5, 10, 6, -1, -1, -1, -1, -1, -1, -1},
-    {1, 6, 5, 2, 6, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {1, 6, 5, 1, 2, 6, 3, 0, 8, -1, -1, -1, -1, -1, -1, -1},
-    {9, 6, 5, 9, 0, 6, 0, 2, 6, -1, -1, -1, -1, -1, -1, -1},
-    {5, 9, 8, 5, 8, 2, 5, 2, 6, 3, 2, 8, -1, -1, -1, -1},
-    {2, 3, 11, 10, 6, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {11, 0, 8, 11, 2, 0, 10, 6, 5, -1, -1, -1, -1, -1, -1, -1},
-    {0, 1, 9, 2, 3, 11, 5, 10, 6, -1, -1, -1, -1, -1, -1, -1},
-    {5, 10, 6, 1, 9, 2, 9, 11, 2, 9, 8, 11, -1, -1, -1, -1},
-    {6, 3, 11, 6, 5, 3, 5, 1, 3, -1, -1, -1, -1, -1, -1, -1},
-    {0, 8, 11, 0, 11, 5, 0, 5, 1, 5, 11, 6, -1, -1, -1, -1},
-    {3, 11, 6, 0, 3, 6, 0, 6, 5, 0, 5, 9, -1, -1, -1, -1},
-    {6, 5, 9, 6, 9, 11, 11, 9, 8, -1, -1, -1, -1, -1, -1, -1},
-    {5, 10, 6, 4, 7, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {4, 3, 0, 4, 7, 3, 6, 5, 10, -1, -1, -1, -1, -1, -1, -1},
-    {1, 9, 0, 5, 10, 6, 8, 4, 7, -1, -1, -1, -1, -1, -1, -1},
-    {10, 6, 5, 1, 9, 7, 1, 7, 3, 7, 9, 4, -1, -1, -1, -1},
-    {6, 1, 2, 6, 5, 1, 4, 7, 8, -1, -1, -1, -1, -1, -1, -1},
-    {1, 2, 5, 5, 2, 6, 3, 0, 4, 3, 4, 7, -1, -1, -1, -1},
-    {8, 4, 7, 9, 0, 5, 0, 6, 5, 0, 2, 6, -1, -1, -1, -1},
-    {7, 3, 9, 7, 9, 4, 3, 2, 9, 5, 9, 6, 2, 6, 9, -1},
-    {3, 11, 2, 7, 8, 4, 10, 6, 5, -1, -1, -1, -1, -1, -1, -1},
-    {5, 10, 6, 4, 7, 2, 4, 2, 0, 2, 7, 11, -1, -1, -1, -1},
-    {0, 1, 9, 4, 7, 8, 2, 3, 11, 5, 10, 6, -1, -1, -1, -1},
-    {9, 2, 1, 9, 11, 2, 9, 4, 11, 7, 11, 4, 5, 10, 6, -1},
-    {8, 4, 7, 3, 11, 5, 3, 5, 1, 5, 11, 6, -1, -1, -1, -1},
-    {5, 1, 11, 5, 11, 6, 1, 0, 11, 7, 11, 4, 0, 4, 11, -1},
-    {0, 5, 9, 0, 6, 5, 0, 3, 6, 11, 6, 3, 8, 4, 7, -1},
-    {6, 5, 9, 6, 9, 11, 4, 7, 9, 7, 11, 9, -1, -1, -1, -1},
-    {10, 4, 9, 6, 4, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {4, 10, 6, 4, 9, 10, 0, 8, 3, -1, -1, -1, -1, -1, -1, -1},
-    {10, 0, 1, 10, 6, 0, 6, 4, 0, -1, -1, -1, -1, -1, -1, -1},
-    {8, 3, 1, 8, 1, 6, 8, 6, 4, 6, 1, 10, -1, -1, -1, -1},
-    {1, 4, 9, 1, 2, 4, 2, 6, 4, -1, -1, -1, -1, -1, -1, -1},
-    {3, 0, 8, 1, 2, 9, 2, 4, 9, 2, 6, 4, -1, -1, -1, -1},
-    {0, 2, 4, 4, 2, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {8, 3, 2, 8, 2, 4, 4, 2, 6, -1, -1, -1, -1, -1, -1, -1},
-    {10, 4, 9, 10, 6, 4, 11, 2, 3, -1, -1, -1, -1, -1, -1, -1},
-    {0, 8, 2, 2, 8, 11, 4, 9, 10, 4, 10, 6, -1, -1, -1, -1},
-    {3, 11, 2, 0, 1, 6, 0, 6, 4, 6, 1, 10, -1, -1, -1, -1},
-    {6, 4, 1, 6, 1, 10, 4, 8, 1, 2, 1, 11, 8, 11, 1, -1},
-    {9, 6, 4, 9, 3, 6, 9, 1, 3, 11, 6, 3, -1, -1, -1, -1},
-    {8, 11, 1, 8, 1, 0, 11, 6, 1, 9, 1, 4, 6, 4, 1, -1},
-    {3, 11, 6, 3, 6, 0, 0, 6, 4, -1, -1, -1, -1, -1, -1, -1},
-    {6, 4, 8, 11, 6, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {7, 10, 6, 7, 8, 10, 8, 9, 10, -1, -1, -1, -1, -1, -1, -1},
-    {0, 7, 3, 0, 10, 7, 0, 9, 10, 6, 7, 10, -1, -1, -1, -1},
-    {10, 6, 7, 1, 10, 7, 1, 7, 8, 1, 8, 0, -1, -1, -1, -1},
-    {10, 6, 7, 10, 7, 1, 1, 7, 3, -1, -1, -1, -1, -1, -1, -1},
-    {1, 2, 6, 1, 6, 8, 1, 8, 9, 8, 6, 7, -1, -1, -1, -1},
-    {2, 6, 9, 2, 9, 1, 6, 7, 9, 0, 9, 3, 7, 3, 9, -1},
-    {7, 8, 0, 7, 0, 6, 6, 0, 2, -1, -1, -1, -1, -1, -1, -1},
-    {7, 3, 2, 6, 7, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {2, 3, 11, 10, 6, 8, 10, 8, 9, 8, 6, 7, -1, -1, -1, -1},
-    {2, 0, 7, 2, 7, 11, 0, 9, 7, 6, 7, 10, 9, 10, 7, -1},
-    {1, 8, 0, 1, 7, 8, 1, 10, 7, 6, 7, 10, 2, 3, 11, -1},
-    {11, 2, 1, 11, 1, 7, 10, 6, 1, 6, 7, 1, -1, -1, -1, -1},
-    {8, 9, 6, 8, 6, 7, 9, 1, 6, 11, 6, 3, 1, 3, 6, -1},
-    {0, 9, 1, 11, 6, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {7, 8, 0, 7, 0, 6, 3, 11, 0, 11, 6, 0, -1, -1, -1, -1},
-    {7, 11, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {7, 6, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {3, 0, 8, 11, 7, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {0, 1, 9, 11, 7, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {8, 1, 9, 8, 3, 1, 11, 7, 6, -1, -1, -1, -1, -1, -1, -1},
-    {10, 1, 2, 6, 11, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {1, 2, 10, 3, 0, 8, 6, 11, 7, -1, -1, -1, -1, -1, -1, -1},
-    {2, 9, 0, 2, 10, 9, 6, 11, 7, -1, -1, -1, -1, -1, -1, -1},
-    {6, 11, 7, 2, 10, 3, 10, 8, 3, 10, 9, 8, -1, -1, -1, -1},
-    {7, 2, 3, 6, 2, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {7, 0, 8, 7, 6, 0, 6, 2, 0, -1, -1, -1, -1, -1, -1, -1},
-    {2, 7, 6, 2, 3, 7, 0, 1, 9, -1, -1, -1, -1, -1, -1, -1},
-    {1, 6, 2, 1, 8, 6, 1, 9, 8, 8, 7, 6, -1, -1, -1, -1},
-    {10, 7, 6, 10, 1, 7, 1, 3, 7, -1, -1, -1, -1, -1, -1, -1},
-    {10, 7, 6, 1, 7, 10, 1, 8, 7, 1, 0, 8, -1, -1, -1, -1},
-    {0, 3, 7, 0, 7, 10, 0, 10, 9, 6, 10, 7, -1, -1, -1, -1},
-    {7, 6, 10, 7, 10, 8, 8, 10, 9, -1, -1, -1, -1, -1, -1, -1},
-    {6, 8, 4, 11, 8, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {3, 6, 11, 3, 0, 6, 0, 4, 6, -1, -1, -1, -1, -1, -1, -1},
-    {8, 6, 11, 8, 4, 6, 9, 0, 1, -1, -1, -1, -1, -1, -1, -1},
-    {9, 4, 6, 9, 6, 3, 9, 3, 1, 11, 3, 6, -1, -1, -1, -1},
-    {6, 8, 4, 6, 11, 8, 2, 10, 1, -1, -1, -1, -1, -1, -1, -1},
-    {1, 2, 10, 3, 0, 11, 0, 6, 11, 0, 4, 6, -1, -1, -1, -1},
-    {4, 11, 8, 4, 6, 11, 0, 2, 9, 2, 10, 9, -1, -1, -1, -1},
-    {10, 9, 3, 10, 3, 2, 9, 4, 3, 11, 3, 6, 4, 6, 3, -1},
-    {8, 2, 3, 8, 4, 2, 4, 6, 2, -1, -1, -1, -1, -1, -1, -1},
-    {0, 4, 2, 4, 6, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {1, 9, 0, 2, 3, 4, 2, 4, 6, 4, 3, 8, -1, -1, -1, -1},
-    {1, 9, 4, 1, 4, 2, 2, 4, 6, -1, -1, -1, -1, -1, -1, -1},
-    {8, 1, 3, 8, 6, 1, 8, 4, 6, 6, 10, 1, -1, -1, -1, -1},
-    {10, 1, 0, 10, 0, 6, 6, 0, 4, -1, -1, -1, -1, -1, -1, -1},
-    {4, 6, 3, 4, 3, 8, 6, 10, 3, 0, 3, 9, 10, 9, 3, -1},
-    {10, 9, 4, 6, 10, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {4, 9, 5, 7, 6, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {0, 8, 3, 4, 9, 5, 11, 7, 6, -1, -1, -1, -1, -1, -1, -1},
-    {5, 0, 1, 5, 4, 0, 7, 6, 11, -1, -1, -1, -1, -1, -1, -1},
-    {11, 7, 6, 8, 3, 4, 3, 5, 4, 3, 1, 5, -1, -1, -1, -1},
-    {9, 5, 4, 10, 1, 2, 7, 6, 11, -1, -1, -1, -1, -1, -1, -1},
-    {6, 11, 7, 1, 2, 10, 0, 8, 3, 4, 9, 5, -1, -1, -1, -1},
-    {7, 6, 11, 5, 4, 10, 4, 2, 10, 4, 0, 2, -1, -1, -1, -1},
-    {3, 4, 8, 3, 5, 4, 3, 2, 5, 10, 5, 2, 11, 7, 6, -1},
-    {7, 2, 3, 7, 6, 2, 5, 4, 9, -1, -1, -1, -1, -1, -1, -1},
-    {9, 5, 4, 0, 8, 6, 0, 6, 2, 6, 8, 7, -1, -1, -1, -1},
-    {3, 6, 2, 3, 7, 6, 1, 5, 0, 5, 4, 0, -1, -1, -1, -1},
-    {6, 2, 8, 6, 8, 7, 2, 1, 8, 4, 8, 5, 1, 5, 8, -1},
-    {9, 5, 4, 10, 1, 6, 1, 7, 6, 1, 3, 7, -1, -1, -1, -1},
-    {1, 6, 10, 1, 7, 6, 1, 0, 7, 8, 7, 0, 9, 5, 4, -1},
-    {4, 0, 10, 4, 10, 5, 0, 3, 10, 6, 10, 7, 3, 7, 10, -1},
-    {7, 6, 10, 7, 10, 8, 5, 4, 10, 4, 8, 10, -1, -1, -1, -1},
-    {6, 9, 5, 6, 11, 9, 11, 8, 9, -1, -1, -1, -1, -1, -1, -1},
-    {3, 6, 11, 0, 6, 3, 0, 5, 6, 0, 9, 5, -1, -1, -1, -1},
-    {0, 11, 8, 0, 5, 11, 0, 1, 5, 5, 6, 11, -1, -1, -1, -1},
-    {6, 11, 3, 6, 3, 5, 5, 3, 1, -1, -1, -1, -1, -1, -1, -1},
-    {1, 2, 10, 9, 5, 11, 9, 11, 8, 11, 5, 6, -1, -1, -1, -1},
-    {0, 11, 3, 0, 6, 11, 0, 9, 6, 5, 6, 9, 1, 2, 10, -1},
-    {11, 8, 5, 11, 5, 6, 8, 0, 5, 10, 5, 2, 0, 2, 5, -1},
-    {6, 11, 3, 6, 3, 5, 2, 10, 3, 10, 5, 3, -1, -1, -1, -1},
-    {5, 8, 9, 5, 2, 8, 5, 6, 2, 3, 8, 2, -1, -1, -1, -1},
-    {9, 5, 6, 9, 6, 0, 0, 6, 2, -1, -1, -1, -1, -1, -1, -1},
-    {1, 5, 8, 1, 8, 0, 5, 6, 8, 3, 8, 2, 6, 2, 8, -1},
-    {1, 5, 6, 2, 1, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {1, 3, 6, 1, 6, 10, 3, 8, 6, 5, 6, 9, 8, 9, 6, -1},
-    {10, 1, 0, 10, 0, 6, 9, 5, 0, 5, 6, 0, -1, -1, -1, -1},
-    {0, 3, 8, 5, 6, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {10, 5, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {11, 5, 10, 7, 5, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {11, 5, 10, 11, 7, 5, 8, 3, 0, -1, -1, -1, -1, -1, -1, -1},
-    {5, 11, 7, 5, 10, 11, 1, 9, 0, -1, -1, -1, -1, -1, -1, -1},
-    {10, 7, 5, 10, 11, 7, 9, 8, 1, 8, 3, 1, -1, -1, -1, -1},
-    {11, 1, 2, 11, 7, 1, 7, 5, 1, -1, -1, -1, -1, -1, -1, -1},
-    {0, 8, 3, 1, 2, 7, 1, 7, 5, 7, 2, 11, -1, -1, -1, -1},
-    {9, 7, 5, 9, 2, 7, 9, 0, 2, 2, 11, 7, -1, -1, -1, -1},
-    {7, 5, 2, 7, 2, 11, 5, 9, 2, 3, 2, 8, 9, 8, 2, -1},
-    {2, 5, 10, 2, 3, 5, 3, 7, 5, -1, -1, -1, -1, -1, -1, -1},
-    {8, 2, 0, 8, 5, 2, 8, 7, 5, 10, 2, 5, -1, -1, -1, -1},
-    {9, 0, 1, 5, 10, 3, 5, 3, 7, 3, 10, 2, -1, -1, -1, -1},
-    {9, 8, 2, 9, 2, 1, 8, 7, 2, 10, 2, 5, 7, 5, 2, -1},
-    {1, 3, 5, 3, 7, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {0, 8, 7, 0, 7, 1, 1, 7, 5, -1, -1, -1, -1, -1, -1, -1},
-    {9, 0, 3, 9, 3, 5, 5, 3, 7, -1, -1, -1, -1, -1, -1, -1},
-    {9, 8, 7, 5, 9, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {5, 8, 4, 5, 10, 8, 10, 11, 8, -1, -1, -1, -1, -1, -1, -1},
-    {5, 0, 4, 5, 11, 0, 5, 10, 11, 11, 3, 0, -1, -1, -1, -1},
-    {0, 1, 9, 8, 4, 10, 8, 10, 11, 10, 4, 5, -1, -1, -1, -1},
-    {10, 11, 4, 10, 4, 5, 11, 3, 4, 9, 4, 1, 3, 1, 4, -1},
-    {2, 5, 1, 2, 8, 5, 2, 11, 8, 4, 5, 8, -1, -1, -1, -1},
-    {0, 4, 11, 0, 11, 3, 4, 5, 11, 2, 11, 1, 5, 1, 11, -1},
-    {0, 2, 5, 0, 5, 9, 2, 11, 5, 4, 5, 8, 11, 8, 5, -1},
-    {9, 4, 5, 2, 11, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {2, 5, 10, 3, 5, 2, 3, 4, 5, 3, 8, 4, -1, -1, -1, -1},
-    {5, 10, 2, 5, 2, 4, 4, 2, 0, -1, -1, -1, -1, -1, -1, -1},
-    {3, 10, 2, 3, 5, 10, 3, 8, 5, 4, 5, 8, 0, 1, 9, -1},
-    {5, 10, 2, 5, 2, 4, 1, 9, 2, 9, 4, 2, -1, -1, -1, -1},
-    {8, 4, 5, 8, 5, 3, 3, 5, 1, -1, -1, -1, -1, -1, -1, -1},
-    {0, 4, 5, 1, 0, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {8, 4, 5, 8, 5, 3, 9, 0, 5, 0, 3, 5, -1, -1, -1, -1},
-    {9, 4, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {4, 11, 7, 4, 9, 11, 9, 10, 11, -1, -1, -1, -1, -1, -1, -1},
-    {0, 8, 3, 4, 9, 7, 9, 11, 7, 9, 10, 11, -1, -1, -1, -1},
-    {1, 10, 11, 1, 11, 4, 1, 4, 0, 7, 4, 11, -1, -1, -1, -1},
-    {3, 1, 4, 3, 4, 8, 1, 10, 4, 7, 4, 11, 10, 11, 4, -1},
-    {4, 11, 7, 9, 11, 4, 9, 2, 11, 9, 1, 2, -1, -1, -1, -1},
-    {9, 7, 4, 9, 11, 7, 9, 1, 11, 2, 11, 1, 0, 8, 3, -1},
-    {11, 7, 4, 11, 4, 2, 2, 4, 0, -1, -1, -1, -1, -1, -1, -1},
-    {11, 7, 4, 11, 4, 2, 8, 3, 4, 3, 2, 4, -1, -1, -1, -1},
-    {2, 9, 10, 2, 7, 9, 2, 3, 7, 7, 4, 9, -1, -1, -1, -1},
-    {9, 10, 7, 9, 7, 4, 10, 2, 7, 8, 7, 0, 2, 0, 7, -1},
-    {3, 7, 10, 3, 10, 2, 7, 4, 10, 1, 10, 0, 4, 0, 10, -1},
-    {1, 10, 2, 8, 7, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {4, 9, 1, 4, 1, 7, 7, 1, 3, -1, -1, -1, -1, -1, -1, -1},
-    {4, 9, 1, 4, 1, 7, 0, 8, 1, 8, 7, 1, -1, -1, -1, -1},
-    {4, 0, 3, 7, 4, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {4, 8, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {9, 10, 8, 10, 11, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {3, 0, 9, 3, 9, 11, 11, 9, 10, -1, -1, -1, -1, -1, -1, -1},
-    {0, 1, 10, 0, 10, 8, 8, 10, 11, -1, -1, -1, -1, -1, -1, -1},
-    {3, 1, 10, 11, 3, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {1, 2, 11, 1, 11, 9, 9, 11, 8, -1, -1, -1, -1, -1, -1, -1},
-    {3, 0, 9, 3, 9, 11, 1, 2, 9, 2, 11, 9, -1, -1, -1, -1},
-    {0, 2, 11, 8, 0, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {3, 2, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {2, 3, 8, 2, 8, 10, 10, 8, 9, -1, -1, -1, -1, -1, -1, -1},
-    {9, 10, 2, 0, 9, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {2, 3, 8, 2, 8, 10, 0, 1, 8, 1, 10, 8, -1, -1, -1, -1},
-    {1, 10, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {1, 3, 8, 9, 1, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {0, 9, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {0, 3, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1}
-};
 
 class MarchingCubesCompute : public Computable<MarchingCubesCompute, glm::vec4> {
 public:
+    // Where one brick's triangles ended up in the triangle buffer
+    struct BrickRange {
+        GLuint offset;
+        GLuint count;
+    };
+
     explicit MarchingCubesCompute(
         ShaderStorageBuffer<glm::vec4>&& ssbo_points,
         ShaderStorageBuffer<Triangle>&& ssbo_triangles, 
-        ShaderStorageBuffer<int>&& ssbo_triangulation,
+        ShaderStorageBuffer<uint64_t>&& ssbo_triangulation,
         ShaderStorageBuffer<float>&& ssbo_scratch,
-        AtomicBufferObject&& asb_num_triangles
+        ShaderStorageBuffer<GpuBounds>&& ssbo_bounds,
+        ShaderStorageBuffer<GpuOccluderColumns>&& ssbo_occluder_columns,
+        ShaderStorageBuffer<glm::vec4>&& ssbo_surface_points,
+        ShaderStorageBuffer<GpuBrush>&& ssbo_brushes,
+        ShaderStorageBuffer<GpuBrickTriangles>&& ssbo_brick_triangles,
+        AtomicBufferObject&& asb_num_surface_points
     ) 
         : _points(std::move(ssbo_points)),
           _triangles(std::move(ssbo_triangles)),
           _triangulation(std::move(ssbo_triangulation)),
           _scratch_buffer(std::move(ssbo_scratch)),
-          _num_triangles_buffer(std::move(asb_num_triangles)),
+          _bounds_buffer(std::move(ssbo_bounds)),
+          _occluder_columns_buffer(std::move(ssbo_occluder_columns)),
+          _surface_points(std::move(ssbo_surface_points)),
+          _brushes(std::move(ssbo_brushes)),
+          _brick_triangles(std::move(ssbo_brick_triangles)),
+          _num_surface_points_buffer(std::move(asb_num_surface_points)),
           _shader_stage1(Shader::create(ShaderInfo { "shaders/marching_cubes_stage1.compute", ShaderType::COMPUTE })),
           _shader_stage2(Shader::create(ShaderInfo { "shaders/marching_cubes_stage2.compute", ShaderType::COMPUTE })),
-          _num_triangles(0)
+          _shader_surface_points(Shader::create(ShaderInfo { "shaders/surface_points.compute", ShaderType::COMPUTE })),
+          _num_triangles(0),
+          _triangle_capacity(INITIAL_TRIANGLE_CAPACITY),
+          _surface_point_capacity(0),
+          _brush_capacity(INITIAL_BRUSH_CAPACITY),
+          _brick_ranges{}
     {
     }
 
@@ -360,75 +132,700 @@ public:
         ssbo_points.reserve_storage(num_components * sizeof(glm::vec4), StorageType::DYNAMIC);
 
         auto ssbo_triangles = ShaderStorageBuffer<Triangle>(1);
-        ssbo_triangles.reserve_storage(sizeof(Triangle) * num_components * 2, StorageType::DYNAMIC);
+        ssbo_triangles.reserve_storage(sizeof(Triangle) * INITIAL_TRIANGLE_CAPACITY, StorageType::DYNAMIC);
 
-        auto ssbo_triangulation = ShaderStorageBuffer<int>(2);
-        ssbo_triangulation.reserve_storage(sizeof(triangulation), StorageType::STATIC);
+        // Little endian, so each entry reads back as uvec2(low, high) in stage 2
+        auto ssbo_triangulation = ShaderStorageBuffer<uint64_t>(2);
+        ssbo_triangulation.reserve_storage(sizeof(PACKED_TRIANGULATION), StorageType::STATIC);
 
         auto triangulation_buffer = ssbo_triangulation.map_buffer(BufferIntent::WRITE);
         assert(triangulation_buffer != nullptr);
-        memcpy(triangulation_buffer, triangulation, sizeof(triangulation));
+        memcpy(triangulation_buffer, PACKED_TRIANGULATION.data(), sizeof(PACKED_TRIANGULATION));
         ssbo_triangulation.unmap_buffer();
 
         auto ssbo_scratch = ShaderStorageBuffer<float>(3);
         ssbo_scratch.reserve_storage(1000 * sizeof(float), StorageType::STATIC);
 
-        auto asb_num_triangles = AtomicBufferObject(0);
-        asb_num_triangles.reserve_storage(sizeof(GLuint), StorageType::DYNAMIC);
+        auto ssbo_bounds = ShaderStorageBuffer<GpuBounds>(4);
+        ssbo_bounds.reserve_storage(sizeof(GpuBounds), StorageType::DYNAMIC);
+
+        auto ssbo_occluder_columns = ShaderStorageBuffer<GpuOccluderColumns>(5);
+        ssbo_occluder_columns.reserve_storage(sizeof(GpuOccluderColumns), StorageType::DYNAMIC);
+
+        // Storage is reserved on the first extraction, most runs never enable the point view
+        auto ssbo_surface_points = ShaderStorageBuffer<glm::vec4>(6);
+
+        auto ssbo_brushes = ShaderStorageBuffer<GpuBrush>(7);
+        ssbo_brushes.reserve_storage(sizeof(GpuBrush) * INITIAL_BRUSH_CAPACITY, StorageType::DYNAMIC);
+
+        auto ssbo_brick_triangles = ShaderStorageBuffer<GpuBrickTriangles>(8);
+        ssbo_brick_triangles.reserve_storage(sizeof(GpuBrickTriangles), StorageType::DYNAMIC);
+
+        auto asb_num_surface_points = AtomicBufferObject(1);
+        asb_num_surface_points.reserve_storage(sizeof(GLuint), StorageType::DYNAMIC);
 
         return std::make_shared<MarchingCubesCompute>(
             std::move(ssbo_points),
             std::move(ssbo_triangles),
             std::move(ssbo_triangulation),
             std::move(ssbo_scratch),
-            std::move(asb_num_triangles)
+            std::move(ssbo_bounds),
+            std::move(ssbo_occluder_columns),
+            std::move(ssbo_surface_points),
+            std::move(ssbo_brushes),
+            std::move(ssbo_brick_triangles),
+            std::move(asb_num_surface_points)
         );
     }
 
     // NOTE: Remember to change shader if axis_length changes
-    void dispatch_impl(const GenerationSettings& settings, const glm::ivec3 offset, const int axis_length) {
-        // Reset triangle count
-        _num_triangles_buffer.clear();
+    void dispatch_impl(
+        const GenerationSettings& settings,
+        const glm::ivec3 offset,
+        const int axis_length,
+        const EditIndex& edits
+    )
+    {
+        TRACE_ZONE("MarchingCubesCompute::dispatch_impl");
+
+        // Columns start fully solid
+        auto columns_buffer = _occluder_columns_buffer.map_buffer(BufferIntent::WRITE);
+        std::fill(std::begin(columns_buffer->lowest_air), std::end(columns_buffer->lowest_air), axis_length);
+        _occluder_columns_buffer.unmap_buffer();
+
+        _constant_air_row = axis_length;
+        if (settings.extractor == ExtractorType::MARCHING_CUBES_GPU) {
+            extract(settings, offset, axis_length, edits, glm::ivec3(0), glm::ivec3(axis_length - 1));
+        } else {
+            extract_on_cpu(settings, offset, axis_length, edits);
+        }
+        read_occluders(offset, axis_length);
+    }
+
+    // True when every sample of the chunk is on the terrain floor or every
+    // sample is on the ceiling and no edit reaches it, so it has no surface
+    // and value is the density all of them share
+    bool uniform_density(
+        const glm::ivec3 offset,
+        const int axis_length,
+        const EditIndex& edits,
+        float& value
+    ) const
+    {
+        if (_custom_density || !constant_rows(float(offset.y), float(offset.y + axis_length - 1), value)) {
+            return false;
+        }
+
+        auto overlapping = std::vector<uint32_t>();
+        edits.query(BoundingBox(glm::vec3(offset), glm::vec3(offset + axis_length - 1)), overlapping);
+        return overlapping.empty();
+    }
+
+    // Regenerates and remeshes only the cells in [cell_min, cell_max). Occluders
+    // are left as they were, the caller decides which ones the edit invalidated.
+    // GPU marching cubes only, the CPU extractors remesh the whole chunk.
+    void dispatch_region(
+        const GenerationSettings& settings,
+        const glm::ivec3 offset,
+        const int axis_length,
+        const EditIndex& edits,
+        const glm::ivec3 cell_min,
+        const glm::ivec3 cell_max
+    )
+    {
+        TRACE_ZONE("MarchingCubesCompute::dispatch_region");
+        extract(settings, offset, axis_length, edits, cell_min, cell_max);
+    }
+
+    // Stage 1 only, refills the density grid without extracting triangles
+    void dispatch_density(
+        const GenerationSettings& settings,
+        const glm::ivec3 offset,
+        const int axis_length,
+        const EditIndex& edits
+    )
+    {
+        dispatch_stage1(settings, offset, axis_length, edits, glm::ivec3(0), glm::ivec3(axis_length));
+    }
+
+    // Compacts the samples next to the surface out of the current density
+    // grid into surface_points_buffer() and returns how many there are
+    GLuint extract_surface_points(const GenerationSettings& settings, const int axis_length) {
+        TRACE_ZONE("MarchingCubesCompute::extract_surface_points");
+
+        if (_surface_point_capacity == 0) {
+            grow_surface_points(INITIAL_SURFACE_POINT_CAPACITY);
+        }
+
+        auto num_points = dispatch_surface_points(settings, axis_length);
+        if (num_points > _surface_point_capacity) {
+            grow_surface_points(num_points + num_points / 4);
+            num_points = dispatch_surface_points(settings, axis_length);
+        }
+
+        return num_points;
+    }
+
+    // Rebuilds stage 1 with glsl in place of its procedural_density, see
+    // density_graph::glsl_function. Sculpting, occluders and the rest of
+    // the pipeline are unchanged. The noise uniforms are no longer set, so
+    // the function has to be rebuilt when the settings it bakes in change.
+    // Nothing is compiled when glsl is the function already in use. If the
+    // source fails to compile or link, stage 1 stays as it was, the log is
+    // kept in density_function_error and false is returned.
+    bool set_density_function(const std::string& glsl) {
+        if (_custom_density && glsl == _density_function) {
+            return true;
+        }
+        auto source = Shader::read_source("shaders/marching_cubes_stage1.compute");
+        try {
+            replace_stage1(Shader::create_from_source(density_graph::splice_density_function(source, glsl), ShaderType::COMPUTE));
+        } catch (const std::runtime_error& error) {
+            _density_error = error.what();
+            return false;
+        }
+        _density_function = glsl;
+        _density_error.clear();
+        _custom_density = true;
+        return true;
+    }
+
+    // Compile or link log of the last set_density_function that failed,
+    // empty once one succeeds or the density function is reset
+    const std::string& density_function_error() const {
+        return _density_error;
+    }
+
+    // Back to stage 1's own procedural_density and the noise uniforms
+    void reset_density_function() {
+        _density_error.clear();
+        if (!_custom_density) {
+            return;
+        }
+        replace_stage1(Shader::create(ShaderInfo { "shaders/marching_cubes_stage1.compute", ShaderType::COMPUTE }));
+        _density_function.clear();
+        _custom_density = false;
+    }
+
+    // Every dispatch from now on also feeds readback's density cache
+    void set_density_readback(std::shared_ptr<DensityReadback> readback) {
+        _density_readback = readback;
+    }
+
+    // Null until set_density_readback
+    DensityReadback* density_readback() const {
+        return _density_readback.get();
+    }
+
+    GLuint num_triangles() const {
+        return _num_triangles;
+    }
+
+    // Triangles of one brick from the last dispatch, bricks outside the
+    // dispatched region are empty
+    BrickRange brick_range(int brick) const {
+        return _brick_ranges[brick];
+    }
+
+    // Number of triangles the triangle buffer currently has room for
+    GLuint triangle_capacity() const {
+        return _triangle_capacity;
+    }
+
+    // Tight bounds of the triangles produced by the last dispatch
+    const BoundingBox& bounds() const {
+        return _bounds;
+    }
+
+    // Conservative solid boxes for software occlusion culling, every sample
+    // inside them is below iso_level so they sit behind the extracted surface
+    const std::vector<BoundingBox>& occluders() const {
+        return _occluders;
+    }
+
+    const ShaderStorageBuffer<Triangle>& triangle_buffer() const {
+        return _triangles;
+    }
+
+    const ShaderStorageBuffer<glm::vec4>& points_buffer() const {
+        return _points;
+    }
+
+    const ShaderStorageBuffer<glm::vec4>& surface_points_buffer() const {
+        return _surface_points;
+    }
 
+private:
+    // Stage 1 over the samples the cells need, then stage 2 counts triangles
+    // per brick, the buffer is sized and laid out from those counts and a
+    // second stage 2 pass writes every triangle into its brick's range
+    void extract(
+        const GenerationSettings& settings,
+        const glm::ivec3 offset,
+        const int axis_length,
+        const EditIndex& edits,
+        const glm::ivec3 cell_min,
+        const glm::ivec3 cell_max
+    )
+    {
+        // Reset bounds to an inverted (empty) box
+        auto bounds_buffer = _bounds_buffer.map_buffer(BufferIntent::WRITE);
+        bounds_buffer->min = glm::ivec4(INT_MAX);
+        bounds_buffer->max = glm::ivec4(INT_MIN);
+        _bounds_buffer.unmap_buffer();
+
+        auto bricks = _brick_triangles.map_buffer(BufferIntent::WRITE);
+        std::fill(std::begin(bricks->counts), std::end(bricks->counts), 0u);
+        _brick_triangles.unmap_buffer();
+
+        // Constant rows are neither sampled nor visited, they cannot emit triangles
+        auto surface_min = cell_min;
+        auto surface_max = cell_max;
+        auto has_surface = surface_cells(offset, edits, surface_min, surface_max);
+        _constant_air_row = constant_air_row(settings, offset, axis_length, surface_min.y, has_surface ? surface_max.y : -1);
+        auto full = cell_min == glm::ivec3(0) && cell_max == glm::ivec3(axis_length - 1);
+        if (!has_surface) {
+            // Only possible when every row is floor or every row is ceiling
+            auto value = 0.0f;
+            if (_density_readback && full && constant_rows(float(offset.y), float(offset.y + axis_length - 1), value)) {
+                _density_readback->store_uniform(offset, value);
+            }
+            _num_triangles = 0;
+            std::fill(std::begin(_brick_ranges), std::end(_brick_ranges), BrickRange { 0, 0 });
+            _bounds = BoundingBox();
+            return;
+        }
+
+        dispatch_stage1(settings, offset, axis_length, edits, surface_min, surface_max + 1);
+        if (_density_readback) {
+            _density_readback->request(offset, axis_length, surface_min, surface_max + 1, full, _points);
+        }
+        dispatch_stage2(settings, axis_length, surface_min, surface_max, true);
+
+        {
+            // Reading the counts back waits for both passes to finish on the GPU
+            TRACE_ZONE("readback");
+            _num_triangles = 0;
+            bricks = _brick_triangles.map_buffer(BufferIntent::READ_WRITE);
+            for (auto brick = 0; brick < NUM_BRICKS; brick++) {
+                _brick_ranges[brick] = BrickRange { _num_triangles, bricks->counts[brick] };
+                bricks->cursors[brick] = _num_triangles;
+                _num_triangles += bricks->counts[brick];
+            }
+            _brick_triangles.unmap_buffer();
+            TRACE_COUNTER("triangles emitted", _num_triangles);
+        }
+
+        if (_num_triangles > _triangle_capacity) {
+            grow_triangles(_num_triangles);
+        }
+
+        dispatch_stage2(settings, axis_length, surface_min, surface_max, false);
+
+        auto bounds = _bounds_buffer.map_buffer(BufferIntent::READ);
+        _bounds = bounds->to_bounding_box();
+        _bounds_buffer.unmap_buffer();
+    }
+
+    // Narrows the cells [cell_min, cell_max) in y to the rows that can hold a
+    // surface. A cell whose samples are all on the floor or all on the ceiling
+    // is constant unless an edit reaches it. False when no cell is left.
+    bool surface_cells(
+        const glm::ivec3 offset,
+        const EditIndex& edits,
+        glm::ivec3& cell_min,
+        glm::ivec3& cell_max
+    ) const
+    {
+        if (_custom_density || glm::any(glm::greaterThanEqual(cell_min, cell_max))) {
+            return glm::all(glm::lessThan(cell_min, cell_max));
+        }
+
+        // Constant cells sit below and above the noise rows, so the rest are contiguous
+        auto is_constant = [&](int cell) {
+            auto value = 0.0f;
+            return constant_rows(float(offset.y + cell), float(offset.y + cell + 1), value);
+        };
+        auto first = cell_min.y;
+        auto end = cell_max.y;
+        while (first < end && is_constant(first)) {
+            first++;
+        }
+        while (end > first && is_constant(end - 1)) {
+            end--;
+        }
+        if (first == end) {
+            first = cell_max.y;
+            end = cell_min.y;
+        }
+
+        // Cells that read a sample an edit can change
+        auto overlapping = std::vector<uint32_t>();
+        edits.query(BoundingBox(glm::vec3(offset + cell_min), glm::vec3(offset + cell_max)), overlapping);
+        for (auto id : overlapping) {
+            auto box = edits.edit(id).bounds();
+            first = std::min(first, std::max(int(std::ceil(box.min.y)) - offset.y - 1, cell_min.y));
+            end = std::max(end, std::min(int(std::floor(box.max.y)) - offset.y + 1, cell_max.y));
+        }
+
+        if (first >= end) {
+            return false;
+        }
+
+        cell_min.y = first;
+        cell_max.y = end;
+        return true;
+    }
+
+    // Lowest sample row outside [first_row, last_row] that is constant air,
+    // those rows are not sampled so stage 1 cannot report them to the occluders
+    int constant_air_row(
+        const GenerationSettings& settings,
+        const glm::ivec3 offset,
+        const int axis_length,
+        const int first_row,
+        const int last_row
+    ) const
+    {
+        for (auto row = 0; row < axis_length; row++) {
+            auto value = 0.0f;
+            auto skipped = row < first_row || row > last_row;
+            if (skipped && constant_rows(float(offset.y + row), float(offset.y + row), value) && value >= settings.iso_level) {
+                return row;
+            }
+        }
+        return axis_length;
+    }
+
+    // Stage 1 on the GPU so sculpting edits apply, then the grid is read back
+    // and meshed by the CPU extractor. Triangles are bucketed into bricks by
+    // centroid and written to the triangle buffer in the same layout as stage 2.
+    void extract_on_cpu(
+        const GenerationSettings& settings,
+        const glm::ivec3 offset,
+        const int axis_length,
+        const EditIndex& edits
+    )
+    {
+        TRACE_ZONE("MarchingCubesCompute::extract_on_cpu");
+
+        if (!_cpu_extractor || _cpu_extractor_type != settings.extractor) {
+            _cpu_extractor = Extractor::create(settings.extractor);
+            _cpu_extractor_type = settings.extractor;
+        }
+
+        dispatch_stage1(settings, offset, axis_length, edits, glm::ivec3(0), glm::ivec3(axis_length));
+
+        {
+            TRACE_ZONE("readback");
+            _density_grid.resize(axis_length);
+            _density_grid.offset = offset;
+            auto points = _points.map_buffer(BufferIntent::READ);
+            for (std::size_t i = 0; i < _density_grid.values.size(); i++) {
+                _density_grid.values[i] = points[i].w;
+            }
+            _points.unmap_buffer();
+        }
+
+        if (_density_readback) {
+            _density_readback->store(_density_grid);
+        }
+
+        const auto* grid = &_density_grid;
+        if (_cpu_extractor->overlap() > 0) {
+            sample_overlap(settings, offset, axis_length, edits, _cpu_extractor->overlap());
+            grid = &_overlap_grid;
+        }
+
+        {
+            TRACE_ZONE("extract");
+            _cpu_extractor->extract(*grid, settings.iso_level, _cpu_mesh);
+        }
+
+        auto num_triangles = GLuint(_cpu_mesh.num_triangles());
+        TRACE_COUNTER("triangles emitted", num_triangles);
+
+        // Counting sort by brick
+        _triangle_bricks.resize(num_triangles);
+        _extraction_memory.set(
+            _density_grid.values.capacity() * sizeof(float) +
+            _overlap_grid.values.capacity() * sizeof(float) +
+            _cpu_mesh.vertices.capacity() * sizeof(MeshVertex) +
+            _cpu_mesh.indices.capacity() * sizeof(uint32_t) +
+            _triangle_bricks.capacity());
+        GLuint counts[NUM_BRICKS] = {};
+        for (auto triangle = 0u; triangle < num_triangles; triangle++) {
+            auto centroid = glm::vec3(0.0f);
+            for (auto corner = 0; corner < 3; corner++) {
+                centroid += glm::vec3(_cpu_mesh.vertices[_cpu_mesh.indices[triangle * 3 + corner]].position);
+            }
+            auto cell = glm::clamp(glm::ivec3(glm::floor(centroid / 3.0f)) - offset, glm::ivec3(0), glm::ivec3(axis_length - 2));
+            auto brick_coord = cell / BRICK_CELLS;
+            auto brick = (brick_coord.x * BRICKS_PER_AXIS + brick_coord.y) * BRICKS_PER_AXIS + brick_coord.z;
+            _triangle_bricks[triangle] = uint8_t(brick);
+            counts[brick]++;
+        }
+
+        GLuint cursors[NUM_BRICKS];
+        _num_triangles = 0;
+        for (auto brick = 0; brick < NUM_BRICKS; brick++) {
+            _brick_ranges[brick] = BrickRange { _num_triangles, counts[brick] };
+            cursors[brick] = _num_triangles;
+            _num_triangles += counts[brick];
+        }
+
+        if (_num_triangles > _triangle_capacity) {
+            grow_triangles(_num_triangles);
+        }
+
+        _bounds = BoundingBox();
+        if (_num_triangles == 0) {
+            return;
+        }
+
+        // Triangle is three MeshVertex back to back
+        static_assert(sizeof(Triangle) == 3 * sizeof(MeshVertex), "Triangle must match three MeshVertex");
+        auto triangles = _triangles.map_buffer(BufferIntent::WRITE);
+        for (auto triangle = 0u; triangle < num_triangles; triangle++) {
+            MeshVertex corners[3];
+            for (auto corner = 0; corner < 3; corner++) {
+                corners[corner] = _cpu_mesh.vertices[_cpu_mesh.indices[triangle * 3 + corner]];
+            }
+            memcpy(&triangles[cursors[_triangle_bricks[triangle]]++], corners, sizeof(corners));
+        }
+        _triangles.unmap_buffer();
+
+        auto bounds_min = glm::vec3(std::numeric_limits<float>::max());
+        auto bounds_max = glm::vec3(std::numeric_limits<float>::lowest());
+        for (const auto& vertex : _cpu_mesh.vertices) {
+            bounds_min = glm::min(bounds_min, glm::vec3(vertex.position));
+            bounds_max = glm::max(bounds_max, glm::vec3(vertex.position));
+        }
+        _bounds = BoundingBox(bounds_min, bounds_max);
+    }
+
+    // Fills _overlap_grid with the chunk's samples and the ring of overlap
+    // samples before it on each axis. Stage 1 samples the ring too, so edits
+    // reach it. Every dispatch writes from the start of the grid buffer, so
+    // the ring goes in seven blocks, the three faces, the three edges where
+    // they meet and the corner, each read back before the next.
+    void sample_overlap(
+        const GenerationSettings& settings,
+        const glm::ivec3 offset,
+        const int axis_length,
+        const EditIndex& edits,
+        const int overlap
+    )
+    {
+        TRACE_ZONE("overlap ring");
+
+        const auto length = axis_length + overlap;
+        _overlap_grid.resize(length);
+        _overlap_grid.offset = offset - glm::ivec3(overlap);
+        for (auto x = 0; x < axis_length; x++) {
+            for (auto y = 0; y < axis_length; y++) {
+                std::copy_n(&_density_grid.at(x, y, 0), axis_length, &_overlap_grid.at(x + overlap, y + overlap, overlap));
+            }
+        }
+
+        // The occluder columns describe the chunk, not the ring
+        auto columns = *_occluder_columns_buffer.map_buffer(BufferIntent::READ);
+        _occluder_columns_buffer.unmap_buffer();
+
+        for (auto ring_axes = 1; ring_axes < 8; ring_axes++) {
+            auto shift = glm::ivec3(0);
+            auto extent = glm::ivec3(axis_length);
+            for (auto axis = 0; axis < 3; axis++) {
+                if ((ring_axes >> axis) & 1) {
+                    shift[axis] = -overlap;
+                    extent[axis] = overlap;
+                }
+            }
+            dispatch_stage1(settings, offset + shift, axis_length, edits, glm::ivec3(0), extent);
+
+            auto end = (std::size_t(extent.x - 1) * axis_length + extent.y - 1) * axis_length + extent.z;
+            auto points = _points.map_buffer_range(0, end * sizeof(glm::vec4), BufferIntentRange::READ);
+            for (auto x = 0; x < extent.x; x++) {
+                for (auto y = 0; y < extent.y; y++) {
+                    for (auto z = 0; z < extent.z; z++) {
+                        auto sample = glm::ivec3(x, y, z) + shift + overlap;
+                        _overlap_grid.at(sample.x, sample.y, sample.z) = points[(std::size_t(x) * axis_length + y) * axis_length + z].w;
+                    }
+                }
+            }
+            _points.unmap_buffer();
+        }
+
+        *_occluder_columns_buffer.map_buffer(BufferIntent::WRITE) = columns;
+        _occluder_columns_buffer.unmap_buffer();
+    }
+
+    void dispatch_stage1(
+        const GenerationSettings& settings,
+        const glm::ivec3 offset,
+        const int axis_length,
+        const EditIndex& edits,
+        const glm::ivec3 sample_min,
+        const glm::ivec3 sample_max
+    )
+    {
+        TRACE_ZONE("stage 1");
+
+        // The smooth brush reads one sample past the region
+        upload_brushes(edits, BoundingBox(
+            glm::vec3(offset + sample_min) - glm::vec3(1.0f),
+            glm::vec3(offset + sample_max)
+        ));
+
+        auto extent = sample_max - sample_min;
         _shader_stage1.use();
-        _shader_stage1.set_float("persistence", settings.persistence);
-        _shader_stage1.set_float("scale", settings.scale);
-        _shader_stage1.set_float("lacunarity", settings.lacunarity);
-        _shader_stage1.set_int("octaves", settings.octaves);
+        // Generated density functions bake their parameters in, so the noise
+        // uniforms are compiled out
+        if (!_custom_density) {
+            _shader_stage1.set_float("persistence", settings.persistence);
+            _shader_stage1.set_float("scale", settings.scale);
+            _shader_stage1.set_float("lacunarity", settings.lacunarity);
+            _shader_stage1.set_int("octaves", settings.octaves);
+        }
+        _shader_stage1.set_float("iso_level", settings.iso_level);
         _shader_stage1.set_int("axis_length", axis_length);
         _shader_stage1.set_ivec3("offset", offset);
-        GL_CHECK(glDispatchCompute(axis_length, axis_length, axis_length));
+        _shader_stage1.set_ivec3("sample_min", sample_min);
+        _shader_stage1.set_ivec3("sample_max", sample_max);
+        _shader_stage1.set_int("num_brushes", int(_brush_ids.size()));
+        GL_CHECK(glDispatchCompute(extent.x, extent.y, extent.z));
         GL_CHECK(glMemoryBarrier( GL_SHADER_STORAGE_BARRIER_BIT));
+    }
 
+    void dispatch_stage2(
+        const GenerationSettings& settings,
+        const int axis_length,
+        const glm::ivec3 cell_min,
+        const glm::ivec3 cell_max,
+        bool count_only
+    )
+    {
+        TRACE_ZONE(count_only ? "stage 2 count" : "stage 2 write");
+
+        auto extent = cell_max - cell_min;
         _shader_stage2.use();
         _shader_stage2.set_float("iso_level", settings.iso_level);
         _shader_stage2.set_int("axis_length", axis_length);
-        GL_CHECK(glDispatchCompute(axis_length, axis_length, axis_length));
+        _shader_stage2.set_ivec3("cell_min", cell_min);
+        _shader_stage2.set_ivec3("cell_max", cell_max);
+        _shader_stage2.set_bool("count_only", count_only);
+        GL_CHECK(glDispatchCompute(extent.x, extent.y, extent.z));
         GL_CHECK(glMemoryBarrier( GL_SHADER_STORAGE_BARRIER_BIT));
+    }
+
+    void upload_brushes(const EditIndex& edits, const BoundingBox& region) {
+        edits.query(region, _brush_ids);
+        if (_brush_ids.empty()) {
+            return;
+        }
 
-        _num_triangles = _num_triangles_buffer.read();
+        if (_brush_ids.size() > _brush_capacity) {
+            _brush_capacity = GLuint(_brush_ids.size() * 2);
+            _brushes.reserve_storage(sizeof(GpuBrush) * _brush_capacity, StorageType::DYNAMIC);
+        }
+
+        auto brushes = _brushes.map_buffer(BufferIntent::WRITE);
+        for (auto i = 0u; i < _brush_ids.size(); i++) {
+            brushes[i] = GpuBrush(edits.edit(_brush_ids[i]));
+        }
+        _brushes.unmap_buffer();
     }
 
-    GLuint num_triangles() const {
-        return _num_triangles;
+    // The new program is built before the old one goes, so a shader that
+    // fails to compile leaves stage 1 as it was
+    void replace_stage1(Shader stage1) {
+        _shader_stage1.destroy();
+        _shader_stage1 = stage1;
     }
 
-    const ShaderStorageBuffer<Triangle>& triangle_buffer() const {
-        return _triangles;
+    // Leaves a quarter of headroom so a slightly busier chunk does not grow it again
+    void grow_triangles(GLuint num_triangles) {
+        _triangle_capacity = num_triangles + num_triangles / 4;
+        _triangles.reserve_storage(sizeof(Triangle) * _triangle_capacity, StorageType::DYNAMIC);
     }
 
-    const ShaderStorageBuffer<glm::vec4>& points_buffer() const {
-        return _points;
+    GLuint dispatch_surface_points(const GenerationSettings& settings, const int axis_length) {
+        _num_surface_points_buffer.clear();
+        _shader_surface_points.use();
+        _shader_surface_points.set_float("iso_level", settings.iso_level);
+        _shader_surface_points.set_int("axis_length", axis_length);
+        _shader_surface_points.set_int("max_points", int(_surface_point_capacity));
+        GL_CHECK(glDispatchCompute(axis_length, axis_length, axis_length));
+        GL_CHECK(glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_ATOMIC_COUNTER_BARRIER_BIT));
+        return _num_surface_points_buffer.read();
+    }
+
+    void grow_surface_points(GLuint num_points) {
+        _surface_point_capacity = num_points;
+        _surface_points.reserve_storage(sizeof(glm::vec4) * _surface_point_capacity, StorageType::DYNAMIC);
+    }
+
+    void read_occluders(const glm::ivec3 offset, const int axis_length) {
+        _occluders.clear();
+
+        auto column_width = (axis_length + OCCLUDER_COLUMNS - 1) / OCCLUDER_COLUMNS;
+        auto columns = _occluder_columns_buffer.map_buffer(BufferIntent::READ);
+        for (auto x = 0; x < OCCLUDER_COLUMNS; x++) {
+            for (auto z = 0; z < OCCLUDER_COLUMNS; z++) {
+                auto lowest_air = std::min(columns->lowest_air[x * OCCLUDER_COLUMNS + z], _constant_air_row);
+                auto x_end = std::min((x + 1) * column_width, axis_length) - 1;
+                auto z_end = std::min((z + 1) * column_width, axis_length) - 1;
+
+                // Need at least one full cell of solid samples
+                if (lowest_air < 2 || x * column_width >= x_end || z * column_width >= z_end) {
+                    continue;
+                }
+
+                _occluders.emplace_back(
+                    glm::vec3(offset) + glm::vec3(x * column_width, 0.0f, z * column_width),
+                    glm::vec3(offset) + glm::vec3(x_end, lowest_air - 1, z_end)
+                );
+            }
+        }
+        _occluder_columns_buffer.unmap_buffer();
     }
 
-private:
     ShaderStorageBuffer<glm::vec4> _points;
     ShaderStorageBuffer<Triangle> _triangles;
-    ShaderStorageBuffer<int> _triangulation;
+    ShaderStorageBuffer<uint64_t> _triangulation;
     ShaderStorageBuffer<float> _scratch_buffer;
-    AtomicBufferObject _num_triangles_buffer;
+    ShaderStorageBuffer<GpuBounds> _bounds_buffer;
+    ShaderStorageBuffer<GpuOccluderColumns> _occluder_columns_buffer;
+    ShaderStorageBuffer<glm::vec4> _surface_points;
+    ShaderStorageBuffer<GpuBrush> _brushes;
+    ShaderStorageBuffer<GpuBrickTriangles> _brick_triangles;
+    AtomicBufferObject _num_surface_points_buffer;
 
     Shader _shader_stage1;
     Shader _shader_stage2;
+    Shader _shader_surface_points;
     GLuint _num_triangles;
-};
\ No newline at end of file
+    GLuint _triangle_capacity;
+    GLuint _surface_point_capacity;
+    GLuint _brush_capacity;
+    bool _custom_density = false;
+    std::string _density_function;
+    std::string _density_error;
+    std::shared_ptr<DensityReadback> _density_readback;
+    // Lowest air row the last full dispatch skipped, see constant_air_row
+    int _constant_air_row = 0;
+    std::vector<uint32_t> _brush_ids;
+    BrickRange _brick_ranges[NUM_BRICKS];
+    BoundingBox _bounds;
+    std::vector<BoundingBox> _occluders;
+
+    // CPU extraction state, created on first use
+    std::unique_ptr<Extractor> _cpu_extractor;
+    ExtractorType _cpu_extractor_type = ExtractorType::MARCHING_CUBES_GPU;
+    DensityGrid _density_grid;
+    // The chunk with the samples before it the extractor overlaps, if any
+    DensityGrid _overlap_grid;
+    ExtractedMesh _cpu_mesh;
+    std::vector<uint8_t> _triangle_bricks;
+    MemoryRecord _extraction_memory { MemoryTag { MemoryCategory::EXTRACTION } };
+};
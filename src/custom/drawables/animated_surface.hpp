@@ -0,0 +1,88 @@
+#pragma once
+
+#include "../../drawable.hpp"
+#include "../../extractor.hpp"
+#include "glm/glm.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+
+// Indexed mesh that is replaced every frame, drawn for the animated region.
+// Every upload respecifies the buffers, so the driver hands out new storage
+// instead of waiting for draws still reading the old one.
+class AnimatedSurface : public Drawable<AnimatedSurface> {
+public:
+    explicit AnimatedSurface(
+        VertexArrayObject&& t_vao,
+        VertexBufferObject&& t_vbo,
+        VertexBufferObject&& t_ebo
+    ) : _vao(std::move(t_vao)),
+        _vbo(std::move(t_vbo)),
+        _ebo(std::move(t_ebo)),
+        _shader(
+            Shader::create(
+                ShaderInfo { "shaders/light_mvm.vert", ShaderType::VERTEX },
+                ShaderInfo { "shaders/light_mvm.frag", ShaderType::FRAGMENT })) {}
+
+    static AnimatedSurface create() {
+        auto vao = VertexArrayObject();
+        auto vbo = VertexBufferObject(VertexBufferType::ARRAY);
+        auto ebo = VertexBufferObject(VertexBufferType::ELEMENT);
+
+        vao.bind();
+        vbo.bind();
+        ebo.bind();
+
+        // Position, normal and color, like a stage 2 vertex
+        vbo.enable_attribute_pointer(0, 4, VertexDataType::FLOAT, 12, 0);
+        vbo.enable_attribute_pointer(1, 4, VertexDataType::FLOAT, 12, 4);
+        vbo.enable_attribute_pointer(2, 4, VertexDataType::FLOAT, 12, 8);
+
+        vao.unbind();
+
+        return AnimatedSurface(std::move(vao), std::move(vbo), std::move(ebo));
+    }
+
+    void update(const ExtractedMesh& mesh) {
+        _num_indices = GLsizei(mesh.indices.size());
+        if (_num_indices == 0) {
+            return;
+        }
+
+        // The element buffer binding belongs to the VAO
+        _vao.bind();
+        _vbo.bind();
+        _vbo.send_data(mesh.vertices, StorageType::STREAM);
+        _ebo.bind();
+        _ebo.send_data(mesh.indices, StorageType::STREAM);
+        _vao.unbind();
+    }
+
+    void draw(glm::mat4& view, glm::mat4& projection, glm::vec3 light_position, glm::vec3 view_position) const {
+        if (_num_indices == 0) {
+            return;
+        }
+
+        _shader.use();
+        _shader.set_mat4("projection", projection);
+        _shader.set_mat4("view", view);
+        _shader.set_mat4("model", glm::mat4x4(1.0));
+        _shader.set_vec3("light_pos", light_position);
+        _shader.set_vec3("view_pos", view_position);
+        _shader.set_vec3("light_color", glm::vec3(1.0f, 1.0f, 1.0f));
+
+        _vao.bind();
+        GL_CHECK(glDrawElements(GL_TRIANGLES, _num_indices, GL_UNSIGNED_INT, nullptr));
+        _vao.unbind();
+    }
+
+    GLsizei num_triangles() const {
+        return _num_indices / 3;
+    }
+
+private:
+    VertexArrayObject _vao;
+    VertexBufferObject _vbo;
+    VertexBufferObject _ebo;
+
+    Shader _shader;
+    GLsizei _num_indices = 0;
+};
@@ -0,0 +1,238 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "../../arena_allocator.hpp"
+#include "../../trace.hpp"
+#include "../../wrappers.hpp"
+#include "../computables/marching_cubes.hpp"
+
+// MeshArena keeps every chunk's triangles in one vertex buffer. Chunks own a
+// sub-allocation measured in whole triangles, which is placed by the TLSF
+// allocator, moved by incremental compaction and drawn with a first vertex
+// offset into the shared vertex array.
+class MeshArena {
+public:
+    using Handle = ArenaAllocator::Handle;
+
+    // Move-only owner of one allocation, gives it back on destruction
+    class Mesh {
+    public:
+        Mesh() : _arena(nullptr), _handle(ArenaAllocator::INVALID_HANDLE) {}
+        Mesh(MeshArena* arena, Handle handle) : _arena(arena), _handle(handle) {}
+
+        Mesh(Mesh&& other) noexcept : _arena(other._arena), _handle(other._handle) {
+            other._handle = ArenaAllocator::INVALID_HANDLE;
+        }
+
+        Mesh& operator=(Mesh&& other) noexcept {
+            if (this != &other) {
+                reset();
+                _arena = other._arena;
+                _handle = other._handle;
+                other._handle = ArenaAllocator::INVALID_HANDLE;
+            }
+            return *this;
+        }
+
+        Mesh(const Mesh&) = delete;
+        Mesh& operator=(const Mesh&) = delete;
+
+        ~Mesh() {
+            reset();
+        }
+
+        void reset() {
+            if (_handle != ArenaAllocator::INVALID_HANDLE) {
+                _arena->release(_handle);
+                _handle = ArenaAllocator::INVALID_HANDLE;
+            }
+        }
+
+        bool valid() const {
+            return _handle != ArenaAllocator::INVALID_HANDLE;
+        }
+
+        Handle handle() const {
+            return _handle;
+        }
+
+    private:
+        MeshArena* _arena;
+        Handle _handle;
+    };
+
+    struct Stats {
+        std::size_t capacity_bytes;
+        std::size_t used_bytes;
+        std::size_t largest_free_bytes;
+        uint32_t meshes;
+    };
+
+    explicit MeshArena(uint32_t capacity_triangles)
+    : _allocator(capacity_triangles)
+    {
+        allocate_storage(capacity_triangles);
+    }
+
+    MeshArena(const MeshArena&) = delete;
+    MeshArena& operator=(const MeshArena&) = delete;
+
+    static std::shared_ptr<MeshArena> create(uint32_t capacity_triangles) {
+        return std::make_shared<MeshArena>(capacity_triangles);
+    }
+
+    // Grows the backing buffer by half when the allocator cannot place the mesh
+    Mesh allocate(uint32_t num_triangles) {
+        if (num_triangles == 0) {
+            return Mesh();
+        }
+
+        auto handle = _allocator.allocate(num_triangles);
+        while (handle == ArenaAllocator::INVALID_HANDLE) {
+            grow(_allocator.capacity() + std::max(_allocator.capacity() / 2, num_triangles));
+            handle = _allocator.allocate(num_triangles);
+        }
+
+        return Mesh(this, handle);
+    }
+
+    // Copies the mesh's size worth of triangles starting at first_triangle in ssbo
+    void upload_from_ssbo(const Mesh& mesh, const ShaderStorageBuffer<Triangle>& ssbo, GLuint first_triangle = 0) {
+        auto bytes = _allocator.size(mesh.handle()) * sizeof(Triangle);
+        _vbo->copy_from_ssbo(
+            ssbo,
+            bytes,
+            GLintptr(_allocator.offset(mesh.handle())) * sizeof(Triangle),
+            GLintptr(first_triangle) * sizeof(Triangle)
+        );
+        TRACE_COUNTER("bytes uploaded", bytes);
+    }
+
+    // Replaces the mesh's triangles with its size worth from data
+    void upload(const Mesh& mesh, const void* data) {
+        auto bytes = _allocator.size(mesh.handle()) * sizeof(Triangle);
+        _vbo->bind();
+        _vbo->buffer_sub_data(data, uint32_t(_allocator.offset(mesh.handle()) * sizeof(Triangle)), uint32_t(bytes));
+        TRACE_COUNTER("bytes uploaded", bytes);
+    }
+
+    // Reads the mesh's triangles back into data, waits for the GPU
+    void read(const Mesh& mesh, void* data) const {
+        auto bytes = _allocator.size(mesh.handle()) * sizeof(Triangle);
+        _vbo->bind();
+        _vbo->get_sub_data(data, uint32_t(_allocator.offset(mesh.handle()) * sizeof(Triangle)), uint32_t(bytes));
+        _vbo->unbind();
+    }
+
+    // Queues a copy of the mesh's triangles into readback at write_offset
+    // bytes, ordered with the GPU work so later compaction does not matter
+    void copy_to(const Mesh& mesh, const ReadbackBuffer& readback, GLintptr write_offset) const {
+        readback.copy_from_buffer(
+            _vbo->vbo,
+            GLintptr(_allocator.offset(mesh.handle())) * sizeof(Triangle),
+            write_offset,
+            GLsizeiptr(_allocator.size(mesh.handle())) * sizeof(Triangle)
+        );
+    }
+
+    // First triangle of the mesh in the arena, moves when compaction does
+    GLuint offset(const Mesh& mesh) const {
+        return _allocator.offset(mesh.handle());
+    }
+
+    // Triangles held by the mesh, zero for an empty one
+    GLuint size(const Mesh& mesh) const {
+        return mesh.valid() ? _allocator.size(mesh.handle()) : 0;
+    }
+
+    void draw(const Mesh& mesh) const {
+        if (!mesh.valid()) {
+            return;
+        }
+
+        _vao->bind();
+        glDrawArrays(
+            GL_TRIANGLES,
+            GLint(_allocator.offset(mesh.handle()) * 3),
+            GLsizei(_allocator.size(mesh.handle()) * 3)
+        );
+        _vao->unbind();
+    }
+
+    // Vertex ranges gathered from offset, drawn with one call
+    void draw_ranges(const std::vector<GLint>& firsts, const std::vector<GLsizei>& counts) const {
+        if (firsts.empty()) {
+            return;
+        }
+
+        _vao->bind();
+        glMultiDrawArrays(GL_TRIANGLES, firsts.data(), counts.data(), GLsizei(firsts.size()));
+        _vao->unbind();
+    }
+
+    // Background defragmentation, moves at most max_triangles per call towards
+    // the front of the buffer. Meant to be called once per frame.
+    void compact(uint32_t max_triangles) {
+        TRACE_ZONE("MeshArena::compact");
+
+        for (const auto& move : _allocator.compact(max_triangles)) {
+            _vbo->copy_within(
+                GLintptr(move.source) * sizeof(Triangle),
+                GLintptr(move.destination) * sizeof(Triangle),
+                GLsizeiptr(move.size) * sizeof(Triangle)
+            );
+        }
+    }
+
+    Stats stats() const {
+        auto stats = _allocator.stats();
+        return Stats {
+            std::size_t(stats.capacity) * sizeof(Triangle),
+            std::size_t(stats.used) * sizeof(Triangle),
+            std::size_t(stats.largest_free) * sizeof(Triangle),
+            stats.allocations
+        };
+    }
+
+private:
+    void release(Handle handle) {
+        _allocator.free(handle);
+    }
+
+    void allocate_storage(uint32_t capacity_triangles) {
+        _vao = std::make_unique<VertexArrayObject>();
+        _vbo = std::make_unique<VertexBufferObject>(VertexBufferType::ARRAY);
+        _vbo->track_memory(MemoryTag { MemoryCategory::MESH_ARENA });
+
+        _vao->bind();
+        _vbo->bind();
+        _vbo->send_data_raw(nullptr, GLsizeiptr(capacity_triangles) * sizeof(Triangle), StorageType::DYNAMIC);
+
+        // Same vertex layout as Triangle: position, normal and color per vertex
+        _vbo->enable_attribute_pointer(0, 4, VertexDataType::FLOAT, 12, 0);
+        _vbo->enable_attribute_pointer(1, 4, VertexDataType::FLOAT, 12, 4);
+        _vbo->enable_attribute_pointer(2, 4, VertexDataType::FLOAT, 12, 8);
+
+        _vao->unbind();
+    }
+
+    // Offsets stay valid, so live meshes are copied over as one block
+    void grow(uint32_t capacity_triangles) {
+        TRACE_ZONE("MeshArena::grow");
+
+        auto old_vao = std::move(_vao);
+        auto old_vbo = std::move(_vbo);
+        auto old_capacity = _allocator.capacity();
+
+        allocate_storage(capacity_triangles);
+        old_vbo->copy_to(*_vbo, GLsizeiptr(old_capacity) * sizeof(Triangle));
+        _allocator.grow(capacity_triangles);
+    }
+
+    ArenaAllocator _allocator;
+    std::unique_ptr<VertexArrayObject> _vao;
+    std::unique_ptr<VertexBufferObject> _vbo;
+};
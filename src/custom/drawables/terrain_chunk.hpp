@@ -1,13 +1,22 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <memory>
+#include <vector>
 
 #include "glm/glm.hpp"
 
 #include "../../drawable.hpp"
+#include "../../frustum.hpp"
+#include "../../meshlets.hpp"
+#include "../../sculpt.hpp"
 #include "../../shader.hpp"
 #include "../../texture.hpp"
+#include "../../trace.hpp"
 #include "../computables/marching_cubes.hpp"
+#include "mesh_arena.hpp"
 #include "../../window.hpp"
 
 extern glm::vec3 eye;
@@ -16,103 +25,132 @@ extern glm::vec3 eye;
 // positions
 class TerrainChunk : public Drawable<TerrainChunk> {
 public:
-    TerrainChunk(
-        VertexArrayObject&& vao_points,
-        VertexBufferObject&& vbo_points,
-        VertexArrayObject&& vao_triangles, 
-        VertexBufferObject&& vbo_triangles, 
-        GLuint amount_points,
-        glm::vec3 origin,
-        std::shared_ptr<MarchingCubesCompute> compute_shader,
-        Texture2D&& depth_texture,
-        FramebufferObject&& depth_fbo,
-        Window& window
-    ) : _vao_points(std::move(vao_points)),
-        _vbo_points(std::move(vbo_points)),
-        _vao_triangles(std::move(vao_triangles)),
-        _vbo_triangles(std::move(vbo_triangles)),
-        _shader_points(
+    // Triangles the last camera pass considered and culled by meshlet
+    struct MeshletStats {
+        uint32_t triangles = 0;
+        uint32_t culled_triangles = 0;
+    };
+
+    // Programs every chunk draws with. Compiled by the first chunk drawn and
+    // shared by all of them, each draw sets every uniform it uses.
+    struct Shaders {
+        Shader points;
+        Shader triangles;
+        Shader depth;
+
+        Shaders()
+        : points(
             Shader::create(
                 ShaderInfo { "shaders/grid_points.vert", ShaderType::VERTEX },
                 ShaderInfo { "shaders/grid_points.frag", ShaderType::FRAGMENT })),
-        _shader_triangles(
+          triangles(
             Shader::create(
                 ShaderInfo { "shaders/shadows.vert", ShaderType::VERTEX }, 
                 ShaderInfo { "shaders/shadows.frag", ShaderType::FRAGMENT })),
+          depth(
+            Shader::create(
+                ShaderInfo { "shaders/depth_map.vert", ShaderType::VERTEX }))
+        {
+        }
+
+        static std::shared_ptr<Shaders> get() {
+            static std::weak_ptr<Shaders> cache;
+            auto shaders = cache.lock();
+            if (!shaders) {
+                shaders = std::make_shared<Shaders>();
+                cache = shaders;
+            }
+            return shaders;
+        }
+    };
+
+    // GL objects only a drawn chunk with triangles needs, created by its first
+    // draw. Uniform chunks, entirely on the terrain floor or ceiling, and
+    // chunks never in view hold none.
+    struct SurfaceResources {
+        VertexArrayObject vao_points;
+        VertexBufferObject vbo_points;
+        Texture2D depth_texture;
+        FramebufferObject depth_fbo;
+        GLsizei points_capacity;
+
+        explicit SurfaceResources(uint32_t owner)
+        : vao_points(),
+          vbo_points(VertexBufferType::ARRAY),
+          depth_texture(),
+          depth_fbo(FramebufferObject::create()),
+          points_capacity(0)
+        {
+            vbo_points.track_memory(MemoryTag { MemoryCategory::CHUNK_POINTS, owner });
+            depth_texture.track_memory(MemoryTag { MemoryCategory::SHADOW_MAPS, owner });
+
+            vao_points.bind();
+            vbo_points.bind();
+
+            // Storage is sized by each near-surface extraction
+            vbo_points.enable_attribute_pointer(0, 4, VertexDataType::FLOAT, 4, 0);
+
+            vao_points.unbind();
+
+            depth_texture.bind();
+            depth_texture.specify(GL_DEPTH_COMPONENT, 1024, 1024, GL_DEPTH_COMPONENT, GL_FLOAT);
+            depth_texture.set_parameteri(GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            depth_texture.set_parameteri(GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            depth_texture.set_parameteri(GL_TEXTURE_WRAP_S, GL_REPEAT);
+            depth_texture.set_parameteri(GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+            depth_fbo.bind();
+            depth_fbo.attach_texture(depth_texture, GL_DEPTH_ATTACHMENT);
+            depth_fbo.remove_color_buffer();
+            depth_fbo.unbind();
+        }
+    };
+
+    TerrainChunk(
+        std::shared_ptr<MeshArena> mesh_arena,
+        std::shared_ptr<EditIndex> edits,
+        GLuint amount_points,
+        glm::vec3 origin,
+        uint32_t id,
+        std::shared_ptr<MarchingCubesCompute> compute_shader,
+        Window& window
+    ) : _id(id),
+        _mesh_arena(mesh_arena),
+        _edits(edits),
         _amount_points(amount_points),
+        _amount_surface_points(0),
+        _surface_points_dirty(true),
         _origin(origin),
+        _amount_triangles(0),
         _marching_cubes(compute_shader),
-        _depth_texture(std::move(depth_texture)),
-        _depth_fbo(std::move(depth_fbo)),
-        _shader_depth(
-            Shader::create(
-                ShaderInfo { "shaders/depth_map.vert", ShaderType::VERTEX })
-        ),
+        _mesh_memory(MemoryTag { MemoryCategory::CHUNK_MESHES, id }),
+        _state_memory(MemoryTag { MemoryCategory::CHUNK_STATE, id }),
+        _uniform(false),
+        _evicted(false),
         _window(window)
     {
     }
 
+    // No GL work, programs and GL objects wait for the first draw of a chunk
+    // with triangles. The id tags the chunk's memory, see MemoryAccounting.
     static TerrainChunk create
     (
         std::shared_ptr<MarchingCubesCompute> compute_shader, 
+        std::shared_ptr<MeshArena> mesh_arena,
+        std::shared_ptr<EditIndex> edits,
         GLuint num_points, 
         glm::vec3 origin,
+        uint32_t id,
         Window& window
     )
     {
-        auto vao_points = VertexArrayObject();
-        auto vbo_points = VertexBufferObject(VertexBufferType::ARRAY);
-
-        vao_points.bind();
-        vbo_points.bind();
-
-        // Reserve data in buffer for number of points
-        vbo_points.send_data_raw(nullptr, num_points * sizeof(glm::vec4), StorageType::DYNAMIC);
-
-        vbo_points.enable_attribute_pointer(0, 4, VertexDataType::FLOAT, 4, 0);
-
-        vao_points.unbind();
-
-        auto vao_triangles = VertexArrayObject();
-        auto vbo_triangles = VertexBufferObject(VertexBufferType::ARRAY);
-
-        vao_triangles.bind();
-        vbo_triangles.bind();
-
-        // Every cube has the chance for up to 5 triangles, however rarely is every cube going to have
-        // that many. Need some way to extrapolate worst case scenario
-        vbo_triangles.send_data_raw(nullptr, num_points * 2 * sizeof(Triangle), StorageType::DYNAMIC);
-
-        vbo_triangles.enable_attribute_pointer(0, 4, VertexDataType::FLOAT, 12, 0);
-        vbo_triangles.enable_attribute_pointer(1, 4, VertexDataType::FLOAT, 12, 4);
-        vbo_triangles.enable_attribute_pointer(2, 4, VertexDataType::FLOAT, 12, 8);
-
-        vao_triangles.unbind();
-
-        Texture2D depth_texture = Texture2D();
-        depth_texture.bind();
-        depth_texture.specify(GL_DEPTH_COMPONENT, 1024, 1024, GL_DEPTH_COMPONENT, GL_FLOAT);
-        depth_texture.set_parameteri(GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        depth_texture.set_parameteri(GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        depth_texture.set_parameteri(GL_TEXTURE_WRAP_S, GL_REPEAT);
-        depth_texture.set_parameteri(GL_TEXTURE_WRAP_T, GL_REPEAT);
-
-        FramebufferObject depth_fbo = FramebufferObject::create();
-        depth_fbo.bind();
-        depth_fbo.attach_texture(depth_texture, GL_DEPTH_ATTACHMENT);
-        depth_fbo.remove_color_buffer();
-        depth_fbo.unbind();
-
         return TerrainChunk(
-            std::move(vao_points),
-            std::move(vbo_points),
-            std::move(vao_triangles),
-            std::move(vbo_triangles),
+            mesh_arena,
+            edits,
             num_points,
             origin,
+            id,
             compute_shader,
-            std::move(depth_texture),
-            std::move(depth_fbo),
             window
         );
     }
@@ -124,26 +162,26 @@ public:
         glm::mat4& light_space_matrix
     )
     {
+        TRACE_ZONE("TerrainChunk::draw_depth_map");
+
         // Send light space matrix
-        _shader_depth.use();
-        _shader_depth.set_mat4("light_space_matrix", light_space_matrix);
+        _shaders->depth.use();
+        _shaders->depth.set_mat4("light_space_matrix", light_space_matrix);
 
         // Change viewport and bind depth-only framebuffer
         glViewport(0, 0, 1024, 1024);
-        _depth_fbo.bind();
+        _surface->depth_fbo.bind();
 
         // Setup the framebuffer
         glClear(GL_DEPTH_BUFFER_BIT);
         glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, _depth_texture.get_id());
+        glBindTexture(GL_TEXTURE_2D, _surface->depth_texture.get_id());
 
         // Draw depth-map
-        _vao_triangles.bind();
-        _shader_depth.set_mat4("model", glm::translate(glm::mat4x4(1.0), glm::vec3(0.0f, 0.0f, 0.0f)));
-        _shader_depth.set_vec3("offset", _origin); // subtract the origin from our position
-        glDrawArrays(GL_TRIANGLES, 0, _amount_triangles * 3);
-        _vao_triangles.unbind();
-        _depth_fbo.unbind();
+        _shaders->depth.set_mat4("model", glm::translate(glm::mat4x4(1.0), glm::vec3(0.0f, 0.0f, 0.0f)));
+        _shaders->depth.set_vec3("offset", _origin); // subtract the origin from our position
+        draw_meshes();
+        _surface->depth_fbo.unbind();
 
         // Reset viewport dimensions
         int width, height;
@@ -162,34 +200,38 @@ public:
         glm::mat4& light_space_matrix
     )
     {
+        TRACE_ZONE("TerrainChunk::draw_marching_cubes");
+
         if (draw_points)
         {
-            _vao_points.bind();
+            if (_surface_points_dirty) {
+                update_surface_points(settings);
+            }
+
+            _surface->vao_points.bind();
             // Draw points
-            _shader_points.use();
-            _shader_points.set_float("iso_level", settings.iso_level);
-            _shader_points.set_mat4("projection", projection);
-            _shader_points.set_mat4("view", view);
-            _shader_points.set_mat4("model", glm::translate(glm::mat4x4(1.0), glm::vec3(0.0f, 0.0f, 0.0f)));
-            glDrawArrays(GL_POINTS, 0, _amount_points);
-            _vao_points.unbind();
+            _shaders->points.use();
+            _shaders->points.set_float("iso_level", settings.iso_level);
+            _shaders->points.set_mat4("projection", projection);
+            _shaders->points.set_mat4("view", view);
+            _shaders->points.set_mat4("model", glm::translate(glm::mat4x4(1.0), glm::vec3(0.0f, 0.0f, 0.0f)));
+            glDrawArrays(GL_POINTS, 0, _amount_surface_points);
+            _surface->vao_points.unbind();
         }
 
         glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, _depth_texture.get_id());
+        glBindTexture(GL_TEXTURE_2D, _surface->depth_texture.get_id());
 
-        _vao_triangles.bind();
         // Draw Triangles
-        _shader_triangles.use();
-        _shader_triangles.set_mat4("projection", projection);
-        _shader_triangles.set_mat4("view", view);
-        _shader_triangles.set_mat4("model", glm::translate(glm::mat4x4(1.0), glm::vec3(0.0f, 0.0f, 0.0f)));
-        _shader_triangles.set_vec3("light_pos", light_position);
-        _shader_triangles.set_vec3("view_pos", camera.get_position());
-        _shader_triangles.set_vec3("light_color", glm::vec3(1.0f, 1.0f, 1.0f));
-        _shader_triangles.set_mat4("light_space_matrix", light_space_matrix);
-        glDrawArrays(GL_TRIANGLES, 0, _amount_triangles * 3);
-        _vao_triangles.unbind();
+        _shaders->triangles.use();
+        _shaders->triangles.set_mat4("projection", projection);
+        _shaders->triangles.set_mat4("view", view);
+        _shaders->triangles.set_mat4("model", glm::translate(glm::mat4x4(1.0), glm::vec3(0.0f, 0.0f, 0.0f)));
+        _shaders->triangles.set_vec3("light_pos", light_position);
+        _shaders->triangles.set_vec3("view_pos", camera.get_position());
+        _shaders->triangles.set_vec3("light_color", glm::vec3(1.0f, 1.0f, 1.0f));
+        _shaders->triangles.set_mat4("light_space_matrix", light_space_matrix);
+        draw_visible_meshes(Frustum::from_matrix(projection * view), camera.get_position());
     }
 
     template<typename Projection>
@@ -203,6 +245,16 @@ public:
         bool draw_debug
     ) 
     {
+        if (_amount_triangles == 0) {
+            return;
+        }
+
+        if (!_surface) {
+            TRACE_ZONE("allocate chunk resources");
+            _shaders = Shaders::get();
+            _surface = std::make_unique<SurfaceResources>(_id);
+        }
+
         // Calculate view from light's position
         float near_plane = 1.0f, far_plane = 200.0f;
         //glm::mat4 light_projection = glm::perspective(glm::radians(45.0f), 1.0f, near_plane, far_plane);
@@ -228,41 +280,424 @@ public:
 
     void update(GenerationSettings& settings)
     {
-        _marching_cubes->dispatch(settings, _origin, int(std::cbrt(_amount_points)));
+        TRACE_ZONE("TerrainChunk::update");
+
+        // Regenerated by restore
+        if (_evicted) {
+            return;
+        }
+
+        auto axis_length = int(std::cbrt(_amount_points));
+        auto uniform_value = 0.0f;
+        if (_marching_cubes->uniform_density(glm::ivec3(_origin), axis_length, *_edits, uniform_value)) {
+            make_uniform(settings, uniform_value);
+            return;
+        }
+        _uniform = false;
 
-        _vao_points.bind();
-        _vbo_points.bind();
-        _vbo_points.copy_from_ssbo(_marching_cubes->points_buffer(), _amount_points * sizeof(glm::vec4));
-        _vao_points.unbind();
+        _marching_cubes->dispatch(settings, _origin, axis_length, *_edits);
 
-        auto num_triangles = _marching_cubes->num_triangles();
-        _amount_triangles = num_triangles;
+        // Extracted on the next draw that has the point view enabled
+        _surface_points_dirty = true;
 
-        if(num_triangles == 0) {
+        _use_meshlets = settings.meshlets;
+        _meshlet_build_ms = 0.0;
+
+        _amount_triangles = _marching_cubes->num_triangles();
+        if (_amount_triangles == 0) {
+            _surface.reset();
+        }
+        _bounds = _marching_cubes->bounds();
+        _occluders = _marching_cubes->occluders();
+
+        for (auto brick = 0; brick < NUM_BRICKS; brick++) {
+            upload_brick(brick);
+        }
+        release_meshlet_scratch();
+        update_memory();
+    }
+
+    // Regenerates only the bricks with cells that read a sample inside box,
+    // call after adding an edit with these bounds to the edit index
+    void apply_edit(GenerationSettings& settings, const BoundingBox& box)
+    {
+        TRACE_ZONE("TerrainChunk::apply_edit");
+
+        // The edit is already in the index, restore picks it up
+        if (_evicted) {
             return;
         }
 
-        _vao_triangles.bind();
-        _vbo_triangles.bind();
-        _vbo_triangles.copy_from_ssbo(_marching_cubes->triangle_buffer(), _amount_triangles * sizeof(Triangle));
-        _vao_triangles.unbind();
+        // Only the GPU path can remesh a region, and a uniform chunk has no
+        // mesh to patch
+        if (settings.extractor != ExtractorType::MARCHING_CUBES_GPU || _uniform) {
+            update(settings);
+            return;
+        }
+
+        auto axis_length = int(std::cbrt(_amount_points));
+        auto num_cells = glm::ivec3(axis_length - 1);
+
+        // Cell c reads samples c and c + 1
+        auto first_cell = glm::clamp(glm::ivec3(glm::floor(box.min - _origin)) - 1, glm::ivec3(0), num_cells);
+        auto end_cell = glm::clamp(glm::ivec3(glm::ceil(box.max - _origin)) + 1, glm::ivec3(0), num_cells);
+        if (glm::any(glm::greaterThanEqual(first_cell, end_cell))) {
+            return;
+        }
+
+        // Brick meshes are replaced whole, so widen to brick boundaries
+        auto first_brick = first_cell / BRICK_CELLS;
+        auto last_brick = (end_cell - 1) / BRICK_CELLS;
+        auto cell_min = first_brick * BRICK_CELLS;
+        auto cell_max = glm::min((last_brick + 1) * BRICK_CELLS, num_cells);
+
+        _marching_cubes->dispatch_region(settings, _origin, axis_length, *_edits, cell_min, cell_max);
+        _surface_points_dirty = true;
+        _meshlet_build_ms = 0.0;
+
+        for (auto x = first_brick.x; x <= last_brick.x; x++) {
+            for (auto y = first_brick.y; y <= last_brick.y; y++) {
+                for (auto z = first_brick.z; z <= last_brick.z; z++) {
+                    auto brick = (x * BRICKS_PER_AXIS + y) * BRICKS_PER_AXIS + z;
+                    _amount_triangles -= _mesh_arena->size(_meshes[brick]);
+                    upload_brick(brick);
+                    _amount_triangles += _mesh_arena->size(_meshes[brick]);
+                }
+            }
+        }
+        // Dug out completely, drop the GL objects like update does
+        if (_amount_triangles == 0) {
+            _surface.reset();
+        }
+
+        // Old bounds may still cover removed terrain, which only costs culling
+        _bounds.expand(_marching_cubes->bounds());
+
+        // The edit may have hollowed out the solid columns behind these
+        _occluders.erase(
+            std::remove_if(_occluders.begin(), _occluders.end(), [&box](const BoundingBox& occluder) {
+                return occluder.intersects(box);
+            }),
+            _occluders.end()
+        );
+        release_meshlet_scratch();
+        update_memory();
+    }
+
+    // Drops the mesh and GL objects to get back under the memory budget. The
+    // chunk draws and occludes nothing until restore regenerates it.
+    void evict()
+    {
+        release();
+        _uniform = false;
+        _evicted = true;
+        if (auto* readback = _marching_cubes->density_readback()) {
+            readback->drop(glm::ivec3(_origin));
+        }
+    }
+
+    void restore(GenerationSettings& settings)
+    {
+        _evicted = false;
+        update(settings);
+    }
+
+    bool is_evicted() const {
+        return _evicted;
+    }
+
+    uint32_t id() const {
+        return _id;
+    }
+
+    // Every sample this chunk covers, edits outside it cannot change the mesh
+    BoundingBox region() const {
+        auto axis_length = int(std::cbrt(_amount_points));
+        return BoundingBox(_origin, _origin + glm::vec3(axis_length - 1));
+    }
+
+    GLsizei num_triangles() const {
+        return _amount_triangles;
+    }
+
+    // Tight bounds of the current mesh, empty when the chunk has no triangles
+    const BoundingBox& bounds() const {
+        return _bounds;
+    }
+
+    // Starts copying the current mesh out of the arena into a staging
+    // buffer, take_positions picks it up once the GPU is done. A new request
+    // replaces one that has not been taken yet.
+    void request_positions()
+    {
+        TRACE_ZONE("TerrainChunk::request_positions");
+
+        _requested_triangles = 0;
+        for (const auto& mesh : _meshes) {
+            _requested_triangles += GLsizei(_mesh_arena->size(mesh));
+        }
+        if (!_positions_readback) {
+            _positions_readback = std::make_unique<ReadbackBuffer>();
+        }
+        _positions_readback->reserve(GLsizeiptr(_requested_triangles) * sizeof(Triangle));
+
+        auto write_offset = GLintptr(0);
+        for (const auto& mesh : _meshes) {
+            if (!mesh.valid()) {
+                continue;
+            }
+            _mesh_arena->copy_to(mesh, *_positions_readback, write_offset);
+            write_offset += GLintptr(_mesh_arena->size(mesh)) * sizeof(Triangle);
+        }
+        _positions_readback->fence();
+        _positions_requested = true;
+    }
+
+    // Three corners per triangle of the mesh at the last request_positions,
+    // in brick order. False without touching positions while the copy is
+    // still in flight or nothing was requested, never waits for the GPU.
+    bool take_positions(std::vector<glm::vec3>& positions)
+    {
+        if (!_positions_requested || !_positions_readback->ready()) {
+            return false;
+        }
+        TRACE_ZONE("TerrainChunk::take_positions");
+
+        _positions_requested = false;
+        positions.clear();
+        if (_requested_triangles == 0) {
+            _positions_readback.reset();
+            return true;
+        }
+
+        auto bytes = GLsizeiptr(_requested_triangles) * sizeof(Triangle);
+        const auto* triangles = static_cast<const Triangle*>(_positions_readback->map(bytes));
+        positions.reserve(std::size_t(_requested_triangles) * 3);
+        for (auto i = 0; i < _requested_triangles; i++) {
+            positions.push_back(glm::vec3(triangles[i].vertex_a));
+            positions.push_back(glm::vec3(triangles[i].vertex_b));
+            positions.push_back(glm::vec3(triangles[i].vertex_c));
+        }
+        _positions_readback->unmap();
+
+        // The staging copy is as large as the mesh, it is not kept around
+        _positions_readback.reset();
+        return true;
+    }
+
+    const std::vector<BoundingBox>& occluders() const {
+        return _occluders;
+    }
+
+    const MeshletStats& meshlet_stats() const {
+        return _meshlet_stats;
+    }
+
+    // Time the last update or edit spent reading back triangles and building
+    // meshlets, zero with meshlets off
+    double meshlet_build_ms() const {
+        return _meshlet_build_ms;
+    }
+
+    // No surface and no GL objects
+    bool is_uniform() const {
+        return _uniform;
+    }
+
+    // Whether the first draw has created the chunk's GL objects
+    bool has_resources() const {
+        return bool(_surface);
     }
 
 private:
-    VertexArrayObject _vao_points;
-    VertexBufferObject _vbo_points;
-    VertexArrayObject _vao_triangles;
-    VertexBufferObject _vbo_triangles;
-    Shader _shader_points;
-    Shader _shader_triangles;
+    void release()
+    {
+        for (auto& mesh : _meshes) {
+            mesh.reset();
+        }
+        for (auto& meshlets : _meshlets) {
+            meshlets.clear();
+        }
+        _surface.reset();
+        _amount_triangles = 0;
+        _amount_surface_points = 0;
+        _surface_points_dirty = true;
+        _bounds = BoundingBox();
+        _occluders.clear();
+        _occluders.shrink_to_fit();
+        update_memory();
+    }
+
+    // Drops the mesh and GL objects. A solid chunk is one big occluder.
+    void make_uniform(const GenerationSettings& settings, float value)
+    {
+        release();
+        _uniform = true;
+        if (auto* readback = _marching_cubes->density_readback()) {
+            readback->store_uniform(glm::ivec3(_origin), value);
+        }
+        if (value < settings.iso_level) {
+            _occluders.push_back(region());
+            update_memory();
+        }
+    }
+
+    // The GL objects record themselves, the arena share and CPU state are
+    // recorded here
+    void update_memory()
+    {
+        _mesh_memory.set(std::size_t(_amount_triangles) * sizeof(Triangle));
+        auto meshlet_bytes = std::size_t(0);
+        for (const auto& meshlets : _meshlets) {
+            meshlet_bytes += meshlets.capacity() * sizeof(Meshlet);
+        }
+        _state_memory.set(_occluders.capacity() * sizeof(BoundingBox) + meshlet_bytes);
+    }
+
+    // Release the old mesh first so its space can be reused straight away
+    void upload_brick(int brick)
+    {
+        auto range = _marching_cubes->brick_range(brick);
+        _meshes[brick].reset();
+        if (range.count == 0) {
+            return;
+        }
+
+        _meshes[brick] = _mesh_arena->allocate(range.count);
+        if (!_use_meshlets) {
+            _meshlets[brick].clear();
+            _mesh_arena->upload_from_ssbo(_meshes[brick], _marching_cubes->triangle_buffer(), range.offset);
+            return;
+        }
+
+        // Meshlets are built on the CPU, so the brick makes a round trip
+        TRACE_ZONE("build meshlets");
+        auto start = std::chrono::high_resolution_clock::now();
+        const auto& triangles = _marching_cubes->triangle_buffer();
+        auto* mapped = triangles.map_buffer_range(
+            GLintptr(range.offset) * sizeof(Triangle),
+            GLsizeiptr(range.count) * sizeof(Triangle),
+            BufferIntentRange::READ);
+        _meshlet_builder.build(reinterpret_cast<const MeshVertex*>(mapped), range.count, _meshlet_vertices, _meshlets[brick]);
+        triangles.unmap_buffer();
+        _mesh_arena->upload(_meshes[brick], _meshlet_vertices.data());
+        auto end = std::chrono::high_resolution_clock::now();
+        _meshlet_build_ms += std::chrono::duration<double, std::milli>(end - start).count();
+    }
+
+    // The scratch is as large as a brick's mesh, chunks between updates
+    // do not keep it
+    void release_meshlet_scratch()
+    {
+        _meshlet_builder = MeshletBuilder();
+        _meshlet_vertices = std::vector<MeshVertex>();
+    }
+
+    void draw_meshes()
+    {
+        for (const auto& mesh : _meshes) {
+            _mesh_arena->draw(mesh);
+        }
+    }
+
+    // Camera pass. The depth map still draws every triangle, back faces cast
+    // shadows too.
+    void draw_visible_meshes(const Frustum& frustum, glm::vec3 camera_position)
+    {
+        _meshlet_stats = MeshletStats { GLuint(_amount_triangles), 0 };
+        if (!_use_meshlets) {
+            draw_meshes();
+            return;
+        }
+
+        _draw_firsts.clear();
+        _draw_counts.clear();
+        for (auto brick = 0; brick < NUM_BRICKS; brick++) {
+            if (!_meshes[brick].valid()) {
+                continue;
+            }
+            auto offset = _mesh_arena->offset(_meshes[brick]);
+            for (const auto& meshlet : _meshlets[brick]) {
+                if (!meshlet_visible(meshlet, frustum, camera_position)) {
+                    _meshlet_stats.culled_triangles += meshlet.count;
+                    continue;
+                }
+
+                // Neighbouring meshlets drawn together become one range
+                auto first = GLint((offset + meshlet.first) * 3);
+                if (!_draw_firsts.empty() && _draw_firsts.back() + _draw_counts.back() == first) {
+                    _draw_counts.back() += GLsizei(meshlet.count * 3);
+                } else {
+                    _draw_firsts.push_back(first);
+                    _draw_counts.push_back(GLsizei(meshlet.count * 3));
+                }
+            }
+        }
+        _mesh_arena->draw_ranges(_draw_firsts, _draw_counts);
+    }
+
+    // Only runs while the point view is on. Other chunks have overwritten the
+    // shared density grid since update, so it is generated again first.
+    void update_surface_points(GenerationSettings& settings)
+    {
+        TRACE_ZONE("TerrainChunk::update_surface_points");
+
+        auto axis_length = int(std::cbrt(_amount_points));
+        _marching_cubes->dispatch_density(settings, _origin, axis_length, *_edits);
+        auto num_points = _marching_cubes->extract_surface_points(settings, axis_length);
+
+        _surface->vao_points.bind();
+        _surface->vbo_points.bind();
+        // Sized to the points, and only shrunk once half would go unused
+        if (GLsizei(num_points) > _surface->points_capacity || GLsizei(num_points) < _surface->points_capacity / 2) {
+            _surface->vbo_points.send_data_raw(nullptr, num_points * sizeof(glm::vec4), StorageType::DYNAMIC);
+            _surface->points_capacity = num_points;
+        }
+        if (num_points > 0) {
+            _surface->vbo_points.copy_from_ssbo(_marching_cubes->surface_points_buffer(), num_points * sizeof(glm::vec4));
+        }
+        _surface->vao_points.unbind();
+        TRACE_COUNTER("bytes uploaded", num_points * sizeof(glm::vec4));
+
+        _amount_surface_points = num_points;
+        _surface_points_dirty = false;
+    }
+
+    uint32_t _id;
+    // The arena must outlive the meshes allocated from it
+    std::shared_ptr<MeshArena> _mesh_arena;
+    std::array<MeshArena::Mesh, NUM_BRICKS> _meshes;
+    // Meshlets of each brick mesh, empty with meshlets off
+    std::array<std::vector<Meshlet>, NUM_BRICKS> _meshlets;
+    bool _use_meshlets = false;
+    // Reused by the bricks of one update
+    MeshletBuilder _meshlet_builder;
+    std::vector<MeshVertex> _meshlet_vertices;
+    double _meshlet_build_ms = 0.0;
+    MeshletStats _meshlet_stats;
+    std::vector<GLint> _draw_firsts;
+    std::vector<GLsizei> _draw_counts;
+    std::shared_ptr<EditIndex> _edits;
     GLsizei _amount_points;
+    GLsizei _amount_surface_points;
+    bool _surface_points_dirty;
     glm::vec3 _origin;
     GLsizei _amount_triangles;
+    BoundingBox _bounds;
+    std::vector<BoundingBox> _occluders;
     std::shared_ptr<MarchingCubesCompute> _marching_cubes;
-
-    Texture2D _depth_texture;
-    FramebufferObject _depth_fbo;
-    Shader _shader_depth;
+    MemoryRecord _mesh_memory;
+    MemoryRecord _state_memory;
+    bool _uniform;
+    bool _evicted;
+
+    // Staging for request_positions, only held while a copy is out
+    std::unique_ptr<ReadbackBuffer> _positions_readback;
+    GLsizei _requested_triangles = 0;
+    bool _positions_requested = false;
+
+    std::shared_ptr<Shaders> _shaders;
+    std::unique_ptr<SurfaceResources> _surface;
 
     Window& _window;
 };
\ No newline at end of file
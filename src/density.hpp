@@ -0,0 +1,117 @@
+#pragma once
+
+// Density.hpp
+//
+// Description: CPU port of the procedural density in marching_cubes_stage1.compute,
+// used by the CPU extractors and benchmarks. Sculpting edits are GPU only, the
+// renderer reads edited grids back from stage 1 instead. procedural_density is
+// the plain scalar reference, sample_density runs the same terrain as a fused
+// density graph.
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "density_graph.hpp"
+#include "generation_settings.hpp"
+
+// procedural_density is TERRAIN_FLOOR_DENSITY below TERRAIN_FLOOR_Y and
+// TERRAIN_CEILING_DENSITY above TERRAIN_CEILING_Y whatever the noise settings.
+// Stage 1 hard codes the same values.
+constexpr auto TERRAIN_FLOOR_Y = 5.0f;
+constexpr auto TERRAIN_CEILING_Y = 140.0f;
+constexpr auto TERRAIN_FLOOR_DENSITY = 0.0f;
+constexpr auto TERRAIN_CEILING_DENSITY = 140.0f;
+
+// Whether every sample with world y in [y_min, y_max] has the same constant
+// density, and which
+inline bool constant_rows(float y_min, float y_max, float& value) {
+    if (y_max < TERRAIN_FLOOR_Y) {
+        value = TERRAIN_FLOOR_DENSITY;
+        return true;
+    }
+    if (y_min > TERRAIN_CEILING_Y) {
+        value = TERRAIN_CEILING_DENSITY;
+        return true;
+    }
+    return false;
+}
+
+// Same terrain as procedural_density in stage 1: ridged noise on a solid floor
+// with air above the ceiling
+inline auto terrain_graph(const GenerationSettings& settings) {
+    using namespace density_graph;
+
+    auto parameters = FractalParameters { settings.scale / 100.0f, settings.octaves, settings.persistence, settings.lacunarity };
+    return if_less(y(), constant(TERRAIN_FLOOR_Y), constant(TERRAIN_FLOOR_DENSITY),
+           if_less(constant(TERRAIN_CEILING_Y), y(), constant(TERRAIN_CEILING_DENSITY), ridged(parameters)));
+}
+
+// The terrain moving through time, its ridged noise is the slice of 4D noise
+// at w. Floor and ceiling stay put.
+inline auto animated_terrain_graph(const GenerationSettings& settings, float w) {
+    using namespace density_graph;
+
+    auto parameters = FractalParameters { settings.scale / 100.0f, settings.octaves, settings.persistence, settings.lacunarity };
+    return if_less(y(), constant(TERRAIN_FLOOR_Y), constant(TERRAIN_FLOOR_DENSITY),
+           if_less(constant(TERRAIN_CEILING_Y), y(), constant(TERRAIN_CEILING_DENSITY), animated_ridged(parameters, w)));
+}
+
+// Samples of one chunk, indexed like the stage 1 grid
+struct DensityGrid {
+    int axis_length = 0;
+    glm::ivec3 offset = glm::ivec3(0);
+    std::vector<float> values;
+
+    void resize(int length) {
+        axis_length = length;
+        values.resize(std::size_t(length) * length * length);
+    }
+
+    float at(int x, int y, int z) const {
+        return values[(std::size_t(x) * axis_length + y) * axis_length + z];
+    }
+
+    float& at(int x, int y, int z) {
+        return values[(std::size_t(x) * axis_length + y) * axis_length + z];
+    }
+
+    // The axis_length samples along z at x, y
+    const float* row(int x, int y) const {
+        return values.data() + (std::size_t(x) * axis_length + y) * axis_length;
+    }
+};
+
+// Same as procedural_density in stage 1, one sample at a time
+inline float procedural_density(const GenerationSettings& settings, glm::vec3 pos) {
+    // Floor and ceiling
+    auto constant = 0.0f;
+    if (constant_rows(pos.y, pos.y, constant)) {
+        return constant;
+    }
+
+    auto noise = 0.0f;
+    auto frequency = settings.scale / 100.0f;
+    auto amplitude = 1.0f;
+    auto weight = 1.0f;
+    for (auto octave = 0; octave < settings.octaves; octave++) {
+        auto v = 1.0f - std::fabs(density_graph::simplex(pos.x * frequency, pos.y * frequency, pos.z * frequency));
+        v = v * v;
+        v *= weight;
+        weight = std::max(std::min(v, 1.0f), 0.0f);
+        noise += v * amplitude;
+        amplitude *= settings.persistence;
+        frequency *= settings.lacunarity;
+    }
+
+    return noise;
+}
+
+// Fills grid with the chunk at offset, without sculpting edits
+inline void sample_density(const GenerationSettings& settings, glm::ivec3 offset, int axis_length, DensityGrid& grid) {
+    grid.resize(axis_length);
+    grid.offset = offset;
+    density_graph::evaluate(terrain_graph(settings), offset, axis_length, grid.values.data());
+}
@@ -0,0 +1,453 @@
+#pragma once
+
+// Density_cache.hpp
+//
+// Description: CPU copies of every chunk's density grid for gameplay queries,
+// with a height map of the topmost surface over the whole world. Point
+// queries are a clamp, a chunk lookup and a trilinear blend of eight samples,
+// batched ones do four points at a time. Chunks are filled from stage 1 read
+// backs or the CPU extractors' grid, see DensityReadback.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "density.hpp"
+#include "lanes.hpp"
+
+// Height of a column without any surface, all air or not cached
+constexpr auto NO_SURFACE = -std::numeric_limits<float>::max();
+
+// One chunk's samples. Rows outside [first_row, first_row + num_rows) are
+// constant floor or ceiling, the same value as the nearest stored row, so
+// reads clamp the row and need no branch.
+struct DensityVolume {
+    int first_row = 0;
+    int num_rows = 0;
+    // [x][row][z] like DensityGrid
+    std::vector<float> values;
+    // World y of the highest solid to air crossing per [x][z] column
+    std::vector<float> heights;
+
+    bool empty() const {
+        return num_rows == 0;
+    }
+};
+
+class DensityCache {
+public:
+    // Chunks are chunks_per_axis^3 grids of axis_length samples that share
+    // their boundary samples, chunk index is (x * n + y) * n + z like the
+    // chunk ids main assigns
+    DensityCache(int chunks_per_axis, int axis_length)
+    : _chunks_per_axis(chunks_per_axis),
+      _axis_length(axis_length),
+      _cells(axis_length - 1),
+      _world_length(chunks_per_axis * (axis_length - 1)),
+      _volumes(std::size_t(chunks_per_axis) * chunks_per_axis * chunks_per_axis),
+      _world_heights(std::size_t(_world_length + 1) * (_world_length + 1), NO_SURFACE)
+    {
+        // Chunks not cached read as air
+        fill_constant(_missing, TERRAIN_CEILING_DENSITY);
+        _views.resize(_volumes.size());
+        for (auto chunk = 0u; chunk < _volumes.size(); chunk++) {
+            refresh_view(chunk);
+        }
+    }
+
+    int axis_length() const {
+        return _axis_length;
+    }
+
+    // Surfaces in the height map are where density crosses iso_level
+    void set_iso_level(float iso_level) {
+        if (iso_level == _iso_level) {
+            return;
+        }
+        _iso_level = iso_level;
+        for (auto index = std::size_t(0); index < _volumes.size(); index++) {
+            auto chunk = glm::ivec3(int(index) / (_chunks_per_axis * _chunks_per_axis), int(index) / _chunks_per_axis % _chunks_per_axis, int(index) % _chunks_per_axis);
+            if (!_volumes[index].empty()) {
+                update_heights(chunk * _cells, _volumes[index], glm::ivec3(0), glm::ivec3(_axis_length));
+            }
+        }
+    }
+
+    // Chunk whose samples start at offset
+    uint32_t chunk_index(glm::ivec3 offset) const {
+        auto chunk = offset / _cells;
+        return uint32_t((chunk.x * _chunks_per_axis + chunk.y) * _chunks_per_axis + chunk.z);
+    }
+
+    bool is_cached(uint32_t chunk) const {
+        return !_volumes[chunk].empty();
+    }
+
+    // Memory the chunk's copy holds
+    std::size_t bytes(uint32_t chunk) const {
+        return (_volumes[chunk].values.capacity() + _volumes[chunk].heights.capacity()) * sizeof(float);
+    }
+
+    // Copies the samples in [sample_min, sample_max) of a chunk, read(x, y, z)
+    // returns one in chunk sample coordinates. A full update replaces the
+    // chunk and takes every row outside as constant floor or ceiling, a
+    // partial one only changes those samples of a cached chunk.
+    template<typename Read>
+    void update(glm::ivec3 offset, glm::ivec3 sample_min, glm::ivec3 sample_max, bool full, Read&& read) {
+        auto& volume = _volumes[chunk_index(offset)];
+        if (!full && volume.empty()) {
+            return;
+        }
+
+        // One constant row either side keeps the clamped reads exact
+        auto first_row = std::max(sample_min.y - 1, 0);
+        auto end_row = std::min(sample_max.y + 1, _axis_length);
+        if (full) {
+            volume.first_row = first_row;
+            volume.num_rows = end_row - first_row;
+            volume.values.resize(std::size_t(_axis_length) * volume.num_rows * _axis_length);
+            for (auto x = 0; x < _axis_length; x++) {
+                for (auto row = 0; row < volume.num_rows; row++) {
+                    auto y = first_row + row;
+                    auto constant = 0.0f;
+                    if (y >= sample_min.y && y < sample_max.y) {
+                        continue;
+                    }
+                    constant_rows(float(offset.y + y), float(offset.y + y), constant);
+                    std::fill_n(&volume.values[(std::size_t(x) * volume.num_rows + row) * _axis_length], _axis_length, constant);
+                }
+            }
+        } else {
+            grow_rows(volume, first_row, end_row);
+        }
+
+        for (auto x = sample_min.x; x < sample_max.x; x++) {
+            for (auto y = sample_min.y; y < sample_max.y; y++) {
+                auto* row = &volume.values[(std::size_t(x) * volume.num_rows + (y - volume.first_row)) * _axis_length];
+                for (auto z = sample_min.z; z < sample_max.z; z++) {
+                    row[z] = read(x, y, z);
+                }
+            }
+        }
+
+        update_heights(offset, volume, full ? glm::ivec3(0) : sample_min, full ? glm::ivec3(_axis_length) : sample_max);
+        refresh_view(chunk_index(offset));
+    }
+
+    void store(const DensityGrid& grid) {
+        update(grid.offset, glm::ivec3(0), glm::ivec3(grid.axis_length), true, [&grid](int x, int y, int z) {
+            return grid.at(x, y, z);
+        });
+    }
+
+    // Every sample of the chunk has value
+    void store_uniform(glm::ivec3 offset, float value) {
+        auto& volume = _volumes[chunk_index(offset)];
+        fill_constant(volume, value);
+        update_heights(offset, volume, glm::ivec3(0), glm::ivec3(_axis_length));
+        refresh_view(chunk_index(offset));
+    }
+
+    // Forgets the chunk, it reads as air until stored again
+    void drop(glm::ivec3 offset) {
+        auto& volume = _volumes[chunk_index(offset)];
+        volume.num_rows = 0;
+        volume.values = std::vector<float>();
+        volume.heights = std::vector<float>();
+        refresh_view(chunk_index(offset));
+        update_world_heights(offset, glm::ivec3(0), glm::ivec3(_axis_length));
+    }
+
+    // Trilinear density at a world position, clamped to the world
+    float density(glm::vec3 position) const {
+        auto sample = locate(position);
+        const auto* values = sample.volume->values.data();
+        auto stride = std::size_t(sample.volume->num_rows) * _axis_length;
+        auto x0 = std::size_t(sample.cell.x) * stride;
+        auto x1 = x0 + stride;
+        auto y0 = std::size_t(sample.row_0) * _axis_length;
+        auto y1 = std::size_t(sample.row_1) * _axis_length;
+        auto z = std::size_t(sample.cell.z);
+
+        auto f = sample.fraction;
+        auto c00 = glm::mix(values[x0 + y0 + z], values[x0 + y0 + z + 1], f.z);
+        auto c01 = glm::mix(values[x0 + y1 + z], values[x0 + y1 + z + 1], f.z);
+        auto c10 = glm::mix(values[x1 + y0 + z], values[x1 + y0 + z + 1], f.z);
+        auto c11 = glm::mix(values[x1 + y1 + z], values[x1 + y1 + z + 1], f.z);
+        return glm::mix(glm::mix(c00, c01, f.y), glm::mix(c10, c11, f.y), f.x);
+    }
+
+    bool is_solid(glm::vec3 position, float iso_level) const {
+        return density(position) < iso_level;
+    }
+
+    // density for count positions. Blocks of points first get their corner
+    // addresses on lanes and prefetched, then the corners are gathered and
+    // blended four at a time, so cache misses overlap across the block.
+    void density(const glm::vec3* positions, std::size_t count, float* out) const {
+        auto low = Lanes(0.0f);
+        auto high = Lanes(float(_world_length) - WORLD_EPSILON);
+        auto cells = Lanes(float(_cells));
+        auto inverse_cells = Lanes(1.0f / float(_cells));
+        auto last_chunk = Lanes(float(_chunks_per_axis - 1));
+        auto chunks_per_axis = Lanes(float(_chunks_per_axis));
+
+        const float* base[QUERY_BLOCK];
+        uint32_t row_0[QUERY_BLOCK];
+        uint32_t row_1[QUERY_BLOCK];
+        uint32_t stride[QUERY_BLOCK];
+        float fraction[3][QUERY_BLOCK];
+
+        auto batched = count - count % LANE_COUNT;
+        for (auto block = std::size_t(0); block < batched; block += QUERY_BLOCK) {
+            auto block_count = std::min<std::size_t>(QUERY_BLOCK, batched - block);
+
+            for (auto first = std::size_t(0); first < block_count; first += LANE_COUNT) {
+                Lanes chunk[3];
+                Lanes cell[3];
+                for (auto axis = 0; axis < 3; axis++) {
+                    const auto* points = positions + block + first;
+                    auto coordinates = Lanes::from(points[0][axis], points[1][axis], points[2][axis], points[3][axis]);
+                    auto world = lane_clamp(coordinates, low, high);
+                    chunk[axis] = lane_min(lane_floor(world * inverse_cells), last_chunk);
+                    auto local = world - chunk[axis] * cells;
+                    cell[axis] = lane_floor(local);
+                    (local - cell[axis]).store(&fraction[axis][first]);
+                }
+
+                int32_t chunk_index[LANE_COUNT], cell_x[LANE_COUNT], cell_y[LANE_COUNT], cell_z[LANE_COUNT];
+                ((chunk[0] * chunks_per_axis + chunk[1]) * chunks_per_axis + chunk[2]).store_int(chunk_index);
+                cell[0].store_int(cell_x);
+                cell[1].store_int(cell_y);
+                cell[2].store_int(cell_z);
+
+                for (auto lane = 0; lane < LANE_COUNT; lane++) {
+                    const auto& view = _views[chunk_index[lane]];
+                    auto i = first + lane;
+                    auto y = cell_y[lane] - view.first_row;
+                    base[i] = view.values + std::size_t(cell_x[lane]) * view.stride + cell_z[lane];
+                    row_0[i] = uint32_t(std::clamp(y, 0, view.last_row)) * _axis_length;
+                    row_1[i] = uint32_t(std::clamp(y + 1, 0, view.last_row)) * _axis_length;
+                    stride[i] = view.stride;
+                    prefetch(base[i] + row_0[i]);
+                    prefetch(base[i] + row_1[i]);
+                    prefetch(base[i] + stride[i] + row_0[i]);
+                    prefetch(base[i] + stride[i] + row_1[i]);
+                }
+            }
+
+            // Corners are gathered straight into registers
+            for (auto first = std::size_t(0); first < block_count; first += LANE_COUNT) {
+                auto corner = [&](int x, int y, int z) {
+                    auto read = [&](std::size_t i) {
+                        return base[i][(x ? stride[i] : 0) + (y ? row_1[i] : row_0[i]) + z];
+                    };
+                    return Lanes::from(read(first), read(first + 1), read(first + 2), read(first + 3));
+                };
+
+                auto fx = Lanes::load(&fraction[0][first]);
+                auto fy = Lanes::load(&fraction[1][first]);
+                auto fz = Lanes::load(&fraction[2][first]);
+                auto lerp = [](Lanes a, Lanes b, Lanes t) { return a + (b - a) * t; };
+                auto c00 = lerp(corner(0, 0, 0), corner(0, 0, 1), fz);
+                auto c01 = lerp(corner(0, 1, 0), corner(0, 1, 1), fz);
+                auto c10 = lerp(corner(1, 0, 0), corner(1, 0, 1), fz);
+                auto c11 = lerp(corner(1, 1, 0), corner(1, 1, 1), fz);
+                lerp(lerp(c00, c01, fy), lerp(c10, c11, fy), fx).store(out + block + first);
+            }
+        }
+
+        for (auto i = batched; i < count; i++) {
+            out[i] = density(positions[i]);
+        }
+    }
+
+    // Height of the topmost surface at world (x, z), blended between the
+    // four surrounding columns. NO_SURFACE over columns of only air.
+    float height(float x, float z) const {
+        auto limit = float(_world_length) - WORLD_EPSILON;
+        x = std::clamp(x, 0.0f, limit);
+        z = std::clamp(z, 0.0f, limit);
+        auto column_x = int(x);
+        auto column_z = int(z);
+        auto fx = x - float(column_x);
+        auto fz = z - float(column_z);
+
+        auto row = std::size_t(_world_length + 1);
+        const auto* heights = &_world_heights[std::size_t(column_x) * row + column_z];
+        auto h00 = heights[0], h01 = heights[1], h10 = heights[row], h11 = heights[row + 1];
+
+        // Next to a column without surface there is nothing to blend with
+        if (std::min(std::min(h00, h01), std::min(h10, h11)) == NO_SURFACE) {
+            return std::max(std::max(h00, h01), std::max(h10, h11));
+        }
+        return glm::mix(glm::mix(h00, h01, fz), glm::mix(h10, h11, fz), fx);
+    }
+
+    std::size_t num_cached() const {
+        return std::size_t(std::count_if(_volumes.begin(), _volumes.end(), [](const DensityVolume& volume) {
+            return !volume.empty();
+        }));
+    }
+
+private:
+    // Keeps the upper clamp inside the last cell
+    static constexpr float WORLD_EPSILON = 1e-3f;
+    // Points whose corners are prefetched before any is read
+    static constexpr std::size_t QUERY_BLOCK = 64;
+
+    // What the batched path needs of a volume, the missing volume stands in
+    // for chunks not cached
+    struct ChunkView {
+        const float* values;
+        int first_row;
+        int last_row;
+        uint32_t stride;
+    };
+
+    static void prefetch(const float* address) {
+#if MC_LANES_SSE
+        _mm_prefetch(reinterpret_cast<const char*>(address), _MM_HINT_T0);
+#else
+        (void) address;
+#endif
+    }
+
+    void refresh_view(uint32_t chunk) {
+        const auto& volume = _volumes[chunk].empty() ? _missing : _volumes[chunk];
+        _views[chunk] = ChunkView {
+            volume.values.data(),
+            volume.first_row,
+            volume.num_rows - 1,
+            uint32_t(volume.num_rows * _axis_length)
+        };
+    }
+
+    struct Location {
+        const DensityVolume* volume;
+        glm::ivec3 cell;
+        int row_0;
+        int row_1;
+        glm::vec3 fraction;
+    };
+
+    Location locate(glm::vec3 position) const {
+        auto world = glm::clamp(position, glm::vec3(0.0f), glm::vec3(float(_world_length) - WORLD_EPSILON));
+        auto chunk = glm::min(glm::ivec3(world / float(_cells)), glm::ivec3(_chunks_per_axis - 1));
+        auto local = world - glm::vec3(chunk * _cells);
+        auto cell = glm::ivec3(local);
+
+        const auto& volume = volume_at(chunk.x, chunk.y, chunk.z);
+        auto row = cell.y - volume.first_row;
+        return Location {
+            &volume,
+            cell,
+            std::clamp(row, 0, volume.num_rows - 1),
+            std::clamp(row + 1, 0, volume.num_rows - 1),
+            local - glm::vec3(cell)
+        };
+    }
+
+    const DensityVolume& volume_at(int x, int y, int z) const {
+        const auto& volume = _volumes[std::size_t((x * _chunks_per_axis + y) * _chunks_per_axis + z)];
+        return volume.empty() ? _missing : volume;
+    }
+
+    // A single row stands for the whole chunk
+    void fill_constant(DensityVolume& volume, float value) {
+        volume.first_row = 0;
+        volume.num_rows = 1;
+        volume.values.assign(std::size_t(_axis_length) * _axis_length, value);
+    }
+
+    // Widens the stored rows to [first_row, end_row), new rows copy the
+    // nearest old one, which is what clamped reads returned for them
+    void grow_rows(DensityVolume& volume, int first_row, int end_row) {
+        first_row = std::min(first_row, volume.first_row);
+        end_row = std::max(end_row, volume.first_row + volume.num_rows);
+        if (first_row == volume.first_row && end_row == volume.first_row + volume.num_rows) {
+            return;
+        }
+
+        auto num_rows = end_row - first_row;
+        _scratch.resize(std::size_t(_axis_length) * num_rows * _axis_length);
+        for (auto x = 0; x < _axis_length; x++) {
+            for (auto row = 0; row < num_rows; row++) {
+                auto old_row = std::clamp(first_row + row - volume.first_row, 0, volume.num_rows - 1);
+                std::copy_n(
+                    &volume.values[(std::size_t(x) * volume.num_rows + old_row) * _axis_length],
+                    _axis_length,
+                    &_scratch[(std::size_t(x) * num_rows + row) * _axis_length]);
+            }
+        }
+        volume.values.swap(_scratch);
+        volume.first_row = first_row;
+        volume.num_rows = num_rows;
+    }
+
+    // Topmost solid to air crossing of each column in [sample_min, sample_max)
+    // in x and z. A solid top row counts as a surface at the top, the chunk
+    // above starts with the same solid row and has the real one if any.
+    void update_heights(glm::ivec3 offset, DensityVolume& volume, glm::ivec3 sample_min, glm::ivec3 sample_max) {
+        volume.heights.resize(std::size_t(_axis_length) * _axis_length, NO_SURFACE);
+        auto top = std::min(volume.first_row + volume.num_rows, _axis_length) - 1;
+        for (auto x = sample_min.x; x < sample_max.x; x++) {
+            for (auto z = sample_min.z; z < sample_max.z; z++) {
+                auto sample = [&](int y) {
+                    auto row = std::clamp(y - volume.first_row, 0, volume.num_rows - 1);
+                    return volume.values[(std::size_t(x) * volume.num_rows + row) * _axis_length + z];
+                };
+
+                // Above the stored rows everything matches the top one
+                auto height = NO_SURFACE;
+                auto above = sample(_axis_length - 1);
+                if (above < _iso_level) {
+                    height = float(offset.y + _axis_length - 1);
+                } else {
+                    for (auto y = top; y >= 0; y--) {
+                        auto value = sample(y);
+                        if (value < _iso_level) {
+                            height = float(offset.y + y) + (_iso_level - value) / (above - value);
+                            break;
+                        }
+                        above = value;
+                    }
+                }
+                volume.heights[std::size_t(x) * _axis_length + z] = height;
+            }
+        }
+        update_world_heights(offset, sample_min, sample_max);
+    }
+
+    // World columns take the first surface from the top chunk down
+    void update_world_heights(glm::ivec3 offset, glm::ivec3 sample_min, glm::ivec3 sample_max) {
+        auto chunk = offset / _cells;
+        for (auto x = sample_min.x; x < sample_max.x; x++) {
+            for (auto z = sample_min.z; z < sample_max.z; z++) {
+                auto height = NO_SURFACE;
+                for (auto y = _chunks_per_axis - 1; y >= 0 && height == NO_SURFACE; y--) {
+                    const auto& volume = _volumes[std::size_t((chunk.x * _chunks_per_axis + y) * _chunks_per_axis + chunk.z)];
+                    if (!volume.empty()) {
+                        height = volume.heights[std::size_t(x) * _axis_length + z];
+                    }
+                }
+                _world_heights[std::size_t(offset.x + x) * (_world_length + 1) + offset.z + z] = height;
+            }
+        }
+    }
+
+    int _chunks_per_axis;
+    int _axis_length;
+    int _cells;
+    int _world_length;
+    float _iso_level = 1.0f;
+    std::vector<DensityVolume> _volumes;
+    std::vector<ChunkView> _views;
+    DensityVolume _missing;
+    std::vector<float> _world_heights;
+    std::vector<float> _scratch;
+};
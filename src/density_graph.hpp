@@ -0,0 +1,816 @@
+#pragma once
+
+// DensityGraph.hpp
+//
+// Description: Density functions composed from noise, fractal sums, clamps,
+// min/max, smooth unions, domain warps and coordinate terms. Nodes are
+// expression templates, so a whole graph inlines into one function that
+// evaluate() runs four samples at a time. The same graph writes the GLSL for
+// stage 1 and can be turned into a tree of virtual nodes for comparison.
+
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "glm/glm.hpp"
+
+#include "generation_settings.hpp"
+#include "lanes.hpp"
+
+namespace density_graph {
+
+// Ashima Arts simplex noise written per component so T can be float or
+// Lanes. Operations are kept in the order of the GLSL version.
+template<typename T>
+inline T mod289(T x) {
+    return x - lane_floor(x * (1.0f / 289.0f)) * 289.0f;
+}
+
+template<typename T>
+inline T permute(T x) {
+    return mod289((x * 34.0f + 1.0f) * x);
+}
+
+template<typename T>
+inline T simplex_corner(T p, T x, T y, T z) {
+    // Gradients: 7x7 points over a square, mapped onto an octahedron
+    T j = p - 49.0f * lane_floor(p * (1.0f / 49.0f));
+    T x_ = lane_floor(j * (1.0f / 7.0f));
+    T y_ = lane_floor(j - 7.0f * x_);
+
+    T gx = x_ * (2.0f / 7.0f) + 0.5f / 7.0f - 1.0f;
+    T gy = y_ * (2.0f / 7.0f) + 0.5f / 7.0f - 1.0f;
+    T h = 1.0f - lane_abs(gx) - lane_abs(gy);
+
+    T sh = -lane_step(h, T(0.0f));
+    gx = gx + (lane_floor(gx) * 2.0f + 1.0f) * sh;
+    gy = gy + (lane_floor(gy) * 2.0f + 1.0f) * sh;
+
+    // Normalise gradient
+    T norm = 1.79284291400159f - 0.85373472095314f * (gx * gx + gy * gy + h * h);
+    gx = gx * norm;
+    gy = gy * norm;
+    h = h * norm;
+
+    T m = lane_max(0.6f - (x * x + y * y + z * z), T(0.0f));
+    m = m * m;
+    m = m * m;
+    return m * (x * gx + y * gy + z * h);
+}
+
+template<typename T>
+inline T simplex(T x, T y, T z) {
+    const auto C_X = 1.0f / 6.0f;
+    const auto C_Y = 1.0f / 3.0f;
+
+    // First corner
+    T skew = x * C_Y + y * C_Y + z * C_Y;
+    T i = lane_floor(x + skew);
+    T j = lane_floor(y + skew);
+    T k = lane_floor(z + skew);
+    T unskew = i * C_X + j * C_X + k * C_X;
+    T x0 = x - i + unskew;
+    T y0 = y - j + unskew;
+    T z0 = z - k + unskew;
+
+    // Other corners
+    T gx = lane_step(y0, x0);
+    T gy = lane_step(z0, y0);
+    T gz = lane_step(x0, z0);
+    T lx = 1.0f - gx;
+    T ly = 1.0f - gy;
+    T lz = 1.0f - gz;
+    T i1x = lane_min(gx, lz), i1y = lane_min(gy, lx), i1z = lane_min(gz, ly);
+    T i2x = lane_max(gx, lz), i2y = lane_max(gy, lx), i2z = lane_max(gz, ly);
+
+    // Permutations
+    i = mod289(i);
+    j = mod289(j);
+    k = mod289(k);
+    T p0 = permute(permute(permute(k + 0.0f) + j + 0.0f) + i + 0.0f);
+    T p1 = permute(permute(permute(k + i1z) + j + i1y) + i + i1x);
+    T p2 = permute(permute(permute(k + i2z) + j + i2y) + i + i2x);
+    T p3 = permute(permute(permute(k + 1.0f) + j + 1.0f) + i + 1.0f);
+
+    T n0 = simplex_corner(p0, x0, y0, z0);
+    T n1 = simplex_corner(p1, x0 - i1x + C_X, y0 - i1y + C_X, z0 - i1z + C_X);
+    T n2 = simplex_corner(p2, x0 - i2x + C_Y, y0 - i2y + C_Y, z0 - i2z + C_Y);
+    T n3 = simplex_corner(p3, x0 - 0.5f, y0 - 0.5f, z0 - 0.5f);
+
+    return 42.0f * ((n0 + n1) + (n2 + n3));
+}
+
+// One corner of 4D simplex noise, the gradient is picked from the permuted
+// hash p like grad4 in the Ashima GLSL
+template<typename T>
+inline T simplex_corner4(T p, T x, T y, T z, T w) {
+    auto fract = [](T v) { return v - lane_floor(v); };
+    T gx = lane_floor(fract(p * (1.0f / 294.0f)) * 7.0f) * (1.0f / 7.0f) - 1.0f;
+    T gy = lane_floor(fract(p * (1.0f / 49.0f)) * 7.0f) * (1.0f / 7.0f) - 1.0f;
+    T gz = lane_floor(fract(p * (1.0f / 7.0f)) * 7.0f) * (1.0f / 7.0f) - 1.0f;
+    T gw = 1.5f - lane_abs(gx) - lane_abs(gy) - lane_abs(gz);
+
+    // Where w is negative, x, y and z are pushed away from zero
+    T sw = 1.0f - lane_step(T(0.0f), gw);
+    gx = gx + ((1.0f - lane_step(T(0.0f), gx)) * 2.0f - 1.0f) * sw;
+    gy = gy + ((1.0f - lane_step(T(0.0f), gy)) * 2.0f - 1.0f) * sw;
+    gz = gz + ((1.0f - lane_step(T(0.0f), gz)) * 2.0f - 1.0f) * sw;
+
+    // Normalise gradient
+    T norm = 1.79284291400159f - 0.85373472095314f * (gx * gx + gy * gy + gz * gz + gw * gw);
+    gx = gx * norm;
+    gy = gy * norm;
+    gz = gz * norm;
+    gw = gw * norm;
+
+    T m = lane_max(0.6f - (x * x + y * y + z * z + w * w), T(0.0f));
+    m = m * m;
+    m = m * m;
+    return m * (x * gx + y * gy + z * gz + w * gw);
+}
+
+// 4D version for noise that moves through time along w
+template<typename T>
+inline T simplex(T x, T y, T z, T w) {
+    const auto F4 = 0.309016994374947451f;
+    const auto G4 = 0.138196601125011f;
+
+    // First corner
+    T skew = (x + y + z + w) * F4;
+    T i = lane_floor(x + skew);
+    T j = lane_floor(y + skew);
+    T k = lane_floor(z + skew);
+    T l = lane_floor(w + skew);
+    T unskew = (i + j + k + l) * G4;
+    T x0 = x - i + unskew;
+    T y0 = y - j + unskew;
+    T z0 = z - k + unskew;
+    T w0 = w - l + unskew;
+
+    // Rank each coordinate by how many others it is at least as large as,
+    // the simplex steps along the largest first
+    T xy = lane_step(y0, x0), xz = lane_step(z0, x0), xw = lane_step(w0, x0);
+    T yz = lane_step(z0, y0), yw = lane_step(w0, y0), zw = lane_step(w0, z0);
+    T rank_x = xy + xz + xw;
+    T rank_y = (1.0f - xy) + yz + yw;
+    T rank_z = (1.0f - xz) + (1.0f - yz) + zw;
+    T rank_w = (1.0f - xw) + (1.0f - yw) + (1.0f - zw);
+
+    auto step_at = [](T rank, float threshold) {
+        return lane_clamp(rank - threshold, T(0.0f), T(1.0f));
+    };
+    T i1x = step_at(rank_x, 2.0f), i1y = step_at(rank_y, 2.0f), i1z = step_at(rank_z, 2.0f), i1w = step_at(rank_w, 2.0f);
+    T i2x = step_at(rank_x, 1.0f), i2y = step_at(rank_y, 1.0f), i2z = step_at(rank_z, 1.0f), i2w = step_at(rank_w, 1.0f);
+    T i3x = step_at(rank_x, 0.0f), i3y = step_at(rank_y, 0.0f), i3z = step_at(rank_z, 0.0f), i3w = step_at(rank_w, 0.0f);
+
+    // Permutations
+    i = mod289(i);
+    j = mod289(j);
+    k = mod289(k);
+    l = mod289(l);
+    T p0 = permute(permute(permute(permute(l) + k) + j) + i);
+    T p1 = permute(permute(permute(permute(l + i1w) + k + i1z) + j + i1y) + i + i1x);
+    T p2 = permute(permute(permute(permute(l + i2w) + k + i2z) + j + i2y) + i + i2x);
+    T p3 = permute(permute(permute(permute(l + i3w) + k + i3z) + j + i3y) + i + i3x);
+    T p4 = permute(permute(permute(permute(l + 1.0f) + k + 1.0f) + j + 1.0f) + i + 1.0f);
+
+    T n0 = simplex_corner4(p0, x0, y0, z0, w0);
+    T n1 = simplex_corner4(p1, x0 - i1x + G4, y0 - i1y + G4, z0 - i1z + G4, w0 - i1w + G4);
+    T n2 = simplex_corner4(p2, x0 - i2x + 2.0f * G4, y0 - i2y + 2.0f * G4, z0 - i2z + 2.0f * G4, w0 - i2w + 2.0f * G4);
+    T n3 = simplex_corner4(p3, x0 - i3x + 3.0f * G4, y0 - i3y + 3.0f * G4, z0 - i3z + 3.0f * G4, w0 - i3w + 3.0f * G4);
+    T n4 = simplex_corner4(p4, x0 - 1.0f + 4.0f * G4, y0 - 1.0f + 4.0f * G4, z0 - 1.0f + 4.0f * G4, w0 - 1.0f + 4.0f * G4);
+
+    return 49.0f * ((n0 + n1) + (n2 + n3) + n4);
+}
+
+// Writes the helper functions a graph needs, every helper takes vec3 pos
+class GlslWriter {
+public:
+    std::string function(const std::string& body) {
+        auto name = "density_node_" + std::to_string(_count++);
+        _functions += "float " + name + "(vec3 pos)\n{\n" + body + "}\n\n";
+        return name;
+    }
+
+    const std::string& functions() const {
+        return _functions;
+    }
+
+    // Round trips through a float and always reads as a float in GLSL
+    static std::string literal(float value) {
+        char buffer[32];
+        std::snprintf(buffer, sizeof(buffer), "%.9g", value);
+        std::string text = buffer;
+        if (text.find_first_of(".en") == std::string::npos) {
+            text += ".0";
+        }
+        return text;
+    }
+
+private:
+    std::string _functions;
+    int _count = 0;
+};
+
+struct AddOp {
+    template<typename T> static T apply(T a, T b) { return a + b; }
+    static std::string glsl(const std::string& a, const std::string& b) { return "(" + a + " + " + b + ")"; }
+};
+
+struct SubtractOp {
+    template<typename T> static T apply(T a, T b) { return a - b; }
+    static std::string glsl(const std::string& a, const std::string& b) { return "(" + a + " - " + b + ")"; }
+};
+
+struct MultiplyOp {
+    template<typename T> static T apply(T a, T b) { return a * b; }
+    static std::string glsl(const std::string& a, const std::string& b) { return "(" + a + " * " + b + ")"; }
+};
+
+struct MinimumOp {
+    template<typename T> static T apply(T a, T b) { return lane_min(a, b); }
+    static std::string glsl(const std::string& a, const std::string& b) { return "min(" + a + ", " + b + ")"; }
+};
+
+struct MaximumOp {
+    template<typename T> static T apply(T a, T b) { return lane_max(a, b); }
+    static std::string glsl(const std::string& a, const std::string& b) { return "max(" + a + ", " + b + ")"; }
+};
+
+struct FractalParameters {
+    float frequency;
+    int octaves;
+    float persistence;
+    float lacunarity;
+};
+
+// Per sample virtual evaluation of a graph, the baseline fusion is measured
+// against. Every operation is its own node, fractal sums included, which are
+// unrolled into nodes per octave.
+class InterpretedNode {
+public:
+    virtual ~InterpretedNode() = default;
+    virtual float eval(float x, float y, float z) const = 0;
+};
+
+using InterpretedGraph = std::unique_ptr<InterpretedNode>;
+
+template<typename Function>
+class InterpretedFunction : public InterpretedNode {
+public:
+    explicit InterpretedFunction(Function&& function) : _function(std::move(function)) {}
+
+    float eval(float x, float y, float z) const override {
+        return _function(x, y, z);
+    }
+
+private:
+    Function _function;
+};
+
+template<typename Function>
+InterpretedGraph make_interpreted(Function function) {
+    return std::make_unique<InterpretedFunction<Function>>(std::move(function));
+}
+
+template<typename Derived>
+struct Node {
+    const Derived& self() const {
+        return static_cast<const Derived&>(*this);
+    }
+};
+
+// Leaves have no children, so interpreting them only adds the virtual call
+template<typename Leaf>
+InterpretedGraph interpret_leaf(const Leaf& leaf) {
+    return make_interpreted([leaf](float x, float y, float z) {
+        return leaf.eval(x, y, z);
+    });
+}
+
+// Children are evaluated a then b, the ridged weight slot relies on it
+template<typename Op>
+InterpretedGraph interpret_binary(InterpretedGraph a, InterpretedGraph b) {
+    return make_interpreted([a = std::move(a), b = std::move(b)](float x, float y, float z) {
+        auto a_value = a->eval(x, y, z);
+        auto b_value = b->eval(x, y, z);
+        return Op::apply(a_value, b_value);
+    });
+}
+
+inline InterpretedGraph interpret_constant(float value) {
+    return make_interpreted([value](float, float, float) {
+        return value;
+    });
+}
+
+// Sum over octaves of term(octave, frequency) * amplitude, a node per octave
+// and per operation. The fused loops add in the same order, so the values
+// match exactly.
+template<typename Term>
+InterpretedGraph interpret_octaves(const FractalParameters& parameters, Term&& term) {
+    auto sum = InterpretedGraph();
+    auto frequency = parameters.frequency;
+    auto amplitude = 1.0f;
+    for (auto octave = 0; octave < parameters.octaves; octave++) {
+        auto weighted = interpret_binary<MultiplyOp>(term(octave, frequency), interpret_constant(amplitude));
+        sum = sum ? interpret_binary<AddOp>(std::move(sum), std::move(weighted)) : std::move(weighted);
+        amplitude *= parameters.persistence;
+        frequency *= parameters.lacunarity;
+    }
+    return sum ? std::move(sum) : interpret_constant(0.0f);
+}
+
+// Ridged octaves with noise(frequency) as the octave's noise node. Each
+// octave is weighted by the last, which passes its clamped value on through
+// a slot shared by the octave nodes, so the graph is not reentrant.
+template<typename Noise>
+InterpretedGraph interpret_ridged(const FractalParameters& parameters, Noise&& noise) {
+    auto weight = std::make_shared<float>(1.0f);
+    return interpret_octaves(parameters, [&](int octave, float frequency) {
+        auto ridge = make_interpreted([noise = noise(frequency)](float x, float y, float z) {
+            return 1.0f - lane_abs(noise->eval(x, y, z));
+        });
+        auto squared = make_interpreted([ridge = std::move(ridge)](float x, float y, float z) {
+            auto value = ridge->eval(x, y, z);
+            return value * value;
+        });
+        auto previous = octave == 0
+            ? interpret_constant(1.0f)
+            : make_interpreted([weight](float, float, float) { return *weight; });
+        auto weighted = interpret_binary<MultiplyOp>(std::move(squared), std::move(previous));
+        return make_interpreted([weighted = std::move(weighted), weight](float x, float y, float z) {
+            auto value = weighted->eval(x, y, z);
+            *weight = lane_max(lane_min(value, 1.0f), 0.0f);
+            return value;
+        });
+    });
+}
+
+struct Constant : Node<Constant> {
+    float value;
+
+    explicit Constant(float t_value) : value(t_value) {}
+
+    template<typename T>
+    T eval(T, T, T) const {
+        return T(value);
+    }
+
+    std::string glsl(GlslWriter&, const std::string&) const {
+        return GlslWriter::literal(value);
+    }
+
+    InterpretedGraph interpret() const {
+        return interpret_leaf(*this);
+    }
+};
+
+template<int Axis>
+struct Coordinate : Node<Coordinate<Axis>> {
+    template<typename T>
+    T eval(T x, T y, T z) const {
+        return Axis == 0 ? x : (Axis == 1 ? y : z);
+    }
+
+    std::string glsl(GlslWriter&, const std::string& pos) const {
+        return pos + (Axis == 0 ? ".x" : (Axis == 1 ? ".y" : ".z"));
+    }
+
+    InterpretedGraph interpret() const {
+        return interpret_leaf(*this);
+    }
+};
+
+struct Simplex : Node<Simplex> {
+    float frequency;
+
+    explicit Simplex(float t_frequency) : frequency(t_frequency) {}
+
+    template<typename T>
+    T eval(T x, T y, T z) const {
+        return simplex(x * frequency, y * frequency, z * frequency);
+    }
+
+    std::string glsl(GlslWriter&, const std::string& pos) const {
+        return "snoise(" + pos + " * " + GlslWriter::literal(frequency) + ")";
+    }
+
+    InterpretedGraph interpret() const {
+        return interpret_leaf(*this);
+    }
+};
+
+// Sum of octaves of simplex noise
+struct Fbm : Node<Fbm> {
+    FractalParameters parameters;
+
+    explicit Fbm(FractalParameters t_parameters) : parameters(t_parameters) {}
+
+    template<typename T>
+    T eval(T x, T y, T z) const {
+        T noise = 0.0f;
+        auto frequency = parameters.frequency;
+        auto amplitude = 1.0f;
+        for (auto octave = 0; octave < parameters.octaves; octave++) {
+            noise = noise + simplex(x * frequency, y * frequency, z * frequency) * amplitude;
+            amplitude *= parameters.persistence;
+            frequency *= parameters.lacunarity;
+        }
+        return noise;
+    }
+
+    std::string glsl(GlslWriter& writer, const std::string& pos) const {
+        return writer.function(
+            "    float noise = 0.0;\n"
+            "    float frequency = " + GlslWriter::literal(parameters.frequency) + ";\n"
+            "    float amplitude = 1.0;\n"
+            "    for (int octave = 0; octave < " + std::to_string(parameters.octaves) + "; octave++) {\n"
+            "        noise += snoise(pos * frequency) * amplitude;\n"
+            "        amplitude *= " + GlslWriter::literal(parameters.persistence) + ";\n"
+            "        frequency *= " + GlslWriter::literal(parameters.lacunarity) + ";\n"
+            "    }\n"
+            "    return noise;\n"
+        ) + "(" + pos + ")";
+    }
+
+    InterpretedGraph interpret() const {
+        return interpret_octaves(parameters, [](int, float frequency) {
+            return Simplex(frequency).interpret();
+        });
+    }
+};
+
+// Ridged multifractal from stage 1, each octave is weighted by the last
+struct Ridged : Node<Ridged> {
+    FractalParameters parameters;
+
+    explicit Ridged(FractalParameters t_parameters) : parameters(t_parameters) {}
+
+    template<typename T>
+    T eval(T x, T y, T z) const {
+        T noise = 0.0f;
+        T weight = 1.0f;
+        auto frequency = parameters.frequency;
+        auto amplitude = 1.0f;
+        for (auto octave = 0; octave < parameters.octaves; octave++) {
+            T v = 1.0f - lane_abs(simplex(x * frequency, y * frequency, z * frequency));
+            v = v * v;
+            v = v * weight;
+            weight = lane_max(lane_min(v, T(1.0f)), T(0.0f));
+            noise = noise + v * amplitude;
+            amplitude *= parameters.persistence;
+            frequency *= parameters.lacunarity;
+        }
+        return noise;
+    }
+
+    std::string glsl(GlslWriter& writer, const std::string& pos) const {
+        return writer.function(
+            "    float noise = 0.0;\n"
+            "    float weight = 1.0;\n"
+            "    float frequency = " + GlslWriter::literal(parameters.frequency) + ";\n"
+            "    float amplitude = 1.0;\n"
+            "    for (int octave = 0; octave < " + std::to_string(parameters.octaves) + "; octave++) {\n"
+            "        float v = 1.0 - abs(snoise(pos * frequency));\n"
+            "        v = v * v;\n"
+            "        v *= weight;\n"
+            "        weight = max(min(v, 1.0), 0.0);\n"
+            "        noise += v * amplitude;\n"
+            "        amplitude *= " + GlslWriter::literal(parameters.persistence) + ";\n"
+            "        frequency *= " + GlslWriter::literal(parameters.lacunarity) + ";\n"
+            "    }\n"
+            "    return noise;\n"
+        ) + "(" + pos + ")";
+    }
+
+    InterpretedGraph interpret() const {
+        return interpret_ridged(parameters, [](float frequency) {
+            return Simplex(frequency).interpret();
+        });
+    }
+};
+
+// Ridged from a slice of 4D noise at w, moving w animates the terrain. Each
+// octave scales w by its frequency, so fine detail changes fastest. CPU only,
+// stage 1 has no 4D noise so there is no glsl.
+struct AnimatedRidged : Node<AnimatedRidged> {
+    FractalParameters parameters;
+    float w;
+
+    AnimatedRidged(FractalParameters t_parameters, float t_w) : parameters(t_parameters), w(t_w) {}
+
+    template<typename T>
+    T eval(T x, T y, T z) const {
+        T noise = 0.0f;
+        T weight = 1.0f;
+        auto frequency = parameters.frequency;
+        auto amplitude = 1.0f;
+        for (auto octave = 0; octave < parameters.octaves; octave++) {
+            T v = 1.0f - lane_abs(simplex(x * frequency, y * frequency, z * frequency, T(w * frequency)));
+            v = v * v;
+            v = v * weight;
+            weight = lane_max(lane_min(v, T(1.0f)), T(0.0f));
+            noise = noise + v * amplitude;
+            amplitude *= parameters.persistence;
+            frequency *= parameters.lacunarity;
+        }
+        return noise;
+    }
+
+    InterpretedGraph interpret() const {
+        return interpret_ridged(parameters, [w = w](float frequency) {
+            return make_interpreted([frequency, w](float x, float y, float z) {
+                return simplex(x * frequency, y * frequency, z * frequency, w * frequency);
+            });
+        });
+    }
+};
+
+template<typename A, typename B, typename Op>
+struct Binary : Node<Binary<A, B, Op>> {
+    A a;
+    B b;
+
+    Binary(const A& t_a, const B& t_b) : a(t_a), b(t_b) {}
+
+    template<typename T>
+    T eval(T x, T y, T z) const {
+        return Op::apply(a.eval(x, y, z), b.eval(x, y, z));
+    }
+
+    std::string glsl(GlslWriter& writer, const std::string& pos) const {
+        return Op::glsl(a.glsl(writer, pos), b.glsl(writer, pos));
+    }
+
+    InterpretedGraph interpret() const {
+        return interpret_binary<Op>(a.interpret(), b.interpret());
+    }
+};
+
+// Polynomial smooth minimum, blends the two surfaces over a band of width k
+template<typename A, typename B>
+struct SmoothUnion : Node<SmoothUnion<A, B>> {
+    A a;
+    B b;
+    float k;
+
+    SmoothUnion(const A& t_a, const B& t_b, float t_k) : a(t_a), b(t_b), k(t_k) {}
+
+    template<typename T>
+    static T blend(T a, T b, float k) {
+        T h = lane_clamp(0.5f + 0.5f * (b - a) / k, T(0.0f), T(1.0f));
+        return b + (a - b) * h - k * h * (1.0f - h);
+    }
+
+    template<typename T>
+    T eval(T x, T y, T z) const {
+        return blend(a.eval(x, y, z), b.eval(x, y, z), k);
+    }
+
+    std::string glsl(GlslWriter& writer, const std::string& pos) const {
+        auto k_text = GlslWriter::literal(k);
+        return writer.function(
+            "    float a = " + a.glsl(writer, "pos") + ";\n"
+            "    float b = " + b.glsl(writer, "pos") + ";\n"
+            "    float h = clamp(0.5 + 0.5 * (b - a) / " + k_text + ", 0.0, 1.0);\n"
+            "    return b + (a - b) * h - " + k_text + " * h * (1.0 - h);\n"
+        ) + "(" + pos + ")";
+    }
+
+    InterpretedGraph interpret() const {
+        return make_interpreted([a = a.interpret(), b = b.interpret(), k = k](float x, float y, float z) {
+            return blend(a->eval(x, y, z), b->eval(x, y, z), k);
+        });
+    }
+};
+
+template<typename A>
+struct Clamp : Node<Clamp<A>> {
+    A a;
+    float low;
+    float high;
+
+    Clamp(const A& t_a, float t_low, float t_high) : a(t_a), low(t_low), high(t_high) {}
+
+    template<typename T>
+    T eval(T x, T y, T z) const {
+        return lane_clamp(a.eval(x, y, z), T(low), T(high));
+    }
+
+    std::string glsl(GlslWriter& writer, const std::string& pos) const {
+        return "clamp(" + a.glsl(writer, pos) + ", " + GlslWriter::literal(low) + ", " + GlslWriter::literal(high) + ")";
+    }
+
+    InterpretedGraph interpret() const {
+        return make_interpreted([a = a.interpret(), low = low, high = high](float x, float y, float z) {
+            return lane_clamp(a->eval(x, y, z), low, high);
+        });
+    }
+};
+
+// Evaluates the child at pos + strength * (wx, wy, wz)
+template<typename A, typename WX, typename WY, typename WZ>
+struct Warp : Node<Warp<A, WX, WY, WZ>> {
+    A a;
+    WX wx;
+    WY wy;
+    WZ wz;
+    float strength;
+
+    Warp(const A& t_a, const WX& t_wx, const WY& t_wy, const WZ& t_wz, float t_strength)
+    : a(t_a), wx(t_wx), wy(t_wy), wz(t_wz), strength(t_strength)
+    {
+    }
+
+    template<typename T>
+    T eval(T x, T y, T z) const {
+        return a.eval(
+            x + strength * wx.eval(x, y, z),
+            y + strength * wy.eval(x, y, z),
+            z + strength * wz.eval(x, y, z)
+        );
+    }
+
+    std::string glsl(GlslWriter& writer, const std::string& pos) const {
+        return writer.function(
+            "    vec3 warped = pos + " + GlslWriter::literal(strength) + " * vec3(" +
+                wx.glsl(writer, "pos") + ", " + wy.glsl(writer, "pos") + ", " + wz.glsl(writer, "pos") + ");\n"
+            "    return " + a.glsl(writer, "warped") + ";\n"
+        ) + "(" + pos + ")";
+    }
+
+    InterpretedGraph interpret() const {
+        return make_interpreted(
+            [a = a.interpret(), wx = wx.interpret(), wy = wy.interpret(), wz = wz.interpret(), strength = strength]
+            (float x, float y, float z) {
+                return a->eval(
+                    x + strength * wx->eval(x, y, z),
+                    y + strength * wy->eval(x, y, z),
+                    z + strength * wz->eval(x, y, z)
+                );
+            });
+    }
+};
+
+// a < b ? then : otherwise. A branch no lane takes is skipped, so rows on the
+// terrain floor or ceiling never evaluate noise.
+template<typename A, typename B, typename Then, typename Otherwise>
+struct IfLess : Node<IfLess<A, B, Then, Otherwise>> {
+    A a;
+    B b;
+    Then then;
+    Otherwise otherwise;
+
+    IfLess(const A& t_a, const B& t_b, const Then& t_then, const Otherwise& t_otherwise)
+    : a(t_a), b(t_b), then(t_then), otherwise(t_otherwise)
+    {
+    }
+
+    template<typename T>
+    T eval(T x, T y, T z) const {
+        auto a_value = a.eval(x, y, z);
+        auto b_value = b.eval(x, y, z);
+        if (lane_all_less(a_value, b_value)) {
+            return then.eval(x, y, z);
+        }
+        if (lane_none_less(a_value, b_value)) {
+            return otherwise.eval(x, y, z);
+        }
+        return lane_select_less(a_value, b_value, then.eval(x, y, z), otherwise.eval(x, y, z));
+    }
+
+    std::string glsl(GlslWriter& writer, const std::string& pos) const {
+        return "(" + a.glsl(writer, pos) + " < " + b.glsl(writer, pos) + " ? " +
+            then.glsl(writer, pos) + " : " + otherwise.glsl(writer, pos) + ")";
+    }
+
+    InterpretedGraph interpret() const {
+        return make_interpreted(
+            [a = a.interpret(), b = b.interpret(), then = then.interpret(), otherwise = otherwise.interpret()]
+            (float x, float y, float z) {
+                return a->eval(x, y, z) < b->eval(x, y, z) ? then->eval(x, y, z) : otherwise->eval(x, y, z);
+            });
+    }
+};
+
+// Builders
+
+inline Constant constant(float value) { return Constant(value); }
+inline Coordinate<0> x() { return {}; }
+inline Coordinate<1> y() { return {}; }
+inline Coordinate<2> z() { return {}; }
+inline Simplex simplex_noise(float frequency) { return Simplex(frequency); }
+inline Fbm fbm(FractalParameters parameters) { return Fbm(parameters); }
+inline Ridged ridged(FractalParameters parameters) { return Ridged(parameters); }
+inline AnimatedRidged animated_ridged(FractalParameters parameters, float w) { return AnimatedRidged(parameters, w); }
+
+template<typename A, typename B>
+Binary<A, B, AddOp> operator+(const Node<A>& a, const Node<B>& b) { return { a.self(), b.self() }; }
+template<typename A, typename B>
+Binary<A, B, SubtractOp> operator-(const Node<A>& a, const Node<B>& b) { return { a.self(), b.self() }; }
+template<typename A, typename B>
+Binary<A, B, MultiplyOp> operator*(const Node<A>& a, const Node<B>& b) { return { a.self(), b.self() }; }
+
+template<typename A>
+Binary<A, Constant, AddOp> operator+(const Node<A>& a, float b) { return { a.self(), Constant(b) }; }
+template<typename A>
+Binary<A, Constant, SubtractOp> operator-(const Node<A>& a, float b) { return { a.self(), Constant(b) }; }
+template<typename A>
+Binary<A, Constant, MultiplyOp> operator*(const Node<A>& a, float b) { return { a.self(), Constant(b) }; }
+template<typename B>
+Binary<Constant, B, AddOp> operator+(float a, const Node<B>& b) { return { Constant(a), b.self() }; }
+template<typename B>
+Binary<Constant, B, SubtractOp> operator-(float a, const Node<B>& b) { return { Constant(a), b.self() }; }
+template<typename B>
+Binary<Constant, B, MultiplyOp> operator*(float a, const Node<B>& b) { return { Constant(a), b.self() }; }
+
+template<typename A, typename B>
+Binary<A, B, MinimumOp> minimum(const Node<A>& a, const Node<B>& b) { return { a.self(), b.self() }; }
+template<typename A, typename B>
+Binary<A, B, MaximumOp> maximum(const Node<A>& a, const Node<B>& b) { return { a.self(), b.self() }; }
+
+template<typename A, typename B>
+SmoothUnion<A, B> smooth_union(const Node<A>& a, const Node<B>& b, float k) { return { a.self(), b.self(), k }; }
+
+template<typename A>
+Clamp<A> clamp(const Node<A>& a, float low, float high) { return { a.self(), low, high }; }
+
+template<typename A, typename WX, typename WY, typename WZ>
+Warp<A, WX, WY, WZ> warp(const Node<A>& a, const Node<WX>& wx, const Node<WY>& wy, const Node<WZ>& wz, float strength) {
+    return { a.self(), wx.self(), wy.self(), wz.self(), strength };
+}
+
+template<typename A, typename B, typename Then, typename Otherwise>
+IfLess<A, B, Then, Otherwise> if_less(const Node<A>& a, const Node<B>& b, const Node<Then>& then, const Node<Otherwise>& otherwise) {
+    return { a.self(), b.self(), then.self(), otherwise.self() };
+}
+
+// Evaluation
+
+template<typename Graph>
+float evaluate(const Node<Graph>& graph, glm::vec3 pos) {
+    return graph.self().eval(pos.x, pos.y, pos.z);
+}
+
+// Fills the x slabs [x_begin, x_end) of an axis_length^3 block laid out like
+// the stage 1 grid, four samples along z per call into the fused graph.
+// Disjoint slab ranges can be filled from different threads.
+template<typename Graph>
+void evaluate(const Node<Graph>& node, glm::ivec3 origin, int axis_length, int x_begin, int x_end, float* values) {
+    const auto& graph = node.self();
+    const float lane_offsets[LANE_COUNT] = { 0.0f, 1.0f, 2.0f, 3.0f };
+    const auto offsets = Lanes::load(lane_offsets);
+
+    for (auto x = x_begin; x < x_end; x++) {
+        for (auto y = 0; y < axis_length; y++) {
+            auto* row = values + (std::size_t(x) * axis_length + y) * axis_length;
+            auto sample_x = float(origin.x + x);
+            auto sample_y = float(origin.y + y);
+
+            auto z = 0;
+            for (; z + LANE_COUNT <= axis_length; z += LANE_COUNT) {
+                auto sample_z = Lanes(float(origin.z + z)) + offsets;
+                graph.eval(Lanes(sample_x), Lanes(sample_y), sample_z).store(row + z);
+            }
+            for (; z < axis_length; z++) {
+                row[z] = graph.eval(sample_x, sample_y, float(origin.z + z));
+            }
+        }
+    }
+}
+
+template<typename Graph>
+void evaluate(const Node<Graph>& node, glm::ivec3 origin, int axis_length, float* values) {
+    evaluate(node, origin, axis_length, 0, axis_length, values);
+}
+
+// GLSL
+
+// A complete function float name(vec3 pos) with the helpers it calls. Needs
+// the vec3 snoise from stage 1.
+template<typename Graph>
+std::string glsl_function(const Node<Graph>& graph, const std::string& name) {
+    auto writer = GlslWriter();
+    auto expression = graph.self().glsl(writer, "pos");
+    return writer.functions() + "float " + name + "(vec3 pos)\n{\n    return " + expression + ";\n}\n";
+}
+
+// Replaces the procedural_density block of the stage 1 source
+inline std::string splice_density_function(const std::string& stage1_source, const std::string& function) {
+    const std::string begin_marker = "// BEGIN DENSITY FUNCTION";
+    const std::string end_marker = "// END DENSITY FUNCTION";
+
+    auto begin = stage1_source.find(begin_marker);
+    auto end = stage1_source.find(end_marker);
+    if (begin == std::string::npos || end == std::string::npos || end < begin) {
+        throw std::runtime_error("Stage 1 source has no density function markers");
+    }
+
+    begin += begin_marker.size();
+    return stage1_source.substr(0, begin) + "\n" + function + stage1_source.substr(end);
+}
+
+} // namespace density_graph
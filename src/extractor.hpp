@@ -0,0 +1,533 @@
+#pragma once
+
+// Extractor.hpp
+//
+// Description: CPU surface extraction from a density grid. Marching cubes is
+// the CPU twin of stage 2 with vertices shared along grid edges, classifies
+// cells 64 at a time on sign bitplanes, meshes several iso levels in one pass
+// over the grid and can be fed one slab at a time. Surface nets places one vertex
+// per surface cell and joins them with a quad per crossing edge. On the
+// default terrain it needs about as many vertices as marching cubes with
+// shared vertices. For chunks it takes a ring of one sample below each chunk
+// face, so the quads across the faces are closed from the same samples on
+// both sides.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "bitplanes.hpp"
+#include "density.hpp"
+#include "generation_settings.hpp"
+#include "marching_cubes_tables.hpp"
+
+struct MeshVertex {
+    glm::vec4 position;
+    glm::vec4 normal;
+    glm::vec4 color;
+};
+
+// Indexed triangle list, positions are in world space like stage 2 output
+struct ExtractedMesh {
+    std::vector<MeshVertex> vertices;
+    std::vector<uint32_t> indices;
+
+    void clear() {
+        vertices.clear();
+        indices.clear();
+    }
+
+    std::size_t num_triangles() const {
+        return indices.size() / 3;
+    }
+};
+
+// Same bands as determine_color in stage 2
+inline glm::vec4 terrain_color(glm::vec3 normal) {
+    const auto length = glm::length(normal);
+    if (length == 0.0f) {
+        return glm::vec4(0.5f);
+    }
+
+    auto angle = glm::degrees(std::acos(glm::clamp(normal.y / length, -1.0f, 1.0f)));
+    if (angle <= 10.0f) {
+        return glm::vec4(0.17f, 0.58f, 0.30f, 0.0f);
+    }
+    if (angle <= 60.0f) {
+        return glm::vec4(0.71f, 0.44f, 0.20f, 0.0f);
+    }
+    if (angle <= 100.0f) {
+        return glm::vec4(0.44f, 0.28f, 0.13f, 0.0f);
+    }
+    return glm::vec4(0.5f);
+}
+
+class Extractor {
+public:
+    virtual ~Extractor() = default;
+
+    // Replaces mesh with the surface at iso_level, solid is below it
+    virtual void extract(const DensityGrid& grid, float iso_level, ExtractedMesh& mesh) = 0;
+
+    // Replaces meshes[i] with the surface at iso_levels[i], the same mesh
+    // extract gives for that level. A pass per level unless overridden.
+    virtual void extract_levels(const DensityGrid& grid, const std::vector<float>& iso_levels, std::vector<ExtractedMesh>& meshes) {
+        meshes.resize(iso_levels.size());
+        for (auto level = std::size_t(0); level < iso_levels.size(); level++) {
+            extract(grid, iso_levels[level], meshes[level]);
+        }
+    }
+
+    // Samples before the chunk on each axis the grid given to extract must
+    // start with. The surface of the edges in that ring belongs to the chunks
+    // below and is left to them. 0, the grid is just the chunk, unless
+    // overridden.
+    virtual int overlap() const {
+        return 0;
+    }
+
+    // For meshing the chunks of the terrain, nullptr for MARCHING_CUBES_GPU,
+    // which stays in the compute shaders
+    static std::unique_ptr<Extractor> create(ExtractorType type);
+
+protected:
+    // Central differences, one sided on the grid border. Density rises
+    // towards air, so the gradient is the outward normal. Grid is anything
+    // with at(x, y, z) and axis_length like DensityGrid.
+    template<typename Grid>
+    static glm::vec3 gradient(const Grid& grid, int x, int y, int z) {
+        auto last = grid.axis_length - 1;
+        auto difference = [&](int x0, int y0, int z0, int x1, int y1, int z1, int steps) {
+            return (grid.at(x1, y1, z1) - grid.at(x0, y0, z0)) / float(steps);
+        };
+
+        auto xl = std::max(x - 1, 0), xh = std::min(x + 1, last);
+        auto yl = std::max(y - 1, 0), yh = std::min(y + 1, last);
+        auto zl = std::max(z - 1, 0), zh = std::min(z + 1, last);
+        return glm::vec3(
+            difference(xl, y, z, xh, y, z, xh - xl),
+            difference(x, yl, z, x, yh, z, yh - yl),
+            difference(x, y, zl, x, y, zh, zh - zl)
+        );
+    }
+
+    static MeshVertex make_vertex(glm::vec3 position, glm::vec3 normal) {
+        auto length = glm::length(normal);
+        if (length > 0.0f) {
+            normal /= length;
+        }
+        return MeshVertex { glm::vec4(position, 0.0f), glm::vec4(normal, 0.0f), terrain_color(normal) };
+    }
+};
+
+class MarchingCubesExtractor : public Extractor {
+public:
+    void extract(const DensityGrid& grid, float iso_level, ExtractedMesh& mesh) override {
+        march(grid, &iso_level, 1, 0, grid.axis_length - 1, &mesh);
+    }
+
+    // Only the cells with x in [cell_x_begin, cell_x_end), so slabs of one
+    // grid can be meshed on different threads. Vertices on the planes between
+    // slabs are repeated in both meshes.
+    void extract_cells(const DensityGrid& grid, float iso_level, int cell_x_begin, int cell_x_end, ExtractedMesh& mesh) {
+        march(grid, &iso_level, 1, cell_x_begin, std::min(cell_x_end, grid.axis_length - 1), &mesh);
+    }
+
+    // One walk over the grid for every level. Each row of samples is read
+    // once and thresholded against all levels, and a level skips the words
+    // of 64 cells whose samples all lie on one side of it.
+    void extract_levels(const DensityGrid& grid, const std::vector<float>& iso_levels, std::vector<ExtractedMesh>& meshes) override {
+        meshes.resize(iso_levels.size());
+        march(grid, iso_levels.data(), iso_levels.size(), 0, grid.axis_length - 1, meshes.data());
+    }
+
+    // The same mesh as extract, fed one slab of cells at a time in x order
+    // for samples that are never all in memory. Samples is anything with
+    // at(x, y, z), row(x, y), axis_length and offset like DensityGrid, and
+    // only has to hold the sample slices x - 1 to x + 2 while slab x is
+    // extracted, the normals read one slice either side of the cell.
+    void begin_slabs(int axis_length, ExtractedMesh& mesh) {
+        begin_march(axis_length, 1, &mesh);
+    }
+
+    template<typename Samples>
+    void extract_slab(const Samples& samples, float iso_level, int x, ExtractedMesh& mesh) {
+        march_slab(samples, &iso_level, 1, x, x == 0, &mesh);
+    }
+
+private:
+    static constexpr uint32_t NO_VERTEX = std::numeric_limits<uint32_t>::max();
+
+    // Lower sample and axis of each edge waiting for its vertex
+    struct PendingEdges {
+        std::vector<int> x, y, z, axis;
+        std::vector<float> density_a, density_b, mu;
+
+        void add(int edge_x, int edge_y, int edge_z, int edge_axis) {
+            x.push_back(edge_x);
+            y.push_back(edge_y);
+            z.push_back(edge_z);
+            axis.push_back(edge_axis);
+        }
+
+        std::size_t size() const {
+            return x.size();
+        }
+
+        void clear() {
+            x.clear();
+            y.clear();
+            z.clear();
+            axis.clear();
+        }
+    };
+
+    template<typename Samples>
+    void march(
+        const Samples& grid,
+        const float* iso_levels,
+        std::size_t num_levels,
+        int cell_x_begin,
+        int cell_x_end,
+        ExtractedMesh* meshes
+    )
+    {
+        begin_march(grid.axis_length, num_levels, meshes);
+        if (num_levels == 0 || grid.axis_length < 2) {
+            return;
+        }
+
+        for (auto x = cell_x_begin; x < cell_x_end; x++) {
+            march_slab(grid, iso_levels, num_levels, x, x == cell_x_begin, meshes);
+        }
+    }
+
+    // One vertex per crossing grid edge, keyed by its lower sample and
+    // axis. The cells of slab x only touch edges whose lower sample is at
+    // x or x + 1, so each level keeps two slabs of edges and reuses them.
+    // Instead of clearing a slab when it is reused, slots holding a vertex
+    // from before it was taken over count as empty.
+    void begin_march(int length, std::size_t num_levels, ExtractedMesh* meshes) {
+        for (auto level = std::size_t(0); level < num_levels; level++) {
+            meshes[level].clear();
+        }
+        _slab_size = std::size_t(length) * length * 3;
+        _edge_vertices.assign(num_levels * 2 * _slab_size, NO_VERTEX);
+        _sign_planes.resize(num_levels * 2);
+        for (auto& plane : _sign_planes) {
+            plane.resize(length);
+        }
+        for (auto& ranges : _range_planes) {
+            ranges.resize(length);
+        }
+        _pending.resize(num_levels);
+        _slab_first_vertex.assign(num_levels * 2, 0);
+    }
+
+    uint32_t* edge_slab(std::size_t level, int x) {
+        return _edge_vertices.data() + (level * 2 + (x & 1)) * _slab_size;
+    }
+
+    // The rows are read once for all levels. Each word of 64 cells is then
+    // meshed for the levels inside the range of its samples, the others
+    // have every corner on one side and are skipped.
+    template<typename Samples>
+    void march_slab(
+        const Samples& grid,
+        const float* iso_levels,
+        std::size_t num_levels,
+        int x,
+        bool first,
+        ExtractedMesh* meshes
+    )
+    {
+        const auto length = grid.axis_length;
+
+        // Slab x + 1 takes the place of slab x - 1, and sign plane x + 1
+        // that of x - 1. Plane x is kept from the slab before.
+        if (first) {
+            threshold_levels(grid, x, iso_levels, num_levels, sign_planes(num_levels, x), range_plane(x));
+        }
+        threshold_levels(grid, x + 1, iso_levels, num_levels, sign_planes(num_levels, x + 1), range_plane(x + 1));
+        for (auto level = std::size_t(0); level < num_levels; level++) {
+            const auto first_vertex = uint32_t(meshes[level].vertices.size());
+            if (first) {
+                _slab_first_vertex[level * 2 + (x & 1)] = first_vertex;
+            }
+            _slab_first_vertex[level * 2 + ((x + 1) & 1)] = first_vertex;
+            _pending[level].clear();
+        }
+
+        const auto* low = sign_planes(num_levels, x);
+        const auto* high = sign_planes(num_levels, x + 1);
+        const auto& low_ranges = range_plane(x);
+        const auto& high_ranges = range_plane(x + 1);
+
+        for (auto y = 0; y < length - 1; y++) {
+            for (auto w = 0; w < low_ranges.words_per_row && w * 64 < length - 1; w++) {
+                const auto below = low_ranges.index(y, w);
+                const auto above = low_ranges.index(y + 1, w);
+                const auto lowest = std::min(
+                    std::min(low_ranges.lowest[below], low_ranges.lowest[above]),
+                    std::min(high_ranges.lowest[below], high_ranges.lowest[above])
+                );
+                const auto highest = std::max(
+                    std::max(low_ranges.highest[below], low_ranges.highest[above]),
+                    std::max(high_ranges.highest[below], high_ranges.highest[above])
+                );
+
+                for (auto level = std::size_t(0); level < num_levels; level++) {
+                    if (lowest >= iso_levels[level] || highest < iso_levels[level]) {
+                        continue;
+                    }
+
+                    auto& mesh = meshes[level];
+                    auto& pending = _pending[level];
+                    const auto first_vertex = _slab_first_vertex[level * 2 + ((x + 1) & 1)];
+                    uint32_t* edges[2] = { edge_slab(level, x), edge_slab(level, x + 1) };
+                    const uint32_t valid_from[2] = { _slab_first_vertex[level * 2 + (x & 1)], first_vertex };
+                    for_each_active_cell_in_word(low[level], high[level], y, w, [&](int z, int cube_index) {
+                        auto packed = PACKED_TRIANGULATION[cube_index];
+                        auto num_vertices = int(packed >> 60) * 3;
+                        for (auto i = 0; i < num_vertices; i++, packed >>= 4) {
+                            auto edge = int(packed & 0xF);
+                            const auto* a = CORNER_OFFSETS[EDGE_CORNER_A[edge]];
+                            auto axis = EDGE_AXIS[edge];
+                            auto& slot = edges[a[0]][(std::size_t(y + a[1]) * length + z + a[2]) * 3 + axis];
+                            if (slot == NO_VERTEX || slot < valid_from[a[0]]) {
+                                slot = first_vertex + uint32_t(pending.size());
+                                pending.add(x + a[0], y + a[1], z + a[2], axis);
+                            }
+                            mesh.indices.push_back(slot);
+                        }
+                    });
+                }
+            }
+        }
+
+        for (auto level = std::size_t(0); level < num_levels; level++) {
+            make_vertices(grid, iso_levels[level], _pending[level], meshes[level]);
+        }
+    }
+
+    // The vertices of the edges first crossed in this slab, in the order
+    // their indices were handed out. Interpolation weights are worked out
+    // for all of them in one loop before the normals.
+    template<typename Samples>
+    void make_vertices(const Samples& grid, float iso_level, PendingEdges& edges, ExtractedMesh& mesh) {
+        const auto count = edges.size();
+        if (count == 0) {
+            return;
+        }
+        edges.density_a.resize(count);
+        edges.density_b.resize(count);
+        edges.mu.resize(count);
+
+        for (auto i = std::size_t(0); i < count; i++) {
+            auto axis = edges.axis[i];
+            edges.density_a[i] = grid.at(edges.x[i], edges.y[i], edges.z[i]);
+            edges.density_b[i] = grid.at(edges.x[i] + (axis == 0), edges.y[i] + (axis == 1), edges.z[i] + (axis == 2));
+        }
+        for (auto i = std::size_t(0); i < count; i++) {
+            edges.mu[i] = (iso_level - edges.density_a[i]) / (edges.density_b[i] - edges.density_a[i]);
+        }
+
+        auto* vertex = &*mesh.vertices.insert(mesh.vertices.end(), count, MeshVertex());
+        for (auto i = std::size_t(0); i < count; i++, vertex++) {
+            auto a = glm::ivec3(edges.x[i], edges.y[i], edges.z[i]);
+            auto b = a;
+            b[edges.axis[i]]++;
+            auto mu = edges.mu[i];
+            auto position = glm::vec3(grid.offset + a);
+            position[edges.axis[i]] += mu;
+            auto normal = glm::mix(gradient(grid, a.x, a.y, a.z), gradient(grid, b.x, b.y, b.z), mu);
+            *vertex = make_vertex(position, normal);
+        }
+    }
+
+    // The planes of every level at x, in level order
+    SignPlane* sign_planes(std::size_t num_levels, int x) {
+        return _sign_planes.data() + (x & 1) * num_levels;
+    }
+
+    RangePlane& range_plane(int x) {
+        return _range_planes[x & 1];
+    }
+
+    std::vector<uint32_t> _edge_vertices;
+    std::size_t _slab_size = 0;
+    std::vector<SignPlane> _sign_planes;
+    RangePlane _range_planes[2];
+    std::vector<PendingEdges> _pending;
+    // Per level and edge slab, the vertex count when the slab was taken over
+    std::vector<uint32_t> _slab_first_vertex;
+};
+
+class SurfaceNetsExtractor : public Extractor {
+public:
+    // With an overlap of 1 the grid starts one sample before the chunk.
+    // The cells in that ring only give vertices to the quads of the edges on
+    // the chunk's lower faces, which are not emitted without them.
+    explicit SurfaceNetsExtractor(int overlap = 0)
+        : _overlap(overlap)
+    {}
+
+    int overlap() const override {
+        return _overlap;
+    }
+
+    void extract(const DensityGrid& grid, float iso_level, ExtractedMesh& mesh) override {
+        mesh.clear();
+        const auto length = grid.axis_length;
+        const auto cells = length - 1;
+        if (cells < 1) {
+            return;
+        }
+
+        auto cell_index = [cells](int x, int y, int z) {
+            return (std::size_t(x) * cells + y) * cells + z;
+        };
+
+        // One vertex per cell the surface passes through, at the mean of the
+        // crossings on its twelve edges. Each cell also closes the quads of the
+        // three grid edges leaving its lowest corner, the other cells around
+        // those edges come earlier in the loop so their vertices already exist.
+        // Edges on the grid's lower faces have cells missing and are left
+        // open, and edges starting in the overlap belong to other chunks.
+        _cell_vertices.assign(std::size_t(cells) * cells * cells, NO_VERTEX);
+        for (auto x = 0; x < cells; x++) {
+            for (auto y = 0; y < cells; y++) {
+                for (auto z = 0; z < cells; z++) {
+                    float corners[8];
+                    auto mask = 0;
+                    for (auto corner = 0; corner < 8; corner++) {
+                        corners[corner] = grid.at(x + (corner & 1), y + ((corner >> 1) & 1), z + ((corner >> 2) & 1));
+                        if (corners[corner] < iso_level) {
+                            mask |= 1 << corner;
+                        }
+                    }
+
+                    if (mask == 0 || mask == 255) {
+                        continue;
+                    }
+
+                    auto sum = glm::vec3(0.0f);
+                    auto crossings = 0;
+                    for (auto edge = 0; edge < 12; edge++) {
+                        auto a = EDGE_CORNERS[edge][0];
+                        auto b = EDGE_CORNERS[edge][1];
+                        if (((mask >> a) & 1) == ((mask >> b) & 1)) {
+                            continue;
+                        }
+
+                        auto mu = (iso_level - corners[a]) / (corners[b] - corners[a]);
+                        sum += glm::mix(corner_offset(a), corner_offset(b), mu);
+                        crossings++;
+                    }
+
+                    auto local = sum / float(crossings);
+                    auto position = glm::vec3(grid.offset + glm::ivec3(x, y, z)) + local;
+
+                    _cell_vertices[cell_index(x, y, z)] = uint32_t(mesh.vertices.size());
+                    mesh.vertices.push_back(make_vertex(position, trilinear_gradient(corners, local)));
+
+                    auto p = glm::ivec3(x, y, z);
+                    auto solid = (mask & 1) != 0;
+                    for (auto axis = 0; axis < 3; axis++) {
+                        auto u = (axis + 1) % 3;
+                        auto v = (axis + 2) % 3;
+                        if (p[u] < 1 || p[v] < 1 || p[axis] < _overlap || ((mask >> (1 << axis)) & 1) == (mask & 1)) {
+                            continue;
+                        }
+
+                        auto du = glm::ivec3(0), dv = glm::ivec3(0);
+                        du[u] = 1;
+                        dv[v] = 1;
+                        auto pu = p - du, pv = p - dv, puv = p - du - dv;
+                        uint32_t quad[4] = {
+                            _cell_vertices[cell_index(p.x, p.y, p.z)],
+                            _cell_vertices[cell_index(pu.x, pu.y, pu.z)],
+                            _cell_vertices[cell_index(puv.x, puv.y, puv.z)],
+                            _cell_vertices[cell_index(pv.x, pv.y, pv.z)]
+                        };
+
+                        // In this order the quad faces +axis, which is outward
+                        // when the solid side is at p
+                        if (!solid) {
+                            std::swap(quad[1], quad[3]);
+                        }
+                        emit_quad(quad, mesh);
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    static constexpr uint32_t NO_VERTEX = std::numeric_limits<uint32_t>::max();
+
+    // Corner bits are x, y, z
+    static constexpr int EDGE_CORNERS[12][2] = {
+        { 0, 1 }, { 2, 3 }, { 4, 5 }, { 6, 7 },
+        { 0, 2 }, { 1, 3 }, { 4, 6 }, { 5, 7 },
+        { 0, 4 }, { 1, 5 }, { 2, 6 }, { 3, 7 }
+    };
+
+    static glm::vec3 corner_offset(int corner) {
+        return glm::vec3(corner & 1, (corner >> 1) & 1, (corner >> 2) & 1);
+    }
+
+    // Derivative of the trilinear interpolation of the corners at local,
+    // cheaper than blending eight central differences and close enough
+    static glm::vec3 trilinear_gradient(const float corners[8], glm::vec3 local) {
+        auto lerp = [](float a, float b, float t) {
+            return a + (b - a) * t;
+        };
+
+        auto dx = lerp(
+            lerp(corners[1] - corners[0], corners[3] - corners[2], local.y),
+            lerp(corners[5] - corners[4], corners[7] - corners[6], local.y), local.z);
+        auto dy = lerp(
+            lerp(corners[2] - corners[0], corners[3] - corners[1], local.x),
+            lerp(corners[6] - corners[4], corners[7] - corners[5], local.x), local.z);
+        auto dz = lerp(
+            lerp(corners[4] - corners[0], corners[5] - corners[1], local.x),
+            lerp(corners[6] - corners[2], corners[7] - corners[3], local.x), local.y);
+        return glm::vec3(dx, dy, dz);
+    }
+
+    // Splits along the shorter diagonal, which follows creases better
+    static void emit_quad(const uint32_t quad[4], ExtractedMesh& mesh) {
+        auto position = [&mesh](uint32_t index) {
+            return glm::vec3(mesh.vertices[index].position);
+        };
+
+        auto diagonal_02 = glm::distance(position(quad[0]), position(quad[2]));
+        auto diagonal_13 = glm::distance(position(quad[1]), position(quad[3]));
+        if (diagonal_02 <= diagonal_13) {
+            mesh.indices.insert(mesh.indices.end(), { quad[0], quad[1], quad[2], quad[0], quad[2], quad[3] });
+        } else {
+            mesh.indices.insert(mesh.indices.end(), { quad[0], quad[1], quad[3], quad[1], quad[2], quad[3] });
+        }
+    }
+
+    int _overlap = 0;
+    std::vector<uint32_t> _cell_vertices;
+};
+
+inline std::unique_ptr<Extractor> Extractor::create(ExtractorType type) {
+    switch (type) {
+    case ExtractorType::MARCHING_CUBES_CPU:
+        return std::make_unique<MarchingCubesExtractor>();
+    case ExtractorType::SURFACE_NETS_CPU:
+        return std::make_unique<SurfaceNetsExtractor>(1);
+    default:
+        return nullptr;
+    }
+}
@@ -0,0 +1,265 @@
+#pragma once
+
+// Frustum.hpp
+//
+// Description: Axis aligned bounding boxes, view frustum extraction and a
+// culler that tests four boxes per SSE instruction and returns the visible
+// set ordered front to back
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define MC_FRUSTUM_SSE 1
+#include <xmmintrin.h>
+#else
+#define MC_FRUSTUM_SSE 0
+#endif
+
+struct BoundingBox {
+    glm::vec3 min;
+    glm::vec3 max;
+
+    BoundingBox()
+    : min(std::numeric_limits<float>::max()),
+      max(std::numeric_limits<float>::lowest())
+    {
+    }
+
+    BoundingBox(glm::vec3 t_min, glm::vec3 t_max) : min(t_min), max(t_max) {}
+
+    // An empty box never intersects anything, used for chunks without triangles
+    bool empty() const {
+        return min.x > max.x || min.y > max.y || min.z > max.z;
+    }
+
+    glm::vec3 center() const {
+        return (min + max) * 0.5f;
+    }
+
+    void expand(glm::vec3 point) {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+
+    void expand(const BoundingBox& other) {
+        min = glm::min(min, other.min);
+        max = glm::max(max, other.max);
+    }
+
+    bool intersects(const BoundingBox& other) const {
+        return glm::all(glm::lessThanEqual(min, other.max)) && glm::all(glm::lessThanEqual(other.min, max));
+    }
+
+    // Squared distance from a point to the closest point of the box
+    float distance_squared(glm::vec3 point) const {
+        auto closest = glm::clamp(point, min, max);
+        auto delta = point - closest;
+        return glm::dot(delta, delta);
+    }
+};
+
+struct Frustum {
+    // Planes are stored as (normal, distance) with normals pointing inwards
+    glm::vec4 planes[6];
+
+    // Gribb/Hartmann plane extraction from a combined projection * view matrix
+    static Frustum from_matrix(const glm::mat4& view_projection) {
+        auto row = [&view_projection](int index) {
+            return glm::vec4(
+                view_projection[0][index],
+                view_projection[1][index],
+                view_projection[2][index],
+                view_projection[3][index]
+            );
+        };
+
+        Frustum frustum;
+        frustum.planes[0] = row(3) + row(0); // left
+        frustum.planes[1] = row(3) - row(0); // right
+        frustum.planes[2] = row(3) + row(1); // bottom
+        frustum.planes[3] = row(3) - row(1); // top
+        frustum.planes[4] = row(3) + row(2); // near
+        frustum.planes[5] = row(3) - row(2); // far
+
+        for (auto& plane : frustum.planes) {
+            plane /= glm::length(glm::vec3(plane));
+        }
+
+        return frustum;
+    }
+
+    bool intersects(const BoundingBox& box) const {
+        if (box.empty()) {
+            return false;
+        }
+
+        for (const auto& plane : planes) {
+            // Test the corner furthest along the plane normal (the "positive vertex")
+            auto positive = glm::vec3(
+                plane.x >= 0.0f ? box.max.x : box.min.x,
+                plane.y >= 0.0f ? box.max.y : box.min.y,
+                plane.z >= 0.0f ? box.max.z : box.min.z
+            );
+
+            if (glm::dot(glm::vec3(plane), positive) + plane.w < 0.0f) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool intersects(glm::vec3 center, float radius) const {
+        for (const auto& plane : planes) {
+            if (glm::dot(glm::vec3(plane), center) + plane.w < -radius) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+};
+
+// Keeps bounding boxes in structure-of-arrays form, padded to a multiple of
+// four, so the frustum test can run on four boxes per instruction
+class FrustumCuller {
+public:
+    struct Stats {
+        uint32_t drawn = 0;
+        uint32_t culled = 0;
+    };
+
+    void resize(std::size_t count) {
+        _count = count;
+        auto padded = (count + 3) & ~std::size_t(3);
+
+        // Padding boxes are inverted so they always fail the test
+        for (auto* lanes : { &_min_x, &_min_y, &_min_z }) {
+            lanes->assign(padded, std::numeric_limits<float>::max());
+        }
+        for (auto* lanes : { &_max_x, &_max_y, &_max_z }) {
+            lanes->assign(padded, std::numeric_limits<float>::lowest());
+        }
+    }
+
+    std::size_t size() const {
+        return _count;
+    }
+
+    void set_bounds(std::size_t index, const BoundingBox& box) {
+        _min_x[index] = box.min.x;
+        _min_y[index] = box.min.y;
+        _min_z[index] = box.min.z;
+        _max_x[index] = box.max.x;
+        _max_y[index] = box.max.y;
+        _max_z[index] = box.max.z;
+    }
+
+    BoundingBox bounds(std::size_t index) const {
+        return BoundingBox(
+            glm::vec3(_min_x[index], _min_y[index], _min_z[index]),
+            glm::vec3(_max_x[index], _max_y[index], _max_z[index])
+        );
+    }
+
+    // Fills visible with the indices of boxes inside the frustum, nearest first
+    Stats cull(const Frustum& frustum, glm::vec3 eye, std::vector<uint32_t>& visible) {
+        visible.clear();
+
+        cull_simd(frustum, visible);
+
+        // Sort front to back so early depth testing rejects more fragments
+        _sort_keys.clear();
+        _sort_keys.reserve(visible.size());
+        for (auto index : visible) {
+            _sort_keys.emplace_back(bounds(index).distance_squared(eye), index);
+        }
+        std::sort(_sort_keys.begin(), _sort_keys.end());
+        for (std::size_t i = 0; i < _sort_keys.size(); i++) {
+            visible[i] = _sort_keys[i].second;
+        }
+
+        Stats stats;
+        stats.drawn = static_cast<uint32_t>(visible.size());
+        stats.culled = static_cast<uint32_t>(_count - visible.size());
+        return stats;
+    }
+
+    // Reference path, one box at a time
+    void cull_scalar(const Frustum& frustum, std::vector<uint32_t>& visible) const {
+        for (std::size_t index = 0; index < _count; index++) {
+            if (frustum.intersects(bounds(index))) {
+                visible.push_back(static_cast<uint32_t>(index));
+            }
+        }
+    }
+
+    void cull_simd(const Frustum& frustum, std::vector<uint32_t>& visible) const {
+#if MC_FRUSTUM_SSE
+        auto const zero = _mm_setzero_ps();
+
+        for (std::size_t base = 0; base < _count; base += 4) {
+            auto min_x = _mm_loadu_ps(&_min_x[base]);
+            auto min_y = _mm_loadu_ps(&_min_y[base]);
+            auto min_z = _mm_loadu_ps(&_min_z[base]);
+            auto max_x = _mm_loadu_ps(&_max_x[base]);
+            auto max_y = _mm_loadu_ps(&_max_y[base]);
+            auto max_z = _mm_loadu_ps(&_max_z[base]);
+
+            // Empty boxes have min > max on at least one axis
+            auto outside = _mm_or_ps(
+                _mm_cmpgt_ps(min_x, max_x),
+                _mm_or_ps(_mm_cmpgt_ps(min_y, max_y), _mm_cmpgt_ps(min_z, max_z))
+            );
+
+            for (const auto& plane : frustum.planes) {
+                auto nx = _mm_set1_ps(plane.x);
+                auto ny = _mm_set1_ps(plane.y);
+                auto nz = _mm_set1_ps(plane.z);
+
+                // max(n * min, n * max) picks the positive vertex without branching
+                auto distance = _mm_add_ps(
+                    _mm_add_ps(
+                        _mm_max_ps(_mm_mul_ps(nx, min_x), _mm_mul_ps(nx, max_x)),
+                        _mm_max_ps(_mm_mul_ps(ny, min_y), _mm_mul_ps(ny, max_y))
+                    ),
+                    _mm_add_ps(
+                        _mm_max_ps(_mm_mul_ps(nz, min_z), _mm_mul_ps(nz, max_z)),
+                        _mm_set1_ps(plane.w)
+                    )
+                );
+
+                outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, zero));
+            }
+
+            auto inside_mask = ~_mm_movemask_ps(outside) & 0xF;
+            while (inside_mask) {
+                auto lane = 0;
+                while (!(inside_mask & (1 << lane))) {
+                    lane++;
+                }
+                inside_mask &= inside_mask - 1;
+
+                auto index = base + lane;
+                if (index < _count) {
+                    visible.push_back(static_cast<uint32_t>(index));
+                }
+            }
+        }
+#else
+        cull_scalar(frustum, visible);
+#endif
+    }
+
+private:
+    std::size_t _count = 0;
+    std::vector<float> _min_x, _min_y, _min_z;
+    std::vector<float> _max_x, _max_y, _max_z;
+    std::vector<std::pair<float, uint32_t>> _sort_keys;
+};
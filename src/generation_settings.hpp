@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cmath>
+
+// How chunk density is turned into triangles
+enum class ExtractorType : int {
+    MARCHING_CUBES_GPU = 0,
+    MARCHING_CUBES_CPU = 1,
+    SURFACE_NETS_CPU = 2
+};
+
+struct GenerationSettings
+{
+    float iso_level;
+    float scale;
+    float persistence;
+    int octaves;
+    float lacunarity;
+    ExtractorType extractor;
+    // Split chunk meshes into meshlets that are culled one by one
+    bool meshlets;
+
+    GenerationSettings()
+    : iso_level(1.0f), scale(1.0f), persistence(0.5f), octaves(4),
+      lacunarity(2.0f), extractor(ExtractorType::MARCHING_CUBES_GPU), meshlets(false)
+    {
+    }
+
+    bool operator==(const GenerationSettings& other) {
+        const auto epsilon = 0.001f;
+        return fabs(iso_level - other.iso_level) < epsilon &&
+               fabs(scale - other.scale) < epsilon &&
+               octaves == other.octaves &&
+               fabs(persistence - other.persistence) < epsilon &&
+               fabs(lacunarity - other.lacunarity) < epsilon &&
+               extractor == other.extractor &&
+               meshlets == other.meshlets;
+    }
+};
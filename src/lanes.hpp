@@ -0,0 +1,172 @@
+#pragma once
+
+// Lanes.hpp
+//
+// Description: Four floats evaluated side by side with SSE2, plus the handful
+// of GLSL style math functions the density code needs, overloaded for both
+// float and Lanes so the same template runs scalar or four samples at a time
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MC_LANES_SSE 1
+#include <emmintrin.h>
+#else
+#define MC_LANES_SSE 0
+#endif
+
+constexpr auto LANE_COUNT = 4;
+
+#if MC_LANES_SSE
+
+struct Lanes {
+    __m128 v;
+
+    Lanes() = default;
+    Lanes(float value) : v(_mm_set1_ps(value)) {}
+    explicit Lanes(__m128 value) : v(value) {}
+
+    static Lanes load(const float* values) {
+        return Lanes(_mm_loadu_ps(values));
+    }
+
+    // Built in registers, a load right after four scalar stores would stall
+    static Lanes from(float a, float b, float c, float d) {
+        return Lanes(_mm_setr_ps(a, b, c, d));
+    }
+
+    void store(float* values) const {
+        _mm_storeu_ps(values, v);
+    }
+
+    // Truncated towards zero
+    void store_int(int32_t* values) const {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(values), _mm_cvttps_epi32(v));
+    }
+};
+
+inline Lanes operator+(Lanes a, Lanes b) { return Lanes(_mm_add_ps(a.v, b.v)); }
+inline Lanes operator-(Lanes a, Lanes b) { return Lanes(_mm_sub_ps(a.v, b.v)); }
+inline Lanes operator*(Lanes a, Lanes b) { return Lanes(_mm_mul_ps(a.v, b.v)); }
+inline Lanes operator/(Lanes a, Lanes b) { return Lanes(_mm_div_ps(a.v, b.v)); }
+inline Lanes operator-(Lanes a) { return Lanes(_mm_xor_ps(a.v, _mm_set1_ps(-0.0f))); }
+
+inline Lanes lane_min(Lanes a, Lanes b) { return Lanes(_mm_min_ps(a.v, b.v)); }
+inline Lanes lane_max(Lanes a, Lanes b) { return Lanes(_mm_max_ps(a.v, b.v)); }
+inline Lanes lane_abs(Lanes a) { return Lanes(_mm_andnot_ps(_mm_set1_ps(-0.0f), a.v)); }
+
+// Truncate and step down where that rounded up, exact below 2^31
+inline Lanes lane_floor(Lanes a) {
+    auto truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.v));
+    return Lanes(_mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, a.v), _mm_set1_ps(1.0f))));
+}
+
+// GLSL step: 0 where x < edge, 1 otherwise
+inline Lanes lane_step(Lanes edge, Lanes x) {
+    return Lanes(_mm_and_ps(_mm_cmpge_ps(x.v, edge.v), _mm_set1_ps(1.0f)));
+}
+
+// a < b ? then : otherwise, per lane
+inline Lanes lane_select_less(Lanes a, Lanes b, Lanes then, Lanes otherwise) {
+    auto mask = _mm_cmplt_ps(a.v, b.v);
+    return Lanes(_mm_or_ps(_mm_and_ps(mask, then.v), _mm_andnot_ps(mask, otherwise.v)));
+}
+
+inline bool lane_all_less(Lanes a, Lanes b) { return _mm_movemask_ps(_mm_cmplt_ps(a.v, b.v)) == 0xF; }
+inline bool lane_none_less(Lanes a, Lanes b) { return _mm_movemask_ps(_mm_cmplt_ps(a.v, b.v)) == 0; }
+
+#else
+
+struct Lanes {
+    float v[LANE_COUNT];
+
+    Lanes() = default;
+    Lanes(float value) : v { value, value, value, value } {}
+
+    static Lanes load(const float* values) {
+        Lanes result;
+        std::copy(values, values + LANE_COUNT, result.v);
+        return result;
+    }
+
+    static Lanes from(float a, float b, float c, float d) {
+        Lanes result;
+        result.v[0] = a;
+        result.v[1] = b;
+        result.v[2] = c;
+        result.v[3] = d;
+        return result;
+    }
+
+    void store(float* values) const {
+        std::copy(v, v + LANE_COUNT, values);
+    }
+
+    void store_int(int32_t* values) const {
+        for (auto lane = 0; lane < LANE_COUNT; lane++) {
+            values[lane] = int32_t(v[lane]);
+        }
+    }
+};
+
+template<typename Function>
+inline Lanes lane_map(Lanes a, Lanes b, Function function) {
+    Lanes result;
+    for (auto lane = 0; lane < LANE_COUNT; lane++) {
+        result.v[lane] = function(a.v[lane], b.v[lane]);
+    }
+    return result;
+}
+
+inline Lanes operator+(Lanes a, Lanes b) { return lane_map(a, b, [](float x, float y) { return x + y; }); }
+inline Lanes operator-(Lanes a, Lanes b) { return lane_map(a, b, [](float x, float y) { return x - y; }); }
+inline Lanes operator*(Lanes a, Lanes b) { return lane_map(a, b, [](float x, float y) { return x * y; }); }
+inline Lanes operator/(Lanes a, Lanes b) { return lane_map(a, b, [](float x, float y) { return x / y; }); }
+inline Lanes operator-(Lanes a) { return lane_map(a, a, [](float x, float) { return -x; }); }
+
+inline Lanes lane_min(Lanes a, Lanes b) { return lane_map(a, b, [](float x, float y) { return std::min(x, y); }); }
+inline Lanes lane_max(Lanes a, Lanes b) { return lane_map(a, b, [](float x, float y) { return std::max(x, y); }); }
+inline Lanes lane_abs(Lanes a) { return lane_map(a, a, [](float x, float) { return std::fabs(x); }); }
+inline Lanes lane_floor(Lanes a) { return lane_map(a, a, [](float x, float) { return std::floor(x); }); }
+
+inline Lanes lane_step(Lanes edge, Lanes x) {
+    return lane_map(edge, x, [](float e, float value) { return value < e ? 0.0f : 1.0f; });
+}
+
+inline Lanes lane_select_less(Lanes a, Lanes b, Lanes then, Lanes otherwise) {
+    Lanes result;
+    for (auto lane = 0; lane < LANE_COUNT; lane++) {
+        result.v[lane] = a.v[lane] < b.v[lane] ? then.v[lane] : otherwise.v[lane];
+    }
+    return result;
+}
+
+inline int lane_count_less(Lanes a, Lanes b) {
+    auto count = 0;
+    for (auto lane = 0; lane < LANE_COUNT; lane++) {
+        count += a.v[lane] < b.v[lane] ? 1 : 0;
+    }
+    return count;
+}
+
+inline bool lane_all_less(Lanes a, Lanes b) { return lane_count_less(a, b) == LANE_COUNT; }
+inline bool lane_none_less(Lanes a, Lanes b) { return lane_count_less(a, b) == 0; }
+
+#endif
+
+// Scalar versions so templates can be instantiated with float
+inline float lane_min(float a, float b) { return std::min(a, b); }
+inline float lane_max(float a, float b) { return std::max(a, b); }
+inline float lane_abs(float a) { return std::fabs(a); }
+inline float lane_floor(float a) { return std::floor(a); }
+inline float lane_step(float edge, float x) { return x < edge ? 0.0f : 1.0f; }
+inline float lane_select_less(float a, float b, float then, float otherwise) { return a < b ? then : otherwise; }
+inline bool lane_all_less(float a, float b) { return a < b; }
+inline bool lane_none_less(float a, float b) { return !(a < b); }
+
+template<typename T>
+inline T lane_clamp(T value, T low, T high) {
+    return lane_min(lane_max(value, low), high);
+}
@@ -1,13 +1,30 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
 #include <iostream>
 #include <limits>
+#include <string>
 
+#include "animated_region.hpp"
+#include "bvh.hpp"
 #include "camera.hpp"
 #include "computable.hpp"
 #include "drawable.hpp"
+#include "frustum.hpp"
+#include "memory_budget.hpp"
+#include "occlusion.hpp"
+#include "regeneration_scheduler.hpp"
+#include "sculpt.hpp"
+#include "session.hpp"
 #include "shader.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
 #include "window.hpp"
 
+#include "custom/computables/density_readback.hpp"
 #include "custom/computables/marching_cubes.hpp"
+#include "custom/drawables/animated_surface.hpp"
 #include "custom/drawables/cube.hpp"
 #include "custom/drawables/terrain_chunk.hpp"
 
@@ -27,7 +44,97 @@ Window window(WINDOW_WIDTH, WINDOW_HEIGHT, "Marching Cubes");
 
 bool focus = true;
 bool draw_points = true;
+bool wireframe = false;
 bool debug_view = false;
+bool occlusion_culling = true;
+int extractor = int(ExtractorType::MARCHING_CUBES_GPU);
+
+// Stage 1 runs the GLSL generated from terrain_graph instead of its own
+// procedural_density, rebuilt whenever the noise settings change
+bool generated_density = false;
+
+// Right click applies the brush this far in front of the camera
+bool sculpt_requested = false;
+int brush_shape = int(BrushShape::SPHERE);
+int brush_operation = int(BrushOperation::SUBTRACT);
+float brush_radius = 5.0f;
+float brush_strength = 1.0f;
+float brush_distance = 20.0f;
+
+// Chunk meshes are read back into a BVH on the worker threads, the brush then
+// lands where the view ray meets the terrain within the brush distance
+bool ray_queries = true;
+
+// Keeps the camera this far above the terrain height map when enabled
+bool stay_above_terrain = false;
+constexpr auto CAMERA_CLEARANCE = 2.0f;
+
+// A cube of terrain animated with 4D noise in front of the camera, rebuilt
+// every frame on the worker threads. Speed is in world units of the noise's
+// fourth axis per second, scale works like the terrain's.
+bool animate = false;
+float animation_speed = 10.0f;
+float animation_scale = 1.0f;
+constexpr auto ANIMATED_REGION_LENGTH = 64;
+
+// Only the nearest visible chunks contribute occluders
+constexpr auto MAX_OCCLUDER_CHUNKS = 64;
+
+// Shared chunk mesh buffer starts at 36 MB and grows by half when full, compaction
+// moves at most 1.4 MB of triangles per frame
+constexpr auto INITIAL_ARENA_TRIANGLES = 256 * 1024;
+constexpr auto MAX_COMPACTION_TRIANGLES = 10 * 1024;
+
+// Chunk memory budget in MB, 0 is unlimited. The farthest chunks are evicted
+// when it is exceeded.
+int gpu_budget_mb = 0;
+int cpu_budget_mb = 0;
+
+constexpr auto BYTES_PER_MB = 1024.0f * 1024.0f;
+
+// --replay steps through a recorded session instead of taking input, with
+// the recorded time steps and without vertical sync
+bool replaying = false;
+
+// Time each frame may spend regenerating chunks after a settings change, at
+// least one chunk is regenerated per frame
+float regeneration_budget_ms = 8.0f;
+
+// The toggles a session records next to the generation settings
+SessionOptions current_options()
+{
+    auto options = SessionOptions();
+    options.occlusion_culling = occlusion_culling;
+    options.ray_queries = ray_queries;
+    options.generated_density = generated_density;
+    options.animate = animate;
+    options.animation_speed = animation_speed;
+    options.animation_scale = animation_scale;
+    options.regeneration_budget_ms = regeneration_budget_ms;
+    options.gpu_budget_mb = gpu_budget_mb;
+    options.cpu_budget_mb = cpu_budget_mb;
+    options.draw_points = draw_points;
+    options.wireframe = wireframe;
+    return options;
+}
+
+void apply_options(const SessionOptions& options)
+{
+    occlusion_culling = options.occlusion_culling;
+    ray_queries = options.ray_queries;
+    generated_density = options.generated_density;
+    animate = options.animate;
+    animation_speed = options.animation_speed;
+    animation_scale = options.animation_scale;
+    regeneration_budget_ms = options.regeneration_budget_ms;
+    gpu_budget_mb = options.gpu_budget_mb;
+    cpu_budget_mb = options.cpu_budget_mb;
+    draw_points = options.draw_points;
+    if (options.wireframe != wireframe) {
+        wireframe = options.wireframe;
+        window.polygon_mode(wireframe ? PolygonMode::LINE : PolygonMode::FILL);
+    }
+}
 
 // custom callback 
 void process_input(float delta_time)
@@ -56,10 +163,12 @@ void process_input(float delta_time)
     }
 
     if(window.get_key(Key::KEY_Q) == KeyState::PRESSED) {
+        wireframe = false;
         window.polygon_mode(PolygonMode::FILL);
     }
 
     if(window.get_key(Key::KEY_E) == KeyState::PRESSED) {
+        wireframe = true;
         window.polygon_mode(PolygonMode::LINE);
     }
 
@@ -93,10 +202,18 @@ void process_input(float delta_time)
 }
 
 void process_mouse_button(GLFWwindow* glfw_window, int button, int action, int mods) {
+    if (replaying) {
+        return;
+    }
+
     if(button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS && focus == false && !ImGui::GetIO().WantCaptureMouse) {
         focus = true;
         window.set_mouse_mode(MouseMode::DISABLED);
     }
+
+    if(button == GLFW_MOUSE_BUTTON_RIGHT && action == GLFW_PRESS && focus == true) {
+        sculpt_requested = true;
+    }
 }
 
 void process_mouse_movement(GLFWwindow* glfw_window, double xpos, double ypos) {
@@ -117,7 +234,7 @@ void process_mouse_movement(GLFWwindow* glfw_window, double xpos, double ypos) {
     last_x = xpos;
     last_y = ypos;
 
-    if(focus) {
+    if(focus && !replaying) {
         // TODO: Fix this
         camera.process_mouse_movement(float(xoffset), float(yoffset));
     }
@@ -157,14 +274,56 @@ void renderQuad()
 
 glm::vec3 eye(7.586, 0.0f, 8.0f);
 
-int main() try {
+int main(int argc, char** argv) try {
+    TRACE_THREAD_NAME("render");
+
+    // --record <file> writes the session on exit, --replay <file> plays one
+    // back and writes per frame CPU and GPU times to --frame-times <file>.
+    // --hidden replays without showing the window.
+    auto record_path = std::string();
+    auto replay_path = std::string();
+    auto frame_times_path = std::string("frame_times.csv");
+    auto hidden = false;
+    for (auto i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_path = argv[++i];
+        } else if (std::strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else if (std::strcmp(argv[i], "--frame-times") == 0 && i + 1 < argc) {
+            frame_times_path = argv[++i];
+        } else if (std::strcmp(argv[i], "--hidden") == 0) {
+            hidden = true;
+        } else {
+            std::cout << "usage: " << argv[0] << " [--record <file>] [--replay <file> [--frame-times <file>] [--hidden]]" << std::endl;
+            return 2;
+        }
+    }
+
+    auto session = Session();
+    if (!replay_path.empty())
+    {
+        if (!session.load(replay_path) || session.size() == 0)
+        {
+            std::cout << "cannot replay " << replay_path << std::endl;
+            return 1;
+        }
+        replaying = true;
+        focus = false;
+        window.set_visible(!hidden);
+        window.set_swap_interval(0);
+    }
+    auto frame_log = FrameTimeLog();
+    auto gpu_timer = FrameTimerQueries();
+    auto frame_index = std::size_t(0);
+
     window.set_mouse_callback(process_mouse_button, process_mouse_movement);
-    window.set_mouse_mode(MouseMode::DISABLED);
+    window.set_mouse_mode(replaying ? MouseMode::NORMAL : MouseMode::DISABLED);
     window.enable_capability(Capability::DEPTH_TEST);
     window.enable_capability(Capability::PROGRAM_POINT_SIZE);
     //window.enable_capability(Capability::CULL_FACE);
 
     GenerationSettings settings, last_settings;
+    auto last_generated_density = false;
     settings.scale = 0.151;
 
     // Only use valid cubed integers
@@ -182,6 +341,13 @@ int main() try {
     auto cube_light = Cube::create(light_position);
 
     auto marching_cubes_shader = MarchingCubesCompute::create(number_of_components);
+    auto mesh_arena = MeshArena::create(INITIAL_ARENA_TRIANGLES);
+    auto edits = std::make_shared<EditIndex>();
+
+    // CPU copy of every chunk's density for gameplay queries, fed by each dispatch
+    auto density_cache = std::make_shared<DensityCache>(num_chunks_per_axis, int(std::lround(axis_length)));
+    auto density_readback = DensityReadback::create(density_cache, num_chunks_per_axis * num_chunks_per_axis * num_chunks_per_axis);
+    marching_cubes_shader->set_density_readback(density_readback);
 
     // auto shader_debug(
     //     Shader::create(
@@ -199,8 +365,11 @@ int main() try {
             {
                 chunks.push_back(TerrainChunk::create(
                     marching_cubes_shader,
+                    mesh_arena,
+                    edits,
                     number_of_components,
                     glm::ivec3(i* axis_length - i, j * axis_length - j, k* axis_length - k),
+                    uint32_t(chunks.size()),
                     window
                 ));
             }
@@ -221,14 +390,82 @@ int main() try {
     ImGui_ImplOpenGL3_Init("#version 450");
 
     bool first = true;
+    auto last_edit_ms = 0.0;
+    auto last_regenerate_ms = 0.0;
+    auto total_triangles = 0u;
+
+    auto budget = ChunkBudget();
+    auto scheduler = RegenerationScheduler();
+    auto frame_times = FrameTimes();
+
+    auto culler = FrustumCuller();
+    auto visible_chunks = std::vector<uint32_t>();
+    culler.resize(chunks.size());
+
+    auto thread_pool = ThreadPool();
+    auto occlusion = OcclusionBuffer(OcclusionBuffer::DEFAULT_WIDTH, OcclusionBuffer::DEFAULT_HEIGHT, &thread_pool);
+
+    // Chunks whose mesh changed since their tree was last submitted
+    auto world_bvh = WorldBvh(&thread_pool);
+    auto bvh_dirty = std::vector<uint8_t>(chunks.size(), 1);
+    auto bvh_evicted = std::vector<uint8_t>(chunks.size(), 0);
+    world_bvh.resize(chunks.size());
+
+    auto animated_region = AnimatedRegion(&thread_pool, ANIMATED_REGION_LENGTH);
+    auto animated_surface = AnimatedSurface::create();
+    auto animation_time = 0.0f;
+
+    // Occluder proxies are only conservative while the camera is inside the world,
+    // from outside it could look into solid ground through an open chunk face
+    auto const world_bounds = BoundingBox(
+        glm::vec3(0.0f),
+        glm::vec3(num_chunks_per_axis * (axis_length - 1))
+    );
 
     while (!window.should_close())
     {
+        TRACE_ZONE("frame");
+
+        if (replaying && frame_index == session.size())
+        {
+            break;
+        }
+        auto frame_start = std::chrono::high_resolution_clock::now();
+
         auto current_frame = window.get_elapsed_time();
         delta_time = current_frame - last_frame;
         last_frame = current_frame;
+        frame_times.add(delta_time * 1000.0);
+
+        // The recorded pose already has the terrain clearance applied. The
+        // recorded settings and options are applied after the UI below.
+        const SessionFrame* replayed = nullptr;
+        if (replaying)
+        {
+            replayed = &session.frames()[frame_index];
+            delta_time = replayed->delta_time;
+            camera.set_position(replayed->position);
+            camera.set_orientation(replayed->yaw, replayed->pitch);
 
-        process_input(delta_time);
+            gpu_timer.collect([&](std::size_t frame, double ms) { frame_log.add_gpu(frame, ms); });
+            gpu_timer.begin(frame_index);
+        }
+        else
+        {
+            process_input(delta_time);
+        }
+
+        density_readback->set_iso_level(settings.iso_level);
+        density_readback->poll();
+        if (stay_above_terrain && !replaying)
+        {
+            auto position = camera.get_position();
+            auto ground = density_cache->height(position.x, position.z);
+            if (ground != NO_SURFACE && position.y < ground + CAMERA_CLEARANCE)
+            {
+                camera.set_position(glm::vec3(position.x, ground + CAMERA_CLEARANCE, position.z));
+            }
+        }
 
         // Start the Dear ImGui frame
         ImGui_ImplOpenGL3_NewFrame();
@@ -243,23 +480,201 @@ int main() try {
         cube_light.update(light_position);
         cube_light.draw(view, projection);
 
-        if(first || !(last_settings == settings))
+        settings.extractor = ExtractorType(extractor);
+        if(first || !(last_settings == settings) || generated_density != last_generated_density)
         {
             if(first)
             {
                 first = false;
             }
 
-            for (auto& chunk : chunks)
+            // Only recompiles when the baked noise parameters differ. A
+            // function that fails to build is reported under its checkbox.
+            if (generated_density)
+            {
+                marching_cubes_shader->set_density_function(density_graph::glsl_function(terrain_graph(settings), "procedural_density"));
+            }
+            else
             {
-                chunk.update(settings);
+                marching_cubes_shader->reset_density_function();
             }
+            last_generated_density = generated_density;
+
+            // Regenerated over the next frames, old meshes stay until then
+            scheduler.invalidate_all(chunks.size());
             last_settings = settings;
         }
 
-        for (auto& chunk : chunks)
+        auto frame_brushes = std::vector<Brush>();
+        if (replaying)
+        {
+            frame_brushes = replayed->brushes;
+        }
+        else if (sculpt_requested)
+        {
+            sculpt_requested = false;
+            auto brush_center = camera.get_position() + camera.get_forward() * brush_distance;
+            if (ray_queries)
+            {
+                auto hit = world_bvh.intersect(Ray { camera.get_position(), camera.get_forward(), brush_distance });
+                if (hit.hit())
+                {
+                    brush_center = camera.get_position() + camera.get_forward() * hit.t;
+                }
+            }
+            frame_brushes.push_back(Brush {
+                BrushShape(brush_shape),
+                BrushOperation(brush_operation),
+                brush_center,
+                brush_radius,
+                brush_strength
+            });
+        }
+
+        for (const auto& brush : frame_brushes)
+        {
+            TRACE_ZONE("sculpt");
+
+            // Remeshing reads the triangle counts back, so the GPU work is
+            // finished by the time this returns
+            auto start = std::chrono::high_resolution_clock::now();
+            edits->add(brush);
+
+            for (auto index = 0u; index < chunks.size(); index++)
+            {
+                // Stale chunks pick the edit up when they are regenerated
+                if (chunks[index].region().intersects(brush.bounds()) && !scheduler.is_stale(index))
+                {
+                    chunks[index].apply_edit(settings, brush.bounds());
+                    culler.set_bounds(index, chunks[index].bounds());
+                    bvh_dirty[index] = 1;
+                }
+            }
+            auto end = std::chrono::high_resolution_clock::now();
+            last_edit_ms = std::chrono::duration<double, std::milli>(end - start).count();
+        }
+
+        {
+            TRACE_ZONE("memory budget");
+            auto limits = MemoryBudget {
+                std::size_t(gpu_budget_mb) * 1024 * 1024,
+                std::size_t(cpu_budget_mb) * 1024 * 1024
+            };
+            auto budget_stats = budget.enforce(chunks, camera.get_position(), limits, settings, scheduler);
+            if (budget_stats.evicted != 0 || budget_stats.restored != 0)
+            {
+                total_triangles = 0;
+                for (auto index = 0u; index < chunks.size(); index++)
+                {
+                    culler.set_bounds(index, chunks[index].bounds());
+                    total_triangles += chunks[index].num_triangles();
+                    if (chunks[index].is_evicted() != bool(bvh_evicted[index]))
+                    {
+                        bvh_evicted[index] = chunks[index].is_evicted();
+                        bvh_dirty[index] = 1;
+                    }
+                }
+            }
+        }
+
+        mesh_arena->compact(MAX_COMPACTION_TRIANGLES);
+
+        auto frustum = Frustum::from_matrix(projection * view);
+        auto cull_stats = culler.cull(frustum, camera.get_position(), visible_chunks);
+
+        if (scheduler.pending() != 0)
+        {
+            TRACE_ZONE("regenerate chunks");
+            auto position = camera.get_position();
+            auto regeneration = scheduler.run(
+                visible_chunks,
+                regeneration_budget_ms,
+                [&](uint32_t index) { return chunks[index].region().distance_squared(position); },
+                [&](uint32_t index) {
+                    chunks[index].update(settings);
+                    culler.set_bounds(index, chunks[index].bounds());
+                    bvh_dirty[index] = 1;
+                });
+            last_regenerate_ms = regeneration.ms;
+
+            total_triangles = 0;
+            for (const auto& chunk : chunks)
+            {
+                total_triangles += chunk.num_triangles();
+            }
+        }
+
+        if (ray_queries)
+        {
+            TRACE_ZONE("submit chunk bvhs");
+            auto positions = std::vector<glm::vec3>();
+            for (auto index = 0u; index < chunks.size(); index++)
+            {
+                // Meshes come back through fenced copies, a chunk's tree is
+                // rebuilt a frame or more after it changed
+                if (bvh_dirty[index])
+                {
+                    bvh_dirty[index] = 0;
+                    chunks[index].request_positions();
+                }
+                else if (chunks[index].take_positions(positions))
+                {
+                    world_bvh.submit(index, std::move(positions));
+                }
+            }
+            world_bvh.poll();
+        }
+
+        auto use_occlusion = occlusion_culling && world_bounds.distance_squared(camera.get_position()) == 0.0f;
+
+        occlusion.begin_frame(projection * view);
+        if (use_occlusion)
+        {
+            TRACE_ZONE("occlusion culling");
+            auto occluder_chunks = std::min<std::size_t>(visible_chunks.size(), MAX_OCCLUDER_CHUNKS);
+            for (auto i = 0u; i < occluder_chunks; i++)
+            {
+                for (auto& occluder : chunks[visible_chunks[i]].occluders())
+                {
+                    occlusion.add_occluder(occluder);
+                }
+            }
+            occlusion.rasterize();
+        }
+
+        // Visible chunks arrive sorted front to back
+        auto occluded_chunks = 0u;
+        auto meshlet_stats = TerrainChunk::MeshletStats();
+        for (auto index : visible_chunks)
+        {
+            if (use_occlusion && !occlusion.is_visible(chunks[index].bounds()))
+            {
+                occluded_chunks++;
+                continue;
+            }
+
+            chunks[index].draw(view, projection, settings, camera, light_position, draw_points, debug_view);
+            meshlet_stats.triangles += chunks[index].meshlet_stats().triangles;
+            meshlet_stats.culled_triangles += chunks[index].meshlet_stats().culled_triangles;
+        }
+
+        if (animate)
         {
-            chunk.draw(view, projection, settings, camera, light_position, draw_points, debug_view);
+            TRACE_ZONE("animate region");
+
+            // Draws the newest finished mesh and starts the next step once
+            // the workers are free, the render thread never waits for them.
+            // A replay waits so every run draws the same steps.
+            animation_time += delta_time * animation_speed;
+            if (replaying ? animated_region.wait() : animated_region.poll())
+            {
+                animated_surface.update(animated_region.front());
+            }
+            auto animation_settings = settings;
+            animation_settings.scale = animation_scale;
+            auto center = camera.get_position() + camera.get_forward() * float(ANIMATED_REGION_LENGTH / 2);
+            animated_region.submit(animation_settings, glm::ivec3(glm::floor(center)) - ANIMATED_REGION_LENGTH / 2, animation_time);
+            animated_surface.draw(view, projection, light_position, camera.get_position());
         }
 
         // if(debug_view)
@@ -283,21 +698,181 @@ int main() try {
         ImGui::SliderFloat("Lacunarity:  ", &settings.lacunarity, 0.0f, 5.0f);
         ImGui::SliderInt("Octaves:       ", &settings.octaves, 0, 10);
         ImGui::SliderFloat("Iso Level:   ", &settings.iso_level, 0.0f, 2.0f);
+        ImGui::Combo("Extractor", &extractor, "Marching cubes (GPU)\0Marching cubes (CPU)\0Surface nets (CPU)\0");
+        ImGui::Checkbox("Generated density shader", &generated_density);
+        if (!marching_cubes_shader->density_function_error().empty())
+        {
+            ImGui::TextWrapped("Generated density shader failed, stage 1 is unchanged:\n%s", marching_cubes_shader->density_function_error().c_str());
+        }
+        ImGui::Text("Triangles: %u, stale chunks: %zu, last regeneration %.2f ms", total_triangles, scheduler.pending(), last_regenerate_ms);
+        ImGui::SliderFloat("Regeneration budget (ms)", &regeneration_budget_ms, 1.0f, 50.0f);
         ImGui::SliderFloat("Light Height", &light_position.y, 0.0f, 500.0f);
         ImGui::SliderFloat("Eye X", &eye.x, 0.0f, 16.0f);
         ImGui::SliderFloat("Eye Y", &eye.y, 0.0f, 16.0f);
         ImGui::SliderFloat("Eye Z", &eye.z, 0.0f, 16.0f);
+        ImGui::Checkbox("Occlusion culling", &occlusion_culling);
+        ImGui::Checkbox("Meshlet culling", &settings.meshlets);
+        if (settings.meshlets)
+        {
+            auto build_ms = 0.0;
+            for (const auto& chunk : chunks)
+            {
+                build_ms += chunk.meshlet_build_ms();
+            }
+            ImGui::Text("Meshlets culled %.1f%% of drawn triangles, last build %.2f ms",
+                meshlet_stats.triangles == 0 ? 0.0f : 100.0f * meshlet_stats.culled_triangles / meshlet_stats.triangles,
+                build_ms);
+        }
+
+        ImGui::Checkbox("Animate region (4D noise)", &animate);
+        if (animate)
+        {
+            ImGui::SliderFloat("Animation speed", &animation_speed, 0.0f, 100.0f);
+            ImGui::SliderFloat("Animation scale", &animation_scale, 0.1f, 5.0f);
+            auto animation_stats = animated_region.stats();
+            ImGui::Text("Animated %d^3: %d triangles, sample %.2f ms, mesh %.2f ms, latency %.2f ms",
+                ANIMATED_REGION_LENGTH, animated_surface.num_triangles(),
+                animation_stats.sample_ms, animation_stats.mesh_ms, animation_stats.latency_ms);
+        }
+
+        ImGui::Text("Sculpting (right click)");
+        ImGui::Combo("Brush", &brush_shape, "Sphere\0Box\0Smooth\0");
+        ImGui::RadioButton("Add", &brush_operation, int(BrushOperation::ADD));
+        ImGui::SameLine();
+        ImGui::RadioButton("Subtract", &brush_operation, int(BrushOperation::SUBTRACT));
+        ImGui::SliderFloat("Brush Radius", &brush_radius, 1.0f, 20.0f);
+        ImGui::SliderFloat("Brush Strength", &brush_strength, 0.0f, 1.0f);
+        ImGui::SliderFloat("Brush Distance", &brush_distance, 2.0f, 100.0f);
+        if (ImGui::Checkbox("Brush on terrain (BVH)", &ray_queries) && ray_queries)
+        {
+            // Meshes that changed while it was off
+            std::fill(bvh_dirty.begin(), bvh_dirty.end(), 1);
+        }
+        ImGui::Checkbox("Stay above terrain", &stay_above_terrain);
+        {
+            auto position = camera.get_position();
+            auto ground = density_cache->height(position.x, position.z);
+            ImGui::Text("Density at camera %.3f, ground %s%.1f, %zu chunks cached, %zu read backs pending",
+                density_cache->density(position), ground == NO_SURFACE ? "none " : "", ground == NO_SURFACE ? 0.0f : ground,
+                density_cache->num_cached(), density_readback->pending());
+        }
+        if (ray_queries)
+        {
+            auto bvh_stats = world_bvh.stats();
+            ImGui::Text("BVH: %zu triangles, %zu nodes, %u builds pending, last chunk build %.2f ms",
+                bvh_stats.triangles, bvh_stats.nodes, bvh_stats.pending, bvh_stats.last_build_ms);
+        }
+        ImGui::Text("Edits: %zu, last edit %.2f ms", edits->size(), last_edit_ms);
+        ImGui::Text("Chunks drawn: %u, culled: %u, occluded: %u", cull_stats.drawn - occluded_chunks, cull_stats.culled, occluded_chunks);
+        ImGui::Text("Uniform chunks: %zu of %zu",
+            std::size_t(std::count_if(chunks.begin(), chunks.end(), [](const TerrainChunk& chunk) { return chunk.is_uniform(); })),
+            chunks.size());
+        ImGui::Text("Occluder triangles: %zu", occlusion.num_triangles());
+
+        auto arena_stats = mesh_arena->stats();
+        ImGui::Text("Mesh arena: %.1f / %.1f MB in %u meshes, largest hole %.1f MB",
+            arena_stats.used_bytes / (1024.0f * 1024.0f),
+            arena_stats.capacity_bytes / (1024.0f * 1024.0f),
+            arena_stats.meshes,
+            arena_stats.largest_free_bytes / (1024.0f * 1024.0f));
+        ImGui::Text("Triangle buffer: %.1f MB",
+            marching_cubes_shader->triangle_capacity() * sizeof(Triangle) / (1024.0f * 1024.0f));
+
+        auto memory = MemoryAccounting::instance().stats();
+        ImGui::Text("GPU memory: %.1f MB, %.1f MB resident, CPU memory: %.1f MB",
+            memory.gpu_bytes / BYTES_PER_MB,
+            memory.resident_gpu_bytes / BYTES_PER_MB,
+            memory.cpu_bytes / BYTES_PER_MB);
+        ImGui::SliderInt("GPU budget (MB)", &gpu_budget_mb, 0, 2048);
+        ImGui::SliderInt("CPU budget (MB)", &cpu_budget_mb, 0, 2048);
+        ImGui::Text("Chunks with GL resources: %zu of %zu",
+            std::size_t(std::count_if(chunks.begin(), chunks.end(), [](const TerrainChunk& chunk) { return chunk.has_resources(); })),
+            chunks.size());
+        ImGui::Text("Evicted chunks: %zu of %zu",
+            std::size_t(std::count_if(chunks.begin(), chunks.end(), [](const TerrainChunk& chunk) { return chunk.is_evicted(); })),
+            chunks.size());
+        if (ImGui::CollapsingHeader("Memory by category"))
+        {
+            for (auto category = std::size_t(0); category < NUM_MEMORY_CATEGORIES; category++)
+            {
+                ImGui::Text("%-16s %8.2f MB", memory_category_name(MemoryCategory(category)), memory.by_category[category] / BYTES_PER_MB);
+            }
+        }
+        if (ImGui::CollapsingHeader("Memory by chunk"))
+        {
+            for (const auto& chunk : chunks)
+            {
+                auto owned = MemoryAccounting::instance().owner(chunk.id());
+                ImGui::Text("Chunk %4u: GPU %6.2f MB, CPU %6.3f MB%s", chunk.id(),
+                    owned.gpu_bytes / BYTES_PER_MB, owned.cpu_bytes / BYTES_PER_MB,
+                    chunk.is_evicted() ? ", evicted" : "");
+            }
+        }
         ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+        ImGui::Text("Frame time p50 %.2f ms, p99 %.2f ms", frame_times.percentile(0.5), frame_times.percentile(0.99));
         ImGui::End();
 
         ImGui::Render();
+        TRACE_COUNTER("chunks drawn", cull_stats.drawn - occluded_chunks);
 
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
-        
+
+        // Settings and options are recorded after the UI changed them and
+        // replayed at the same point, so they reach the next frame either way
+        if (replaying)
+        {
+            settings = replayed->settings;
+            extractor = int(settings.extractor);
+            if (replayed->options.ray_queries && !ray_queries)
+            {
+                std::fill(bvh_dirty.begin(), bvh_dirty.end(), 1);
+            }
+            apply_options(replayed->options);
+        }
+        else if (!record_path.empty())
+        {
+            auto recorded = SessionFrame();
+            recorded.delta_time = delta_time;
+            recorded.position = camera.get_position();
+            recorded.yaw = camera.get_yaw();
+            recorded.pitch = camera.get_pitch();
+            recorded.settings = settings;
+            recorded.settings.extractor = ExtractorType(extractor);
+            recorded.options = current_options();
+            recorded.brushes = frame_brushes;
+            session.record(recorded);
+        }
+        if (replaying)
+        {
+            gpu_timer.end();
+            auto frame_end = std::chrono::high_resolution_clock::now();
+            frame_log.add_cpu(frame_index, std::chrono::duration<double, std::milli>(frame_end - frame_start).count());
+        }
+        frame_index++;
+
         // swap buffers and poll events
         window.swap_and_poll();
     }
 
+    if (replaying)
+    {
+        gpu_timer.collect([&](std::size_t frame, double ms) { frame_log.add_gpu(frame, ms); }, true);
+        if (!frame_log.save(frame_times_path))
+        {
+            std::cout << "cannot write " << frame_times_path << std::endl;
+        }
+        auto cpu = frame_log.cpu_summary();
+        auto gpu = frame_log.gpu_summary();
+        std::cout << "Replayed " << frame_log.size() << " frames, CPU p50 " << cpu.p50 << " p95 " << cpu.p95 << " p99 " << cpu.p99
+            << " ms, GPU p50 " << gpu.p50 << " p95 " << gpu.p95 << " p99 " << gpu.p99 << " ms" << std::endl;
+    }
+    else if (!record_path.empty() && !session.save(record_path))
+    {
+        std::cout << "cannot write " << record_path << std::endl;
+    }
+
+    TRACE_WRITE("trace.json");
+
     return 0;
 } catch (const std::exception& e) {
     std::cout << e.what() << std::endl;
@@ -0,0 +1,106 @@
+#pragma once
+
+// Memory_budget.hpp
+//
+// Description: Holds the chunks to a GPU and CPU byte budget using the totals
+// from MemoryAccounting. Over budget the farthest chunks are evicted until the
+// totals fit, under budget evicted chunks come back nearest first once the
+// size they had when evicted fits again.
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "frustum.hpp"
+#include "wrappers.hpp"
+
+struct MemoryBudget {
+    // Zero means unlimited
+    std::size_t gpu_bytes = 0;
+    std::size_t cpu_bytes = 0;
+};
+
+class ChunkBudget {
+public:
+    struct Stats {
+        uint32_t evicted = 0;
+        uint32_t restored = 0;
+    };
+
+    // Evicts as many chunks as it takes to fit, but restores at most one per
+    // call so regeneration is spread over frames. Chunk needs id, region,
+    // evict, restore and is_evicted like TerrainChunk. A restored chunk is
+    // regenerated with the current settings, so scheduler, a
+    // RegenerationScheduler, no longer counts it as stale.
+    template<typename Chunk, typename Settings, typename Scheduler>
+    Stats enforce(
+        std::vector<Chunk>& chunks,
+        glm::vec3 eye,
+        const MemoryBudget& budget,
+        Settings& settings,
+        Scheduler& scheduler
+    )
+    {
+        auto& accounting = MemoryAccounting::instance();
+        auto stats = Stats();
+        _evicted_memory.resize(chunks.size());
+
+        auto over = [&budget](const MemoryStats& memory, const OwnerMemory& extra) {
+            return (budget.gpu_bytes != 0 && memory.resident_gpu_bytes + extra.gpu_bytes > budget.gpu_bytes) ||
+                   (budget.cpu_bytes != 0 && memory.cpu_bytes + extra.cpu_bytes > budget.cpu_bytes);
+        };
+
+        auto memory = accounting.stats();
+        if (over(memory, OwnerMemory())) {
+            _order.clear();
+            for (auto index = 0u; index < chunks.size(); index++) {
+                auto owned = accounting.owner(chunks[index].id());
+                if (!chunks[index].is_evicted() && (owned.gpu_bytes != 0 || owned.cpu_bytes != 0)) {
+                    _order.push_back(index);
+                }
+            }
+
+            // Farthest first
+            std::sort(_order.begin(), _order.end(), [&](uint32_t a, uint32_t b) {
+                return chunks[a].region().distance_squared(eye) > chunks[b].region().distance_squared(eye);
+            });
+
+            for (auto index : _order) {
+                _evicted_memory[index] = accounting.owner(chunks[index].id());
+                chunks[index].evict();
+                stats.evicted++;
+
+                memory = accounting.stats();
+                if (!over(memory, OwnerMemory())) {
+                    break;
+                }
+            }
+            return stats;
+        }
+
+        auto nearest = chunks.size();
+        auto nearest_distance = 0.0f;
+        for (auto index = std::size_t(0); index < chunks.size(); index++) {
+            auto distance = chunks[index].region().distance_squared(eye);
+            if (chunks[index].is_evicted() && (nearest == chunks.size() || distance < nearest_distance)) {
+                nearest = index;
+                nearest_distance = distance;
+            }
+        }
+
+        // The size at eviction is only an estimate, anything over is evicted
+        // again on the next call
+        if (nearest != chunks.size() && !over(memory, _evicted_memory[nearest])) {
+            chunks[nearest].restore(settings);
+            scheduler.mark_fresh(nearest);
+            stats.restored++;
+        }
+        return stats;
+    }
+
+private:
+    std::vector<OwnerMemory> _evicted_memory;
+    std::vector<uint32_t> _order;
+};
@@ -0,0 +1,315 @@
+#pragma once
+
+// Meshlets.hpp
+//
+// Description: Splits a triangle soup in the stage 2 layout into meshlets of
+// at most 64 distinct vertices and 124 triangles, each with a bounding sphere
+// and a cone around its face normals. The soup is reordered so each meshlet
+// is one contiguous range, which lets a chunk draw only the meshlets that
+// are in the frustum and facing the camera with one multi-draw.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "extractor.hpp"
+#include "frustum.hpp"
+
+constexpr auto MESHLET_MAX_VERTICES = 64u;
+constexpr auto MESHLET_MAX_TRIANGLES = 124u;
+
+struct Meshlet {
+    // Triangle range in the reordered soup
+    uint32_t first;
+    uint32_t count;
+    glm::vec3 center;
+    float radius;
+    // Every face normal is within the cone angle of the axis. A cone of 90
+    // degrees or more is never back facing, cone_cos is then 0 or less.
+    glm::vec3 cone_axis;
+    float cone_cos;
+    float cone_sin;
+};
+
+// Whether every triangle of the meshlet faces away from eye. Conservative:
+// for any point within the sphere and any normal within the cone the angle
+// to the view direction is under 90 degrees.
+inline bool meshlet_back_facing(const Meshlet& meshlet, glm::vec3 eye) {
+    if (meshlet.cone_cos <= 0.0f) {
+        return false;
+    }
+
+    auto to_center = meshlet.center - eye;
+    auto distance = glm::length(to_center);
+    if (distance <= meshlet.radius) {
+        return false;
+    }
+
+    // cos(view angle + cone angle) > radius / distance
+    auto view_cos = glm::dot(to_center, meshlet.cone_axis) / distance;
+    auto view_sin = std::sqrt(std::max(0.0f, 1.0f - view_cos * view_cos));
+    return view_cos * meshlet.cone_cos - view_sin * meshlet.cone_sin > meshlet.radius / distance;
+}
+
+inline bool meshlet_visible(const Meshlet& meshlet, const Frustum& frustum, glm::vec3 eye) {
+    return frustum.intersects(meshlet.center, meshlet.radius) && !meshlet_back_facing(meshlet, eye);
+}
+
+// Keeps its scratch space between builds, one per thread
+class MeshletBuilder {
+public:
+    // Replaces reordered and meshlets with the meshlets of num_triangles
+    // triangles, three MeshVertex each
+    void build(
+        const MeshVertex* triangles,
+        uint32_t num_triangles,
+        std::vector<MeshVertex>& reordered,
+        std::vector<Meshlet>& meshlets
+    )
+    {
+        reordered.clear();
+        meshlets.clear();
+        if (num_triangles == 0) {
+            return;
+        }
+
+        weld(triangles, num_triangles);
+        build_adjacency(num_triangles);
+        face_normals(triangles, num_triangles);
+
+        _used.assign(num_triangles, 0);
+        _vertex_stamp.assign(_num_vertices, 0);
+        _candidate_stamp.assign(num_triangles, 0);
+        _meshlet_triangles.clear();
+        _candidates.clear();
+        reordered.reserve(std::size_t(num_triangles) * 3);
+
+        auto scan = 0u;
+        auto stamp = 0u;
+        auto remaining = num_triangles;
+        while (remaining > 0) {
+            // Continue next to the last meshlet when it left neighbours
+            // behind, so consecutive meshlets stay close
+            auto seed = num_triangles;
+            for (auto candidate : _candidates) {
+                if (!_used[candidate]) {
+                    seed = candidate;
+                    break;
+                }
+            }
+            if (seed == num_triangles) {
+                while (_used[scan]) {
+                    scan++;
+                }
+                seed = scan;
+            }
+
+            stamp++;
+            _meshlet_triangles.clear();
+            _candidates.clear();
+            auto num_vertices = 0u;
+            auto centroid_sum = glm::vec3(0.0f);
+            auto normal_sum = glm::vec3(0.0f);
+
+            auto add = [&](uint32_t triangle) {
+                _used[triangle] = 1;
+                remaining--;
+                _meshlet_triangles.push_back(triangle);
+                centroid_sum += _centroids[triangle];
+                normal_sum += _normals[triangle];
+                for (auto corner = 0; corner < 3; corner++) {
+                    auto vertex = _triangle_vertices[triangle * 3 + corner];
+                    if (_vertex_stamp[vertex] == stamp) {
+                        continue;
+                    }
+                    _vertex_stamp[vertex] = stamp;
+                    num_vertices++;
+                    for (auto i = _adjacency_offsets[vertex]; i < _adjacency_offsets[vertex + 1]; i++) {
+                        auto neighbour = _adjacency[i];
+                        if (!_used[neighbour] && _candidate_stamp[neighbour] != stamp) {
+                            _candidate_stamp[neighbour] = stamp;
+                            _candidates.push_back(neighbour);
+                        }
+                    }
+                }
+            };
+
+            add(seed);
+            while (_meshlet_triangles.size() < MESHLET_MAX_TRIANGLES) {
+                // Fewest new vertices first, then the triangle nearest the
+                // meshlet and closest to its mean normal
+                auto centroid = centroid_sum / float(_meshlet_triangles.size());
+                auto mean_normal = glm::length(normal_sum) > 0.0f ? glm::normalize(normal_sum) : glm::vec3(0.0f);
+                auto best = num_triangles;
+                auto best_new = 4u;
+                auto best_score = std::numeric_limits<float>::max();
+                // Used candidates are dropped as the list is scanned
+                auto kept = std::size_t(0);
+                auto next = std::size_t(0);
+                while (next < _candidates.size()) {
+                    auto candidate = _candidates[next++];
+                    if (_used[candidate]) {
+                        continue;
+                    }
+                    _candidates[kept++] = candidate;
+                    auto new_vertices = 0u;
+                    for (auto corner = 0; corner < 3; corner++) {
+                        new_vertices += _vertex_stamp[_triangle_vertices[candidate * 3 + corner]] != stamp;
+                    }
+                    if (num_vertices + new_vertices > MESHLET_MAX_VERTICES || new_vertices > best_new) {
+                        continue;
+                    }
+                    auto offset = _centroids[candidate] - centroid;
+                    auto score = glm::dot(offset, offset) * (1.5f - glm::dot(_normals[candidate], mean_normal));
+                    if (new_vertices < best_new || score < best_score) {
+                        best = candidate;
+                        best_new = new_vertices;
+                        best_score = score;
+                    }
+                    // Closes a gap between triangles already in, nothing beats it
+                    if (new_vertices == 0) {
+                        break;
+                    }
+                }
+                kept = std::size_t(std::copy(_candidates.begin() + next, _candidates.end(), _candidates.begin() + kept) - _candidates.begin());
+                _candidates.resize(kept);
+
+                if (best == num_triangles) {
+                    break;
+                }
+                add(best);
+            }
+
+            meshlets.push_back(bounds(triangles, uint32_t(reordered.size() / 3)));
+            for (auto triangle : _meshlet_triangles) {
+                reordered.insert(reordered.end(), triangles + std::size_t(triangle) * 3, triangles + std::size_t(triangle) * 3 + 3);
+            }
+        }
+    }
+
+private:
+    // Stage 2 writes shared vertices once per triangle, positions are
+    // quantised so both copies of a vertex get the same id
+    void weld(const MeshVertex* triangles, uint32_t num_triangles) {
+        auto num_corners = std::size_t(num_triangles) * 3;
+        _triangle_vertices.resize(num_corners);
+
+        // Open addressing. Marching cubes shares a vertex between about six
+        // triangles, so the table ends up about a sixth full.
+        auto capacity = std::size_t(16);
+        while (capacity <= num_corners) {
+            capacity *= 2;
+        }
+        _slots.assign(capacity, Slot { EMPTY_SLOT, 0 });
+
+        _num_vertices = 0;
+        for (auto i = std::size_t(0); i < num_corners; i++) {
+            auto quantised = glm::ivec3(glm::floor(glm::vec3(triangles[i].position) * 256.0f + 0.5f));
+            auto key = (uint64_t(uint32_t(quantised.x) & 0x1fffff) << 42) |
+                       (uint64_t(uint32_t(quantised.y) & 0x1fffff) << 21) |
+                        uint64_t(uint32_t(quantised.z) & 0x1fffff);
+            auto slot = std::size_t((key * 0x9e3779b97f4a7c15ull) >> 32) & (capacity - 1);
+            while (_slots[slot].key != EMPTY_SLOT && _slots[slot].key != key) {
+                slot = (slot + 1) & (capacity - 1);
+            }
+            if (_slots[slot].key == EMPTY_SLOT) {
+                _slots[slot] = Slot { key, _num_vertices++ };
+            }
+            _triangle_vertices[i] = _slots[slot].id;
+        }
+    }
+
+    // Triangles around each vertex, compressed rows
+    void build_adjacency(uint32_t num_triangles) {
+        _adjacency_offsets.assign(_num_vertices + 1, 0);
+        for (auto vertex : _triangle_vertices) {
+            _adjacency_offsets[vertex + 1]++;
+        }
+        for (auto vertex = 0u; vertex < _num_vertices; vertex++) {
+            _adjacency_offsets[vertex + 1] += _adjacency_offsets[vertex];
+        }
+        _adjacency.resize(_triangle_vertices.size());
+        _cursors.assign(_adjacency_offsets.begin(), _adjacency_offsets.end() - 1);
+        for (auto triangle = 0u; triangle < num_triangles; triangle++) {
+            for (auto corner = 0; corner < 3; corner++) {
+                _adjacency[_cursors[_triangle_vertices[triangle * 3 + corner]]++] = triangle;
+            }
+        }
+    }
+
+    // Geometric normals, turned to agree with the stored outward normals
+    // whichever winding the extractor used
+    void face_normals(const MeshVertex* triangles, uint32_t num_triangles) {
+        _normals.resize(num_triangles);
+        _centroids.resize(num_triangles);
+        for (auto triangle = 0u; triangle < num_triangles; triangle++) {
+            const auto* corners = triangles + std::size_t(triangle) * 3;
+            auto a = glm::vec3(corners[0].position);
+            auto b = glm::vec3(corners[1].position);
+            auto c = glm::vec3(corners[2].position);
+            auto normal = glm::cross(a - b, a - c);
+            auto stored = glm::vec3(corners[0].normal + corners[1].normal + corners[2].normal);
+            if (glm::dot(normal, stored) < 0.0f) {
+                normal = -normal;
+            }
+            auto length = glm::length(normal);
+            _normals[triangle] = length > 0.0f ? normal / length : glm::vec3(0.0f);
+            _centroids[triangle] = (a + b + c) / 3.0f;
+        }
+    }
+
+    Meshlet bounds(const MeshVertex* triangles, uint32_t first) const {
+        auto box = BoundingBox();
+        auto axis = glm::vec3(0.0f);
+        for (auto triangle : _meshlet_triangles) {
+            for (auto corner = 0; corner < 3; corner++) {
+                box.expand(glm::vec3(triangles[std::size_t(triangle) * 3 + corner].position));
+            }
+            axis += _normals[triangle];
+        }
+
+        auto meshlet = Meshlet();
+        meshlet.first = first;
+        meshlet.count = uint32_t(_meshlet_triangles.size());
+        meshlet.center = box.center();
+        meshlet.radius = glm::length(box.max - meshlet.center);
+        meshlet.cone_axis = glm::length(axis) > 0.0f ? glm::normalize(axis) : glm::vec3(0.0f, 1.0f, 0.0f);
+
+        // Degenerate triangles cover no pixels, so they do not widen the cone
+        meshlet.cone_cos = 1.0f;
+        for (auto triangle : _meshlet_triangles) {
+            if (_normals[triangle] != glm::vec3(0.0f)) {
+                meshlet.cone_cos = std::min(meshlet.cone_cos, glm::dot(_normals[triangle], meshlet.cone_axis));
+            }
+        }
+        meshlet.cone_sin = std::sqrt(std::max(0.0f, 1.0f - meshlet.cone_cos * meshlet.cone_cos));
+        return meshlet;
+    }
+
+    // Keys use 63 bits
+    static constexpr uint64_t EMPTY_SLOT = ~uint64_t(0);
+
+    struct Slot {
+        uint64_t key;
+        uint32_t id;
+    };
+
+    std::vector<Slot> _slots;
+    uint32_t _num_vertices = 0;
+    std::vector<uint32_t> _triangle_vertices;
+    std::vector<uint32_t> _adjacency_offsets;
+    std::vector<uint32_t> _adjacency;
+    std::vector<uint32_t> _cursors;
+    std::vector<glm::vec3> _normals;
+    std::vector<glm::vec3> _centroids;
+    std::vector<uint8_t> _used;
+    std::vector<uint32_t> _vertex_stamp;
+    std::vector<uint32_t> _candidate_stamp;
+    std::vector<uint32_t> _meshlet_triangles;
+    std::vector<uint32_t> _candidates;
+};
@@ -0,0 +1,314 @@
+#pragma once
+
+// Occlusion.hpp
+//
+// Description: Low resolution software depth buffer. Occluder boxes are
+// rasterised four pixels at a time with SSE, split into row bands across a
+// thread pool, and bounding boxes are then tested against the result.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "frustum.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
+
+class OcclusionBuffer {
+public:
+    static constexpr auto DEFAULT_WIDTH = 256;
+    static constexpr auto DEFAULT_HEIGHT = 160;
+
+    // Width is rounded up to a multiple of four so every row splits into SSE lanes
+    explicit OcclusionBuffer(int width = DEFAULT_WIDTH, int height = DEFAULT_HEIGHT, ThreadPool* pool = nullptr)
+    : _width((width + 3) & ~3),
+      _height(height),
+      _depth(std::size_t(_width) * _height, 1.0f),
+      _pool(pool)
+    {
+    }
+
+    int width() const {
+        return _width;
+    }
+
+    int height() const {
+        return _height;
+    }
+
+    // Depth is stored bottom row first in [0, 1], 1.0 meaning nothing rasterised
+    const std::vector<float>& depth() const {
+        return _depth;
+    }
+
+    std::size_t num_triangles() const {
+        return _triangles.size();
+    }
+
+    void begin_frame(const glm::mat4& view_projection) {
+        _view_projection = view_projection;
+        _triangles.clear();
+        std::fill(_depth.begin(), _depth.end(), 1.0f);
+    }
+
+    // Queues the front facing faces of a box that is known to be fully solid
+    void add_occluder(const BoundingBox& box) {
+        if (box.empty()) {
+            return;
+        }
+
+        glm::vec3 corners[8];
+        if (!project_corners(box, corners)) {
+            // Crosses the near plane, skipping an occluder is always conservative
+            return;
+        }
+
+        // Quads wound counter-clockwise when seen from outside the box, corner
+        // index bits are (x, y, z)
+        static constexpr int faces[6][4] = {
+            { 0, 4, 6, 2 }, // -x
+            { 1, 3, 7, 5 }, // +x
+            { 0, 1, 5, 4 }, // -y
+            { 2, 6, 7, 3 }, // +y
+            { 0, 2, 3, 1 }, // -z
+            { 4, 5, 7, 6 }  // +z
+        };
+
+        for (const auto& face : faces) {
+            add_triangle(corners[face[0]], corners[face[1]], corners[face[2]]);
+            add_triangle(corners[face[0]], corners[face[2]], corners[face[3]]);
+        }
+    }
+
+    // Rasterises every queued occluder, one band of rows per job
+    void rasterize() {
+        auto const num_bands = _pool ? std::min<std::size_t>(_height, _pool->size() * 2) : 1;
+        auto const band_height = (_height + int(num_bands) - 1) / int(num_bands);
+
+        auto rasterize_band = [this, band_height](std::size_t band) {
+            TRACE_ZONE("rasterize occluder band");
+            auto row_begin = int(band) * band_height;
+            auto row_end = std::min(_height, row_begin + band_height);
+            for (const auto& triangle : _triangles) {
+                rasterize_triangle(triangle, row_begin, row_end);
+            }
+        };
+
+        if (_pool) {
+            _pool->parallel_for(num_bands, rasterize_band);
+        } else {
+            rasterize_band(0);
+        }
+    }
+
+    // True unless every pixel the box could touch already holds something nearer
+    bool is_visible(const BoundingBox& box) const {
+        if (box.empty()) {
+            return false;
+        }
+
+        glm::vec3 corners[8];
+        if (!project_corners(box, corners)) {
+            return true;
+        }
+
+        auto screen_min = corners[0];
+        auto screen_max = corners[0];
+        for (const auto& corner : corners) {
+            screen_min = glm::min(screen_min, corner);
+            screen_max = glm::max(screen_max, corner);
+        }
+
+        // Round outwards and widen to whole SSE lanes, extra pixels only make
+        // the test more conservative
+        auto x_begin = std::max(0, int(std::floor(screen_min.x)) & ~3);
+        auto x_end = std::min(_width, (int(std::ceil(screen_max.x)) + 4) & ~3);
+        auto y_begin = std::max(0, int(std::floor(screen_min.y)));
+        auto y_end = std::min(_height, int(std::ceil(screen_max.y)) + 1);
+
+        if (x_begin >= x_end || y_begin >= y_end) {
+            return true;
+        }
+
+        auto const nearest = std::max(0.0f, screen_min.z);
+
+#if MC_FRUSTUM_SSE
+        auto const nearest4 = _mm_set1_ps(nearest);
+        for (auto y = y_begin; y < y_end; y++) {
+            const auto* row = &_depth[std::size_t(y) * _width];
+            for (auto x = x_begin; x < x_end; x += 4) {
+                if (_mm_movemask_ps(_mm_cmpgt_ps(_mm_loadu_ps(row + x), nearest4))) {
+                    return true;
+                }
+            }
+        }
+#else
+        for (auto y = y_begin; y < y_end; y++) {
+            const auto* row = &_depth[std::size_t(y) * _width];
+            for (auto x = x_begin; x < x_end; x++) {
+                if (row[x] > nearest) {
+                    return true;
+                }
+            }
+        }
+#endif
+
+        return false;
+    }
+
+private:
+    // Edge functions and depth plane of a screen space triangle, all of the
+    // form a * x + b * y + c
+    struct OccluderTriangle {
+        float edge_a[3];
+        float edge_b[3];
+        float edge_c[3];
+        float depth_a;
+        float depth_b;
+        float depth_c;
+        int x_begin;
+        int x_end;
+        int y_begin;
+        int y_end;
+    };
+
+    // Projects corners to (pixel x, pixel y, depth), false if any is behind the near plane
+    bool project_corners(const BoundingBox& box, glm::vec3 (&corners)[8]) const {
+        constexpr auto near_w = 1e-3f;
+
+        for (auto index = 0; index < 8; index++) {
+            auto corner = glm::vec4(
+                index & 1 ? box.max.x : box.min.x,
+                index & 2 ? box.max.y : box.min.y,
+                index & 4 ? box.max.z : box.min.z,
+                1.0f
+            );
+
+            auto clip = _view_projection * corner;
+            if (clip.w < near_w) {
+                return false;
+            }
+
+            auto ndc = glm::vec3(clip) / clip.w;
+            corners[index] = glm::vec3(
+                (ndc.x * 0.5f + 0.5f) * _width,
+                (ndc.y * 0.5f + 0.5f) * _height,
+                ndc.z * 0.5f + 0.5f
+            );
+        }
+
+        return true;
+    }
+
+    void add_triangle(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2) {
+        auto area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+
+        // Back facing or degenerate, the front faces of a box already cover its silhouette
+        if (area <= 0.0f) {
+            return;
+        }
+
+        OccluderTriangle triangle;
+        glm::vec3 vertices[3] = { v0, v1, v2 };
+        for (auto edge = 0; edge < 3; edge++) {
+            auto a = vertices[edge];
+            auto b = vertices[(edge + 1) % 3];
+            triangle.edge_a[edge] = -(b.y - a.y);
+            triangle.edge_b[edge] = b.x - a.x;
+            triangle.edge_c[edge] = (b.y - a.y) * a.x - (b.x - a.x) * a.y;
+        }
+
+        // Depth is affine in screen space, solve the plane through the three vertices
+        auto inverse_area = 1.0f / area;
+        auto dz1 = v1.z - v0.z;
+        auto dz2 = v2.z - v0.z;
+        triangle.depth_a = (dz1 * (v2.y - v0.y) - dz2 * (v1.y - v0.y)) * inverse_area;
+        triangle.depth_b = (dz2 * (v1.x - v0.x) - dz1 * (v2.x - v0.x)) * inverse_area;
+        triangle.depth_c = v0.z - triangle.depth_a * v0.x - triangle.depth_b * v0.y;
+
+        auto screen_min = glm::min(v0, glm::min(v1, v2));
+        auto screen_max = glm::max(v0, glm::max(v1, v2));
+        triangle.x_begin = std::max(0, int(std::floor(screen_min.x)) & ~3);
+        triangle.x_end = std::min(_width, (int(std::ceil(screen_max.x)) + 4) & ~3);
+        triangle.y_begin = std::max(0, int(std::floor(screen_min.y)));
+        triangle.y_end = std::min(_height, int(std::ceil(screen_max.y)) + 1);
+
+        if (triangle.x_begin >= triangle.x_end || triangle.y_begin >= triangle.y_end) {
+            return;
+        }
+
+        _triangles.push_back(triangle);
+    }
+
+    void rasterize_triangle(const OccluderTriangle& triangle, int row_begin, int row_end) {
+        auto y_begin = std::max(row_begin, triangle.y_begin);
+        auto y_end = std::min(row_end, triangle.y_end);
+
+#if MC_FRUSTUM_SSE
+        auto const lane_offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+        auto const zero = _mm_setzero_ps();
+
+        auto const edge_a0 = _mm_set1_ps(triangle.edge_a[0]);
+        auto const edge_a1 = _mm_set1_ps(triangle.edge_a[1]);
+        auto const edge_a2 = _mm_set1_ps(triangle.edge_a[2]);
+        auto const depth_a = _mm_set1_ps(triangle.depth_a);
+
+        for (auto y = y_begin; y < y_end; y++) {
+            auto py = y + 0.5f;
+            auto row_edge0 = _mm_set1_ps(triangle.edge_b[0] * py + triangle.edge_c[0]);
+            auto row_edge1 = _mm_set1_ps(triangle.edge_b[1] * py + triangle.edge_c[1]);
+            auto row_edge2 = _mm_set1_ps(triangle.edge_b[2] * py + triangle.edge_c[2]);
+            auto row_depth = _mm_set1_ps(triangle.depth_b * py + triangle.depth_c);
+
+            auto* row = &_depth[std::size_t(y) * _width];
+            for (auto x = triangle.x_begin; x < triangle.x_end; x += 4) {
+                auto px = _mm_add_ps(_mm_set1_ps(float(x)), lane_offsets);
+
+                auto e0 = _mm_add_ps(_mm_mul_ps(edge_a0, px), row_edge0);
+                auto e1 = _mm_add_ps(_mm_mul_ps(edge_a1, px), row_edge1);
+                auto e2 = _mm_add_ps(_mm_mul_ps(edge_a2, px), row_edge2);
+                auto inside = _mm_and_ps(
+                    _mm_cmpge_ps(e0, zero),
+                    _mm_and_ps(_mm_cmpge_ps(e1, zero), _mm_cmpge_ps(e2, zero))
+                );
+
+                if (!_mm_movemask_ps(inside)) {
+                    continue;
+                }
+
+                auto depth = _mm_add_ps(_mm_mul_ps(depth_a, px), row_depth);
+                auto current = _mm_loadu_ps(row + x);
+                auto nearer = _mm_min_ps(current, depth);
+                _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, current)));
+            }
+        }
+#else
+        for (auto y = y_begin; y < y_end; y++) {
+            auto py = y + 0.5f;
+            auto* row = &_depth[std::size_t(y) * _width];
+            for (auto x = triangle.x_begin; x < triangle.x_end; x++) {
+                auto px = x + 0.5f;
+
+                auto inside = true;
+                for (auto edge = 0; edge < 3; edge++) {
+                    inside &= triangle.edge_a[edge] * px + triangle.edge_b[edge] * py + triangle.edge_c[edge] >= 0.0f;
+                }
+
+                if (inside) {
+                    row[x] = std::min(row[x], triangle.depth_a * px + triangle.depth_b * py + triangle.depth_c);
+                }
+            }
+        }
+#endif
+    }
+
+    int _width;
+    int _height;
+    std::vector<float> _depth;
+    ThreadPool* _pool;
+    glm::mat4 _view_projection = glm::mat4(1.0f);
+    std::vector<OccluderTriangle> _triangles;
+};
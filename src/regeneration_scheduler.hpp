@@ -0,0 +1,134 @@
+#pragma once
+
+// Regeneration_scheduler.hpp
+//
+// Description: Spreads chunk regeneration after a settings change over frames.
+// Each frame regenerates the stale chunks nearest the camera, visible ones
+// first, for as long as a millisecond budget allows. Stale chunks keep their
+// old mesh on screen until their turn comes.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+class RegenerationScheduler {
+public:
+    struct Stats {
+        uint32_t regenerated = 0;
+        double ms = 0.0;
+    };
+
+    // Marks every chunk stale, call when the settings change
+    void invalidate_all(std::size_t count) {
+        _stale.assign(count, 1);
+        _pending = count;
+    }
+
+    // For a chunk regenerated outside run, like one restored after
+    // eviction, so run does not regenerate it a second time
+    void mark_fresh(std::size_t index) {
+        if (is_stale(index)) {
+            _stale[index] = 0;
+            _pending--;
+        }
+    }
+
+    bool is_stale(std::size_t index) const {
+        return index < _stale.size() && _stale[index];
+    }
+
+    std::size_t pending() const {
+        return _pending;
+    }
+
+    // Regenerates at least one stale chunk, then more while the running
+    // average cost of a chunk still fits in budget_ms. visible is sorted
+    // front to back, distance gives the order of the chunks not in view.
+    template<typename Distance, typename Regenerate>
+    Stats run(const std::vector<uint32_t>& visible, double budget_ms, Distance&& distance, Regenerate&& regenerate)
+    {
+        auto stats = Stats();
+        if (_pending == 0) {
+            return stats;
+        }
+
+        _order.clear();
+        _in_view.assign(_stale.size(), 0);
+        for (auto index : visible) {
+            _in_view[index] = 1;
+            if (_stale[index]) {
+                _order.push_back(index);
+            }
+        }
+        auto first_hidden = _order.size();
+        for (auto index = 0u; index < _stale.size(); index++) {
+            if (_stale[index] && !_in_view[index]) {
+                _order.push_back(index);
+            }
+        }
+        std::sort(_order.begin() + first_hidden, _order.end(), [&](uint32_t a, uint32_t b) {
+            return distance(a) < distance(b);
+        });
+
+        auto start = std::chrono::high_resolution_clock::now();
+        for (auto index : _order) {
+            if (stats.regenerated != 0 && stats.ms + _average_ms > budget_ms) {
+                break;
+            }
+
+            auto chunk_start = std::chrono::high_resolution_clock::now();
+            regenerate(index);
+            auto end = std::chrono::high_resolution_clock::now();
+
+            _stale[index] = 0;
+            _pending--;
+            stats.regenerated++;
+            stats.ms = std::chrono::duration<double, std::milli>(end - start).count();
+
+            // Chunk cost varies with how much surface it has
+            auto chunk_ms = std::chrono::duration<double, std::milli>(end - chunk_start).count();
+            _average_ms = _average_ms == 0.0 ? chunk_ms : _average_ms * 0.75 + chunk_ms * 0.25;
+        }
+
+        return stats;
+    }
+
+private:
+    std::vector<uint8_t> _stale;
+    std::size_t _pending = 0;
+    double _average_ms = 0.0;
+    std::vector<uint32_t> _order;
+    std::vector<uint8_t> _in_view;
+};
+
+// Frame times over the last few seconds, for the percentiles in the UI
+class FrameTimes {
+public:
+    static constexpr std::size_t CAPACITY = 512;
+
+    void add(double ms) {
+        if (_times.size() < CAPACITY) {
+            _times.push_back(ms);
+        } else {
+            _times[_next] = ms;
+        }
+        _next = (_next + 1) % CAPACITY;
+    }
+
+    // The frame time fraction of recent frames stay under, 0.99 for p99
+    double percentile(double fraction) {
+        if (_times.empty()) {
+            return 0.0;
+        }
+        _sorted = _times;
+        auto rank = std::min(_sorted.size() - 1, std::size_t(fraction * _sorted.size()));
+        std::nth_element(_sorted.begin(), _sorted.begin() + rank, _sorted.end());
+        return _sorted[rank];
+    }
+
+private:
+    std::vector<double> _times;
+    std::vector<double> _sorted;
+    std::size_t _next = 0;
+};
@@ -0,0 +1,140 @@
+#pragma once
+
+// Sculpt.hpp
+//
+// Description: Density brushes layered on top of the procedural terrain and a
+// uniform grid index over them, so a region only has to evaluate the edits
+// that overlap it
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "frustum.hpp"
+
+// Values must match the BRUSH_ constants in marching_cubes_stage1.compute
+enum class BrushShape : int {
+    SPHERE = 0,
+    BOX = 1,
+    SMOOTH = 2
+};
+
+enum class BrushOperation : int {
+    ADD = 0,
+    SUBTRACT = 1
+};
+
+struct Brush {
+    BrushShape shape;
+    BrushOperation operation;
+    glm::vec3 center;
+    float radius;
+    // Blend factor between the current density and the brush result, 0 to 1
+    float strength;
+
+    // Every sample whose density the brush can change, one sample of margin
+    // covers the soft edge and the neighbours read by the smooth brush
+    BoundingBox bounds() const {
+        return BoundingBox(center - glm::vec3(radius + 1.0f), center + glm::vec3(radius + 1.0f));
+    }
+};
+
+// Mirrors the Brush struct in stage 1
+struct GpuBrush {
+    glm::vec4 center_radius;
+    // shape, operation, strength, unused
+    glm::vec4 parameters;
+
+    explicit GpuBrush(const Brush& brush)
+    : center_radius(brush.center, brush.radius),
+      parameters(float(brush.shape), float(brush.operation), brush.strength, 0.0f)
+    {
+    }
+};
+
+class EditIndex {
+public:
+    // World units per index cell, a little larger than a typical brush
+    static constexpr float CELL_SIZE = 16.0f;
+
+    // Edits are applied in the order they were added
+    uint32_t add(const Brush& brush) {
+        auto id = uint32_t(_edits.size());
+        _edits.push_back(brush);
+        _stamps.push_back(0);
+
+        glm::ivec3 first, last;
+        cell_range(brush.bounds(), first, last);
+        for (auto x = first.x; x <= last.x; x++) {
+            for (auto y = first.y; y <= last.y; y++) {
+                for (auto z = first.z; z <= last.z; z++) {
+                    _cells[key(x, y, z)].push_back(id);
+                }
+            }
+        }
+
+        return id;
+    }
+
+    const Brush& edit(uint32_t id) const {
+        return _edits[id];
+    }
+
+    std::size_t size() const {
+        return _edits.size();
+    }
+
+    // Edits whose bounds overlap box, in the order they were added
+    void query(const BoundingBox& box, std::vector<uint32_t>& result) const {
+        result.clear();
+        if (_edits.empty() || box.empty()) {
+            return;
+        }
+
+        // Stamps skip edits already seen through another cell
+        _query++;
+
+        glm::ivec3 first, last;
+        cell_range(box, first, last);
+        for (auto x = first.x; x <= last.x; x++) {
+            for (auto y = first.y; y <= last.y; y++) {
+                for (auto z = first.z; z <= last.z; z++) {
+                    auto cell = _cells.find(key(x, y, z));
+                    if (cell == _cells.end()) {
+                        continue;
+                    }
+
+                    for (auto id : cell->second) {
+                        if (_stamps[id] != _query && _edits[id].bounds().intersects(box)) {
+                            _stamps[id] = _query;
+                            result.push_back(id);
+                        }
+                    }
+                }
+            }
+        }
+
+        std::sort(result.begin(), result.end());
+    }
+
+private:
+    static void cell_range(const BoundingBox& box, glm::ivec3& first, glm::ivec3& last) {
+        first = glm::ivec3(glm::floor(box.min / CELL_SIZE));
+        last = glm::ivec3(glm::floor(box.max / CELL_SIZE));
+    }
+
+    // 21 bits per axis, enough for +-1M cells
+    static uint64_t key(int x, int y, int z) {
+        constexpr auto MASK = (uint64_t(1) << 21) - 1;
+        return (uint64_t(x) & MASK) | ((uint64_t(y) & MASK) << 21) | ((uint64_t(z) & MASK) << 42);
+    }
+
+    std::vector<Brush> _edits;
+    std::unordered_map<uint64_t, std::vector<uint32_t>> _cells;
+    mutable std::vector<uint32_t> _stamps;
+    mutable uint32_t _query = 0;
+};
@@ -0,0 +1,296 @@
+#pragma once
+
+// Session.hpp
+//
+// Description: Records a session frame by frame, with the frame's time step,
+// the camera pose, the generation settings and renderer options when they
+// changed and the brushes applied, and writes it as text. Replaying the file steps the
+// renderer through the same frames with the recorded time steps instead of
+// the clock. FrameTimeLog collects CPU and GPU time per frame of a replay
+// and writes them with their p50, p95 and p99 so two builds can be compared
+// on the same frames.
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "generation_settings.hpp"
+#include "sculpt.hpp"
+
+// Renderer toggles that change what a frame costs but not the terrain
+struct SessionOptions {
+    bool occlusion_culling = true;
+    bool ray_queries = true;
+    bool generated_density = false;
+    bool animate = false;
+    float animation_speed = 10.0f;
+    float animation_scale = 1.0f;
+    float regeneration_budget_ms = 8.0f;
+    int gpu_budget_mb = 0;
+    int cpu_budget_mb = 0;
+    // The point view adds a stage 1 dispatch and point extraction per frame
+    bool draw_points = true;
+    bool wireframe = false;
+
+    bool operator==(const SessionOptions& other) const {
+        return occlusion_culling == other.occlusion_culling && ray_queries == other.ray_queries &&
+               generated_density == other.generated_density && animate == other.animate &&
+               animation_speed == other.animation_speed && animation_scale == other.animation_scale &&
+               regeneration_budget_ms == other.regeneration_budget_ms &&
+               gpu_budget_mb == other.gpu_budget_mb && cpu_budget_mb == other.cpu_budget_mb &&
+               draw_points == other.draw_points && wireframe == other.wireframe;
+    }
+};
+
+// Settings and options are the values at the end of the frame, after the UI
+// had its chance to change them, and replay applies them at the same point
+struct SessionFrame {
+    // Seconds since the last frame
+    float delta_time = 0.0f;
+    glm::vec3 position = glm::vec3(0.0f);
+    float yaw = 0.0f;
+    float pitch = 0.0f;
+    // Settings stay as they are until a frame changes them
+    bool settings_changed = false;
+    GenerationSettings settings;
+    bool options_changed = false;
+    SessionOptions options;
+    // Resolved brushes, replay does not depend on where the ray hit then
+    std::vector<Brush> brushes;
+};
+
+class Session {
+public:
+    static constexpr const char* HEADER = "# marching cubes session 3";
+
+    void clear() {
+        _frames.clear();
+    }
+
+    // Settings and options are kept only when they differ from the last
+    // ones recorded
+    void record(const SessionFrame& frame) {
+        _frames.push_back(frame);
+        auto& recorded = _frames.back();
+        recorded.settings_changed = _frames.size() == 1 || !(_last_settings == frame.settings);
+        recorded.options_changed = _frames.size() == 1 || !(_last_options == frame.options);
+        _last_settings = frame.settings;
+        _last_options = frame.options;
+    }
+
+    const std::vector<SessionFrame>& frames() const {
+        return _frames;
+    }
+
+    std::size_t size() const {
+        return _frames.size();
+    }
+
+    // One frame line per frame, followed by its settings and brush lines
+    bool save(const std::string& path) const {
+        auto file = std::ofstream(path);
+        if (!file) {
+            return false;
+        }
+
+        file << HEADER << "\n";
+        file << "# frame delta_time x y z yaw pitch\n";
+        file << "# settings iso_level scale persistence octaves lacunarity extractor meshlets\n";
+        file << "# options occlusion_culling ray_queries generated_density animate animation_speed animation_scale regeneration_budget_ms gpu_budget_mb cpu_budget_mb draw_points wireframe\n";
+        file << "# brush shape operation x y z radius strength\n";
+        char line[256];
+        for (const auto& frame : _frames) {
+            std::snprintf(line, sizeof(line), "frame %.9g %.9g %.9g %.9g %.9g %.9g\n", frame.delta_time,
+                frame.position.x, frame.position.y, frame.position.z, frame.yaw, frame.pitch);
+            file << line;
+            if (frame.settings_changed) {
+                const auto& settings = frame.settings;
+                std::snprintf(line, sizeof(line), "settings %.9g %.9g %.9g %d %.9g %d %d\n", settings.iso_level,
+                    settings.scale, settings.persistence, settings.octaves, settings.lacunarity,
+                    int(settings.extractor), int(settings.meshlets));
+                file << line;
+            }
+            if (frame.options_changed) {
+                const auto& options = frame.options;
+                std::snprintf(line, sizeof(line), "options %d %d %d %d %.9g %.9g %.9g %d %d %d %d\n", int(options.occlusion_culling),
+                    int(options.ray_queries), int(options.generated_density), int(options.animate), options.animation_speed,
+                    options.animation_scale, options.regeneration_budget_ms, options.gpu_budget_mb, options.cpu_budget_mb,
+                    int(options.draw_points), int(options.wireframe));
+                file << line;
+            }
+            for (const auto& brush : frame.brushes) {
+                std::snprintf(line, sizeof(line), "brush %d %d %.9g %.9g %.9g %.9g %.9g\n", int(brush.shape),
+                    int(brush.operation), brush.center.x, brush.center.y, brush.center.z, brush.radius, brush.strength);
+                file << line;
+            }
+        }
+        return bool(file);
+    }
+
+    // Frames without a settings or options line carry the last ones forward
+    bool load(const std::string& path) {
+        auto file = std::ifstream(path);
+        if (!file) {
+            return false;
+        }
+
+        clear();
+        auto settings = GenerationSettings();
+        auto options = SessionOptions();
+        auto line = std::string();
+        while (std::getline(file, line)) {
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+
+            auto stream = std::istringstream(line);
+            auto kind = std::string();
+            stream >> kind;
+            if (kind == "frame") {
+                auto frame = SessionFrame();
+                if (!(stream >> frame.delta_time >> frame.position.x >> frame.position.y >> frame.position.z
+                    >> frame.yaw >> frame.pitch)) {
+                    return false;
+                }
+                frame.settings = settings;
+                frame.options = options;
+                _frames.push_back(frame);
+            } else if (kind == "settings" && !_frames.empty()) {
+                auto extractor = 0, meshlets = 0;
+                if (!(stream >> settings.iso_level >> settings.scale >> settings.persistence >> settings.octaves
+                    >> settings.lacunarity >> extractor >> meshlets)) {
+                    return false;
+                }
+                settings.extractor = ExtractorType(extractor);
+                settings.meshlets = meshlets != 0;
+                _frames.back().settings = settings;
+                _frames.back().settings_changed = true;
+            } else if (kind == "options" && !_frames.empty()) {
+                auto occlusion_culling = 0, ray_queries = 0, generated_density = 0, animate = 0, draw_points = 0, wireframe = 0;
+                if (!(stream >> occlusion_culling >> ray_queries >> generated_density >> animate >> options.animation_speed
+                    >> options.animation_scale >> options.regeneration_budget_ms >> options.gpu_budget_mb >> options.cpu_budget_mb
+                    >> draw_points >> wireframe)) {
+                    return false;
+                }
+                options.occlusion_culling = occlusion_culling != 0;
+                options.ray_queries = ray_queries != 0;
+                options.generated_density = generated_density != 0;
+                options.animate = animate != 0;
+                options.draw_points = draw_points != 0;
+                options.wireframe = wireframe != 0;
+                _frames.back().options = options;
+                _frames.back().options_changed = true;
+            } else if (kind == "brush" && !_frames.empty()) {
+                auto brush = Brush();
+                auto shape = 0, operation = 0;
+                if (!(stream >> shape >> operation >> brush.center.x >> brush.center.y >> brush.center.z
+                    >> brush.radius >> brush.strength)) {
+                    return false;
+                }
+                brush.shape = BrushShape(shape);
+                brush.operation = BrushOperation(operation);
+                _frames.back().brushes.push_back(brush);
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    std::vector<SessionFrame> _frames;
+    GenerationSettings _last_settings;
+    SessionOptions _last_options;
+};
+
+// Every frame of a replay, kept whole so the percentiles cover all of it
+class FrameTimeLog {
+public:
+    struct Summary {
+        double p50 = 0.0;
+        double p95 = 0.0;
+        double p99 = 0.0;
+    };
+
+    // GPU times arrive a few frames late, frame is the one they belong to
+    void add_cpu(std::size_t frame, double ms) {
+        resize(frame + 1);
+        _cpu_ms[frame] = ms;
+    }
+
+    void add_gpu(std::size_t frame, double ms) {
+        resize(frame + 1);
+        _gpu_ms[frame] = ms;
+    }
+
+    std::size_t size() const {
+        return _cpu_ms.size();
+    }
+
+    Summary cpu_summary() const {
+        return summary(_cpu_ms);
+    }
+
+    Summary gpu_summary() const {
+        return summary(_gpu_ms);
+    }
+
+    // CSV with a row per frame, then a row per percentile. Frames whose GPU
+    // time never arrived are left empty.
+    bool save(const std::string& path) const {
+        auto file = std::ofstream(path);
+        if (!file) {
+            return false;
+        }
+
+        file << "frame,cpu_ms,gpu_ms\n";
+        char line[128];
+        for (auto frame = std::size_t(0); frame < size(); frame++) {
+            if (_gpu_ms[frame] < 0.0) {
+                std::snprintf(line, sizeof(line), "%zu,%.4f,\n", frame, _cpu_ms[frame]);
+            } else {
+                std::snprintf(line, sizeof(line), "%zu,%.4f,%.4f\n", frame, _cpu_ms[frame], _gpu_ms[frame]);
+            }
+            file << line;
+        }
+
+        auto cpu = cpu_summary();
+        auto gpu = gpu_summary();
+        std::snprintf(line, sizeof(line), "p50,%.4f,%.4f\np95,%.4f,%.4f\np99,%.4f,%.4f\n",
+            cpu.p50, gpu.p50, cpu.p95, gpu.p95, cpu.p99, gpu.p99);
+        file << line;
+        return bool(file);
+    }
+
+private:
+    void resize(std::size_t count) {
+        if (_cpu_ms.size() < count) {
+            _cpu_ms.resize(count, 0.0);
+            _gpu_ms.resize(count, -1.0);
+        }
+    }
+
+    // Negative times are missing ones
+    static Summary summary(const std::vector<double>& times) {
+        auto sorted = std::vector<double>();
+        std::copy_if(times.begin(), times.end(), std::back_inserter(sorted), [](double ms) { return ms >= 0.0; });
+        if (sorted.empty()) {
+            return Summary();
+        }
+
+        std::sort(sorted.begin(), sorted.end());
+        auto at = [&sorted](double fraction) {
+            return sorted[std::min(sorted.size() - 1, std::size_t(fraction * sorted.size()))];
+        };
+        return Summary { at(0.5), at(0.95), at(0.99) };
+    }
+
+    std::vector<double> _cpu_ms;
+    std::vector<double> _gpu_ms;
+};
@@ -25,6 +25,7 @@ GLuint Shader::compile_shader(const char * shader_source, GLenum shader_type) {
 
         std::vector<GLchar> log(length);
         glGetShaderInfoLog(shader, length, nullptr, log.data());
+        glDeleteShader(shader);
 
         throw std::runtime_error(const_cast<const char *>(log.data()));
     }
@@ -51,6 +52,12 @@ GLuint Shader::link_program(GLuint program) {
     return program;
 }
 
+void Shader::destroy()
+{
+    GL_CHECK(glDeleteProgram(_program));
+    _program = 0;
+}
+
 void Shader::use() const
 {
     GL_CHECK(glUseProgram(_program));
@@ -4,10 +4,12 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <stdexcept>
 #include <type_traits>
 #include <utility>
 #include <filesystem>
 
+#include "trace.hpp"
 #include "utility.hpp"
 
 #include "glad/glad.h"
@@ -52,8 +54,18 @@ public:
             GL_CHECK(glAttachShader(program, shader_array[index]));
         }
 
-        // Link program and delete shader program memory
-        Shader::link_program(program);
+        // Link program and delete shader program memory, the program too
+        // when it fails to link
+        try {
+            Shader::link_program(program);
+        } catch (const std::runtime_error&) {
+            GL_CHECK(glDeleteProgram(program));
+            for(auto index = 0u; index < initialized_count; index++)
+            {
+                GL_CHECK(glDeleteShader(shader_array[index]));
+            }
+            throw;
+        }
         for(auto index = 0u; index < initialized_count; index++)
         {
             GL_CHECK(glDeleteShader(shader_array[index]));
@@ -63,6 +75,19 @@ public:
     }
 
     static GLuint create_internal(ShaderInfo& info, uint8_t& initialized_count)
+    {
+        TRACE_ZONE("load shader");
+
+        auto shader_source = Shader::read_source(info.name);
+        auto shader = Shader::compile_shader(shader_source.c_str(), info.shader_type);
+
+        initialized_count++;
+
+        return shader;
+    }
+
+    // Whole file as a string, throws if it cannot be read
+    static std::string read_source(const char* name)
     {
         std::string shader_source;
         std::ifstream shader_file;
@@ -73,7 +98,7 @@ public:
             shader_file.exceptions (std::ifstream::failbit | std::ifstream::badbit);
 
             // open files
-            shader_file.open(info.name);
+            shader_file.open(name);
 
             // read file's buffer contents into streams
             shader_stream << shader_file.rdbuf();
@@ -84,20 +109,38 @@ public:
             // convert stream into string
             shader_source = shader_stream.str();
         } catch (std::ifstream::failure&) {
-            throw std::runtime_error(std::string("Failed to load shader: ") + std::string(info.name));
+            throw std::runtime_error(std::string("Failed to load shader: ") + std::string(name));
         }
         
-        auto shader = Shader::compile_shader(shader_source.c_str(), info.shader_type);
-
-        initialized_count++;
+        return shader_source;
+    }
 
-        return shader;
+    // Single stage program from source generated at runtime. Throws with
+    // the compile or link log and leaves no GL objects behind if it fails.
+    static Shader create_from_source(const std::string& source, ShaderType shader_type)
+    {
+        auto shader = Shader::compile_shader(source.c_str(), shader_type);
+        auto program = GL_CHECK(glCreateProgram());
+        GL_CHECK(glAttachShader(program, shader));
+        try {
+            Shader::link_program(program);
+        } catch (const std::runtime_error&) {
+            GL_CHECK(glDeleteProgram(program));
+            GL_CHECK(glDeleteShader(shader));
+            throw;
+        }
+        GL_CHECK(glDeleteShader(shader));
+        return Shader(program);
     }
 
     ~Shader() 
     {
     }
 
+    // Deletes the program. Shaders are copied around by value, so the
+    // destructor leaves it alone and the owner calls this once.
+    void destroy();
+
     void use() const;
 
     void set_bool(const char *name, bool value) const;
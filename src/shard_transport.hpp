@@ -0,0 +1,269 @@
+#pragma once
+
+// Shard_transport.hpp
+//
+// Description: Byte stream connections between the sharded meshing
+// coordinator and its workers, and the framed messages they exchange. A
+// connection only has to move bytes in order and tell when the other end is
+// gone, so shared memory rings serve workers on the same machine and a
+// socket could serve workers on others. POSIX only.
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <sys/mman.h>
+
+// Both directions between the coordinator and one worker
+class Connection {
+public:
+    virtual ~Connection() = default;
+
+    // Blocks until all of data is written, false once the other end is gone
+    virtual bool write(const void* data, std::size_t size) = 0;
+
+    // Blocks until size bytes have been read, false once the other end is gone
+    virtual bool read(void* data, std::size_t size) = 0;
+
+    // Whether read would find data without waiting
+    virtual bool readable() = 0;
+
+    // Tells the other end no more will be written
+    virtual void close() = 0;
+};
+
+// Single producer, single consumer byte ring in an anonymous shared
+// mapping. Made before fork, the child sees the same memory.
+class SharedMemoryRing {
+public:
+    explicit SharedMemoryRing(std::size_t capacity) : _capacity(capacity)
+    {
+        _size = sizeof(Header) + capacity;
+        auto* memory = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            throw std::runtime_error("Failed to map shared memory ring");
+        }
+        _header = new (memory) Header();
+        _data = static_cast<uint8_t*>(memory) + sizeof(Header);
+    }
+
+    SharedMemoryRing(const SharedMemoryRing&) = delete;
+    SharedMemoryRing& operator=(const SharedMemoryRing&) = delete;
+
+    ~SharedMemoryRing() {
+        munmap(_header, _size);
+    }
+
+    // As much of data as fits, returns how much that was
+    std::size_t write_some(const void* data, std::size_t size) {
+        auto head = _header->head.load(std::memory_order_relaxed);
+        auto tail = _header->tail.load(std::memory_order_acquire);
+        auto count = std::min<std::size_t>(size, _capacity - std::size_t(head - tail));
+        copy_in(head, static_cast<const uint8_t*>(data), count);
+        _header->head.store(head + count, std::memory_order_release);
+        return count;
+    }
+
+    // As much as there is up to size, returns how much that was
+    std::size_t read_some(void* data, std::size_t size) {
+        auto tail = _header->tail.load(std::memory_order_relaxed);
+        auto head = _header->head.load(std::memory_order_acquire);
+        auto count = std::min<std::size_t>(size, std::size_t(head - tail));
+        copy_out(tail, static_cast<uint8_t*>(data), count);
+        _header->tail.store(tail + count, std::memory_order_release);
+        return count;
+    }
+
+    std::size_t available() const {
+        return std::size_t(_header->head.load(std::memory_order_acquire) - _header->tail.load(std::memory_order_relaxed));
+    }
+
+    void close() {
+        _header->closed.store(1, std::memory_order_release);
+    }
+
+    bool closed() const {
+        return _header->closed.load(std::memory_order_acquire) != 0;
+    }
+
+private:
+    // Positions count every byte ever written or read, the writer and
+    // reader each own one on its own cache line
+    struct Header {
+        alignas(64) std::atomic<uint64_t> head { 0 };
+        alignas(64) std::atomic<uint64_t> tail { 0 };
+        alignas(64) std::atomic<uint32_t> closed { 0 };
+    };
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "ring positions must be lock free to be shared between processes");
+
+    void copy_in(uint64_t position, const uint8_t* data, std::size_t count) {
+        auto start = std::size_t(position % _capacity);
+        auto first = std::min(count, _capacity - start);
+        std::memcpy(_data + start, data, first);
+        std::memcpy(_data, data + first, count - first);
+    }
+
+    void copy_out(uint64_t position, uint8_t* data, std::size_t count) const {
+        auto start = std::size_t(position % _capacity);
+        auto first = std::min(count, _capacity - start);
+        std::memcpy(data, _data + start, first);
+        std::memcpy(data + first, _data, count - first);
+    }
+
+    std::size_t _capacity;
+    std::size_t _size;
+    Header* _header;
+    uint8_t* _data;
+};
+
+// Reads from one ring and writes to the other. Waiting spins briefly, then
+// sleeps, asking peer_alive every millisecond whether to keep waiting.
+class SharedMemoryConnection : public Connection {
+public:
+    SharedMemoryConnection(SharedMemoryRing* input, SharedMemoryRing* output, std::function<bool()> peer_alive)
+    : _input(input), _output(output), _peer_alive(std::move(peer_alive))
+    {
+    }
+
+    bool write(const void* data, std::size_t size) override {
+        const auto* bytes = static_cast<const uint8_t*>(data);
+        return wait_until([&] {
+            auto written = _output->write_some(bytes, size);
+            bytes += written;
+            size -= written;
+            return size == 0;
+        }, false);
+    }
+
+    bool read(void* data, std::size_t size) override {
+        auto* bytes = static_cast<uint8_t*>(data);
+        return wait_until([&] {
+            auto count = _input->read_some(bytes, size);
+            bytes += count;
+            size -= count;
+            return size == 0;
+        }, true);
+    }
+
+    bool readable() override {
+        return _input->available() != 0;
+    }
+
+    void close() override {
+        _output->close();
+    }
+
+private:
+    static constexpr int SPINS = 64;
+    static constexpr auto SLEEP = std::chrono::microseconds(20);
+    static constexpr auto PEER_CHECK = std::chrono::milliseconds(1);
+
+    template<typename Step>
+    bool wait_until(Step step, bool reading) {
+        auto last_check = std::chrono::steady_clock::now();
+        for (auto attempt = 0; ; attempt++) {
+            if (step()) {
+                return true;
+            }
+            // What was written before the writer closed or died is still read
+            if (reading && _input->closed()) {
+                return step();
+            }
+
+            if (attempt < SPINS) {
+                std::this_thread::yield();
+                continue;
+            }
+            std::this_thread::sleep_for(SLEEP);
+            auto now = std::chrono::steady_clock::now();
+            if (now - last_check >= PEER_CHECK) {
+                last_check = now;
+                if (!_peer_alive()) {
+                    return reading && step();
+                }
+            }
+        }
+    }
+
+    SharedMemoryRing* _input;
+    SharedMemoryRing* _output;
+    std::function<bool()> _peer_alive;
+};
+
+// Messages are a type and a byte count followed by the payload. Fields are
+// copied as they are in memory, both ends have to agree on byte order.
+struct Message {
+    uint32_t type = 0;
+    std::vector<uint8_t> payload;
+
+    template<typename T>
+    void put(const T& value) {
+        static_assert(std::is_trivially_copyable<T>::value, "only plain values can be copied into a message");
+        put_bytes(&value, sizeof(T));
+    }
+
+    void put_bytes(const void* data, std::size_t size) {
+        auto offset = payload.size();
+        payload.resize(offset + size);
+        if (size != 0) {
+            std::memcpy(payload.data() + offset, data, size);
+        }
+    }
+};
+
+// Reads the fields of a message back in the order they were put
+class MessageReader {
+public:
+    explicit MessageReader(const Message& message) : _message(message)
+    {
+    }
+
+    template<typename T>
+    bool get(T& value) {
+        static_assert(std::is_trivially_copyable<T>::value, "only plain values can be copied out of a message");
+        return get_bytes(&value, sizeof(T));
+    }
+
+    bool get_bytes(void* data, std::size_t size) {
+        if (_offset + size > _message.payload.size()) {
+            return false;
+        }
+        if (size != 0) {
+            std::memcpy(data, _message.payload.data() + _offset, size);
+        }
+        _offset += size;
+        return true;
+    }
+
+private:
+    const Message& _message;
+    std::size_t _offset = 0;
+};
+
+inline bool send_message(Connection& connection, const Message& message) {
+    uint32_t header[2] = { message.type, uint32_t(message.payload.size()) };
+    return connection.write(header, sizeof(header)) &&
+           (message.payload.empty() || connection.write(message.payload.data(), message.payload.size()));
+}
+
+inline bool receive_message(Connection& connection, Message& message) {
+    uint32_t header[2];
+    if (!connection.read(header, sizeof(header))) {
+        return false;
+    }
+    message.type = header[0];
+    message.payload.resize(header[1]);
+    return message.payload.empty() || connection.read(message.payload.data(), message.payload.size());
+}
+
+#endif
@@ -0,0 +1,446 @@
+#pragma once
+
+// Sharded_meshing.hpp
+//
+// Description: Meshes a world region in worker processes. The coordinator
+// splits the region into chunk shards, keeps a few in flight on every worker
+// and collects the meshes over each worker's Connection. Workers that crash
+// or stop answering are killed and replaced, and their shards are handed out
+// again. Workers come from a WorkerLauncher, ForkLauncher forks them with
+// shared memory rings. run_shard_worker is the worker side and only needs a
+// Connection, so a launcher for workers on other machines only has to
+// connect to them. POSIX only.
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "glm/glm.hpp"
+
+#include "density.hpp"
+#include "extractor.hpp"
+#include "generation_settings.hpp"
+#include "shard_transport.hpp"
+#include "trace.hpp"
+
+enum class ShardMessage : uint32_t {
+    // Coordinator to worker, a ShardRequest
+    MESH_CHUNK = 1,
+    // Worker to coordinator, the chunk, vertex and index counts, then both arrays
+    CHUNK_MESH = 2,
+    // Coordinator to worker, no payload
+    STOP = 3
+};
+
+struct ShardRequest {
+    uint32_t chunk;
+    glm::ivec3 offset;
+    int32_t axis_length;
+    GenerationSettings settings;
+};
+
+// Meshes chunks until told to stop or the coordinator is gone. With
+// crash_after above 0 the worker kills itself after that many chunks, for
+// testing how the coordinator recovers.
+inline void run_shard_worker(Connection& connection, int crash_after = 0) {
+    auto grid = DensityGrid();
+    auto mesh = ExtractedMesh();
+    auto extractor = std::unique_ptr<Extractor>();
+    auto extractor_type = ExtractorType::MARCHING_CUBES_GPU;
+    auto message = Message();
+    auto meshed = 0;
+
+    while (receive_message(connection, message) && message.type == uint32_t(ShardMessage::MESH_CHUNK)) {
+        auto request = ShardRequest();
+        if (!MessageReader(message).get(request)) {
+            break;
+        }
+
+        // The compute shaders are not available here, the CPU twin is
+        auto type = request.settings.extractor == ExtractorType::MARCHING_CUBES_GPU
+            ? ExtractorType::MARCHING_CUBES_CPU : request.settings.extractor;
+        if (!extractor || type != extractor_type) {
+            extractor = Extractor::create(type);
+            extractor_type = type;
+        }
+        // Surface nets wants a ring of samples below the chunk to close its seams
+        auto overlap = extractor->overlap();
+        sample_density(request.settings, request.offset - glm::ivec3(overlap), request.axis_length + overlap, grid);
+        extractor->extract(grid, request.settings.iso_level, mesh);
+
+        if (crash_after > 0 && ++meshed == crash_after) {
+            kill(getpid(), SIGKILL);
+        }
+
+        auto reply = Message();
+        reply.type = uint32_t(ShardMessage::CHUNK_MESH);
+        reply.put(request.chunk);
+        reply.put(uint32_t(mesh.vertices.size()));
+        reply.put(uint32_t(mesh.indices.size()));
+        reply.put_bytes(mesh.vertices.data(), mesh.vertices.size() * sizeof(MeshVertex));
+        reply.put_bytes(mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t));
+        if (!send_message(connection, reply)) {
+            break;
+        }
+    }
+    connection.close();
+}
+
+// A started worker as the coordinator sees it
+class WorkerProcess {
+public:
+    virtual ~WorkerProcess() = default;
+
+    // False once it has exited or can no longer be reached
+    virtual bool alive() = 0;
+
+    // Stops it for good and waits until it is gone
+    virtual void kill() = 0;
+};
+
+struct LaunchedWorker {
+    std::unique_ptr<WorkerProcess> process;
+    // Must be destroyed before its process
+    std::unique_ptr<Connection> connection;
+};
+
+class WorkerLauncher {
+public:
+    virtual ~WorkerLauncher() = default;
+
+    // Both null when the worker could not be started. crash_after is passed
+    // on to run_shard_worker.
+    virtual LaunchedWorker launch(int crash_after) = 0;
+};
+
+// Forked workers, talking over a pair of shared memory rings
+class ForkLauncher : public WorkerLauncher {
+public:
+    // Per direction and worker, messages larger than this stream through
+    explicit ForkLauncher(std::size_t ring_bytes) : _ring_bytes(ring_bytes) {}
+
+    // Rings are mapped before the fork so both processes share them. The
+    // child never returns, it leaves with _exit so none of the parent's
+    // destructors or exit handlers run twice.
+    LaunchedWorker launch(int crash_after) override {
+        auto process = std::make_unique<ForkedWorker>();
+        process->requests = std::make_unique<SharedMemoryRing>(_ring_bytes);
+        process->results = std::make_unique<SharedMemoryRing>(_ring_bytes);
+
+        auto parent = getpid();
+        auto pid = fork();
+        if (pid == 0) {
+            auto connection = SharedMemoryConnection(process->requests.get(), process->results.get(), [parent] {
+                return getppid() == parent;
+            });
+            run_shard_worker(connection, crash_after);
+            _exit(0);
+        }
+        if (pid < 0) {
+            return LaunchedWorker();
+        }
+
+        process->pid = pid;
+        auto* self = process.get();
+        auto connection = std::make_unique<SharedMemoryConnection>(process->results.get(), process->requests.get(), [self] {
+            return self->alive();
+        });
+        return LaunchedWorker { std::move(process), std::move(connection) };
+    }
+
+private:
+    struct ForkedWorker : WorkerProcess {
+        pid_t pid = -1;
+        bool exited = false;
+        std::unique_ptr<SharedMemoryRing> requests;
+        std::unique_ptr<SharedMemoryRing> results;
+
+        ~ForkedWorker() override {
+            kill();
+        }
+
+        // Reaps the worker the first time it is seen to have exited
+        bool alive() override {
+            if (exited) {
+                return false;
+            }
+            auto status = 0;
+            if (waitpid(pid, &status, WNOHANG) == pid) {
+                exited = true;
+            }
+            return !exited;
+        }
+
+        void kill() override {
+            if (pid > 0 && !exited) {
+                ::kill(pid, SIGKILL);
+                auto status = 0;
+                waitpid(pid, &status, 0);
+                exited = true;
+            }
+        }
+    };
+
+    std::size_t _ring_bytes;
+};
+
+class ShardCoordinator {
+public:
+    struct Options {
+        std::size_t num_workers = 1;
+        // Per direction and worker for the default ForkLauncher
+        std::size_t ring_bytes = std::size_t(4) << 20;
+        // Shards queued on a worker, the next one is ready when it finishes one
+        std::size_t max_in_flight = 2;
+        // A worker with shards out and no result for this long is killed
+        std::chrono::milliseconds shard_timeout = std::chrono::seconds(30);
+        // Replacement workers over the coordinator's life
+        int max_restarts = 8;
+        // Tries per shard before it is given up on
+        int max_attempts = 3;
+        // Testing, the first workers kill themselves after this many shards
+        int crash_after = 0;
+    };
+
+    struct Stats {
+        double ms = 0.0;
+        std::size_t shards = 0;
+        // Handed out again after their worker failed
+        std::size_t retried = 0;
+        std::size_t failed = 0;
+        std::size_t bytes_received = 0;
+        int restarts = 0;
+    };
+
+    explicit ShardCoordinator(const Options& options)
+    : ShardCoordinator(options, std::make_unique<ForkLauncher>(options.ring_bytes))
+    {
+    }
+
+    ShardCoordinator(const Options& options, std::unique_ptr<WorkerLauncher> launcher)
+    : _options(options), _launcher(std::move(launcher))
+    {
+        _workers.resize(std::max<std::size_t>(1, options.num_workers));
+        for (auto& worker : _workers) {
+            spawn(worker, options.crash_after);
+        }
+    }
+
+    ShardCoordinator(const ShardCoordinator&) = delete;
+    ShardCoordinator& operator=(const ShardCoordinator&) = delete;
+
+    // Workers get a stop message and a second to leave before being killed
+    ~ShardCoordinator() {
+        for (auto& worker : _workers) {
+            if (worker.process && worker.process->alive()) {
+                auto message = Message();
+                message.type = uint32_t(ShardMessage::STOP);
+                send_message(*worker.connection, message);
+                worker.connection->close();
+            }
+        }
+
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+        for (auto& worker : _workers) {
+            while (worker.process && worker.process->alive() && std::chrono::steady_clock::now() < deadline) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            stop(worker);
+        }
+    }
+
+    // Workers that are running
+    std::size_t num_workers() {
+        return std::size_t(std::count_if(_workers.begin(), _workers.end(), [](Worker& worker) {
+            return worker.process && worker.process->alive();
+        }));
+    }
+
+    // Meshes the axis_length^3 chunk at each offset into the mesh with the
+    // same index. False if a shard failed max_attempts times or no worker
+    // was left, the meshes of those shards are left empty.
+    bool mesh(const GenerationSettings& settings, const std::vector<glm::ivec3>& offsets, int axis_length, std::vector<ExtractedMesh>& meshes) {
+        TRACE_ZONE("ShardCoordinator::mesh");
+        auto start = std::chrono::steady_clock::now();
+
+        _stats = Stats();
+        _stats.shards = offsets.size();
+        meshes.resize(offsets.size());
+        for (auto& mesh : meshes) {
+            mesh.clear();
+        }
+
+        auto queue = std::deque<uint32_t>();
+        for (auto chunk = uint32_t(0); chunk < offsets.size(); chunk++) {
+            queue.push_back(chunk);
+        }
+        _attempts.assign(offsets.size(), 0);
+        auto finished = std::size_t(0);
+
+        // Shards of a failed worker go to the front, the others are waiting
+        // on them least
+        auto fail = [&](Worker& worker) {
+            for (auto chunk : worker.in_flight) {
+                if (++_attempts[chunk] >= _options.max_attempts) {
+                    _stats.failed++;
+                    finished++;
+                } else {
+                    _stats.retried++;
+                    queue.push_front(chunk);
+                }
+            }
+            worker.in_flight.clear();
+            stop(worker);
+            if (_stats.restarts < _options.max_restarts) {
+                _stats.restarts++;
+                spawn(worker, 0);
+            }
+        };
+
+        // Idle polls back off so the coordinator leaves the cores to workers
+        auto idle = MIN_IDLE;
+        auto message = Message();
+        while (finished < offsets.size()) {
+            auto now = std::chrono::steady_clock::now();
+            auto progress = false;
+            auto running = 0;
+            for (auto& worker : _workers) {
+                if (!worker.process) {
+                    continue;
+                }
+                running++;
+
+                while (worker.in_flight.size() < _options.max_in_flight && !queue.empty()) {
+                    auto request = ShardRequest { queue.front(), offsets[queue.front()], axis_length, settings };
+                    message.type = uint32_t(ShardMessage::MESH_CHUNK);
+                    message.payload.clear();
+                    message.put(request);
+                    if (!send_message(*worker.connection, message)) {
+                        break;
+                    }
+                    if (worker.in_flight.empty()) {
+                        worker.last_progress = now;
+                    }
+                    worker.in_flight.push_back(queue.front());
+                    queue.pop_front();
+                }
+
+                if (worker.connection->readable()) {
+                    if (!receive_message(*worker.connection, message) || !take_mesh(worker, message, meshes)) {
+                        fail(worker);
+                        continue;
+                    }
+                    worker.last_progress = std::chrono::steady_clock::now();
+                    finished++;
+                    progress = true;
+                }
+            }
+
+            if (running == 0) {
+                _stats.failed += offsets.size() - finished;
+                break;
+            }
+            if (progress) {
+                idle = MIN_IDLE;
+                continue;
+            }
+
+            // Nothing arrived, look for workers that died or hang
+            for (auto& worker : _workers) {
+                if (!worker.process || worker.in_flight.empty()) {
+                    continue;
+                }
+                // Anything it wrote before dying is read first, fail kills
+                // one that hangs
+                if (!worker.process->alive() && !worker.connection->readable()) {
+                    fail(worker);
+                } else if (now - worker.last_progress > _options.shard_timeout) {
+                    fail(worker);
+                }
+            }
+            std::this_thread::sleep_for(idle);
+            idle = std::min(idle * 2, MAX_IDLE);
+        }
+
+        auto end = std::chrono::steady_clock::now();
+        _stats.ms = std::chrono::duration<double, std::milli>(end - start).count();
+        return _stats.failed == 0;
+    }
+
+    const Stats& stats() const {
+        return _stats;
+    }
+
+private:
+    static constexpr auto MIN_IDLE = std::chrono::microseconds(50);
+    static constexpr auto MAX_IDLE = std::chrono::microseconds(1000);
+
+    struct Worker {
+        std::unique_ptr<WorkerProcess> process;
+        std::unique_ptr<Connection> connection;
+        std::deque<uint32_t> in_flight;
+        std::chrono::steady_clock::time_point last_progress;
+    };
+
+    // Leaves the worker without a process when the launch failed
+    void spawn(Worker& worker, int crash_after) {
+        worker.in_flight.clear();
+        auto launched = _launcher->launch(crash_after);
+        worker.process = std::move(launched.process);
+        worker.connection = std::move(launched.connection);
+    }
+
+    // The connection goes first, it may still look at its process
+    void stop(Worker& worker) {
+        worker.connection.reset();
+        if (worker.process) {
+            worker.process->kill();
+        }
+        worker.process.reset();
+    }
+
+    bool take_mesh(Worker& worker, const Message& message, std::vector<ExtractedMesh>& meshes) {
+        auto reader = MessageReader(message);
+        auto chunk = uint32_t(0), num_vertices = uint32_t(0), num_indices = uint32_t(0);
+        if (message.type != uint32_t(ShardMessage::CHUNK_MESH) ||
+            !reader.get(chunk) || !reader.get(num_vertices) || !reader.get(num_indices)) {
+            return false;
+        }
+        auto found = std::find(worker.in_flight.begin(), worker.in_flight.end(), chunk);
+        if (found == worker.in_flight.end()) {
+            return false;
+        }
+
+        auto& mesh = meshes[chunk];
+        mesh.vertices.resize(num_vertices);
+        mesh.indices.resize(num_indices);
+        if (!reader.get_bytes(mesh.vertices.data(), num_vertices * sizeof(MeshVertex)) ||
+            !reader.get_bytes(mesh.indices.data(), num_indices * sizeof(uint32_t))) {
+            mesh.clear();
+            return false;
+        }
+
+        worker.in_flight.erase(found);
+        _stats.bytes_received += message.payload.size();
+        return true;
+    }
+
+    Options _options;
+    std::unique_ptr<WorkerLauncher> _launcher;
+    std::vector<Worker> _workers;
+    std::vector<int> _attempts;
+    Stats _stats;
+};
+
+#endif
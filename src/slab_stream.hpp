@@ -0,0 +1,200 @@
+#pragma once
+
+// Slab_stream.hpp
+//
+// Description: Meshes a region too large to hold its density whole. The pool
+// workers sample it one slice of constant x at a time into a small ring while
+// the calling thread runs marching cubes over each slab of cells as soon as
+// its slices are in, so memory grows with the area of a slice rather than the
+// volume. The mesh is the one MarchingCubesExtractor gives for the grid
+// sampled whole.
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <future>
+#include <mutex>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "density_graph.hpp"
+#include "extractor.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
+
+// A power of two number of slices of an axis_length^3 grid, addressed like
+// DensityGrid by their x in the whole grid
+struct SliceRing {
+    int axis_length = 0;
+    int num_slices = 0;
+    glm::ivec3 offset = glm::ivec3(0);
+    std::vector<float> values;
+
+    void resize(int length, int slices) {
+        axis_length = length;
+        num_slices = slices;
+        values.resize(std::size_t(slices) * length * length);
+    }
+
+    int slot(int x) const {
+        return x & (num_slices - 1);
+    }
+
+    float at(int x, int y, int z) const {
+        return values[(std::size_t(slot(x)) * axis_length + y) * axis_length + z];
+    }
+
+    const float* row(int x, int y) const {
+        return values.data() + (std::size_t(slot(x)) * axis_length + y) * axis_length;
+    }
+};
+
+class SlabStreamExtractor {
+public:
+    struct Stats {
+        // Summed over the samplers
+        double sample_ms = 0.0;
+        double extract_ms = 0.0;
+        // Extraction waiting for slices, the share of the time sampling
+        // holds the pipeline up
+        double wait_ms = 0.0;
+        double total_ms = 0.0;
+        // Density and edge slots, the mesh not included
+        std::size_t working_bytes = 0;
+    };
+
+    // Sampling runs as a job per worker of pool, extract must not be called
+    // from one of them
+    explicit SlabStreamExtractor(ThreadPool* pool) : _pool(pool)
+    {
+    }
+
+    SlabStreamExtractor(const SlabStreamExtractor&) = delete;
+    SlabStreamExtractor& operator=(const SlabStreamExtractor&) = delete;
+
+    // Replaces mesh with the surface at iso_level of the axis_length^3
+    // samples of graph starting at origin
+    template<typename Graph>
+    void extract(const density_graph::Node<Graph>& graph, glm::ivec3 origin, int axis_length, float iso_level, ExtractedMesh& mesh) {
+        TRACE_ZONE("SlabStreamExtractor::extract");
+        auto start = std::chrono::high_resolution_clock::now();
+
+        mesh.clear();
+        _stats = Stats();
+        if (axis_length < 2) {
+            return;
+        }
+
+        // Extraction holds four slices, each sampler can be up to two
+        // ahead of it
+        const auto num_samplers = int(_pool->size());
+        auto slices = 8;
+        while (slices < 4 + 2 * num_samplers) {
+            slices *= 2;
+        }
+        _ring.resize(axis_length, slices);
+        _ring.offset = origin;
+        _next_slice = 0;
+        _sampled = 0;
+        _released = 0;
+        _finished.assign(std::size_t(slices), -1);
+        _sample_ms = 0.0;
+
+        // Slice s goes to its ring slot, evaluate is asked for that slot with
+        // the origin moved so the sample positions are those of slice s.
+        // Slices finish out of order, _sampled only counts the ones in order.
+        auto sample = [this, &graph, origin, axis_length] {
+            auto sample_ms = 0.0;
+            while (true) {
+                auto s = 0;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    if (_next_slice == axis_length) {
+                        break;
+                    }
+                    s = _next_slice++;
+                    _released_changed.wait(lock, [&] { return s - _released < _ring.num_slices; });
+                }
+
+                auto slice_start = std::chrono::high_resolution_clock::now();
+                auto slot = _ring.slot(s);
+                density_graph::evaluate(graph, origin + glm::ivec3(s - slot, 0, 0), axis_length, slot, slot + 1, _ring.values.data());
+                auto slice_end = std::chrono::high_resolution_clock::now();
+                sample_ms += std::chrono::duration<double, std::milli>(slice_end - slice_start).count();
+
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    _finished[slot] = s;
+                    while (_sampled < axis_length && _finished[_ring.slot(_sampled)] == _sampled) {
+                        _sampled++;
+                    }
+                }
+                _sampled_changed.notify_one();
+            }
+
+            std::lock_guard<std::mutex> lock(_mutex);
+            _sample_ms += sample_ms;
+        };
+        auto samplers = std::vector<std::future<void>>();
+        for (auto sampler = 0; sampler < num_samplers; sampler++) {
+            samplers.push_back(_pool->submit(sample));
+        }
+
+        // Slab x reads slices x - 1 to x + 2, the normals one either side
+        _extractor.begin_slabs(axis_length, mesh);
+        for (auto x = 0; x < axis_length - 1; x++) {
+            auto needed = std::min(x + 3, axis_length);
+            auto wait_start = std::chrono::high_resolution_clock::now();
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _sampled_changed.wait(lock, [&] { return _sampled >= needed; });
+            }
+            auto wait_end = std::chrono::high_resolution_clock::now();
+            _stats.wait_ms += std::chrono::duration<double, std::milli>(wait_end - wait_start).count();
+
+            _extractor.extract_slab(_ring, iso_level, x, mesh);
+            auto extract_end = std::chrono::high_resolution_clock::now();
+            _stats.extract_ms += std::chrono::duration<double, std::milli>(extract_end - wait_end).count();
+
+            // The next slab starts at slice x
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _released = x;
+            }
+            _released_changed.notify_all();
+        }
+        for (auto& sampler : samplers) {
+            sampler.get();
+        }
+        _stats.sample_ms = _sample_ms;
+
+        auto end = std::chrono::high_resolution_clock::now();
+        _stats.total_ms = std::chrono::duration<double, std::milli>(end - start).count();
+        _stats.working_bytes = _ring.values.size() * sizeof(float) +
+            std::size_t(2) * axis_length * axis_length * 3 * sizeof(uint32_t);
+    }
+
+    const Stats& stats() const {
+        return _stats;
+    }
+
+private:
+    ThreadPool* _pool;
+    MarchingCubesExtractor _extractor;
+    SliceRing _ring;
+    Stats _stats;
+
+    // Slices [0, _sampled) have been written, slots of slices below
+    // _released may be written over. _finished holds the slice last
+    // written to each slot.
+    std::mutex _mutex;
+    std::condition_variable _sampled_changed;
+    std::condition_variable _released_changed;
+    int _next_slice = 0;
+    int _sampled = 0;
+    int _released = 0;
+    std::vector<int> _finished;
+    double _sample_ms = 0.0;
+};
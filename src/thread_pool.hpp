@@ -0,0 +1,147 @@
+#pragma once
+
+// ThreadPool.hpp
+//
+// Description: Fixed size pool of worker threads with a shared job queue and
+// a blocking parallel_for helper
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <string>
+#include <vector>
+
+#include "trace.hpp"
+
+class ThreadPool {
+public:
+    explicit ThreadPool(std::size_t num_threads = std::max(1u, std::thread::hardware_concurrency()))
+    {
+        _workers.reserve(num_threads);
+        for (auto index = 0u; index < num_threads; index++) {
+            _workers.emplace_back([this, index] {
+                TRACE_THREAD_NAME("worker " + std::to_string(index));
+                worker_loop();
+            });
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _condition.notify_all();
+
+        for (auto& worker : _workers) {
+            worker.join();
+        }
+    }
+
+    std::size_t size() const {
+        return _workers.size();
+    }
+
+    template <typename Func>
+    std::future<void> submit(Func&& func) {
+        auto task = std::make_shared<std::packaged_task<void()>>(std::forward<Func>(func));
+        auto future = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _jobs.emplace([task] { (*task)(); });
+        }
+        _condition.notify_one();
+        return future;
+    }
+
+    // Calls func(index) for every index in [0, count) and blocks until all are done.
+    // The calling thread takes part and never waits on queued jobs, so calling
+    // this from inside a worker cannot deadlock. If func throws, the indices not
+    // yet started are skipped and the first exception is rethrown here.
+    template <typename Func>
+    void parallel_for(std::size_t count, Func&& func) {
+        if (count == 0) {
+            return;
+        }
+
+        struct State {
+            std::atomic<std::size_t> next { 0 };
+            std::atomic<std::size_t> done { 0 };
+            std::atomic<bool> failed { false };
+            std::mutex error_mutex;
+            std::exception_ptr error;
+        };
+
+        // Helpers that start after every index is claimed return without touching func.
+        // A thrown index still counts as done, or the caller would wait forever.
+        auto state = std::make_shared<State>();
+        auto run = [state, count, &func] {
+            TRACE_ZONE("parallel_for");
+            for (auto index = state->next.fetch_add(1); index < count; index = state->next.fetch_add(1)) {
+                if (!state->failed.load(std::memory_order_relaxed)) {
+                    try {
+                        func(index);
+                    } catch (...) {
+                        std::lock_guard<std::mutex> lock(state->error_mutex);
+                        if (!state->error) {
+                            state->error = std::current_exception();
+                        }
+                        state->failed.store(true, std::memory_order_relaxed);
+                    }
+                }
+                state->done.fetch_add(1, std::memory_order_release);
+            }
+        };
+
+        auto helpers = std::min(count - 1, _workers.size());
+        for (auto helper = 0u; helper < helpers; helper++) {
+            submit(run);
+        }
+
+        run();
+
+        while (state->done.load(std::memory_order_acquire) < count) {
+            std::this_thread::yield();
+        }
+
+        if (state->error) {
+            std::rethrow_exception(state->error);
+        }
+    }
+
+private:
+    void worker_loop() {
+        while (true) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _condition.wait(lock, [this] { return _stopping || !_jobs.empty(); });
+
+                if (_stopping && _jobs.empty()) {
+                    return;
+                }
+
+                job = std::move(_jobs.front());
+                _jobs.pop();
+            }
+
+            job();
+        }
+    }
+
+    std::vector<std::thread> _workers;
+    std::queue<std::function<void()>> _jobs;
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    bool _stopping = false;
+};
@@ -0,0 +1,179 @@
+#pragma once
+
+// Trace.hpp
+//
+// Description: Scoped zone and counter tracing that writes Chrome trace-event
+// JSON (load it in chrome://tracing or ui.perfetto.dev). Every thread records
+// into its own fixed size ring buffer so the hot path never takes a lock.
+// Configure with -DENABLE_TRACING=ON, otherwise the macros compile to nothing.
+//
+// Zone and counter names must be string literals, only the pointer is stored.
+
+#if MC_TRACING
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Trace {
+
+    constexpr std::size_t RING_CAPACITY = 1 << 16;
+
+    enum class EventType : uint8_t {
+        ZONE,
+        COUNTER
+    };
+
+    struct Event {
+        const char* name;
+        uint64_t timestamp_ns;
+        uint64_t duration_ns;
+        double value;
+        EventType type;
+    };
+
+    inline uint64_t now_ns() {
+        static const auto start = std::chrono::steady_clock::now();
+        return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count());
+    }
+
+    // Only the owning thread writes, the oldest events are overwritten when full
+    struct ThreadBuffer {
+        explicit ThreadBuffer(uint32_t t_thread_id)
+        : thread_id(t_thread_id), name("thread " + std::to_string(t_thread_id)), events(RING_CAPACITY)
+        {
+        }
+
+        void push(const Event& event) {
+            auto index = written.load(std::memory_order_relaxed);
+            events[index % RING_CAPACITY] = event;
+            written.store(index + 1, std::memory_order_release);
+        }
+
+        uint32_t thread_id;
+        std::string name;
+        std::vector<Event> events;
+        std::atomic<uint64_t> written { 0 };
+    };
+
+    class Registry {
+    public:
+        static Registry& instance() {
+            static Registry registry;
+            return registry;
+        }
+
+        // Buffers live as long as the registry so events survive their thread exiting
+        ThreadBuffer& local() {
+            thread_local ThreadBuffer* buffer = nullptr;
+            if (!buffer) {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _buffers.push_back(std::make_unique<ThreadBuffer>(uint32_t(_buffers.size() + 1)));
+                buffer = _buffers.back().get();
+            }
+            return *buffer;
+        }
+
+        void set_thread_name(const std::string& name) {
+            auto& buffer = local();
+            std::lock_guard<std::mutex> lock(_mutex);
+            buffer.name = name;
+        }
+
+        // Best taken while the traced threads are idle, e.g. at shutdown
+        void write_chrome_json(const std::string& path) {
+            std::lock_guard<std::mutex> lock(_mutex);
+
+            std::ofstream file(path);
+            file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+            auto first = true;
+            auto separator = [&file, &first] {
+                if (!first) {
+                    file << ",\n";
+                }
+                first = false;
+            };
+
+            for (const auto& buffer : _buffers) {
+                separator();
+                file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->thread_id
+                     << ",\"args\":{\"name\":\"" << escape(buffer->name) << "\"}}";
+
+                auto written = buffer->written.load(std::memory_order_acquire);
+                auto begin = written > RING_CAPACITY ? written - RING_CAPACITY : 0;
+                for (auto index = begin; index < written; index++) {
+                    const auto& event = buffer->events[index % RING_CAPACITY];
+
+                    separator();
+                    file << "{\"name\":\"" << escape(event.name) << "\",\"pid\":1,\"tid\":" << buffer->thread_id
+                         << ",\"ts\":" << event.timestamp_ns / 1000.0;
+
+                    if (event.type == EventType::ZONE) {
+                        file << ",\"ph\":\"X\",\"dur\":" << event.duration_ns / 1000.0 << "}";
+                    } else {
+                        file << ",\"ph\":\"C\",\"args\":{\"value\":" << event.value << "}}";
+                    }
+                }
+            }
+
+            file << "\n]}\n";
+        }
+
+    private:
+        static std::string escape(const std::string& text) {
+            std::string result;
+            for (auto character : text) {
+                if (character == '"' || character == '\\') {
+                    result += '\\';
+                }
+                result += character;
+            }
+            return result;
+        }
+
+        std::mutex _mutex;
+        std::vector<std::unique_ptr<ThreadBuffer>> _buffers;
+    };
+
+    class ScopedZone {
+    public:
+        explicit ScopedZone(const char* name) : _name(name), _begin(now_ns()) {}
+
+        ~ScopedZone() {
+            auto end = now_ns();
+            Registry::instance().local().push(Event { _name, _begin, end - _begin, 0.0, EventType::ZONE });
+        }
+
+    private:
+        const char* _name;
+        uint64_t _begin;
+    };
+
+    inline void counter(const char* name, double value) {
+        Registry::instance().local().push(Event { name, now_ns(), 0, value, EventType::COUNTER });
+    }
+}
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+#define TRACE_ZONE(name) Trace::ScopedZone TRACE_CONCAT(_trace_zone_, __LINE__)(name)
+#define TRACE_COUNTER(name, value) Trace::counter(name, double(value))
+#define TRACE_THREAD_NAME(name) Trace::Registry::instance().set_thread_name(name)
+#define TRACE_WRITE(path) Trace::Registry::instance().write_chrome_json(path)
+
+#else
+
+#define TRACE_ZONE(name)
+#define TRACE_COUNTER(name, value)
+#define TRACE_THREAD_NAME(name)
+#define TRACE_WRITE(path)
+
+#endif
@@ -122,6 +122,18 @@ float Window::get_elapsed_time() {
     return static_cast<float>(glfwGetTime());
 }
 
+void Window::set_visible(bool visible) {
+    if (visible) {
+        glfwShowWindow(_window);
+    } else {
+        glfwHideWindow(_window);
+    }
+}
+
+void Window::set_swap_interval(int interval) {
+    glfwSwapInterval(interval);
+}
+
 void Window::set_mouse_callback(GLFWmousebuttonfun mouse_btn_func, GLFWcursorposfun mouse_pos_func) {
     if(mouse_btn_func) {
         glfwSetMouseButtonCallback(_window, mouse_btn_func);
@@ -172,6 +172,9 @@ public:
     void poll_events();
     void swap_and_poll();
     float get_elapsed_time();
+    void set_visible(bool visible);
+    // 0 swaps without waiting for vertical sync
+    void set_swap_interval(int interval);
 
     void get_dimensions(int& width, int& height)
     {
@@ -1,6 +1,11 @@
 ﻿#pragma once
 
+#include <array>
+#include <cassert>
+#include <cstdint>
 #include <cstring>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <glad/glad.h>
@@ -15,6 +20,7 @@ enum class VertexDataType {
 enum class BufferIntent {
     READ = GL_READ_ONLY,
     WRITE = GL_WRITE_ONLY,
+    READ_WRITE = GL_READ_WRITE,
 };
 
 enum class BufferIntentRange {
@@ -29,20 +35,213 @@ enum class VertexBufferType {
 
 enum class StorageType {
     STATIC = GL_STATIC_DRAW,
-    DYNAMIC = GL_DYNAMIC_DRAW
+    DYNAMIC = GL_DYNAMIC_DRAW,
+    // Replaced every frame
+    STREAM = GL_STREAM_DRAW
 };
 
+// Every GL buffer and texture below records its size against a category
+// and, for chunk resources, the chunk that owns it. CPU state that grows with
+// the world is recorded the same way through MemoryRecord.
+enum class MemoryCategory : int {
+    COMPUTE_BUFFERS = 0,
+    MESH_ARENA,
+    // Arena triangles held by chunks, a part of MESH_ARENA rather than extra
+    CHUNK_MESHES,
+    CHUNK_POINTS,
+    SHADOW_MAPS,
+    OTHER_GPU,
+    CHUNK_STATE,
+    EXTRACTION,
+    DENSITY_CACHE,
+    COUNT
+};
+
+constexpr auto NUM_MEMORY_CATEGORIES = std::size_t(MemoryCategory::COUNT);
+
+inline const char* memory_category_name(MemoryCategory category) {
+    static const char* names[NUM_MEMORY_CATEGORIES] = {
+        "compute buffers", "mesh arena", "chunk meshes", "chunk points",
+        "shadow maps", "other GPU", "chunk state", "CPU extraction", "density cache"
+    };
+    return names[std::size_t(category)];
+}
+
+inline bool memory_category_is_gpu(MemoryCategory category) {
+    return category < MemoryCategory::CHUNK_STATE;
+}
+
+constexpr uint32_t NO_MEMORY_OWNER = ~0u;
+
+struct MemoryTag {
+    MemoryCategory category = MemoryCategory::OTHER_GPU;
+    uint32_t owner = NO_MEMORY_OWNER;
+};
+
+struct MemoryStats {
+    // What is actually allocated
+    std::size_t gpu_bytes;
+    std::size_t cpu_bytes;
+    // GPU bytes with the mesh arena counted by what chunks use rather than
+    // its capacity, evicting a chunk frees arena space but never shrinks it
+    std::size_t resident_gpu_bytes;
+    std::array<std::size_t, NUM_MEMORY_CATEGORIES> by_category;
+};
+
+struct OwnerMemory {
+    std::size_t gpu_bytes = 0;
+    std::size_t cpu_bytes = 0;
+};
+
+// Render thread only, like the GL calls that feed it
+class MemoryAccounting {
+public:
+    static MemoryAccounting& instance() {
+        static MemoryAccounting accounting;
+        return accounting;
+    }
+
+    void add(MemoryTag tag, std::size_t bytes) {
+        if (bytes == 0) {
+            return;
+        }
+        _by_category[std::size_t(tag.category)] += bytes;
+        if (tag.owner != NO_MEMORY_OWNER) {
+            auto& owner = _owners[tag.owner];
+            (memory_category_is_gpu(tag.category) ? owner.gpu_bytes : owner.cpu_bytes) += bytes;
+        }
+    }
+
+    void remove(MemoryTag tag, std::size_t bytes) {
+        if (bytes == 0) {
+            return;
+        }
+        _by_category[std::size_t(tag.category)] -= bytes;
+        if (tag.owner != NO_MEMORY_OWNER) {
+            // Bytes an owner never added are a bookkeeping bug
+            auto found = _owners.find(tag.owner);
+            assert(found != _owners.end());
+            if (found == _owners.end()) {
+                return;
+            }
+            (memory_category_is_gpu(tag.category) ? found->second.gpu_bytes : found->second.cpu_bytes) -= bytes;
+            if (found->second.gpu_bytes == 0 && found->second.cpu_bytes == 0) {
+                _owners.erase(found);
+            }
+        }
+    }
+
+    MemoryStats stats() const {
+        auto stats = MemoryStats { 0, 0, 0, _by_category };
+        for (auto category = std::size_t(0); category < NUM_MEMORY_CATEGORIES; category++) {
+            if (MemoryCategory(category) == MemoryCategory::CHUNK_MESHES) {
+                continue;
+            }
+            (memory_category_is_gpu(MemoryCategory(category)) ? stats.gpu_bytes : stats.cpu_bytes) += _by_category[category];
+        }
+        stats.resident_gpu_bytes = stats.gpu_bytes
+            - _by_category[std::size_t(MemoryCategory::MESH_ARENA)]
+            + _by_category[std::size_t(MemoryCategory::CHUNK_MESHES)];
+        return stats;
+    }
+
+    // Everything recorded against one chunk, arena triangles included
+    OwnerMemory owner(uint32_t owner) const {
+        auto found = _owners.find(owner);
+        return found == _owners.end() ? OwnerMemory() : found->second;
+    }
+
+    const std::unordered_map<uint32_t, OwnerMemory>& owners() const {
+        return _owners;
+    }
+
+private:
+    std::array<std::size_t, NUM_MEMORY_CATEGORIES> _by_category {};
+    std::unordered_map<uint32_t, OwnerMemory> _owners;
+};
+
+// Bytes currently recorded against one tag, given back on destruction
+class MemoryRecord {
+public:
+    explicit MemoryRecord(MemoryTag tag = MemoryTag()) : _tag(tag), _bytes(0) {}
+
+    MemoryRecord(MemoryRecord&& other) noexcept
+        : _tag(other._tag), _bytes(std::exchange(other._bytes, 0))
+    {
+    }
+
+    MemoryRecord& operator=(MemoryRecord&& other) noexcept {
+        if (this != &other) {
+            set(0);
+            _tag = other._tag;
+            _bytes = std::exchange(other._bytes, 0);
+        }
+        return *this;
+    }
+
+    MemoryRecord(const MemoryRecord&) = delete;
+    MemoryRecord& operator=(const MemoryRecord&) = delete;
+
+    ~MemoryRecord() {
+        set(0);
+    }
+
+    void set(std::size_t bytes) {
+        auto& accounting = MemoryAccounting::instance();
+        accounting.remove(_tag, _bytes);
+        accounting.add(_tag, bytes);
+        _bytes = bytes;
+    }
+
+    // Moves the recorded bytes over to a new category or owner
+    void retag(MemoryTag tag) {
+        auto bytes = _bytes;
+        set(0);
+        _tag = tag;
+        set(bytes);
+    }
+
+    std::size_t bytes() const {
+        return _bytes;
+    }
+
+private:
+    MemoryTag _tag;
+    std::size_t _bytes;
+};
+
+// Bytes per pixel of an uploaded format and type, close enough to what
+// drivers allocate for the formats used here
+inline std::size_t pixel_bytes(GLenum format, GLenum type) {
+    auto components = 4;
+    switch (format) {
+        case GL_RED: case GL_RED_INTEGER: case GL_DEPTH_COMPONENT: components = 1; break;
+        case GL_RG: case GL_RG_INTEGER: components = 2; break;
+        case GL_RGB: case GL_RGB_INTEGER: components = 3; break;
+        default: break;
+    }
+
+    auto component_bytes = 4;
+    switch (type) {
+        case GL_UNSIGNED_BYTE: case GL_BYTE: component_bytes = 1; break;
+        case GL_UNSIGNED_SHORT: case GL_SHORT: case GL_HALF_FLOAT: component_bytes = 2; break;
+        default: break;
+    }
+
+    return std::size_t(components) * component_bytes;
+}
+
 // Note: Only supports one atomic integer at the moment
 struct AtomicBufferObject {
     using InternalStorageType = GLuint;
     constexpr static auto InternalBufferType = GL_ATOMIC_COUNTER_BUFFER;
 
-    explicit AtomicBufferObject(GLuint index) : _asb(0u), _index(index) {
+    explicit AtomicBufferObject(GLuint index) : _asb(0u), _index(index), _memory(MemoryTag { MemoryCategory::COMPUTE_BUFFERS }) {
         GL_CHECK(glGenBuffers(1, &_asb));
     }
 
     explicit AtomicBufferObject(AtomicBufferObject&& other) noexcept
-        : _asb(other._asb), _index(other._index)
+        : _asb(other._asb), _index(other._index), _memory(std::move(other._memory))
     {
         other._asb = 0;
         other._index = 0;
@@ -55,13 +254,15 @@ struct AtomicBufferObject {
     void clear()
     {
         uint32_t clear = 0;
-        GL_CHECK(glInvalidateBufferData(GL_ATOMIC_COUNTER_BUFFER));
-        GL_CHECK(glClearBufferData(GL_ATOMIC_COUNTER_BUFFER, GL_R32UI, GL_RED, GL_UNSIGNED_INT, &clear));
+        GL_CHECK(glBindBufferBase(InternalBufferType, _index, _asb));
+        GL_CHECK(glInvalidateBufferData(_asb));
+        GL_CHECK(glClearBufferData(GL_ATOMIC_COUNTER_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &clear));
     }
 
     InternalStorageType read()
     {
         uint32_t value = 0;
+        GL_CHECK(glBindBufferBase(InternalBufferType, _index, _asb));
         GL_CHECK(glGetBufferSubData(GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(uint32_t), &value));
         return value;
     }
@@ -72,6 +273,7 @@ struct AtomicBufferObject {
         GL_CHECK(glBindBufferBase(InternalBufferType, _index, _asb));
         GL_CHECK(glBufferData(InternalBufferType, size, nullptr, static_cast<GLenum>(type)));
         _size = size;
+        _memory.set(size);
     }
 
     // TODO: Create MapBufferRange which lets you specify exact bytes to map
@@ -79,6 +281,7 @@ struct AtomicBufferObject {
     InternalStorageType _asb;
     GLuint _size;
     GLuint _index;
+    MemoryRecord _memory;
 };
 
 template<typename Internal>
@@ -86,12 +289,12 @@ struct ShaderStorageBuffer {
     using InternalStorageType = GLuint;
     constexpr static auto InternalBufferType = GL_SHADER_STORAGE_BUFFER;
 
-    explicit ShaderStorageBuffer(GLuint index) : _ssb(0u), _index(index) {
+    explicit ShaderStorageBuffer(GLuint index) : _ssb(0u), _index(index), _memory(MemoryTag { MemoryCategory::COMPUTE_BUFFERS }) {
         GL_CHECK(glGenBuffers(1, &_ssb));
     }
 
     explicit ShaderStorageBuffer(ShaderStorageBuffer&& other) 
-        : _ssb(other._ssb), _index(other._index)
+        : _ssb(other._ssb), _index(other._index), _memory(std::move(other._memory))
     {
         other._ssb = 0;
         other._index = 0;
@@ -117,6 +320,11 @@ struct ShaderStorageBuffer {
         GL_CHECK(glBindBufferBase(InternalBufferType, _index, _ssb));
         GL_CHECK(glBufferData(InternalBufferType, size, nullptr, static_cast<GLenum>(type)));
         _size = size;
+        _memory.set(size);
+    }
+
+    void track_memory(MemoryTag tag) {
+        _memory.retag(tag);
     }
 
     Internal *map_buffer(BufferIntent intent) const
@@ -153,6 +361,94 @@ struct ShaderStorageBuffer {
     InternalStorageType _ssb;
     GLuint _size;
     GLuint _index;
+    MemoryRecord _memory;
+};
+
+// Staging buffer for copies from the GPU that are read later. The copies are
+// followed by a fence, ready tells without blocking whether they landed.
+struct ReadbackBuffer {
+    ReadbackBuffer() : _buffer(0u), _size(0), _fence(nullptr), _memory(MemoryTag { MemoryCategory::COMPUTE_BUFFERS }) {
+        GL_CHECK(glGenBuffers(1, &_buffer));
+    }
+
+    ReadbackBuffer(const ReadbackBuffer&) = delete;
+    ReadbackBuffer& operator=(const ReadbackBuffer&) = delete;
+
+    ~ReadbackBuffer() {
+        if (_fence) {
+            glDeleteSync(_fence);
+        }
+        glDeleteBuffers(1, &_buffer);
+    }
+
+    // Grows to at least size bytes, contents are lost when it does
+    void reserve(GLsizeiptr size) {
+        if (size <= _size) {
+            return;
+        }
+        GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, _buffer));
+        GL_CHECK(glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, GL_STREAM_READ));
+        GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+        _size = size;
+        _memory.set(std::size_t(size));
+    }
+
+    template<typename ShaderType>
+    void copy_from_ssbo(const ShaderStorageBuffer<ShaderType>& ssbo, GLintptr read_offset, GLintptr write_offset, GLsizeiptr size) const {
+        GL_CHECK(glBindBuffer(GL_COPY_READ_BUFFER, ssbo._ssb));
+        GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, _buffer));
+        GL_CHECK(glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, read_offset, write_offset, size));
+        GL_CHECK(glBindBuffer(GL_COPY_READ_BUFFER, 0));
+        GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+    }
+
+    // From any buffer object, like a vertex buffer
+    void copy_from_buffer(GLuint buffer, GLintptr read_offset, GLintptr write_offset, GLsizeiptr size) const {
+        GL_CHECK(glBindBuffer(GL_COPY_READ_BUFFER, buffer));
+        GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, _buffer));
+        GL_CHECK(glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, read_offset, write_offset, size));
+        GL_CHECK(glBindBuffer(GL_COPY_READ_BUFFER, 0));
+        GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+    }
+
+    // Call after the last copy
+    void fence() {
+        if (_fence) {
+            glDeleteSync(_fence);
+        }
+        _fence = GL_CHECK(glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+    }
+
+    bool ready() const {
+        if (!_fence) {
+            return true;
+        }
+        auto status = GL_CHECK(glClientWaitSync(_fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0));
+        return status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED;
+    }
+
+    // Blocks until the copies have landed
+    void wait() const {
+        if (_fence) {
+            GL_CHECK(glClientWaitSync(_fence, GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1000000000)));
+        }
+    }
+
+    const void* map(GLsizeiptr size) const {
+        GL_CHECK(glBindBuffer(GL_COPY_READ_BUFFER, _buffer));
+        const auto* data = GL_CHECK(glMapBufferRange(GL_COPY_READ_BUFFER, 0, size, GL_MAP_READ_BIT));
+        return data;
+    }
+
+    void unmap() const {
+        GL_CHECK(glUnmapBuffer(GL_COPY_READ_BUFFER));
+        GL_CHECK(glBindBuffer(GL_COPY_READ_BUFFER, 0));
+    }
+
+    GLuint _buffer;
+    GLsizeiptr _size;
+    GLsync _fence;
+    MemoryRecord _memory;
 };
 
 struct VertexArrayObject {
@@ -191,7 +487,7 @@ struct VertexBufferObject {
     }
 
     explicit VertexBufferObject(VertexBufferObject&& other) 
-        : vbo(other.vbo), type(other.type)
+        : vbo(other.vbo), type(other.type), _memory(std::move(other._memory))
     {
         other.vbo = 0;
     }
@@ -220,17 +516,24 @@ struct VertexBufferObject {
     }
 
     template<typename Type>
-    void send_data(const std::vector<Type> &data, const StorageType draw_type) const {
+    void send_data(const std::vector<Type> &data, const StorageType draw_type) {
         GL_CHECK(glBufferData(static_cast<GLenum>(type), sizeof(Type) * data.size(), &data[0], static_cast<GLenum>(draw_type)));
+        _memory.set(sizeof(Type) * data.size());
     }
 
     template <typename Type, std::size_t Size>
-    void send_data(const Type (&data)[Size], const StorageType draw_type) const {
+    void send_data(const Type (&data)[Size], const StorageType draw_type) {
         GL_CHECK(glBufferData(static_cast<GLenum>(type), Size * sizeof(data[0]), &data[0], static_cast<GLenum>(draw_type)));
+        _memory.set(Size * sizeof(data[0]));
     }
 
-    void send_data_raw(const void* data, GLsizei size, const StorageType draw_type) const {
+    void send_data_raw(const void* data, GLsizeiptr size, const StorageType draw_type) {
         GL_CHECK(glBufferData(static_cast<GLenum>(type), size, data, static_cast<GLenum>(draw_type)));
+        _memory.set(std::size_t(size));
+    }
+
+    void track_memory(MemoryTag tag) {
+        _memory.retag(tag);
     }
 
     template<typename Type>
@@ -244,21 +547,43 @@ struct VertexBufferObject {
         GL_CHECK(glBufferSubData(static_cast<GLenum>(type), offset, size, data));
     }
 
+    void get_sub_data(void* data, uint32_t offset, uint32_t size) const {
+        GL_CHECK(glGetBufferSubData(static_cast<GLenum>(type), offset, size, data));
+    }
+
     template<typename ShaderType>
-    void copy_from_ssbo(const ShaderStorageBuffer<ShaderType>& ssbo, uint32_t size) {
+    void copy_from_ssbo(const ShaderStorageBuffer<ShaderType>& ssbo, uint32_t size, GLintptr write_offset = 0, GLintptr read_offset = 0) {
         bind();
         ssbo.bind();
-        glCopyBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_ARRAY_BUFFER, 0, 0, size);
+        glCopyBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_ARRAY_BUFFER, read_offset, write_offset, size);
         unbind();
         ssbo.unbind();
     }
 
+    // Copies between two non-overlapping ranges of this buffer
+    void copy_within(GLintptr read_offset, GLintptr write_offset, GLsizeiptr size) const {
+        GL_CHECK(glBindBuffer(GL_COPY_READ_BUFFER, vbo));
+        GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, vbo));
+        GL_CHECK(glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, read_offset, write_offset, size));
+        GL_CHECK(glBindBuffer(GL_COPY_READ_BUFFER, 0));
+        GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+    }
+
+    void copy_to(const VertexBufferObject& other, GLsizeiptr size) const {
+        GL_CHECK(glBindBuffer(GL_COPY_READ_BUFFER, vbo));
+        GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, other.vbo));
+        GL_CHECK(glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, size));
+        GL_CHECK(glBindBuffer(GL_COPY_READ_BUFFER, 0));
+        GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+    }
+
     void unbind() const {
         GL_CHECK(glBindBuffer(static_cast<GLenum>(type), 0));
     }
 
     VboInner vbo;
     const VertexBufferType type;
+    MemoryRecord _memory;
 };
 
 struct Texture2D {
@@ -267,6 +592,16 @@ struct Texture2D {
         GL_CHECK(glGenTextures(1, &_texture));
     }
 
+    explicit Texture2D(Texture2D&& other) noexcept
+        : _texture(other._texture), _memory(std::move(other._memory))
+    {
+        other._texture = 0;
+    }
+
+    ~Texture2D() {
+        glDeleteTextures(1, &_texture);
+    }
+
     const GLuint get_id() const
     {
         return _texture;
@@ -282,6 +617,11 @@ struct Texture2D {
     )
     {
         GL_CHECK(glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format, type, nullptr));
+        _memory.set(std::size_t(width) * height * pixel_bytes(format, type));
+    }
+
+    void track_memory(MemoryTag tag) {
+        _memory.retag(tag);
     }
 
     void set_parameteri(GLenum parameter, GLint value)
@@ -295,6 +635,7 @@ struct Texture2D {
     }
 
     GLuint _texture;
+    MemoryRecord _memory;
 };
 
 struct FramebufferObject {
@@ -340,3 +681,68 @@ private:
 
     GLuint _fbo;
 };
+
+// GPU time of whole frames from GL_TIME_ELAPSED queries. Results are read a
+// few frames after the frame they measured so the CPU never waits on them,
+// frames whose query is still in use when the ring wraps are not timed.
+struct FrameTimerQueries {
+    static constexpr std::size_t RING_SIZE = 4;
+
+    FrameTimerQueries() {
+        GL_CHECK(glGenQueries(GLsizei(RING_SIZE), _queries.data()));
+        _frames.fill(NO_FRAME);
+    }
+
+    FrameTimerQueries(const FrameTimerQueries&) = delete;
+    FrameTimerQueries& operator=(const FrameTimerQueries&) = delete;
+
+    ~FrameTimerQueries() {
+        glDeleteQueries(GLsizei(RING_SIZE), _queries.data());
+    }
+
+    void begin(std::size_t frame) {
+        _slot = frame % RING_SIZE;
+        _timing = _frames[_slot] == NO_FRAME;
+        if (_timing) {
+            GL_CHECK(glBeginQuery(GL_TIME_ELAPSED, _queries[_slot]));
+            _frames[_slot] = frame;
+        }
+    }
+
+    void end() {
+        if (_timing) {
+            GL_CHECK(glEndQuery(GL_TIME_ELAPSED));
+            _timing = false;
+        }
+    }
+
+    // Calls done(frame, ms) for every query whose result has arrived, with
+    // wait it blocks until all of them have
+    template<typename Done>
+    void collect(Done done, bool wait = false) {
+        for (auto slot = std::size_t(0); slot < RING_SIZE; slot++) {
+            if (_frames[slot] == NO_FRAME || (_timing && slot == _slot)) {
+                continue;
+            }
+
+            auto available = GLint(GL_FALSE);
+            GL_CHECK(glGetQueryObjectiv(_queries[slot], GL_QUERY_RESULT_AVAILABLE, &available));
+            if (!available && !wait) {
+                continue;
+            }
+
+            auto nanoseconds = GLuint64(0);
+            GL_CHECK(glGetQueryObjectui64v(_queries[slot], GL_QUERY_RESULT, &nanoseconds));
+            done(_frames[slot], double(nanoseconds) / 1.0e6);
+            _frames[slot] = NO_FRAME;
+        }
+    }
+
+private:
+    static constexpr std::size_t NO_FRAME = ~std::size_t(0);
+
+    std::array<GLuint, RING_SIZE> _queries;
+    std::array<std::size_t, RING_SIZE> _frames;
+    std::size_t _slot = 0;
+    bool _timing = false;
+};
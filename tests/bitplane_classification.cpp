@@ -0,0 +1,92 @@
+// Bitplane classification test
+//
+// Description: Classifies random grids on sign bitplanes and one corner at a
+// time and checks both find the same active cells with the same cube
+// indices. The lengths sit either side of the 64 bit word boundaries, where
+// the shifted corners carry between words, and a quarter of the samples are
+// exactly the iso level.
+
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "bitplanes.hpp"
+#include "density.hpp"
+#include "marching_cubes_tables.hpp"
+
+namespace {
+    constexpr int LENGTHS[] = { 2, 3, 63, 64, 65, 66, 127, 128, 129, 130 };
+    constexpr auto ISO_LEVEL = 1.0f;
+
+    struct Cell {
+        int z;
+        int cube_index;
+    };
+
+    int scalar_cube_index(const DensityGrid& grid, int x, int y, int z) {
+        auto cube_index = 0;
+        for (auto corner = 0; corner < 8; corner++) {
+            const auto* c = CORNER_OFFSETS[corner];
+            if (grid.at(x + c[0], y + c[1], z + c[2]) < ISO_LEVEL) {
+                cube_index |= 1 << corner;
+            }
+        }
+        return cube_index;
+    }
+}
+
+int main() {
+    auto random = std::mt19937(7);
+    auto density = std::uniform_real_distribution<float>(0.0f, 2.0f);
+    auto failures = 0;
+    auto checked = std::size_t(0);
+
+    for (auto length : LENGTHS) {
+        // Mostly one side, so whole words drop out as in real terrain
+        auto grid = DensityGrid();
+        grid.resize(length);
+        for (auto& value : grid.values) {
+            auto pick = random() % 8;
+            value = pick < 2 ? ISO_LEVEL : pick < 6 ? 1.5f : density(random);
+        }
+
+        SignPlane planes[2];
+        planes[0].resize(length);
+        planes[1].resize(length);
+        planes[0].threshold(grid, 0, ISO_LEVEL);
+        auto cells = std::vector<Cell>();
+        for (auto x = 0; x < length - 1; x++) {
+            planes[(x + 1) & 1].threshold(grid, x + 1, ISO_LEVEL);
+            for (auto y = 0; y < length - 1; y++) {
+                cells.clear();
+                for_each_active_cell(planes[x & 1], planes[(x + 1) & 1], y, [&](int z, int cube_index) {
+                    cells.push_back(Cell { z, cube_index });
+                });
+
+                auto next = std::size_t(0);
+                for (auto z = 0; z < length - 1; z++) {
+                    auto expected = scalar_cube_index(grid, x, y, z);
+                    auto active = expected != 0 && expected != 255;
+                    auto found = next < cells.size() && cells[next].z == z;
+                    if (active != found || (found && cells[next].cube_index != expected)) {
+                        if (failures < 10) {
+                            std::printf("length %d cell %d %d %d: expected index %d, bitplanes %s %d\n", length, x, y, z,
+                                expected, found ? "gave" : "skipped", found ? cells[next].cube_index : 0);
+                        }
+                        failures++;
+                    }
+                    next += found;
+                    checked++;
+                }
+                if (next != cells.size()) {
+                    std::printf("length %d row %d %d: %zu cells visited past the end or out of order\n", length, x, y, cells.size() - next);
+                    failures++;
+                }
+            }
+        }
+    }
+
+    std::printf("%zu cells, %d failures\n", checked, failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,178 @@
+// Density GLSL test
+//
+// Description: Generates the terrain graph's GLSL, splices it into the stage 1
+// source the way MarchingCubesCompute::set_density_function does and checks
+// the result holds together: brackets balance outside comments, the
+// handwritten procedural_density is gone and every function the generated
+// code calls is defined in the spliced source or built into GLSL. The spliced
+// source is written out for density_glsl_gl, which compiles it with the
+// OpenGL driver.
+
+#include <cctype>
+#include <cstdio>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "density.hpp"
+
+namespace {
+    // Source without comments, which hold unbalanced brackets and stray names
+    std::string strip_comments(const std::string& source) {
+        auto code = std::string();
+        for (auto i = std::size_t(0); i < source.size(); i++) {
+            if (source.compare(i, 2, "//") == 0) {
+                i = source.find('\n', i);
+                if (i == std::string::npos) {
+                    break;
+                }
+            } else if (source.compare(i, 2, "/*") == 0) {
+                i = source.find("*/", i);
+                if (i == std::string::npos) {
+                    break;
+                }
+                i++;
+                continue;
+            }
+            code += source[i];
+        }
+        return code;
+    }
+
+    bool balanced(const std::string& code) {
+        auto stack = std::string();
+        for (auto c : code) {
+            if (c == '(' || c == '{' || c == '[') {
+                stack += c;
+            } else if (c == ')' || c == '}' || c == ']') {
+                auto open = c == ')' ? '(' : c == '}' ? '{' : '[';
+                if (stack.empty() || stack.back() != open) {
+                    return false;
+                }
+                stack.pop_back();
+            }
+        }
+        return stack.empty();
+    }
+
+    bool identifier_char(char c) {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+    }
+
+    // Names directly followed by an opening parenthesis
+    std::set<std::string> called_names(const std::string& code) {
+        auto names = std::set<std::string>();
+        for (auto i = std::size_t(0); i < code.size(); i++) {
+            if (code[i] != '(') {
+                continue;
+            }
+            auto end = i;
+            while (end > 0 && code[end - 1] == ' ') {
+                end--;
+            }
+            auto begin = end;
+            while (begin > 0 && identifier_char(code[begin - 1])) {
+                begin--;
+            }
+            if (begin < end && !std::isdigit(static_cast<unsigned char>(code[begin]))) {
+                names.insert(code.substr(begin, end - begin));
+            }
+        }
+        return names;
+    }
+
+    // Definitions start a line with a return type, the name and a parenthesis
+    int count_definitions(const std::string& code, const std::string& name) {
+        auto count = 0;
+        auto lines = std::istringstream(code);
+        auto line = std::string();
+        while (std::getline(lines, line)) {
+            for (const auto* type : { "float ", "vec3 ", "vec4 ", "int ", "void " }) {
+                if (line.rfind(type + name + "(", 0) == 0) {
+                    count++;
+                }
+            }
+        }
+        return count;
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::printf("usage: %s <stage1 source> <spliced output>\n", argv[0]);
+        return 2;
+    }
+
+    auto file = std::ifstream(argv[1]);
+    auto stream = std::stringstream();
+    stream << file.rdbuf();
+    const auto stage1 = stream.str();
+    if (stage1.empty()) {
+        std::printf("could not read %s\n", argv[1]);
+        return 1;
+    }
+
+    const std::set<std::string> builtins = {
+        "abs", "clamp", "floor", "fract", "max", "min", "mix", "mod", "sqrt", "step",
+        "float", "int", "vec2", "vec3", "vec4", "for", "if", "while", "return"
+    };
+
+    auto failures = 0;
+    auto spliced = std::string();
+    auto settings = GenerationSettings();
+    for (auto octaves : { 1, 4, 10 }) {
+        settings.octaves = octaves;
+        settings.scale = 0.151f * octaves;
+
+        auto function = density_graph::glsl_function(terrain_graph(settings), "procedural_density");
+        spliced = density_graph::splice_density_function(stage1, function);
+        auto code = strip_comments(spliced);
+
+        if (!balanced(code)) {
+            std::printf("%d octaves: brackets do not balance in the spliced source\n", octaves);
+            failures++;
+        }
+        if (count_definitions(code, "procedural_density") != 1) {
+            std::printf("%d octaves: procedural_density is defined %d times\n", octaves, count_definitions(code, "procedural_density"));
+            failures++;
+        }
+        if (code.find("offsets[octave]") != std::string::npos) {
+            std::printf("%d octaves: the handwritten procedural_density is still there\n", octaves);
+            failures++;
+        }
+        if (code.find("octave < " + std::to_string(octaves) + ";") == std::string::npos) {
+            std::printf("%d octaves: the octave count is not baked into the function\n", octaves);
+            failures++;
+        }
+        if (count_definitions(code, "main") != 1 || count_definitions(code, "edited_density") != 1) {
+            std::printf("%d octaves: the rest of stage 1 did not survive the splice\n", octaves);
+            failures++;
+        }
+
+        for (const auto& name : called_names(strip_comments(function))) {
+            if (builtins.count(name) == 0 && count_definitions(code, name) == 0) {
+                std::printf("%d octaves: generated code calls %s, which is not defined\n", octaves, name.c_str());
+                failures++;
+            }
+        }
+    }
+
+    try {
+        density_graph::splice_density_function("void main() {}", "float procedural_density(vec3 pos) { return 0.0; }");
+        std::printf("splicing into a source without markers did not throw\n");
+        failures++;
+    } catch (const std::runtime_error&) {
+    }
+
+    auto output = std::ofstream(argv[2]);
+    output << spliced;
+    if (!output) {
+        std::printf("could not write %s\n", argv[2]);
+        failures++;
+    }
+
+    std::printf("%d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
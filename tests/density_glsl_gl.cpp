@@ -0,0 +1,77 @@
+// Density GLSL GL test
+//
+// Description: Compiles and links the spliced stage 1 source density_glsl
+// writes out with the OpenGL driver. The context is a surfaceless EGL one, so
+// no window or display is needed, and the test is skipped where the driver
+// cannot give one with GL 4.3 core.
+
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <glad/glad.h>
+
+#include "shader.hpp"
+
+namespace {
+    // Tells CTest the test did not run, see SKIP_RETURN_CODE
+    constexpr auto SKIPPED = 77;
+
+    bool create_context() {
+        auto get_platform_display = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+        if (get_platform_display == nullptr) {
+            return false;
+        }
+        auto display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+        if (display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr) || !eglBindAPI(EGL_OPENGL_API)) {
+            return false;
+        }
+
+        // The version the renderer's window asks for
+        const EGLint attributes[] = {
+            EGL_CONTEXT_MAJOR_VERSION, 4,
+            EGL_CONTEXT_MINOR_VERSION, 3,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+            EGL_NONE
+        };
+        auto context = eglCreateContext(display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, attributes);
+        if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+            return false;
+        }
+        return gladLoadGLLoader(reinterpret_cast<GLADloadproc>(eglGetProcAddress)) != 0;
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::printf("usage: %s <spliced stage1 source>\n", argv[0]);
+        return 2;
+    }
+
+    auto source = std::string();
+    try {
+        source = Shader::read_source(argv[1]);
+    } catch (const std::runtime_error& error) {
+        std::printf("%s\n", error.what());
+        return 1;
+    }
+
+    if (!create_context()) {
+        std::printf("no surfaceless OpenGL 4.3 context, skipped\n");
+        return SKIPPED;
+    }
+    std::printf("compiling with %s\n", reinterpret_cast<const char*>(glGetString(GL_RENDERER)));
+
+    auto failures = 0;
+    try {
+        auto shader = Shader::create_from_source(source, ShaderType::COMPUTE);
+    } catch (const std::runtime_error& error) {
+        std::printf("the spliced source does not build:\n%s\n", error.what());
+        failures++;
+    }
+
+    std::printf("%d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,243 @@
+// Golden meshes test
+//
+// Description: Runs every window-free extraction path over a fixed set of
+// chunks and compares triangle counts, vertex counts and a hash of each
+// mesh against tests/golden/meshes.txt. With --update it rewrites the file
+// instead, for changes that are meant to alter the output.
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "adaptive_density.hpp"
+#include "density.hpp"
+#include "extractor.hpp"
+#include "slab_stream.hpp"
+#include "thread_pool.hpp"
+
+namespace {
+    // Stage 1 has no seed yet, the noise settings and chunk offset pick the
+    // terrain instead
+    struct GoldenCase {
+        const char* name;
+        float scale;
+        int octaves;
+        glm::ivec3 offset;
+        int axis_length;
+    };
+
+    const GoldenCase CASES[] = {
+        { "default_100", 0.151f, 4, glm::ivec3(0, 0, 0), 100 },
+        { "default_100_east", 0.151f, 4, glm::ivec3(99, 0, 0), 100 },
+        // Reaches past the ceiling
+        { "default_100_up", 0.151f, 4, glm::ivec3(0, 99, 0), 100 },
+        { "fine_64", 1.0f, 6, glm::ivec3(100, 20, 100), 64 },
+        { "rough_33", 2.0f, 3, glm::ivec3(-40, 30, 17), 33 },
+        // Crosses the floor
+        { "small_17", 0.5f, 4, glm::ivec3(5, 0, 5), 17 },
+    };
+
+    // The 4D terrain is all air or all floor at the default scale, so these
+    // start from the animated region's scale of 1 and every chunk crosses the
+    // iso level somewhere other than the floor
+    const GoldenCase ANIMATED_CASES[] = {
+        { "animated_100", 1.0f, 4, glm::ivec3(0, 0, 0), 100 },
+        { "animated_100_east", 1.0f, 4, glm::ivec3(99, 0, 0), 100 },
+        // Reaches past the ceiling
+        { "animated_100_up", 1.0f, 4, glm::ivec3(0, 99, 0), 100 },
+        { "fine_64", 1.0f, 6, glm::ivec3(100, 20, 100), 64 },
+        { "rough_33", 2.0f, 3, glm::ivec3(-40, 30, 17), 33 },
+        // Crosses the floor
+        { "animated_17", 2.0f, 4, glm::ivec3(5, 0, 5), 17 },
+    };
+
+    const float ISO_LEVELS[] = { 0.8f, 1.2f };
+    constexpr auto ANIMATION_W = 3.5f;
+
+    struct Result {
+        std::size_t triangles;
+        std::size_t vertices;
+        uint64_t hash;
+    };
+
+    // FNV-1a over every triangle corner. Positions are rounded to 1/1024 and
+    // normals to 1/64, so the last bits of float math, which move with the
+    // compiler and its flags, do not change the hash.
+    uint64_t mesh_hash(const ExtractedMesh& mesh) {
+        auto hash = uint64_t(14695981039346656037ull);
+        auto add = [&hash](float value, float scale) {
+            auto rounded = int32_t(std::lround(value * scale));
+            for (auto byte = 0; byte < 4; byte++) {
+                hash ^= uint8_t(uint32_t(rounded) >> (byte * 8));
+                hash *= 1099511628211ull;
+            }
+        };
+
+        for (auto index : mesh.indices) {
+            const auto& vertex = mesh.vertices[index];
+            for (auto axis = 0; axis < 3; axis++) {
+                add(vertex.position[axis], 1024.0f);
+            }
+            for (auto axis = 0; axis < 3; axis++) {
+                add(vertex.normal[axis], 64.0f);
+            }
+        }
+        return hash;
+    }
+
+    Result result(const ExtractedMesh& mesh) {
+        return Result { mesh.num_triangles(), mesh.vertices.size(), mesh_hash(mesh) };
+    }
+
+    std::string key(const std::string& mesh, const std::string& chunk) {
+        return mesh + " " + chunk;
+    }
+
+    std::map<std::string, Result> run_cases() {
+        auto results = std::map<std::string, Result>();
+        auto marching_cubes = MarchingCubesExtractor();
+        auto surface_nets = SurfaceNetsExtractor();
+        auto pool = ThreadPool(2);
+        auto slab_stream = SlabStreamExtractor(&pool);
+        auto grid = DensityGrid();
+        auto mesh = ExtractedMesh();
+        auto meshes = std::vector<ExtractedMesh>();
+
+        for (const auto& chunk : CASES) {
+            auto settings = GenerationSettings();
+            settings.scale = chunk.scale;
+            settings.octaves = chunk.octaves;
+
+            sample_density(settings, chunk.offset, chunk.axis_length, grid);
+            marching_cubes.extract(grid, settings.iso_level, mesh);
+            results[key("marching_cubes", chunk.name)] = result(mesh);
+            surface_nets.extract(grid, settings.iso_level, mesh);
+            results[key("surface_nets", chunk.name)] = result(mesh);
+            slab_stream.extract(terrain_graph(settings), chunk.offset, chunk.axis_length, settings.iso_level, mesh);
+            results[key("marching_cubes_stream", chunk.name)] = result(mesh);
+
+            auto levels = std::vector<float>(std::begin(ISO_LEVELS), std::end(ISO_LEVELS));
+            marching_cubes.extract_levels(grid, levels, meshes);
+            for (auto level = std::size_t(0); level < levels.size(); level++) {
+                char name[64];
+                std::snprintf(name, sizeof(name), "marching_cubes_iso_%.1f", levels[level]);
+                results[key(name, chunk.name)] = result(meshes[level]);
+            }
+
+            sample_density_adaptive(settings, chunk.offset, chunk.axis_length, grid);
+            marching_cubes.extract(grid, settings.iso_level, mesh);
+            results[key("marching_cubes_adaptive", chunk.name)] = result(mesh);
+        }
+
+        for (const auto& chunk : ANIMATED_CASES) {
+            auto settings = GenerationSettings();
+            settings.scale = chunk.scale;
+            settings.octaves = chunk.octaves;
+
+            grid.resize(chunk.axis_length);
+            grid.offset = chunk.offset;
+            density_graph::evaluate(animated_terrain_graph(settings, ANIMATION_W), chunk.offset, chunk.axis_length, grid.values.data());
+            marching_cubes.extract(grid, settings.iso_level, mesh);
+            results[key("marching_cubes_4d", chunk.name)] = result(mesh);
+        }
+        return results;
+    }
+
+    bool write_golden(const std::string& path, const std::map<std::string, Result>& results) {
+        auto file = std::ofstream(path);
+        if (!file) {
+            std::printf("cannot write %s\n", path.c_str());
+            return false;
+        }
+
+        file << "# Rewrite with: golden_meshes_test <this file> --update\n";
+        file << "# mesh chunk triangles vertices hash\n";
+        for (const auto& entry : results) {
+            char line[256];
+            std::snprintf(line, sizeof(line), "%s %zu %zu %016llx\n", entry.first.c_str(),
+                entry.second.triangles, entry.second.vertices, (unsigned long long)entry.second.hash);
+            file << line;
+        }
+        std::printf("wrote %zu meshes to %s\n", results.size(), path.c_str());
+        return true;
+    }
+
+    bool read_golden(const std::string& path, std::map<std::string, Result>& golden) {
+        auto file = std::ifstream(path);
+        if (!file) {
+            std::printf("cannot read %s\n", path.c_str());
+            return false;
+        }
+
+        auto line = std::string();
+        while (std::getline(file, line)) {
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+            auto stream = std::istringstream(line);
+            auto mesh = std::string(), chunk = std::string(), hash = std::string();
+            auto entry = Result();
+            if (!(stream >> mesh >> chunk >> entry.triangles >> entry.vertices >> hash)) {
+                std::printf("bad line in %s: %s\n", path.c_str(), line.c_str());
+                return false;
+            }
+            entry.hash = std::stoull(hash, nullptr, 16);
+            golden[key(mesh, chunk)] = entry;
+        }
+        return true;
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::printf("usage: %s <golden file> [--update]\n", argv[0]);
+        return 2;
+    }
+    const auto path = std::string(argv[1]);
+    const auto update = argc > 2 && std::string(argv[2]) == "--update";
+
+    auto results = run_cases();
+    if (update) {
+        return write_golden(path, results) ? 0 : 1;
+    }
+
+    auto golden = std::map<std::string, Result>();
+    if (!read_golden(path, golden)) {
+        return 1;
+    }
+
+    auto failures = 0;
+    for (const auto& entry : results) {
+        auto found = golden.find(entry.first);
+        if (found == golden.end()) {
+            std::printf("%-40s no golden entry\n", entry.first.c_str());
+            failures++;
+            continue;
+        }
+
+        const auto& expected = found->second;
+        const auto& actual = entry.second;
+        if (expected.triangles != actual.triangles || expected.vertices != actual.vertices || expected.hash != actual.hash) {
+            std::printf("%-40s expected %zu triangles %zu vertices %016llx, got %zu %zu %016llx\n", entry.first.c_str(),
+                expected.triangles, expected.vertices, (unsigned long long)expected.hash,
+                actual.triangles, actual.vertices, (unsigned long long)actual.hash);
+            failures++;
+        }
+    }
+    for (const auto& entry : golden) {
+        if (results.find(entry.first) == results.end()) {
+            std::printf("%-40s golden entry no longer produced\n", entry.first.c_str());
+            failures++;
+        }
+    }
+
+    std::printf("%zu meshes, %d failures\n", results.size(), failures);
+    return failures == 0 ? 0 : 1;
+}
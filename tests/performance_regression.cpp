@@ -0,0 +1,268 @@
+// Performance regression test
+//
+// Description: Times the window-free hot paths on fixed chunks and compares
+// their throughput against tests/baselines/performance.txt. Each benchmark
+// is timed interleaved with a fixed reference loop and compared relative to
+// it, so a machine that is busier or slower as a whole does not read as a
+// regression. Fails when any of them is slower than its baseline by more
+// than the tolerance, given in percent, or the benchmark's own tighter one. With --update it records the
+// current throughput as the new baselines. Baselines hold for the machine
+// and build flags they were recorded with.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "bvh.hpp"
+#include "density.hpp"
+#include "density_cache.hpp"
+#include "extractor.hpp"
+
+namespace {
+    // Best of, to keep other load on the machine out of the numbers. Each
+    // repetition runs a benchmark for at least MIN_SECONDS.
+    constexpr auto REPETITIONS = 7;
+    constexpr auto MIN_SECONDS = 0.05;
+    constexpr auto AXIS_LENGTH = 64;
+    constexpr auto NUM_QUERIES = 1 << 18;
+    constexpr auto REFERENCE_NAME = "reference";
+    constexpr auto REFERENCE_STEPS = 1 << 16;
+
+    struct Benchmark {
+        const char* name;
+        const char* unit;
+        // Runs once and returns how many units of work it did
+        std::function<double()> run;
+        // Tighter tolerance in percent than the one given, for benchmarks
+        // whose last optimisation would otherwise hide inside the noise. 0
+        // keeps the given one.
+        double tolerance_percent = 0.0;
+    };
+
+    // Scalar float math with a dependency chain, it only moves with the
+    // speed of the machine
+    double reference() {
+        volatile float sink = 0.0f;
+        auto value = 0.5f;
+        for (auto step = 0; step < REFERENCE_STEPS; step++) {
+            value = std::sqrt(value * 1.0001f + float(step & 7));
+        }
+        // Read back through the volatile so the chain is not folded away,
+        // the square roots are never negative
+        sink = value;
+        return sink >= 0.0f ? double(REFERENCE_STEPS) : 0.0;
+    }
+
+    // Units per second over at least MIN_SECONDS
+    double time(const std::function<double()>& run) {
+        auto work = 0.0;
+        auto seconds = 0.0;
+        auto start = std::chrono::high_resolution_clock::now();
+        while (seconds < MIN_SECONDS) {
+            work += run();
+            auto end = std::chrono::high_resolution_clock::now();
+            seconds = std::chrono::duration<double>(end - start).count();
+        }
+        return work / seconds;
+    }
+
+    struct Throughput {
+        double benchmark = 0.0;
+        double reference = 0.0;
+    };
+
+    // Best of REPETITIONS for the benchmark and for the reference timed
+    // right before each of its repetitions
+    Throughput throughput(const Benchmark& benchmark) {
+        auto best = Throughput();
+        for (auto repetition = 0; repetition < REPETITIONS; repetition++) {
+            best.reference = std::max(best.reference, time(reference));
+            best.benchmark = std::max(best.benchmark, time(benchmark.run));
+        }
+        return best;
+    }
+
+    bool write_baselines(const std::string& path, const std::map<std::string, double>& results) {
+        auto file = std::ofstream(path);
+        if (!file) {
+            std::printf("cannot write %s\n", path.c_str());
+            return false;
+        }
+
+        file << "# Rewrite with: performance_regression_test <this file> 0 --update\n";
+        file << "# benchmark units_per_second\n";
+        for (const auto& entry : results) {
+            char line[128];
+            std::snprintf(line, sizeof(line), "%s %.6g\n", entry.first.c_str(), entry.second);
+            file << line;
+        }
+        std::printf("wrote %zu baselines to %s\n", results.size(), path.c_str());
+        return true;
+    }
+
+    bool read_baselines(const std::string& path, std::map<std::string, double>& baselines) {
+        auto file = std::ifstream(path);
+        if (!file) {
+            std::printf("cannot read %s\n", path.c_str());
+            return false;
+        }
+
+        auto line = std::string();
+        while (std::getline(file, line)) {
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+            auto stream = std::istringstream(line);
+            auto name = std::string();
+            auto value = 0.0;
+            if (!(stream >> name >> value)) {
+                std::printf("bad line in %s: %s\n", path.c_str(), line.c_str());
+                return false;
+            }
+            baselines[name] = value;
+        }
+        return true;
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::printf("usage: %s <baseline file> <tolerance percent> [--update]\n", argv[0]);
+        return 2;
+    }
+    const auto path = std::string(argv[1]);
+    const auto tolerance = std::stod(argv[2]) / 100.0;
+    const auto update = argc > 3 && std::string(argv[3]) == "--update";
+
+    auto settings = GenerationSettings();
+    settings.scale = 1.0f;
+    const auto offset = glm::ivec3(100, 20, 100);
+    const auto num_samples = double(AXIS_LENGTH) * AXIS_LENGTH * AXIS_LENGTH;
+    const auto num_cells = double(AXIS_LENGTH - 1) * (AXIS_LENGTH - 1) * (AXIS_LENGTH - 1);
+
+    // Shared inputs, made once outside the timing
+    auto grid = DensityGrid();
+    sample_density(settings, offset, AXIS_LENGTH, grid);
+    auto scratch = DensityGrid();
+    auto mesh = ExtractedMesh();
+    auto meshes = std::vector<ExtractedMesh>();
+    auto marching_cubes = MarchingCubesExtractor();
+    auto surface_nets = SurfaceNetsExtractor();
+
+    marching_cubes.extract(grid, settings.iso_level, mesh);
+    auto positions = std::vector<glm::vec3>();
+    for (auto index : mesh.indices) {
+        positions.push_back(glm::vec3(mesh.vertices[index].position));
+    }
+    auto bvh = TriangleBvh();
+
+    // The cache takes chunks at multiples of AXIS_LENGTH - 1
+    auto cache = DensityCache(1, AXIS_LENGTH);
+    cache.set_iso_level(settings.iso_level);
+    auto cached = grid;
+    cached.offset = glm::ivec3(0);
+    cache.store(cached);
+    auto queries = std::vector<glm::vec3>(NUM_QUERIES);
+    auto random = std::mt19937(7);
+    auto coordinate = std::uniform_real_distribution<float>(0.0f, float(AXIS_LENGTH - 1));
+    for (auto& query : queries) {
+        query = glm::vec3(coordinate(random), coordinate(random), coordinate(random));
+    }
+    auto densities = std::vector<float>(NUM_QUERIES);
+
+    const Benchmark benchmarks[] = {
+        { "density_sampling", "samples/s", [&] {
+            sample_density(settings, offset, AXIS_LENGTH, scratch);
+            return num_samples;
+        } },
+        { "density_sampling_4d", "samples/s", [&] {
+            scratch.resize(AXIS_LENGTH);
+            density_graph::evaluate(animated_terrain_graph(settings, 3.5f), offset, AXIS_LENGTH, scratch.values.data());
+            return num_samples;
+        } },
+        // Per corner classification ran about 45% and 42% below the
+        // bitplane baselines, run to run noise stays within about 22%
+        { "marching_cubes", "cells/s", [&] {
+            marching_cubes.extract(grid, settings.iso_level, mesh);
+            return num_cells;
+        }, 30.0 },
+        { "marching_cubes_4_levels", "cells/s", [&] {
+            marching_cubes.extract_levels(grid, { 0.8f, 0.9f, 1.0f, 1.1f }, meshes);
+            return num_cells;
+        }, 30.0 },
+        { "surface_nets", "cells/s", [&] {
+            surface_nets.extract(grid, settings.iso_level, mesh);
+            return num_cells;
+        } },
+        { "bvh_build", "triangles/s", [&] {
+            bvh.build(positions);
+            return double(positions.size() / 3);
+        } },
+        { "density_queries_batched", "queries/s", [&] {
+            cache.density(queries.data(), queries.size(), densities.data());
+            return double(NUM_QUERIES);
+        } },
+    };
+
+    // The reference of every benchmark goes into one best, the baseline file
+    // keeps a single reference throughput
+    auto results = std::map<std::string, double>();
+    auto references = std::map<std::string, double>();
+    for (const auto& benchmark : benchmarks) {
+        auto measured = throughput(benchmark);
+        results[benchmark.name] = measured.benchmark;
+        references[benchmark.name] = measured.reference;
+        results[REFERENCE_NAME] = std::max(results[REFERENCE_NAME], measured.reference);
+    }
+    if (update) {
+        return write_baselines(path, results) ? 0 : 1;
+    }
+
+    auto baselines = std::map<std::string, double>();
+    if (!read_baselines(path, baselines)) {
+        return 1;
+    }
+    if (baselines.find(REFERENCE_NAME) == baselines.end()) {
+        std::printf("%s has no %s throughput\n", path.c_str(), REFERENCE_NAME);
+        return 1;
+    }
+    const auto baseline_reference = baselines[REFERENCE_NAME];
+
+    auto failures = 0;
+    std::printf("%-26s %14s %14s %9s %9s  (tolerance %.0f%%)\n", "benchmark", "baseline", "measured", "machine", "change", tolerance * 100.0);
+    for (const auto& benchmark : benchmarks) {
+        auto measured = results[benchmark.name];
+        auto found = baselines.find(benchmark.name);
+        if (found == baselines.end()) {
+            std::printf("%-26s %14s %14.4g %9s %9s  no baseline\n", benchmark.name, "-", measured, "-", "-");
+            failures++;
+            continue;
+        }
+
+        // How fast the machine ran the reference next to this benchmark
+        // against when the baselines were recorded
+        auto machine = references[benchmark.name] / baseline_reference;
+        auto change = measured / (found->second * machine) - 1.0;
+        auto allowed = benchmark.tolerance_percent > 0.0 ? std::min(tolerance, benchmark.tolerance_percent / 100.0) : tolerance;
+        auto regressed = change < -allowed;
+        std::printf("%-26s %14.4g %14.4g %+8.1f%% %+8.1f%%  %s", benchmark.name, found->second, measured,
+            (machine - 1.0) * 100.0, change * 100.0, benchmark.unit);
+        if (allowed < tolerance) {
+            std::printf("  (tolerance %.0f%%)", allowed * 100.0);
+        }
+        std::printf("%s\n", regressed ? "  REGRESSED" : "");
+        failures += regressed;
+    }
+
+    return failures == 0 ? 0 : 1;
+}
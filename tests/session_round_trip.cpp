@@ -0,0 +1,141 @@
+// Session round trip test
+//
+// Description: Saves a recorded session, loads it back and checks every
+// frame comes back exactly, settings and renderer options carried forward
+// between changes included. Also checks the frame time percentiles on known times.
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+
+#include "glm/glm.hpp"
+
+#include "session.hpp"
+
+namespace {
+    constexpr auto NUM_FRAMES = 300;
+
+    bool same_settings(const GenerationSettings& a, const GenerationSettings& b) {
+        return a.iso_level == b.iso_level && a.scale == b.scale && a.persistence == b.persistence &&
+               a.octaves == b.octaves && a.lacunarity == b.lacunarity && a.extractor == b.extractor &&
+               a.meshlets == b.meshlets;
+    }
+
+    bool same_brush(const Brush& a, const Brush& b) {
+        return a.shape == b.shape && a.operation == b.operation && a.center == b.center &&
+               a.radius == b.radius && a.strength == b.strength;
+    }
+
+    // A walk with a settings change every 50 frames, an options change
+    // every 70 and a brush every 40
+    Session recorded_session() {
+        auto session = Session();
+        auto settings = GenerationSettings();
+        settings.scale = 0.151f;
+        auto options = SessionOptions();
+        for (auto i = 0; i < NUM_FRAMES; i++) {
+            auto frame = SessionFrame();
+            frame.delta_time = 1.0f / 60.0f + 0.001f * std::sin(float(i));
+            frame.position = glm::vec3(0.1f * i, 10.0f + std::cos(0.05f * i), -0.3f * i);
+            frame.yaw = -90.0f + 0.7f * i;
+            frame.pitch = 30.0f * std::sin(0.02f * i);
+            if (i % 50 == 49) {
+                settings.iso_level += 0.013f;
+                settings.octaves = 1 + i % 7;
+                settings.extractor = ExtractorType(i % 3);
+                settings.meshlets = !settings.meshlets;
+            }
+            frame.settings = settings;
+            if (i % 70 == 69) {
+                options.occlusion_culling = !options.occlusion_culling;
+                options.ray_queries = i % 140 != 69;
+                options.generated_density = !options.generated_density;
+                options.animate = !options.animate;
+                options.animation_speed = 0.37f * i;
+                options.animation_scale = 1.0f + 0.011f * i;
+                options.regeneration_budget_ms = 2.5f + 0.1f * i;
+                options.gpu_budget_mb = 3 * i;
+                options.cpu_budget_mb = i / 2;
+                options.draw_points = !options.draw_points;
+                options.wireframe = i % 140 == 69;
+            }
+            frame.options = options;
+            if (i % 40 == 39) {
+                frame.brushes.push_back(Brush { BrushShape(i % 3), BrushOperation(i % 2), frame.position, 3.3f, 0.75f });
+            }
+            session.record(frame);
+        }
+        return session;
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::printf("usage: %s <scratch file>\n", argv[0]);
+        return 2;
+    }
+    const auto path = std::string(argv[1]);
+
+    auto failures = 0;
+    auto session = recorded_session();
+    auto loaded = Session();
+    if (!session.save(path) || !loaded.load(path)) {
+        std::printf("cannot save and load %s\n", path.c_str());
+        return 1;
+    }
+    if (loaded.size() != session.size()) {
+        std::printf("saved %zu frames, loaded %zu\n", session.size(), loaded.size());
+        return 1;
+    }
+
+    auto changes = 0;
+    auto option_changes = 0;
+    for (auto i = std::size_t(0); i < session.size(); i++) {
+        const auto& expected = session.frames()[i];
+        const auto& actual = loaded.frames()[i];
+        auto same = expected.delta_time == actual.delta_time && expected.position == actual.position &&
+                    expected.yaw == actual.yaw && expected.pitch == actual.pitch &&
+                    expected.settings_changed == actual.settings_changed &&
+                    same_settings(expected.settings, actual.settings) &&
+                    expected.options_changed == actual.options_changed &&
+                    expected.options == actual.options &&
+                    expected.brushes.size() == actual.brushes.size();
+        for (auto b = std::size_t(0); same && b < expected.brushes.size(); b++) {
+            same = same_brush(expected.brushes[b], actual.brushes[b]);
+        }
+        if (!same) {
+            std::printf("frame %zu differs after loading\n", i);
+            failures++;
+        }
+        changes += actual.settings_changed;
+        option_changes += actual.options_changed;
+    }
+
+    // The first frame and one per change
+    if (changes != 1 + NUM_FRAMES / 50) {
+        std::printf("%d settings changes recorded, expected %d\n", changes, 1 + NUM_FRAMES / 50);
+        failures++;
+    }
+    if (option_changes != 1 + NUM_FRAMES / 70) {
+        std::printf("%d options changes recorded, expected %d\n", option_changes, 1 + NUM_FRAMES / 70);
+        failures++;
+    }
+
+    // 1 to 100 ms, the GPU time of every other frame missing
+    auto log = FrameTimeLog();
+    for (auto frame = std::size_t(0); frame < 100; frame++) {
+        log.add_cpu(frame, double(frame + 1));
+        if (frame % 2 == 0) {
+            log.add_gpu(frame, double(frame + 1));
+        }
+    }
+    auto cpu = log.cpu_summary();
+    auto gpu = log.gpu_summary();
+    if (cpu.p50 != 51.0 || cpu.p95 != 96.0 || cpu.p99 != 100.0 || gpu.p50 != 51.0 || gpu.p99 != 99.0) {
+        std::printf("percentiles cpu %.0f %.0f %.0f gpu %.0f %.0f %.0f\n", cpu.p50, cpu.p95, cpu.p99, gpu.p50, gpu.p95, gpu.p99);
+        failures++;
+    }
+
+    std::printf("%zu frames, %d failures\n", session.size(), failures);
+    return failures == 0 ? 0 : 1;
+}
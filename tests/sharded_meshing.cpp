@@ -0,0 +1,152 @@
+// Sharded meshing test
+//
+// Description: Meshes a small world with three worker processes and checks
+// every chunk matches meshing it in this process, and the same with workers
+// on threads from a launcher of its own. Then again with workers
+// killing themselves after each chunk, where the replacements have to finish
+// the shards the dead ones held, and with no restarts allowed, where the run
+// has to report failure rather than hang.
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "density.hpp"
+#include "extractor.hpp"
+#include "sharded_meshing.hpp"
+
+namespace {
+    constexpr auto AXIS_LENGTH = 33;
+    constexpr auto CHUNKS_PER_AXIS = 3;
+
+    bool same_mesh(const ExtractedMesh& a, const ExtractedMesh& b) {
+        return a.indices == b.indices && a.vertices.size() == b.vertices.size() &&
+            std::memcmp(a.vertices.data(), b.vertices.data(), a.vertices.size() * sizeof(MeshVertex)) == 0;
+    }
+
+    // Workers on threads of this process over the same rings, a launcher
+    // the coordinator knows nothing about
+    class ThreadLauncher : public WorkerLauncher {
+    public:
+        LaunchedWorker launch(int crash_after) override {
+            auto process = std::make_unique<ThreadWorker>();
+            auto* self = process.get();
+            self->worker_side = std::make_unique<SharedMemoryConnection>(self->requests.get(), self->results.get(), [self] {
+                return !self->stopped;
+            });
+            self->thread = std::thread([self, crash_after] {
+                run_shard_worker(*self->worker_side, crash_after);
+                self->finished = true;
+            });
+            auto connection = std::make_unique<SharedMemoryConnection>(self->results.get(), self->requests.get(), [self] {
+                return self->alive();
+            });
+            return LaunchedWorker { std::move(process), std::move(connection) };
+        }
+
+    private:
+        struct ThreadWorker : WorkerProcess {
+            std::unique_ptr<SharedMemoryRing> requests = std::make_unique<SharedMemoryRing>(std::size_t(1) << 20);
+            std::unique_ptr<SharedMemoryRing> results = std::make_unique<SharedMemoryRing>(std::size_t(1) << 20);
+            std::unique_ptr<SharedMemoryConnection> worker_side;
+            std::atomic<bool> stopped { false };
+            std::atomic<bool> finished { false };
+            std::thread thread;
+
+            ~ThreadWorker() override {
+                kill();
+            }
+
+            bool alive() override {
+                return !finished;
+            }
+
+            // The worker notices on its next wait and returns
+            void kill() override {
+                stopped = true;
+                if (thread.joinable()) {
+                    thread.join();
+                }
+            }
+        };
+    };
+
+    int check(const char* name, bool complete, const std::vector<ExtractedMesh>& meshes, const std::vector<ExtractedMesh>& expected) {
+        auto failures = 0;
+        if (!complete) {
+            std::printf("%s: coordinator reported failed shards\n", name);
+            failures++;
+        }
+        for (auto i = std::size_t(0); i < expected.size(); i++) {
+            if (!same_mesh(meshes[i], expected[i])) {
+                std::printf("%s: chunk %zu differs, %zu against %zu triangles\n", name, i, meshes[i].num_triangles(), expected[i].num_triangles());
+                failures++;
+            }
+        }
+        return failures;
+    }
+}
+
+int main() {
+    auto settings = GenerationSettings();
+    settings.extractor = ExtractorType::MARCHING_CUBES_CPU;
+
+    auto offsets = std::vector<glm::ivec3>();
+    auto expected = std::vector<ExtractedMesh>();
+    auto extractor = MarchingCubesExtractor();
+    auto grid = DensityGrid();
+    for (auto x = 0; x < CHUNKS_PER_AXIS; x++) {
+        for (auto z = 0; z < CHUNKS_PER_AXIS; z++) {
+            offsets.push_back(glm::ivec3(x * (AXIS_LENGTH - 1), 0, z * (AXIS_LENGTH - 1)));
+            expected.emplace_back();
+            sample_density(settings, offsets.back(), AXIS_LENGTH, grid);
+            extractor.extract(grid, settings.iso_level, expected.back());
+        }
+    }
+
+    auto failures = 0;
+    auto meshes = std::vector<ExtractedMesh>();
+    auto options = ShardCoordinator::Options();
+    options.num_workers = 3;
+    {
+        auto coordinator = ShardCoordinator(options);
+        failures += check("healthy", coordinator.mesh(settings, offsets, AXIS_LENGTH, meshes), meshes, expected);
+        // Workers are kept between runs
+        failures += check("second run", coordinator.mesh(settings, offsets, AXIS_LENGTH, meshes), meshes, expected);
+    }
+    {
+        auto coordinator = ShardCoordinator(options, std::make_unique<ThreadLauncher>());
+        failures += check("threads", coordinator.mesh(settings, offsets, AXIS_LENGTH, meshes), meshes, expected);
+    }
+
+    options.crash_after = 1;
+    {
+        auto coordinator = ShardCoordinator(options);
+        failures += check("crashing", coordinator.mesh(settings, offsets, AXIS_LENGTH, meshes), meshes, expected);
+        const auto& stats = coordinator.stats();
+        if (stats.restarts != 3 || stats.retried == 0) {
+            std::printf("crashing: %d restarts and %zu shards retried, expected 3 and some\n", stats.restarts, stats.retried);
+            failures++;
+        }
+        if (coordinator.num_workers() != 3) {
+            std::printf("crashing: %zu workers left running, expected 3\n", coordinator.num_workers());
+            failures++;
+        }
+    }
+
+    options.max_restarts = 0;
+    {
+        auto coordinator = ShardCoordinator(options);
+        if (coordinator.mesh(settings, offsets, AXIS_LENGTH, meshes) || coordinator.stats().failed == 0) {
+            std::printf("no restarts: every worker died but the run reported success\n");
+            failures++;
+        }
+    }
+
+    std::printf("%zu chunks, %d failures\n", offsets.size(), failures);
+    return failures == 0 ? 0 : 1;
+}
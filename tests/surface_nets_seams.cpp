@@ -0,0 +1,99 @@
+// Surface nets seams test
+//
+// Description: Meshes a 2x2x2 block of chunks with surface nets the way the
+// renderer does, each chunk with its overlap ring, and checks the chunks
+// together give exactly the triangles of one grid over the whole block. A
+// seam between chunks would show up as triangles missing from the chunks.
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "density.hpp"
+#include "extractor.hpp"
+
+namespace {
+    constexpr auto CHUNK_CELLS = 32;
+    constexpr auto CHUNKS_PER_AXIS = 2;
+
+    using TriangleKey = std::array<float, 9>;
+
+    // Triangles by their corner positions, sorted, so meshes whose vertices
+    // are numbered differently compare equal
+    void add_triangles(const ExtractedMesh& mesh, std::vector<TriangleKey>& triangles) {
+        for (auto triangle = std::size_t(0); triangle < mesh.num_triangles(); triangle++) {
+            auto key = TriangleKey();
+            for (auto corner = 0; corner < 3; corner++) {
+                const auto& position = mesh.vertices[mesh.indices[triangle * 3 + corner]].position;
+                for (auto axis = 0; axis < 3; axis++) {
+                    key[corner * 3 + axis] = position[axis];
+                }
+            }
+            triangles.push_back(key);
+        }
+    }
+
+    // Every chunk of the block meshed on its own, with overlap samples before it
+    std::vector<TriangleKey> chunked(const GenerationSettings& settings, glm::ivec3 origin, int overlap) {
+        auto extractor = SurfaceNetsExtractor(overlap);
+        auto grid = DensityGrid();
+        auto mesh = ExtractedMesh();
+        auto triangles = std::vector<TriangleKey>();
+        for (auto x = 0; x < CHUNKS_PER_AXIS; x++) {
+            for (auto y = 0; y < CHUNKS_PER_AXIS; y++) {
+                for (auto z = 0; z < CHUNKS_PER_AXIS; z++) {
+                    auto offset = origin + glm::ivec3(x, y, z) * CHUNK_CELLS;
+                    sample_density(settings, offset - glm::ivec3(overlap), CHUNK_CELLS + 1 + overlap, grid);
+                    extractor.extract(grid, settings.iso_level, mesh);
+                    add_triangles(mesh, triangles);
+                }
+            }
+        }
+        std::sort(triangles.begin(), triangles.end());
+        return triangles;
+    }
+}
+
+int main() {
+    auto failures = 0;
+    auto settings = GenerationSettings();
+    settings.scale = 1.0f;
+    settings.octaves = 4;
+
+    for (auto origin : { glm::ivec3(100, 20, 100), glm::ivec3(-40, 0, 17) }) {
+        // The whole block as one grid, with the same ring below it
+        auto whole = SurfaceNetsExtractor(1);
+        auto grid = DensityGrid();
+        auto mesh = ExtractedMesh();
+        sample_density(settings, origin - glm::ivec3(1), CHUNKS_PER_AXIS * CHUNK_CELLS + 2, grid);
+        whole.extract(grid, settings.iso_level, mesh);
+        auto expected = std::vector<TriangleKey>();
+        add_triangles(mesh, expected);
+        std::sort(expected.begin(), expected.end());
+
+        auto closed = chunked(settings, origin, 1);
+        auto open = chunked(settings, origin, 0);
+        std::printf("%d,%d,%d: %zu triangles as one grid, %zu from chunks with the overlap, %zu without\n",
+            origin.x, origin.y, origin.z, expected.size(), closed.size(), open.size());
+
+        if (expected.empty()) {
+            std::printf("no surface in the block\n");
+            failures++;
+        }
+        if (closed != expected) {
+            std::printf("chunks with the overlap differ from the whole grid\n");
+            failures++;
+        }
+        // Without it the quads across the inner chunk faces are missing
+        if (open.size() >= expected.size()) {
+            std::printf("chunks without the overlap are not missing their seams\n");
+            failures++;
+        }
+    }
+
+    std::printf("%d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
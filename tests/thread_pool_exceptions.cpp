@@ -0,0 +1,51 @@
+// Thread pool exceptions test
+//
+// Description: Throws from parallel_for bodies and checks the caller gets the
+// exception back instead of waiting forever, and that the pool still runs
+// work afterwards.
+
+#include <atomic>
+#include <cstdio>
+#include <stdexcept>
+
+#include "thread_pool.hpp"
+
+int main() {
+    auto pool = ThreadPool(4);
+    auto failures = 0;
+
+    for (auto thrower : { std::size_t(0), std::size_t(57), std::size_t(999) }) {
+        auto caught = false;
+        try {
+            pool.parallel_for(1000, [thrower](std::size_t index) {
+                if (index == thrower) {
+                    throw std::runtime_error("index failed");
+                }
+            });
+        } catch (const std::runtime_error&) {
+            caught = true;
+        }
+        if (!caught) {
+            std::printf("exception from index %zu did not reach the caller\n", thrower);
+            failures++;
+        }
+    }
+
+    // Every index throwing, only one exception comes back
+    try {
+        pool.parallel_for(64, [](std::size_t) { throw std::runtime_error("all failed"); });
+        std::printf("exceptions from every index did not reach the caller\n");
+        failures++;
+    } catch (const std::runtime_error&) {
+    }
+
+    auto sum = std::atomic<std::size_t>(0);
+    pool.parallel_for(1000, [&](std::size_t index) { sum += index; });
+    if (sum != 999 * 1000 / 2) {
+        std::printf("pool summed %zu after the exceptions, expected %d\n", sum.load(), 999 * 1000 / 2);
+        failures++;
+    }
+
+    std::printf("%d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}